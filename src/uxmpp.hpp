@@ -37,6 +37,8 @@ namespace uxmpp {
 #include <uxmpp/utils.hpp>
 #include <uxmpp/UxmppException.hpp>
 #include <uxmpp/Logger.hpp>
+#include <uxmpp/Metrics.hpp>
+#include <uxmpp/Tracer.hpp>
 
 #include <uxmpp/Semaphore.hpp>
 #include <uxmpp/Jid.hpp>
@@ -45,6 +47,9 @@ namespace uxmpp {
 #include <uxmpp/XmlStream.hpp>
 #include <uxmpp/Stanza.hpp>
 #include <uxmpp/IqStanza.hpp>
+#include <uxmpp/IqCorrelator.hpp>
+#include <uxmpp/IqResult.hpp>
+#include <uxmpp/IqTracker.hpp>
 #include <uxmpp/MessageStanza.hpp>
 #include <uxmpp/PresenceStanza.hpp>
 #include <uxmpp/StreamError.hpp>
@@ -53,6 +58,7 @@ namespace uxmpp {
 #include <uxmpp/SessionConfig.hpp>
 #include <uxmpp/SessionListener.hpp>
 #include <uxmpp/Session.hpp>
+#include <uxmpp/ComponentSession.hpp>
 
 #include <uxmpp/xml.hpp>
 #include <uxmpp/io.hpp>
@@ -0,0 +1,135 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/ComponentSession.hpp>
+#include <uxmpp/Logger.hpp>
+#include <uxmpp/utils.hpp>
+#include <uxmpp/xml/names.hpp>
+
+UXMPP_START_NAMESPACE1(uxmpp)
+
+
+using namespace std;
+
+
+static const string log_unit {"ComponentSession"};
+
+
+//------------------------------------------------------------------------------
+// Move an XML object and its children from one namespace to another.
+//------------------------------------------------------------------------------
+static void map_namespace (XmlObject& xml_obj, const string& from_ns, const string& to_ns)
+{
+    if (xml_obj.get_namespace() == from_ns)
+        xml_obj.set_namespace (to_ns);
+    if (xml_obj.get_default_namespace_attr() == from_ns)
+        xml_obj.set_default_namespace_attr ("");
+    for (auto& node : xml_obj.get_nodes())
+        map_namespace (node, from_ns, to_ns);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+ComponentSession::ComponentSession ()
+    : Session ()
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+ComponentSession::~ComponentSession ()
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void ComponentSession::run (const SessionConfig& config, const std::string& secret)
+{
+    SessionConfig component_cfg (config);
+    component_cfg.disable_srv = true;
+    component_cfg.websocket_url = "";
+    if (component_cfg.port == 0)
+        component_cfg.port = UXMPP_DEFAULT_COMPONENT_PORT;
+
+    this->secret = secret;
+    Session::run (component_cfg);
+    this->secret = "";
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void ComponentSession::init_stream_xml_obj ()
+{
+    stream_xml_obj.set_default_namespace_attr (xml::namespace_component_accept);
+    stream_xml_obj.set_to (cfg.domain);
+    stream_xml_obj.get_attributes().erase ("from");
+    stream_xml_obj.set_part (XmlObjPart::start);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void ComponentSession::on_rx_xml_obj (XmlStream& stream, XmlObject& xml_obj)
+{
+    if (xml_obj.get_namespace() == xml::namespace_component_accept) {
+        string name = xml_obj.get_tag_name ();
+        if (name=="iq" || name=="message" || name=="presence")
+            map_namespace (xml_obj, xml::namespace_component_accept, xml::namespace_jabber_client);
+    }
+    Session::on_rx_xml_obj (stream, xml_obj);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool ComponentSession::process_xml_object (Session& session, XmlObject& xml_obj)
+{
+    // The server accepted the handshake
+    //
+    if (xml_obj.get_full_name() == xml::full_tag_component_handshake) {
+        if (get_state() == SessionState::negotiating) {
+            jid = cfg.domain;
+            uxmpp_log_info (log_unit, "Component ", jid, " is connected");
+            change_state (SessionState::bound);
+        }
+        return true;
+    }
+
+    bool handled = Session::process_xml_object (session, xml_obj);
+
+    // Send the handshake when we have got the stream id
+    //
+    if (xml_obj.get_full_name() == xml::full_tag_stream &&
+        xml_obj.get_part() == XmlObjPart::start &&
+        get_state() == SessionState::negotiating)
+    {
+        uxmpp_log_trace (log_unit, "Send handshake for stream ", sess_id);
+        XmlObject handshake ("handshake", xml::namespace_component_accept, false);
+        handshake.set_content (get_sha1_str(sess_id + secret));
+        xs.write (handshake);
+    }
+
+    return handled;
+}
+
+
+UXMPP_END_NAMESPACE1
@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_COMPONENTSESSION_HPP
+#define UXMPP_COMPONENTSESSION_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/Session.hpp>
+#include <uxmpp/SessionConfig.hpp>
+
+#include <string>
+
+
+namespace uxmpp {
+
+
+/**
+ * Default port number for external component connections.
+ */
+#define UXMPP_DEFAULT_COMPONENT_PORT 5347
+
+
+    /**
+     * An external component session (XEP-0114).
+     * The component connects to a server and authenticates with a shared
+     * secret in namespace <code>jabber:component:accept</code>. There is no
+     * SASL, TLS or resource binding. When the handshake is done the session
+     * is in state SessionState::bound and the session jid is the component
+     * domain. Received stanzas are presented in namespace <code>jabber:client</code>,
+     * so registered modules, listeners and stanza classes work as in a client
+     * session. Stanzas sent by the component must have a 'from' attribute.
+     */
+    class ComponentSession : public Session {
+    public:
+
+        /**
+         * Default constructor.
+         */
+        ComponentSession ();
+
+        /**
+         * Destructor.
+         */
+        virtual ~ComponentSession ();
+
+        /**
+         * Connect to an XMPP server and run the component session until it is closed.
+         * This call will block until the session is closed.
+         * @param config Session configuration. The component domain is
+         *               SessionConfig::domain, the server to connect to is
+         *               SessionConfig::server. No DNS SRV lookup is made, and
+         *               the default port is 5347.
+         * @param secret The secret shared with the server.
+         */
+        void run (const SessionConfig& config, const std::string& secret);
+
+
+    protected:
+
+        /**
+         * Shared secret used in the handshake.
+         */
+        std::string secret;
+
+        /**
+         * Handle the component handshake, and everything else as a client session.
+         */
+        virtual bool process_xml_object (Session& session, XmlObject& xml_obj) override;
+
+        /**
+         * Map stanzas from namespace <code>jabber:component:accept</code> to
+         * <code>jabber:client</code> before they are passed on.
+         */
+        virtual void on_rx_xml_obj (XmlStream& stream, XmlObject& xml_obj) override;
+
+        /**
+         * The 'stream' start tag of a component is in namespace
+         * <code>jabber:component:accept</code> and has no 'from' attribute.
+         */
+        virtual void init_stream_xml_obj () override;
+    };
+
+
+}
+
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/IqCorrelator.hpp>
+#include <uxmpp/Logger.hpp>
+#include <vector>
+
+UXMPP_START_NAMESPACE1(uxmpp)
+
+
+using namespace std;
+
+
+static const string log_unit {"IqCorrelator"};
+
+
+//------------------------------------------------------------------------------
+// A request to the server, or to our own account, may be answered
+// with no 'from' attribute, our bare jid, or the domain.
+//------------------------------------------------------------------------------
+static bool is_from_ok (const Jid& to, const Jid& from, const Jid& own_jid)
+{
+    string to_str   = to_string (to);
+    string from_str = to_string (from);
+    if (to_str == from_str)
+        return true;
+
+    // A server may answer for itself without a 'from' attribute
+    if (from_str.empty() && to_str.find_first_of("@/")==string::npos)
+        return true;
+
+    string own_bare = to_string (own_jid.bare());
+    if (to_str.empty() || to_str==own_bare) {
+        return from_str.empty() ||
+            from_str == own_bare ||
+            from_str == own_jid.get_domain() ||
+            from_str == to_string(own_jid);
+    }
+    return false;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IqCorrelator::IqCorrelator ()
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IqCorrelator::~IqCorrelator ()
+{
+    timer.cancel ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool IqCorrelator::add (const std::string& id, const Jid& to, callback_t cb, unsigned timeout)
+{
+    lock_guard<std::mutex> lock (mutex);
+    if (pending.find(id) != pending.end()) {
+        uxmpp_log_warning (log_unit, "IQ request with id '", id, "' already pending");
+        return false;
+    }
+
+    pending_t& request = pending[id];
+    request.to       = to;
+    request.cb       = cb;
+    request.deadline = deadlines.emplace (clock::now() + chrono::milliseconds(timeout), id);
+    set_timer ();
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool IqCorrelator::dispatch (IqStanza& iq, const Jid& own_jid)
+{
+    if (iq.get_type()!=IqType::result && iq.get_type()!=IqType::error)
+        return false;
+
+    callback_t cb;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto i = pending.find (iq.get_id());
+        if (i == pending.end())
+            return false;
+        if (!is_from_ok(i->second.to, iq.get_from(), own_jid)) {
+            uxmpp_log_info (log_unit, "IQ response with id '", iq.get_id(),
+                            "' from unexpected entity: ", to_string(iq.get_from()));
+            return false;
+        }
+        cb = i->second.cb;
+        deadlines.erase (i->second.deadline);
+        pending.erase (i);
+        set_timer ();
+    }
+
+    if (cb)
+        cb (&iq);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool IqCorrelator::cancel (const std::string& id)
+{
+    lock_guard<std::mutex> lock (mutex);
+    auto i = pending.find (id);
+    if (i == pending.end())
+        return false;
+    deadlines.erase (i->second.deadline);
+    pending.erase (i);
+    set_timer ();
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IqCorrelator::abort_all ()
+{
+    vector<callback_t> callbacks;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        for (auto& deadline : deadlines)
+            callbacks.push_back (pending[deadline.second].cb);
+        pending.clear ();
+        deadlines.clear ();
+        set_timer ();
+    }
+    if (!callbacks.empty())
+        uxmpp_log_debug (log_unit, "Abort ", callbacks.size(), " pending IQ requests");
+    for (auto& cb : callbacks) {
+        if (cb)
+            cb (nullptr);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+size_t IqCorrelator::size ()
+{
+    lock_guard<std::mutex> lock (mutex);
+    return pending.size ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IqCorrelator::set_timeout_handler (std::function<void ()> handler)
+{
+    lock_guard<std::mutex> lock (mutex);
+    timeout_handler = handler;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IqCorrelator::expire ()
+{
+    vector<callback_t> callbacks;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto now = clock::now ();
+        while (!deadlines.empty() && deadlines.begin()->first <= now) {
+            auto i = pending.find (deadlines.begin()->second);
+            uxmpp_log_debug (log_unit, "No response to IQ request '", i->first, "'");
+            callbacks.push_back (i->second.cb);
+            pending.erase (i);
+            deadlines.erase (deadlines.begin());
+        }
+        timer_deadline = clock::time_point ();
+        set_timer ();
+    }
+    for (auto& cb : callbacks) {
+        if (cb)
+            cb (nullptr);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Set the timer to the earliest deadline. Called with the mutex locked.
+//------------------------------------------------------------------------------
+void IqCorrelator::set_timer ()
+{
+    if (deadlines.empty()) {
+        if (timer_deadline != clock::time_point()) {
+            timer.cancel ();
+            timer_deadline = clock::time_point ();
+        }
+        return;
+    }
+
+    auto deadline = deadlines.begin()->first;
+    if (deadline == timer_deadline)
+        return;
+    timer_deadline = deadline;
+    auto duration = deadline - clock::now ();
+    if (duration < clock::duration::zero())
+        duration = clock::duration::zero ();
+    timer.set (duration, [this](){
+            std::function<void ()> handler;
+            {
+                lock_guard<std::mutex> lock (mutex);
+                timer_deadline = clock::time_point ();
+                handler = timeout_handler;
+            }
+            if (handler)
+                handler ();
+            else
+                expire ();
+        });
+}
+
+
+UXMPP_END_NAMESPACE1
@@ -0,0 +1,141 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_IQCORRELATOR_HPP
+#define UXMPP_IQCORRELATOR_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/IqStanza.hpp>
+#include <uxmpp/Jid.hpp>
+#include <uxmpp/io/Timer.hpp>
+
+#include <string>
+#include <unordered_map>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <functional>
+
+
+namespace uxmpp {
+
+
+    /**
+     * Keeps track of IQ requests waiting for a response.
+     * Each request has a deadline, all deadlines share one timer.
+     * A response is matched by its id and by the entity it is sent from.
+     */
+    class IqCorrelator {
+    public:
+
+        /**
+         * Called with the response to an IQ request.
+         * @param response The 'result' or 'error' response, or
+         *                 <code>nullptr</code> if no response was
+         *                 received before the deadline, or if the
+         *                 request was aborted.
+         */
+        typedef std::function<void (IqStanza* response)> callback_t;
+
+        /**
+         * Constructor.
+         */
+        IqCorrelator ();
+
+        /**
+         * Destructor.
+         * Pending requests are dropped without calling their callbacks.
+         */
+        ~IqCorrelator ();
+
+        /**
+         * Add a request waiting for a response.
+         * @param id The id of the IQ request.
+         * @param to The 'to' attribute of the IQ request.
+         * @param cb Called when the response is received or the deadline expires.
+         * @param timeout Milliseconds to wait for a response.
+         * @return false if a request with the same id is already pending.
+         */
+        bool add (const std::string& id, const Jid& to, callback_t cb, unsigned timeout);
+
+        /**
+         * Call the callback of the request that this IQ is a response to.
+         * @param iq A received IQ stanza.
+         * @param own_jid The session jid. A request to the server or to our
+         *                own bare jid may be answered from either.
+         * @return true if the IQ was a response to a pending request.
+         */
+        bool dispatch (IqStanza& iq, const Jid& own_jid);
+
+        /**
+         * Remove a pending request without calling its callback.
+         * @return true if the request was pending.
+         */
+        bool cancel (const std::string& id);
+
+        /**
+         * Remove all pending requests and call their callbacks with a
+         * <code>nullptr</code> response.
+         */
+        void abort_all ();
+
+        /**
+         * Return the number of pending requests.
+         */
+        size_t size ();
+
+        /**
+         * Set a function called from the timer thread when a deadline
+         * has expired. It should arrange for expire() to be called,
+         * like on the thread that dispatches responses, so callbacks
+         * for responses and timeouts are called on the same thread.
+         * If not set, expire() is called from the timer thread.
+         */
+        void set_timeout_handler (std::function<void ()> handler);
+
+        /**
+         * Call the callbacks of the requests with an expired deadline,
+         * with a <code>nullptr</code> response.
+         */
+        void expire ();
+
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        struct pending_t {
+            Jid to;
+            callback_t cb;
+            std::multimap<clock::time_point, std::string>::iterator deadline;
+        };
+
+        std::mutex mutex;
+        std::unordered_map<std::string, pending_t> pending;
+        std::multimap<clock::time_point, std::string> deadlines;
+        io::Timer timer;
+        clock::time_point timer_deadline;
+        std::function<void ()> timeout_handler;
+
+        void set_timer ();
+    };
+
+
+}
+
+
+#endif
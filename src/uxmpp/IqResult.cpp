@@ -0,0 +1,72 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/IqResult.hpp>
+#include <uxmpp/xml/names.hpp>
+
+UXMPP_START_NAMESPACE1(uxmpp)
+
+
+using namespace std;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IqResult::IqResult ()
+    :
+    received {false},
+    response (IqType::error)
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IqResult::IqResult (IqStanza* response)
+    :
+    received {response != nullptr},
+    response (response ? *response : IqStanza(IqType::error))
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+StanzaError IqResult::get_error ()
+{
+    if (!received)
+        return StanzaError (StanzaError::type_wait, StanzaError::remote_server_timeout);
+    return response.get_error ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+XmlObject IqResult::get_payload ()
+{
+    if (is_ok()) {
+        for (auto& node : response.get_nodes()) {
+            if (node.get_full_name() != xml::full_tag_error_stanza)
+                return node;
+        }
+    }
+    return XmlObject ();
+}
+
+
+UXMPP_END_NAMESPACE1
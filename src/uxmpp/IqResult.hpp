@@ -0,0 +1,95 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_IQRESULT_HPP
+#define UXMPP_IQRESULT_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/IqStanza.hpp>
+#include <uxmpp/StanzaError.hpp>
+#include <uxmpp/XmlObject.hpp>
+
+
+namespace uxmpp {
+
+
+    /**
+     * The outcome of an IQ request.
+     * This holds the 'result' or 'error' response, or nothing
+     * if no response was received.
+     */
+    class IqResult {
+    public:
+        /**
+         * Create a result without a response.
+         */
+        IqResult ();
+
+        /**
+         * Create a result from a received response.
+         * @param response The response, or <code>nullptr</code> if
+         *                 no response was received.
+         */
+        IqResult (IqStanza* response);
+
+        /**
+         * Return true if a response was received.
+         */
+        bool have_response () const {
+            return received;
+        }
+
+        /**
+         * Return true if a response of type 'result' was received.
+         */
+        bool is_ok () const {
+            return received && response.get_type()==IqType::result;
+        }
+
+        /**
+         * Return the response. If no response was
+         * received this is an empty IQ of type 'error'.
+         */
+        IqStanza& get_response () {
+            return response;
+        }
+
+        /**
+         * Return the error of the request. A missing response is
+         * reported as error condition 'remote-server-timeout'.
+         * If the request succeeded the error has an empty tag name.
+         */
+        StanzaError get_error ();
+
+        /**
+         * Return the first child element of the response, the
+         * payload of a 'result'. Empty if there is none.
+         */
+        XmlObject get_payload ();
+
+
+    private:
+        bool received;
+        IqStanza response;
+    };
+
+
+}
+
+
+#endif
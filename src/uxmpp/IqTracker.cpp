@@ -0,0 +1,120 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/IqTracker.hpp>
+#include <uxmpp/Stanza.hpp>
+#include <vector>
+
+UXMPP_START_NAMESPACE1(uxmpp)
+
+
+using namespace std;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IqTracker::IqTracker ()
+    : sess {nullptr}
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IqTracker::~IqTracker ()
+{
+    cancel_all ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string IqTracker::send_iq (Session& session,
+                                XmlObject&& iq,
+                                Session::iq_callback_t cb,
+                                unsigned timeout)
+{
+    XmlObject request (std::move(iq));
+    string id = request.get_attribute ("id");
+    if (id.empty()) {
+        id = Stanza::make_id ();
+        request.set_attribute ("id", id);
+    }
+
+    // Track the request before sending it, the callback
+    // may be called before send_iq returns.
+    //
+    {
+        lock_guard<std::mutex> lock (mutex);
+        sess = &session;
+        ids.insert (id);
+    }
+    string sent_id = session.send_iq (std::move(request), [this, id, cb](Session& s, IqStanza* response){
+            {
+                lock_guard<std::mutex> lock (mutex);
+                ids.erase (id);
+            }
+            if (cb)
+                cb (s, response);
+        }, timeout);
+    if (sent_id.empty()) {
+        lock_guard<std::mutex> lock (mutex);
+        ids.erase (id);
+    }
+    return sent_id;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string IqTracker::send_iq (Session& session,
+                                const XmlObject& iq,
+                                Session::iq_callback_t cb,
+                                unsigned timeout)
+{
+    return send_iq (session, XmlObject(iq), cb, timeout);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IqTracker::cancel_all ()
+{
+    vector<string> pending;
+    Session* session;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        pending.assign (ids.begin(), ids.end());
+        ids.clear ();
+        session = sess;
+    }
+    for (auto& id : pending)
+        session->cancel_iq (id);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+size_t IqTracker::size ()
+{
+    lock_guard<std::mutex> lock (mutex);
+    return ids.size ();
+}
+
+
+UXMPP_END_NAMESPACE1
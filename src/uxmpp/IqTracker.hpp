@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_IQTRACKER_HPP
+#define UXMPP_IQTRACKER_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/Session.hpp>
+#include <uxmpp/XmlObject.hpp>
+
+#include <string>
+#include <unordered_set>
+#include <mutex>
+
+
+namespace uxmpp {
+
+
+    /**
+     * Keeps track of the IQ requests sent by a module that are
+     * waiting for a response. A module cancels them when it is
+     * unregistered or destroyed, so no callback is called on a
+     * module that is gone.
+     */
+    class IqTracker {
+    public:
+
+        /**
+         * Constructor.
+         */
+        IqTracker ();
+
+        /**
+         * Destructor.
+         * Cancels the pending requests.
+         */
+        ~IqTracker ();
+
+        /**
+         * Send an IQ request with Session::send_iq() and keep
+         * track of it until the callback is called.
+         * @param session The session to send the request in.
+         * @param iq An IQ stanza of type 'get' or 'set'.
+         *           If it has no 'id' attribute, one is generated.
+         * @param cb Called when the response is received or the request times out.
+         * @param timeout Milliseconds to wait for a response.
+         * @return The id of the IQ request, or an empty string if it wasn't sent.
+         */
+        std::string send_iq (Session& session,
+                             XmlObject&& iq,
+                             Session::iq_callback_t cb,
+                             unsigned timeout=UXMPP_DEFAULT_IQ_TIMEOUT);
+
+        /**
+         * Send an IQ request and keep track of it.
+         */
+        std::string send_iq (Session& session,
+                             const XmlObject& iq,
+                             Session::iq_callback_t cb,
+                             unsigned timeout=UXMPP_DEFAULT_IQ_TIMEOUT);
+
+        /**
+         * Cancel all pending requests, their callbacks will not be called.
+         */
+        void cancel_all ();
+
+        /**
+         * Return the number of pending requests.
+         */
+        size_t size ();
+
+
+    private:
+        std::mutex mutex;
+        Session* sess;                   // The session of the pending requests
+        std::unordered_set<std::string> ids;
+    };
+
+
+}
+
+
+#endif
@@ -0,0 +1,355 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/Metrics.hpp>
+#include <uxmpp/Logger.hpp>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+UXMPP_START_NAMESPACE1(uxmpp)
+
+
+using namespace std;
+
+
+static const string log_unit {"Metrics"};
+
+Metrics* Metrics::instance = nullptr;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string to_string (const MetricType& type)
+{
+    switch (type) {
+    case MetricType::counter:
+        return "counter";
+    case MetricType::gauge:
+        return "gauge";
+    case MetricType::summary:
+        return "summary";
+    }
+    return "untyped";
+}
+
+
+//------------------------------------------------------------------------------
+// Integers are printed without exponent or decimals.
+//------------------------------------------------------------------------------
+static string format_value (double value)
+{
+    ostringstream os;
+    if (value == std::floor(value) && std::fabs(value) < 1e15)
+        os << static_cast<int64_t> (value);
+    else
+        os << std::setprecision(9) << value;
+    return os.str ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static string with_labels (const string& name, const string& labels)
+{
+    return labels.empty() ? name : name + "{" + labels + "}";
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+Metric::Metric (MetricType type,
+                const std::string& name,
+                const std::string& labels,
+                const std::string& help,
+                double scale)
+    :
+    type   {type},
+    name   {name},
+    labels {labels},
+    help   {help},
+    scale  {scale},
+    value  {0},
+    count  {0}
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+Metrics::Metrics ()
+{
+    export_pipe[0] = export_pipe[1] = -1;
+}
+
+
+//------------------------------------------------------------------------------
+// The instance is never deleted, metrics may be updated
+// by other static objects while the process exits.
+//------------------------------------------------------------------------------
+Metrics& Metrics::get_instance ()
+{
+    static std::mutex instance_mutex;
+    if (instance == nullptr) {
+        lock_guard<std::mutex> lock (instance_mutex);
+        if (instance == nullptr)
+            instance = new Metrics;
+    }
+    return *instance;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::shared_ptr<Metric> Metrics::add (MetricType type,
+                                      const std::string& name,
+                                      const std::string& help,
+                                      const std::string& labels,
+                                      double scale)
+{
+    lock_guard<std::mutex> lock (mutex);
+    auto& metric = metrics[name][labels];
+    if (!metric)
+        metric = make_shared<Metric> (type, name, labels, help, scale);
+    return metric;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Metrics::remove (const std::shared_ptr<Metric>& metric)
+{
+    if (!metric)
+        return;
+    lock_guard<std::mutex> lock (mutex);
+    auto i = metrics.find (metric->get_name());
+    if (i == metrics.end())
+        return;
+    auto j = i->second.find (metric->get_labels());
+    if (j!=i->second.end() && j->second==metric)
+        i->second.erase (j);
+    if (i->second.empty())
+        metrics.erase (i);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::vector<MetricSample> Metrics::snapshot ()
+{
+    vector<MetricSample> samples;
+    lock_guard<std::mutex> lock (mutex);
+    for (auto& family : metrics) {
+        for (auto& m : family.second) {
+            auto& metric = *m.second;
+            samples.push_back (MetricSample{metric.get_type(),
+                                            metric.get_name(),
+                                            metric.get_labels(),
+                                            metric.get_value() * metric.get_scale(),
+                                            metric.get_count()});
+        }
+    }
+    return samples;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string Metrics::to_prometheus ()
+{
+    ostringstream os;
+    lock_guard<std::mutex> lock (mutex);
+    for (auto& family : metrics) {
+        if (family.second.empty())
+            continue;
+        auto& first = *family.second.begin()->second;
+        os << "# HELP " << family.first << " " << first.get_help() << "\n";
+        os << "# TYPE " << family.first << " " << to_string(first.get_type()) << "\n";
+        for (auto& m : family.second) {
+            auto& metric = *m.second;
+            double value = metric.get_value() * metric.get_scale();
+            if (metric.get_type() == MetricType::summary) {
+                os << with_labels(family.first+"_sum", m.first) << " " << format_value(value) << "\n";
+                os << with_labels(family.first+"_count", m.first) << " " << metric.get_count() << "\n";
+            }else{
+                os << with_labels(family.first, m.first) << " " << format_value(value) << "\n";
+            }
+        }
+    }
+    return os.str ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool Metrics::write_file (const std::string& file)
+{
+    string tmp_file = file + ".tmp";
+    {
+        ofstream out (tmp_file, ios::trunc);
+        out << to_prometheus ();
+        if (!out) {
+            uxmpp_log_warning (log_unit, "Unable to write ", tmp_file);
+            return false;
+        }
+    }
+    if (rename(tmp_file.c_str(), file.c_str())) {
+        uxmpp_log_warning (log_unit, "Unable to rename ", tmp_file, " to ", file);
+        ::unlink (tmp_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool Metrics::export_to_file (const std::string& file, unsigned interval)
+{
+    stop_export ();
+    lock_guard<std::mutex> lock (export_mutex);
+    if (pipe(export_pipe)) {
+        uxmpp_log_warning (log_unit, "Unable to create pipe: ", string(strerror(errno)));
+        return false;
+    }
+    export_thread = std::thread ([this, file, interval](){
+            run_export (file, interval ? interval : 1, -1);
+        });
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool Metrics::export_to_socket (const std::string& path)
+{
+    stop_export ();
+    lock_guard<std::mutex> lock (export_mutex);
+
+    struct sockaddr_un addr;
+    memset (&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        uxmpp_log_warning (log_unit, "Socket path too long: ", path);
+        return false;
+    }
+    strcpy (addr.sun_path, path.c_str());
+
+    int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        uxmpp_log_warning (log_unit, "Unable to create socket: ", string(strerror(errno)));
+        return false;
+    }
+    ::unlink (path.c_str());
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) || listen(fd, 8)) {
+        uxmpp_log_warning (log_unit, "Unable to listen on ", path, ": ", string(strerror(errno)));
+        ::close (fd);
+        return false;
+    }
+    if (pipe(export_pipe)) {
+        uxmpp_log_warning (log_unit, "Unable to create pipe: ", string(strerror(errno)));
+        ::close (fd);
+        ::unlink (path.c_str());
+        return false;
+    }
+    export_path = path;
+    export_thread = std::thread ([this, fd](){
+            run_export ("", 0, fd);
+        });
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Metrics::stop_export ()
+{
+    lock_guard<std::mutex> lock (export_mutex);
+    if (!export_thread.joinable())
+        return;
+
+    char c = 0;
+    if (::write(export_pipe[1], &c, 1) != 1)
+        uxmpp_log_warning (log_unit, "Unable to stop the export thread");
+    export_thread.join ();
+    ::close (export_pipe[0]);
+    ::close (export_pipe[1]);
+    export_pipe[0] = export_pipe[1] = -1;
+    if (!export_path.empty()) {
+        ::unlink (export_path.c_str());
+        export_path = "";
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Write the metrics to 'file' every 'interval' milliseconds, or
+// to each client connecting to 'listen_fd', until stop_export().
+//------------------------------------------------------------------------------
+void Metrics::run_export (std::string file, unsigned interval, int listen_fd)
+{
+    struct pollfd fds[2];
+    fds[0].fd     = export_pipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd     = listen_fd;
+    fds[1].events = POLLIN;
+
+    while (true) {
+        fds[0].revents = fds[1].revents = 0;
+        int result = poll (fds, listen_fd==-1 ? 1 : 2, listen_fd==-1 ? static_cast<int>(interval) : -1);
+        if (result < 0 && errno != EINTR)
+            break;
+        if (fds[0].revents)
+            break;
+        if (listen_fd == -1) {
+            if (result == 0)
+                write_file (file);
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            int fd = accept (listen_fd, nullptr, nullptr);
+            if (fd == -1)
+                continue;
+            string text = to_prometheus ();
+            const char* data = text.data ();
+            size_t left = text.size ();
+            while (left > 0) {
+                auto n = ::send (fd, data, left, MSG_NOSIGNAL);
+                if (n <= 0)
+                    break;
+                data += n;
+                left -= n;
+            }
+            ::close (fd);
+        }
+    }
+    if (listen_fd != -1)
+        ::close (listen_fd);
+}
+
+
+UXMPP_END_NAMESPACE1
@@ -0,0 +1,268 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_METRICS_HPP
+#define UXMPP_METRICS_HPP
+
+#include <uxmpp/types.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+
+
+namespace uxmpp {
+
+
+    /**
+     * The type of a metric.
+     */
+    enum class MetricType {
+        /**
+         * A value that only increases, like the number of bytes received.
+         */
+        counter,
+
+        /**
+         * A value that can go up and down, like a queue depth.
+         */
+        gauge,
+
+        /**
+         * A sum and a count of observed values,
+         * like the time spent in a callback.
+         */
+        summary
+    };
+
+
+    /**
+     * Return a string representation of a metric type.
+     */
+    std::string to_string (const MetricType& type);
+
+
+    /**
+     * A counter, gauge or summary.
+     * Updating a metric is lock free, so it can be done in any hot path.
+     */
+    class Metric {
+    public:
+        /**
+         * Constructor.
+         * Metrics are normally created by Metrics::add().
+         * @param type The metric type.
+         * @param name The metric name.
+         * @param labels Labels in Prometheus format, like <code>stream="1"</code>.
+         * @param help A description of the metric.
+         * @param scale Values are multiplied with this when exported,
+         *              1e-9 for nanoseconds exported as seconds.
+         */
+        Metric (MetricType type,
+                const std::string& name,
+                const std::string& labels,
+                const std::string& help,
+                double scale=1.0);
+
+        /**
+         * Increase a counter or gauge.
+         */
+        void inc (int64_t n=1) {
+            value.fetch_add (n, std::memory_order_relaxed);
+        }
+
+        /**
+         * Decrease a gauge.
+         */
+        void dec (int64_t n=1) {
+            value.fetch_sub (n, std::memory_order_relaxed);
+        }
+
+        /**
+         * Set the value of a gauge.
+         */
+        void set (int64_t v) {
+            value.store (v, std::memory_order_relaxed);
+        }
+
+        /**
+         * Add a value to a summary.
+         */
+        void observe (int64_t v) {
+            value.fetch_add (v, std::memory_order_relaxed);
+            count.fetch_add (1, std::memory_order_relaxed);
+        }
+
+        /**
+         * Return the value, or the sum of a summary.
+         */
+        int64_t get_value () const {
+            return value.load (std::memory_order_relaxed);
+        }
+
+        /**
+         * Return the number of observed values of a summary.
+         */
+        uint64_t get_count () const {
+            return count.load (std::memory_order_relaxed);
+        }
+
+        MetricType get_type () const {
+            return type;
+        }
+        const std::string& get_name () const {
+            return name;
+        }
+        const std::string& get_labels () const {
+            return labels;
+        }
+        const std::string& get_help () const {
+            return help;
+        }
+        double get_scale () const {
+            return scale;
+        }
+
+
+    private:
+        MetricType type;
+        std::string name;
+        std::string labels;
+        std::string help;
+        double scale;
+        std::atomic<int64_t> value;
+        std::atomic<uint64_t> count;
+    };
+
+
+    /**
+     * The value of a metric at the time of a snapshot.
+     */
+    struct MetricSample {
+        MetricType  type;
+        std::string name;
+        std::string labels;
+        double      value; /**< Scaled value, or the scaled sum of a summary. */
+        uint64_t    count; /**< Number of observed values of a summary. */
+    };
+
+
+    /**
+     * A singleton registry of the metrics in the process.
+     * Metrics are created by the library for XML streams, the connection
+     * manager, timers and sessions, and applications can add their own.
+     * The current values can be read as a snapshot or in the Prometheus
+     * text exposition format, and be exported to a file or a Unix socket.
+     */
+    class Metrics {
+    public:
+        /**
+         * Return the singleton instance.
+         */
+        static Metrics& get_instance ();
+
+        /**
+         * Add a metric, or return the existing metric
+         * with the same name and labels.
+         * @param type The metric type.
+         * @param name The metric name.
+         * @param help A description of the metric.
+         * @param labels Labels in Prometheus format, like <code>stream="1"</code>.
+         * @param scale Values are multiplied with this when exported.
+         */
+        std::shared_ptr<Metric> add (MetricType type,
+                                     const std::string& name,
+                                     const std::string& help,
+                                     const std::string& labels="",
+                                     double scale=1.0);
+
+        /**
+         * Remove a metric from the registry.
+         * This is done for metrics of an object that goes away,
+         * like the metrics of an XML stream.
+         */
+        void remove (const std::shared_ptr<Metric>& metric);
+
+        /**
+         * Return the current value of all metrics,
+         * sorted by name and labels.
+         */
+        std::vector<MetricSample> snapshot ();
+
+        /**
+         * Return the current value of all metrics
+         * in the Prometheus text exposition format.
+         */
+        std::string to_prometheus ();
+
+        /**
+         * Write all metrics in the Prometheus text format to a file.
+         * The file is replaced atomically, so a reader never
+         * sees a partly written file.
+         * @return false if the file can't be written.
+         */
+        bool write_file (const std::string& file);
+
+        /**
+         * Write the metrics to a file periodically.
+         * This stops any previous export.
+         * @param file The file to write.
+         * @param interval Milliseconds between each write.
+         */
+        bool export_to_file (const std::string& file, unsigned interval=10000);
+
+        /**
+         * Listen on a Unix stream socket and write the metrics in the
+         * Prometheus text format to each client that connects.
+         * This stops any previous export.
+         * @param path The path of the socket. An existing socket is replaced.
+         */
+        bool export_to_socket (const std::string& path);
+
+        /**
+         * Stop exporting metrics.
+         */
+        void stop_export ();
+
+
+    private:
+        Metrics ();
+        ~Metrics () = default;
+
+        static Metrics* instance;
+
+        std::mutex mutex;
+        std::map<std::string, std::map<std::string, std::shared_ptr<Metric>>> metrics;
+
+        std::mutex export_mutex;
+        std::thread export_thread;
+        int export_pipe[2];
+        std::string export_path;
+
+        void run_export (std::string file, unsigned interval, int listen_fd);
+    };
+
+
+}
+
+
+#endif
@@ -24,7 +24,9 @@
 #include <uxmpp/utils.hpp>
 #include <uxmpp/IqStanza.hpp>
 #include <uxmpp/xml/names.hpp>
+#include <uxmpp/Tracer.hpp>
 #include <arpa/inet.h>
+#include <chrono>
 
 UXMPP_START_NAMESPACE1(uxmpp)
 
@@ -38,6 +40,12 @@ static string XmlDiscoQueryNs {"http://jabber.org/protocol/disco#info"};
 
 
 static std::vector<IpHostAddr> get_server_address_list (const SessionConfig& cfg);
+static bool parse_websocket_url (const std::string& url,
+                                 std::string& authority,
+                                 std::string& host,
+                                 uint16_t& port,
+                                 std::string& path,
+                                 bool& secure);
 
 
 static const bool valid_session_state_matrix [5/*old state*/][5/*new state*/] = {
@@ -70,9 +78,21 @@ Session::Session ()
     xs         (XmlObject(xml::tag_stream, xml::namespace_stream, false, false)),
     sess_id    {""},
     sess_from  {""},
-    state      {SessionState::closed}
+    state      {SessionState::closed},
+    resumed    {false},
+    bind_sent  {false},
+    login_start {0},
+    login_time  {0},
+    login_round_trips {0},
+    modules_version {0}
 {
     register_module (*this);
+
+    // Handle IQ timeouts on the thread that dispatches IQ responses
+    //
+    iq_correlator.set_timeout_handler ([this](){
+            xs.set_timeout ("iq_timeout", 0);
+        });
 }
 
 
@@ -101,22 +121,40 @@ void Session::run (const SessionConfig& config)
     sess_id   = "";
     sess_from = "";
     jid       = "";
+    resumed   = false;
+    bind_sent = false;
+    login_time = 0;
+    login_round_trips = 0;
     stream_error.set_error_name ("");
 
     // Initialize the first top-level XML object to send
     //
-    stream_xml_obj.set_to    (cfg.domain);
-    stream_xml_obj.set_from (string("user@")+cfg.domain);
-    stream_xml_obj.set_part (XmlObjPart::start);
+    init_stream_xml_obj ();
 
     // Get the list of IP addresses to try to connect to
     //
-    auto addr_list = get_server_address_list (cfg);
+    bool websocket = !cfg.websocket_url.empty ();
+    string ws_authority;
+    string ws_path;
+    bool ws_secure = false;
+    std::vector<IpHostAddr> addr_list;
+    if (websocket) {
+        string ws_host;
+        uint16_t ws_port;
+        if (parse_websocket_url(cfg.websocket_url, ws_authority, ws_host, ws_port, ws_path, ws_secure)) {
+            BsdResolver resolver;
+            addr_list = resolver.lookup_host (ws_host, ws_port, AddrProto::tcp);
+        }else{
+            uxmpp_log_warning (log_unit, "Invalid WebSocket URL: ", cfg.websocket_url);
+        }
+    }else{
+        addr_list = get_server_address_list (cfg);
+    }
 
     // Set error 'undefined-condition' if the resolver fails.
     //
     if (addr_list.empty()) {
-        string host = cfg.server.empty() ? cfg.domain : cfg.server;
+        string host = websocket ? cfg.websocket_url : (cfg.server.empty() ? cfg.domain : cfg.server);
         uxmpp_log_warning (log_unit, "Unable to resolv host ", host);
         stream_error.set_app_error ("resolve-error",
                                     string("Unable to resolve host ") + host);
@@ -147,8 +185,9 @@ void Session::run (const SessionConfig& config)
 
     // Try to connect to the addresses the resolver returned.
     //
+    login_start = Tracer::now ();
     for (auto& addr : addr_list) {
-        if (cfg.port) // Override port number ?
+        if (cfg.port && !websocket) // Override port number ?
             addr.port = htons (cfg.port);
 
         connected = false;
@@ -167,6 +206,15 @@ void Session::run (const SessionConfig& config)
             stream_error.set_error_name ("");
         }
 
+        // Open the WebSocket
+        //
+        if (websocket && !start_websocket(ws_authority, ws_path, ws_secure)) {
+            socket.close ();
+            stream_error.set_app_error ("websocket-error", "Unable to open WebSocket connection");
+            continue;
+        }
+        xs.set_framed (websocket);
+
         // This is a blocking call. The execution of xs.start() could take quite some time.
         //
         connected = xs.run (socket, socket, stream_xml_obj);
@@ -194,6 +242,61 @@ void Session::run (const SessionConfig& config)
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Session::init_stream_xml_obj ()
+{
+    stream_xml_obj.set_to    (cfg.domain);
+    stream_xml_obj.set_from (string("user@")+cfg.domain);
+    stream_xml_obj.set_part (XmlObjPart::start);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool Session::start_websocket (const std::string& host, const std::string& path, bool secure)
+{
+    bool success = false;
+    Semaphore sem;
+
+    // Secure WebSocket, TLS below the WebSocket framing
+    //
+    if (secure) {
+        socket.set_tls_connected_cb ([&success, &sem](SocketConnection& connection,
+                                                      int errnum,
+                                                      const std::string& errstr){
+                success = errnum == 0;
+                sem.post ();
+            });
+        socket.enable_tls (cfg.websocket_tls); // This is a non-blocking call
+        bool done = sem.wait (chrono::seconds(5));
+        socket.set_tls_connected_cb (nullptr);
+        if (!done || !success) {
+            uxmpp_log_info (log_unit, "TLS handshake failed for ", cfg.websocket_url);
+            return false;
+        }
+        success = false;
+    }
+
+    // WebSocket opening handshake
+    //
+    socket.set_upgraded_cb ([&success, &sem](WebSocketConnection& connection,
+                                             int errnum,
+                                             const std::string& errstr){
+            success = errnum == 0;
+            sem.post ();
+        });
+    socket.upgrade (host, path, "xmpp", cfg.websocket_deflate); // This is a non-blocking call
+    bool done = sem.wait (chrono::seconds(5));
+    socket.set_upgraded_cb (nullptr);
+    if (!done || !success) {
+        uxmpp_log_info (log_unit, "Unable to open WebSocket ", cfg.websocket_url);
+        return false;
+    }
+    return true;
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void Session::stop (bool fast)
@@ -224,6 +327,49 @@ void Session::stop (bool fast)
 }
 
 
+//------------------------------------------------------------------------------
+// The metrics are shared by all sessions and never removed from the registry.
+//------------------------------------------------------------------------------
+static Metric& state_metric (SessionState state)
+{
+    static Metric* metrics[5] {nullptr};
+    static std::once_flag once;
+    std::call_once (once, [](){
+            for (int i=0; i<5; ++i) {
+                metrics[i] = Metrics::get_instance().add (
+                    MetricType::counter,
+                    "uxmpp_session_state_transitions_total",
+                    "Session state transitions, by new state.",
+                    string("state=\"") + to_string(static_cast<SessionState>(i)) + "\"").get ();
+            }
+        });
+    return *metrics[static_cast<int>(state)];
+}
+
+
+//------------------------------------------------------------------------------
+// Login time and round trips from connect to bound, shared by all sessions.
+//------------------------------------------------------------------------------
+static void observe_login (int64_t nsec, unsigned round_trips)
+{
+    static Metric* login_seconds {nullptr};
+    static Metric* login_round_trips {nullptr};
+    static std::once_flag once;
+    std::call_once (once, [](){
+            auto& metrics = Metrics::get_instance ();
+            login_seconds = metrics.add (MetricType::summary,
+                                         "uxmpp_session_login_seconds",
+                                         "Time from connect until the session is bound.",
+                                         "", 1e-9).get ();
+            login_round_trips = metrics.add (MetricType::summary,
+                                             "uxmpp_session_login_round_trips",
+                                             "Round trips from connect until the session is bound.").get ();
+        });
+    login_seconds->observe (nsec);
+    login_round_trips->observe (round_trips);
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 bool Session::change_state (SessionState new_state)
@@ -241,12 +387,14 @@ bool Session::change_state (SessionState new_state)
     }
 
     state = new_state;
+    state_metric(new_state).inc ();
 
     uxmpp_log_trace (log_unit, "### new session state: ", to_string(state), " ###");
 
     switch (new_state) {
     case SessionState::closed:
         xs.cancel_timeout ("stop_session"); // Disable stop_session timer
+        iq_correlator.abort_all ();
         break;
 
     case SessionState::connecting:
@@ -256,7 +404,11 @@ bool Session::change_state (SessionState new_state)
         break;
 
     case SessionState::bound:
-        uxmpp_log_debug (log_unit, "Binding is done: ", jid);
+        login_time = Tracer::now() - login_start;
+        login_round_trips = xs.get_round_trips ();
+        observe_login (login_time, login_round_trips);
+        uxmpp_log_debug (log_unit, "Binding is done: ", jid, ", ",
+                         login_time/1000, " us, ", login_round_trips, " round trips");
         break;
 
     case SessionState::closing:
@@ -278,15 +430,50 @@ bool Session::change_state (SessionState new_state)
 //------------------------------------------------------------------------------
 void Session::on_rx_xml_obj (XmlStream& stream, XmlObject& xml_obj)
 {
-    uxmpp_log_debug (log_unit, "Got XML obj: ", to_string(xml_obj, true));
+    // Don't serialize every received object unless it is logged
+    //
+    if (uxmpp_get_log_level() >= LogLevel::debug)
+        uxmpp_log_debug (log_unit, "Got XML obj: ", to_string(xml_obj, true));
+
+    // Inform listeners about received stanzas
+    //
+    string full_name = xml_obj.get_full_name ();
+    if (full_name == xml::full_tag_iq_stanza ||
+        full_name == xml::full_tag_message_stanza ||
+        full_name == xml::full_tag_presence_stanza)
+    {
+        for (auto& listener : listeners)
+            listener->on_stanza_received (*this, xml_obj);
+
+        // Responses to requests sent by send_iq()
+        //
+        if (full_name == xml::full_tag_iq_stanza &&
+            iq_correlator.dispatch(reinterpret_cast<IqStanza&>(xml_obj), get_jid()))
+        {
+            return;
+        }
+    }
 
     // Find an XMPP module to handle the XML object.
     //
     bool handled = false;
-    for (XmppModule* module : xmpp_modules) {
+    std::shared_ptr<const vector<ModuleEntry>> entries;
+    {
+        lock_guard<std::mutex> lock (modules_mutex);
+        entries = module_entries;
+    }
+    for (auto& entry : *entries) {
+        XmppModule* module = entry.module;
         uxmpp_log_trace (log_unit, string("Call module ") + module->get_name());
-        if (module->process_xml_object(*this, xml_obj)) {
-            uxmpp_log_debug (log_unit, string("XML object handled by module ") + module->get_name());
+        auto start = Tracer::now ();
+        bool processed = module->process_xml_object (*this, xml_obj);
+        auto end = Tracer::now ();
+        entry.metric->observe (end - start);
+        if (auto trace_id = Tracer::get_current())
+            Tracer::get_instance().span ("module", start, end, trace_id, module->get_name());
+        if (processed) {
+            if (uxmpp_get_log_level() >= LogLevel::debug)
+                uxmpp_log_debug (log_unit, "XML object handled by module ", module->get_name());
             handled = true;
             break;
         }
@@ -322,16 +509,12 @@ void Session::on_rx_xml_obj (XmlStream& stream, XmlObject& xml_obj)
     // If the XML object was not handled and we have got feature 'bind'
     // then send 'bind' to the server. And yes, only if we are in 'negotiating' state.
     //
-    if (get_state() == SessionState::negotiating) {
+    // Unless it was already sent by reset_and_bind().
+    //
+    if (get_state() == SessionState::negotiating && !bind_sent) {
         for (auto& feature : features) {
             if (feature.get_tag_name() == xml::tag_bind) {
-                IqStanza iq (IqType::set, "", "", "b#1");
-                XmlObject bind_node (xml::tag_bind, xml::namespace_bind, true, true);
-                if (!cfg.resource.empty()) {
-                    bind_node.add_node (XmlObject("resource", xml::namespace_bind, false).set_content(cfg.resource));
-                }
-                iq.add_node (bind_node);
-                xs.write (iq);
+                bind_sent = xs.write (make_bind_request());
                 break;
             }
         }
@@ -339,6 +522,36 @@ void Session::on_rx_xml_obj (XmlStream& stream, XmlObject& xml_obj)
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IqStanza Session::make_bind_request () const
+{
+    IqStanza iq (IqType::set, "", "", "b#1");
+    XmlObject bind_node (xml::tag_bind, xml::namespace_bind, true, true);
+    if (!cfg.resource.empty()) {
+        bind_node.add_node (XmlObject("resource", xml::namespace_bind, false).set_content(cfg.resource));
+    }
+    iq.add_node (bind_node);
+    return iq;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::chrono::nanoseconds Session::get_login_time () const
+{
+    return std::chrono::nanoseconds (login_time);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+unsigned Session::get_login_round_trips () const
+{
+    return login_round_trips;
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 StreamError& Session::get_error ()
@@ -410,7 +623,148 @@ Jid Session::get_domain () const
 //------------------------------------------------------------------------------
 void Session::send_stanza (const XmlObject& xml_obj)
 {
-    xs.write (xml_obj);
+    if (!xml_obj)
+        return;
+
+    string data (xs.serialize(xml_obj));
+    std::lock_guard<std::mutex> lock (tx_mutex);
+    if (xs.write_raw(data)) {
+        for (auto& listener : listeners)
+            listener->on_stanza_sent (*this, xml_obj, data);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string Session::send_iq (const XmlObject& iq, iq_callback_t cb, unsigned timeout)
+{
+    return send_iq (XmlObject(iq), cb, timeout);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string Session::send_iq (XmlObject&& iq, iq_callback_t cb, unsigned timeout)
+{
+    XmlObject request (std::move(iq));
+    string id = request.get_attribute ("id");
+    if (id.empty()) {
+        id = Stanza::make_id ();
+        request.set_attribute ("id", id);
+    }
+
+    if (state==SessionState::closed || state==SessionState::closing) {
+        uxmpp_log_debug (log_unit, "Can't send IQ request in state ", to_string(state));
+        return "";
+    }
+
+    // Add the request before sending it, the response may
+    // be received before send_stanza returns.
+    //
+    bool added = iq_correlator.add (id, Jid(request.get_attribute("to")), [this, cb](IqStanza* response){
+            if (cb)
+                cb (*this, response);
+        }, timeout);
+    if (!added)
+        return "";
+    send_stanza (request);
+
+    return id;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool Session::cancel_iq (const std::string& id)
+{
+    return iq_correlator.cancel (id);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::future<IqResult> Session::iq (IqType type,
+                                   const Jid& to,
+                                   const XmlObject& payload,
+                                   unsigned timeout)
+{
+    auto promise = make_shared<std::promise<IqResult>> ();
+    auto future = promise->get_future ();
+
+    IqStanza request (type, to, get_jid());
+    request.add_node (payload);
+    string id = send_iq (request, [promise](Session& session, IqStanza* response){
+            promise->set_value (IqResult(response));
+        }, timeout);
+    if (id.empty())
+        promise->set_value (IqResult());
+
+    return future;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Session::iq_all (const std::vector<XmlObject>& requests,
+                      iq_all_callback_t cb,
+                      unsigned timeout)
+{
+    struct iq_all_state_t {
+        std::mutex mutex;
+        std::vector<IqResult> results;
+        size_t remaining;
+    };
+    auto state = make_shared<iq_all_state_t> ();
+    state->results.resize (requests.size());
+    state->remaining = requests.size ();
+
+    // Store one result and call the callback after the last one
+    //
+    auto done = [state, cb](Session& session, size_t index, IqStanza* response){
+        std::unique_lock<std::mutex> lock (state->mutex);
+        state->results[index] = IqResult (response);
+        if (--state->remaining == 0) {
+            lock.unlock ();
+            if (cb)
+                cb (session, state->results);
+        }
+    };
+
+    if (requests.empty()) {
+        if (cb)
+            cb (*this, state->results);
+        return;
+    }
+    for (size_t i=0; i<requests.size(); ++i) {
+        string id = send_iq (requests[i], [done, i](Session& session, IqStanza* response){
+                done (session, i, response);
+            }, timeout);
+        if (id.empty())
+            done (*this, i, nullptr);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Session::resume (const std::string& resumed_jid)
+{
+    if (state != SessionState::negotiating) {
+        uxmpp_log_warning (log_unit, "Unable to resume session in state ", to_string(state));
+        return;
+    }
+    jid     = resumed_jid;
+    resumed = true;
+    change_state (SessionState::bound);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool Session::is_resumed () const
+{
+    return resumed;
 }
 
 
@@ -434,15 +788,28 @@ std::string Session::get_stream_from_attr () const
 //------------------------------------------------------------------------------
 void Session::register_module (XmppModule& module)
 {
-    for (XmppModule* m : xmpp_modules) {
-        if (&module == m) {
-            uxmpp_log_info (log_unit,
-                            string("Not registering XMPP module '") +
-                            module.get_name() + "' - already registered");
-            return;
+    auto metric = Metrics::get_instance().add (MetricType::summary,
+                                               "uxmpp_session_module_seconds",
+                                               "Time spent in XMPP modules processing XML objects.",
+                                               string("module=\"") + module.get_name() + "\"",
+                                               1e-9);
+    {
+        lock_guard<std::mutex> lock (modules_mutex);
+        for (XmppModule* m : xmpp_modules) {
+            if (&module == m) {
+                uxmpp_log_info (log_unit,
+                                string("Not registering XMPP module '") +
+                                module.get_name() + "' - already registered");
+                return;
+            }
         }
+        xmpp_modules.push_back (&module);
+        auto entries = module_entries ? make_shared<vector<ModuleEntry>>(*module_entries)
+                                      : make_shared<vector<ModuleEntry>>();
+        entries->push_back (ModuleEntry{&module, metric});
+        module_entries = entries;
+        ++modules_version;
     }
-    xmpp_modules.push_back (&module);
     module.module_registered (*this);
     uxmpp_log_debug (log_unit, string("XMPP module '") + module.get_name() + "' - registered");
 }
@@ -452,17 +819,32 @@ void Session::register_module (XmppModule& module)
 //------------------------------------------------------------------------------
 void Session::unregister_module (XmppModule& module)
 {
-    for (auto i=xmpp_modules.begin(); i!=xmpp_modules.end(); ++i) {
-        if (*i == &module) {
-            xmpp_modules.erase (i);
-            module.module_unregistered (*this);
-            uxmpp_log_debug (log_unit, string("XMPP module '") + module.get_name() + "' - unregistered");
-            return;
+    bool found = false;
+    {
+        lock_guard<std::mutex> lock (modules_mutex);
+        for (auto i=xmpp_modules.begin(); i!=xmpp_modules.end(); ++i) {
+            if (*i == &module) {
+                xmpp_modules.erase (i);
+                auto entries = make_shared<vector<ModuleEntry>> ();
+                for (auto& entry : *module_entries) {
+                    if (entry.module != &module)
+                        entries->push_back (entry);
+                }
+                module_entries = entries;
+                ++modules_version;
+                found = true;
+                break;
+            }
         }
     }
-    uxmpp_log_info (log_unit,
-                    string("Not unregistering XMPP module '") +
-                    module.get_name() + "' - not registered");
+    if (!found) {
+        uxmpp_log_info (log_unit,
+                        string("Not unregistering XMPP module '") +
+                        module.get_name() + "' - not registered");
+        return;
+    }
+    module.module_unregistered (*this);
+    uxmpp_log_debug (log_unit, string("XMPP module '") + module.get_name() + "' - unregistered");
 }
 
 
@@ -496,12 +878,44 @@ void Session::reset ()
 {
     xs.reset ();
     features.clear ();
+    bind_sent = false;
     stream_xml_obj.set_from (cfg.user_id);
     stream_xml_obj.set_part (XmlObjPart::start);
     xs.write (stream_xml_obj);
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool Session::reset_and_bind ()
+{
+    bool pipeline = cfg.pipeline_bind && get_state()==SessionState::negotiating;
+    for (auto module=xmpp_modules.begin(); pipeline && module!=xmpp_modules.end(); ++module) {
+        if (!(*module)->allow_pipelined_bind(*this)) {
+            uxmpp_log_debug (log_unit, "Module ", (*module)->get_name(), " doesn't allow a pipelined bind");
+            pipeline = false;
+        }
+    }
+    if (!pipeline) {
+        reset ();
+        return false;
+    }
+
+    // One write, so the server gets both in the same segment
+    //
+    uxmpp_log_debug (log_unit, "Send bind together with the stream restart");
+    xs.reset ();
+    features.clear ();
+    stream_xml_obj.set_from (cfg.user_id);
+    stream_xml_obj.set_part (XmlObjPart::start);
+    if (xs.is_framed())
+        bind_sent = xs.write(stream_xml_obj) && xs.write(make_bind_request());
+    else
+        bind_sent = xs.write_raw (xs.serialize(stream_xml_obj) + xs.serialize(make_bind_request()));
+    return bind_sent;
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void Session::set_app_error (const std::string& app_error, const std::string& text)
@@ -617,6 +1031,13 @@ bool Session::process_xml_object (Session& session, XmlObject& xml_obj)
                 xs.stop ();
             return true;
         }
+        //
+        // Check the IQ request deadlines
+        //
+        else if (xml_obj.get_attribute("id") == "iq_timeout") {
+            iq_correlator.expire ();
+            return true;
+        }
     }
 
     //
@@ -747,4 +1168,56 @@ static std::vector<IpHostAddr> get_server_address_list (const SessionConfig& cfg
 }
 
 
+//------------------------------------------------------------------------------
+// Split a ws:// or wss:// URL.
+//------------------------------------------------------------------------------
+static bool parse_websocket_url (const std::string& url,
+                                 std::string& authority,
+                                 std::string& host,
+                                 uint16_t& port,
+                                 std::string& path,
+                                 bool& secure)
+{
+    string rest;
+    if (url.compare(0, 6, "wss://") == 0) {
+        secure = true;
+        rest = url.substr (6);
+    }
+    else if (url.compare(0, 5, "ws://") == 0) {
+        secure = false;
+        rest = url.substr (5);
+    }else{
+        return false;
+    }
+
+    auto slash = rest.find ('/');
+    authority = rest.substr (0, slash);
+    path = slash==string::npos ? "/" : rest.substr (slash);
+    port = secure ? 443 : 80;
+
+    string port_str;
+    if (!authority.empty() && authority[0] == '[') {
+        // IPv6 address
+        auto end = authority.find (']');
+        if (end == string::npos)
+            return false;
+        host = authority.substr (1, end-1);
+        if (end+1 < authority.size()) {
+            if (authority[end+1] != ':')
+                return false;
+            port_str = authority.substr (end+2);
+        }
+    }else{
+        auto colon = authority.find (':');
+        host = authority.substr (0, colon);
+        if (colon != string::npos)
+            port_str = authority.substr (colon+1);
+    }
+    if (!port_str.empty())
+        port = atoi (port_str.c_str());
+
+    return !host.empty() && port != 0;
+}
+
+
 UXMPP_END_NAMESPACE1
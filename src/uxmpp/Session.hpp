@@ -27,15 +27,32 @@
 #include <uxmpp/SessionConfig.hpp>
 #include <uxmpp/SessionListener.hpp>
 #include <uxmpp/StreamError.hpp>
+#include <uxmpp/IqStanza.hpp>
+#include <uxmpp/IqCorrelator.hpp>
+#include <uxmpp/IqResult.hpp>
 #include <uxmpp/Jid.hpp>
+#include <uxmpp/Metrics.hpp>
 #include <uxmpp/io/SocketConnection.hpp>
+#include <uxmpp/io/WebSocketConnection.hpp>
 
 #include <string>
 #include <list>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <chrono>
 
 
 namespace uxmpp {
 
+
+/**
+ * Default number of milliseconds to wait for the response to an IQ request.
+ */
+#define UXMPP_DEFAULT_IQ_TIMEOUT 30000
+
+
     // Forward declarations
     class Session;
 
@@ -46,6 +63,22 @@ namespace uxmpp {
     class Session : XmppModule {
     public:
 
+        /**
+         * Called with the response to an IQ request sent by send_iq().
+         * @param session The session object.
+         * @param response The 'result' or 'error' response, or <code>nullptr</code>
+         *                 if no response was received before the timeout or if
+         *                 the session was closed.
+         */
+        typedef std::function<void (Session& session, IqStanza* response)> iq_callback_t;
+
+        /**
+         * Called when all IQ requests sent by iq_all() are done.
+         * @param session The session object.
+         * @param results One result for each request, in the same order as the requests.
+         */
+        typedef std::function<void (Session& session, std::vector<IqResult>& results)> iq_all_callback_t;
+
         /**
          * Default constructor.
          */
@@ -123,6 +156,86 @@ namespace uxmpp {
          */
         void send_stanza (const XmlObject& xml_obj);
 
+        /**
+         * Send an IQ request and call a callback with the response.
+         * The response is handled before any registered module sees it.
+         * Pending requests are aborted when the session is closed.
+         * Responses and timeouts are both delivered on the thread that
+         * handles received XML objects.
+         * @param iq An IQ stanza of type 'get' or 'set'.
+         *           If it has no 'id' attribute, one is generated.
+         * @param cb Called when the response is received or the request times out.
+         * @param timeout Milliseconds to wait for a response.
+         * @return The id of the IQ request, or an empty string if the request
+         *         wasn't sent because the session is closing or a request
+         *         with the same id is pending. The callback is not called
+         *         in that case.
+         */
+        std::string send_iq (const XmlObject& iq, iq_callback_t cb, unsigned timeout=UXMPP_DEFAULT_IQ_TIMEOUT);
+
+        /**
+         * Send an IQ request and call a callback with the response.
+         * The request is moved instead of copied, for requests with
+         * a large payload.
+         */
+        std::string send_iq (XmlObject&& iq, iq_callback_t cb, unsigned timeout=UXMPP_DEFAULT_IQ_TIMEOUT);
+
+        /**
+         * Stop waiting for the response to an IQ request sent by send_iq().
+         * The callback will not be called.
+         * @return true if the request was waiting for a response.
+         */
+        bool cancel_iq (const std::string& id);
+
+        /**
+         * Send an IQ request and return a future for the result.
+         * This lets an application thread write a sequence of requests
+         * as plain sequential code:
+         * <pre>
+         * auto info  = session.iq (IqType::get, jid, XmlObject("query", disco_info_ns)).get ();
+         * auto vcard = session.iq (IqType::get, jid, XmlObject("vCard", "vcard-temp")).get ();
+         * </pre>
+         * The future is ready when the response is received, the request
+         * times out, or the session is closed. Don't wait for the future
+         * in a session callback or module, that would block the thread
+         * that delivers the response. Use send_iq() or iq_all() there.
+         * @param type The IQ type, 'get' or 'set'.
+         * @param to The entity to send the request to. Empty for our own account.
+         * @param payload The child element of the request.
+         * @param timeout Milliseconds to wait for a response.
+         */
+        std::future<IqResult> iq (IqType type,
+                                  const Jid& to,
+                                  const XmlObject& payload,
+                                  unsigned timeout=UXMPP_DEFAULT_IQ_TIMEOUT);
+
+        /**
+         * Send a number of IQ requests at once and call a callback when
+         * all of them are done. No thread is blocked while waiting, so
+         * this can be used anywhere, including in session callbacks.
+         * @param requests IQ stanzas of type 'get' or 'set'.
+         * @param cb Called once with the results in the same order as the requests.
+         * @param timeout Milliseconds to wait for each response.
+         */
+        void iq_all (const std::vector<XmlObject>& requests,
+                     iq_all_callback_t cb,
+                     unsigned timeout=UXMPP_DEFAULT_IQ_TIMEOUT);
+
+        /**
+         * Enter state SessionState::bound using the resource binding
+         * of a previous stream instead of binding a new resource.
+         * This is used by stream management when a stream is resumed.
+         * @param resumed_jid The full JID bound in the previous stream.
+         */
+        void resume (const std::string& resumed_jid);
+
+        /**
+         * Return true if the session was bound by resuming a previous
+         * stream. Modules may use this to skip work already done in
+         * the previous stream.
+         */
+        bool is_resumed () const;
+
         /**
          * Return the session id.
          */
@@ -154,9 +267,20 @@ namespace uxmpp {
 
         /**
          * Get the list of pointers to registered XMPP modules.
+         * The list is not locked, only use it on the thread
+         * that handles received XML objects.
          */
         std::list<XmppModule*>& get_modules ();
 
+        /**
+         * Return a number that changes each time an XMPP module
+         * is registered or unregistered. Modules that keep pointers
+         * to other modules use it to know when to look them up again.
+         */
+        unsigned get_modules_version () const {
+            return modules_version;
+        }
+
         /**
          * Return a reference to the underlaying XML stream.
          */
@@ -172,6 +296,28 @@ namespace uxmpp {
          */
         void reset ();
 
+        /**
+         * Restart the stream after a successful authentication, like reset().
+         * If SessionConfig::pipeline_bind is set and all registered modules
+         * allow it, see XmppModule::allow_pipelined_bind(), the resource
+         * binding request is sent in the same write as the 'stream' start
+         * tag instead of waiting for the stream features.
+         * @return True if the resource binding request was sent.
+         */
+        bool reset_and_bind ();
+
+        /**
+         * Return the time from the start of the connection attempt
+         * until the session was bound, or 0 if it isn't bound yet.
+         */
+        std::chrono::nanoseconds get_login_time () const;
+
+        /**
+         * Return the number of round trips from connect until the
+         * session was bound, see XmlStream::get_round_trips().
+         */
+        unsigned get_login_round_trips () const;
+
         /**
          * Set an application specific error condition.
          */
@@ -195,8 +341,9 @@ namespace uxmpp {
 
         /**
          * IP socket connection.
+         * This is a plain TCP connection unless SessionConfig::websocket_url is set.
          */
-        io::SocketConnection socket;
+        io::WebSocketConnection socket;
 
         /**
          * An XML stream.
@@ -248,11 +395,76 @@ namespace uxmpp {
          */
         std::string jid;
 
+        /**
+         * True if the session was bound by resuming a previous stream.
+         */
+        bool resumed;
+
+        /**
+         * True if the resource binding request is sent in this stream.
+         */
+        bool bind_sent;
+
+        /**
+         * Start of the connection attempt, from Tracer::now().
+         */
+        int64_t login_start;
+
+        /**
+         * Nanoseconds from login_start until the session was bound.
+         */
+        int64_t login_time;
+
+        /**
+         * Round trips from connect until the session was bound.
+         */
+        unsigned login_round_trips;
+
+        /**
+         * Return the resource binding request.
+         */
+        IqStanza make_bind_request () const;
+
+        /**
+         * Keeps stanzas and the on_stanza_sent notifications in the same order.
+         */
+        std::mutex tx_mutex;
+
+        /**
+         * IQ requests waiting for a response.
+         */
+        IqCorrelator iq_correlator;
+
+        /**
+         * An XMPP module and the time spent in it.
+         */
+        struct ModuleEntry {
+            XmppModule* module;
+            std::shared_ptr<Metric> metric;
+        };
+
+        /**
+         * Protects xmpp_modules and module_entries.
+         */
+        std::mutex modules_mutex;
+
         /**
          * Registered XMPP modules.
          */
         std::list<XmppModule*> xmpp_modules;
 
+        /**
+         * The registered modules used when dispatching received XML objects.
+         * Replaced, never modified, when a module is registered or unregistered,
+         * so a dispatch in progress keeps a consistent list.
+         */
+        std::shared_ptr<const std::vector<ModuleEntry>> module_entries;
+
+        /**
+         * Incremented when a module is registered or unregistered.
+         */
+        std::atomic<unsigned> modules_version;
+
         /**
          * Called whan an XML object is received.
          * @return Return true if this XML object was processed and no further work should be done.
@@ -260,9 +472,24 @@ namespace uxmpp {
         virtual bool process_xml_object (Session& session, XmlObject& xml_obj) override;
 
         /**
-         *
+         * Called for each XML object received on the XML stream.
+         * Stanzas are passed to listeners and IQ responses to send_iq()
+         * callbacks before the registered modules get the XML object.
+         */
+        virtual void on_rx_xml_obj (XmlStream& stream, XmlObject& xml_obj);
+
+        /**
+         * Initialize the 'stream' start tag sent to the server
+         * when the XML stream is started.
+         */
+        virtual void init_stream_xml_obj ();
+
+        /**
+         * Enable TLS if needed and perform the WebSocket opening handshake
+         * on the connected socket.
+         * @return True if the socket is ready for RFC 7395 framing.
          */
-        void on_rx_xml_obj (XmlStream& stream, XmlObject& xml_obj);
+        bool start_websocket (const std::string& host, const std::string& path, bool secure);
 
     private:
     };
@@ -40,7 +40,9 @@ SessionConfig::SessionConfig ()
     server      {""},
     port        {0},
     protocol    {AddrProto::tcp},
-    disable_srv {false}
+    disable_srv {false},
+    websocket_deflate {true},
+    pipeline_bind {false}
 {
 }
 
@@ -21,6 +21,7 @@
 
 #include <uxmpp/types.hpp>
 #include <uxmpp/io/IpHostAddr.hpp>
+#include <uxmpp/io/TlsConfig.hpp>
 #include <string>
 
 
@@ -86,6 +87,35 @@ namespace uxmpp {
          * Default is 'false' to use DNS SRV queries.
          */
         bool disable_srv;
+
+        /**
+         * Connect using XMPP over WebSocket (RFC 7395) instead of TCP.
+         * For example "wss://example.com/xmpp-websocket", "ws://" for
+         * an unencrypted connection. The host and port in the URL are
+         * used instead of 'server' and 'port', and no DNS SRV lookup is done.
+         * Default is an empty string to use TCP.
+         */
+        std::string websocket_url;
+
+        /**
+         * Offer the permessage-deflate extension (RFC 7692) when connecting
+         * using WebSocket. Default is 'true'.
+         */
+        bool websocket_deflate;
+
+        /**
+         * TLS configuration used for "wss://" URLs.
+         */
+        uxmpp::io::TlsConfig websocket_tls;
+
+        /**
+         * Send the resource binding request together with the stream restart
+         * after a successful authentication, instead of waiting for the stream
+         * features. This saves one round trip when logging in. RFC 6120 says
+         * the client should wait for the features, but servers that handle
+         * the stream in order accept it. Default is 'false'.
+         */
+        bool pipeline_bind;
     };
 
 
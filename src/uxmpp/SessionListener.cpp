@@ -32,5 +32,19 @@ void SessionListener::on_features (Session& session, std::list<XmlObject>& featu
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void SessionListener::on_stanza_sent (Session& session, const XmlObject& stanza, const std::string& data)
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void SessionListener::on_stanza_received (Session& session, XmlObject& stanza)
+{
+}
+
+
 
 UXMPP_END_NAMESPACE1
@@ -23,6 +23,7 @@
 #include <uxmpp/SessionState.hpp>
 #include <uxmpp/XmlObject.hpp>
 #include <list>
+#include <string>
 
 
 namespace uxmpp {
@@ -58,6 +59,21 @@ namespace uxmpp {
          * Called when feature list updated.
          */
         virtual void on_features (Session& session, std::list<XmlObject>& features);
+
+        /**
+         * Called when a stanza has been written to the XML stream
+         * by Session::send_stanza.
+         * @param session The session.
+         * @param stanza The stanza.
+         * @param data The stanza serialized as it was written to the stream.
+         */
+        virtual void on_stanza_sent (Session& session, const XmlObject& stanza, const std::string& data);
+
+        /**
+         * Called when a stanza is received, before it is
+         * handled by the registered XMPP modules.
+         */
+        virtual void on_stanza_received (Session& session, XmlObject& stanza);
     };
 
 
@@ -0,0 +1,258 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/Tracer.hpp>
+#include <uxmpp/Logger.hpp>
+#include <uxmpp/utils.hpp>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <cstdio>
+#include <unistd.h>
+
+UXMPP_START_NAMESPACE1(uxmpp)
+
+
+using namespace std;
+
+
+static const string log_unit {"Tracer"};
+
+static constexpr size_t default_buffer_size = 65536;
+
+Tracer* Tracer::instance = nullptr;
+
+static thread_local uint64_t current_trace_id {0};
+static thread_local unsigned long thread_id {0};
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static void json_escape (ostream& os, const string& str)
+{
+    for (auto c : str) {
+        switch (c) {
+        case '"':
+            os << "\\\"";
+            break;
+        case '\\':
+            os << "\\\\";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                os << "\\u" << hex << setw(4) << setfill('0') << static_cast<int>(c)
+                   << dec << setfill(' ');
+            }else{
+                os << c;
+            }
+            break;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Chrome trace timestamps are in microseconds.
+//------------------------------------------------------------------------------
+static void json_usec (ostream& os, int64_t nsec)
+{
+    os << (nsec / 1000) << '.' << setw(3) << setfill('0') << (nsec % 1000) << setfill(' ');
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+Tracer::Tracer ()
+    :
+    sample_interval {0},
+    sample_count    {0},
+    events          (default_buffer_size),
+    next            {0},
+    wrapped         {false}
+{
+}
+
+
+//------------------------------------------------------------------------------
+// The instance is never deleted, like the Metrics instance.
+//------------------------------------------------------------------------------
+Tracer& Tracer::get_instance ()
+{
+    static std::mutex instance_mutex;
+    if (instance == nullptr) {
+        lock_guard<std::mutex> lock (instance_mutex);
+        if (instance == nullptr)
+            instance = new Tracer;
+    }
+    return *instance;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+uint64_t Tracer::get_current ()
+{
+    return current_trace_id;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Tracer::set_current (uint64_t trace_id)
+{
+    current_trace_id = trace_id;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Tracer::set_buffer_size (size_t size)
+{
+    lock_guard<std::mutex> lock (mutex);
+    events.clear ();
+    events.resize (size ? size : 1);
+    next    = 0;
+    wrapped = false;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Tracer::span (const char* name, int64_t start, int64_t end,
+                   uint64_t trace_id, const std::string& detail)
+{
+    add ('X', name, start, end, trace_id, detail);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Tracer::stanza_span (const char* name, int64_t start, int64_t end,
+                          uint64_t trace_id, const std::string& detail)
+{
+    add ('a', name, start, end, trace_id, detail);
+}
+
+
+//------------------------------------------------------------------------------
+// Only sampled stanzas get here, so a mutex is cheap enough.
+//------------------------------------------------------------------------------
+void Tracer::add (char phase, const char* name, int64_t start, int64_t end,
+                  uint64_t trace_id, const std::string& detail)
+{
+    if (thread_id == 0)
+        thread_id = get_thread_id ();
+
+    lock_guard<std::mutex> lock (mutex);
+    auto& event = events[next];
+    event.phase    = phase;
+    event.name     = name;
+    event.detail   = detail;
+    event.trace_id = trace_id;
+    event.start    = start;
+    event.duration = end - start;
+    event.tid      = thread_id;
+    if (++next == events.size()) {
+        next    = 0;
+        wrapped = true;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Tracer::clear ()
+{
+    lock_guard<std::mutex> lock (mutex);
+    next    = 0;
+    wrapped = false;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+size_t Tracer::size ()
+{
+    lock_guard<std::mutex> lock (mutex);
+    return wrapped ? events.size() : next;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string Tracer::to_json ()
+{
+    ostringstream os;
+    auto pid = getpid ();
+
+    lock_guard<std::mutex> lock (mutex);
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    size_t count = wrapped ? events.size() : next;
+    size_t pos   = wrapped ? next : 0;
+    for (size_t i=0; i<count; ++i, pos=(pos+1)%events.size()) {
+        auto& event = events[pos];
+        if (event.phase == 'X') {
+            os << (first ? "\n" : ",\n");
+            os << "{\"ph\":\"X\",\"cat\":\"uxmpp\",\"name\":\"" << event.name << "\",\"pid\":" << pid
+               << ",\"tid\":" << event.tid << ",\"ts\":";
+            json_usec (os, event.start);
+            os << ",\"dur\":";
+            json_usec (os, event.duration);
+            os << ",\"args\":{\"trace_id\":" << event.trace_id << ",\"detail\":\"";
+            json_escape (os, event.detail);
+            os << "\"}}";
+        }else{
+            // A stanza track is an async begin/end pair with the trace id
+            for (char phase : {'b', 'e'}) {
+                os << (first ? "\n" : ",\n");
+                first = false;
+                os << "{\"ph\":\"" << phase << "\",\"cat\":\"stanza\",\"name\":\"" << event.name
+                   << "\",\"id\":" << event.trace_id << ",\"pid\":" << pid << ",\"tid\":" << event.tid
+                   << ",\"ts\":";
+                json_usec (os, phase=='b' ? event.start : event.start+event.duration);
+                if (phase == 'b') {
+                    os << ",\"args\":{\"detail\":\"";
+                    json_escape (os, event.detail);
+                    os << "\"}";
+                }
+                os << "}";
+            }
+        }
+        first = false;
+    }
+    os << "\n]}\n";
+    return os.str ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool Tracer::write_file (const std::string& file)
+{
+    ofstream out (file, ios::trunc);
+    out << to_json ();
+    if (!out) {
+        uxmpp_log_warning (log_unit, "Unable to write ", file);
+        return false;
+    }
+    return true;
+}
+
+
+UXMPP_END_NAMESPACE1
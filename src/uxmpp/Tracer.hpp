@@ -0,0 +1,196 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_TRACER_HPP
+#define UXMPP_TRACER_HPP
+
+#include <uxmpp/types.hpp>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+
+namespace uxmpp {
+
+
+    /**
+     * A singleton that collects sampled per-stanza trace events
+     * in an in-memory ring buffer.
+     * <p/>
+     * When sampling is enabled, every n:th stanza received or sent
+     * on an XmlStream is traced. A received stanza gets the spans
+     * <code>parse</code> (socket read to parser emit), <code>queue</code>
+     * (waiting in the RX queue) and <code>dispatch</code> (the RX callback),
+     * and a span for each XMPP module that gets it. A sent stanza gets
+     * <code>serialize</code> (XmlStream::write to queued for writing)
+     * and <code>send</code> (queued to written to the socket).
+     * <p/>
+     * The events can be dumped in the Chrome trace event JSON format,
+     * which can be loaded in Perfetto or chrome://tracing.
+     * Stanzas that are not sampled only cost an atomic load.
+     */
+    class Tracer {
+    public:
+        /**
+         * Return the singleton instance.
+         */
+        static Tracer& get_instance ();
+
+        /**
+         * Return the current time in nanoseconds of the steady clock.
+         */
+        static int64_t now () {
+            return std::chrono::duration_cast<std::chrono::nanoseconds> (
+                std::chrono::steady_clock::now().time_since_epoch()).count ();
+        }
+
+        /**
+         * Return the trace id of the stanza currently
+         * handled by the calling thread, or 0.
+         */
+        static uint64_t get_current ();
+
+        /**
+         * Set the trace id of the stanza currently
+         * handled by the calling thread.
+         */
+        static void set_current (uint64_t trace_id);
+
+        /**
+         * Set the sampling interval.
+         * @param interval Trace every interval:th stanza, 0 disables tracing.
+         */
+        void set_sample_interval (unsigned interval) {
+            sample_interval.store (interval, std::memory_order_relaxed);
+        }
+
+        /**
+         * Return the sampling interval.
+         */
+        unsigned get_sample_interval () const {
+            return sample_interval.load (std::memory_order_relaxed);
+        }
+
+        /**
+         * Check if tracing is enabled.
+         */
+        bool is_enabled () const {
+            return get_sample_interval() != 0;
+        }
+
+        /**
+         * Decide if a stanza should be traced.
+         * @return A new trace id, or 0 if the stanza isn't sampled.
+         */
+        uint64_t sample () {
+            auto interval = get_sample_interval ();
+            if (interval == 0)
+                return 0;
+            auto n = sample_count.fetch_add (1, std::memory_order_relaxed) + 1;
+            return (n % interval) ? 0 : n;
+        }
+
+        /**
+         * Set the maximum number of events in the buffer.
+         * When the buffer is full the oldest events are overwritten.
+         * This clears the buffer.
+         */
+        void set_buffer_size (size_t size);
+
+        /**
+         * Add a span on the calling thread.
+         * @param name The span name, must be a string literal.
+         * @param start Start time from now().
+         * @param end End time from now().
+         * @param trace_id The trace id of the stanza.
+         * @param detail Optional detail, like a module name.
+         */
+        void span (const char* name, int64_t start, int64_t end,
+                   uint64_t trace_id, const std::string& detail="");
+
+        /**
+         * Add a span to the track of a stanza.
+         * Spans with the same trace id are shown on the
+         * same track regardless of the thread.
+         * @param name The span name, must be a string literal.
+         * @param start Start time from now().
+         * @param end End time from now().
+         * @param trace_id The trace id of the stanza.
+         * @param detail Optional detail, like the stanza name.
+         */
+        void stanza_span (const char* name, int64_t start, int64_t end,
+                          uint64_t trace_id, const std::string& detail="");
+
+        /**
+         * Remove all events.
+         */
+        void clear ();
+
+        /**
+         * Return the number of events in the buffer.
+         */
+        size_t size ();
+
+        /**
+         * Return the events in the Chrome trace event JSON format.
+         */
+        std::string to_json ();
+
+        /**
+         * Write the events in the Chrome trace event JSON format to a file.
+         * @return false if the file can't be written.
+         */
+        bool write_file (const std::string& file);
+
+
+    private:
+        struct Event {
+            char phase;
+            const char* name;
+            std::string detail;
+            uint64_t trace_id;
+            int64_t start;
+            int64_t duration;
+            unsigned long tid;
+        };
+
+        Tracer ();
+        ~Tracer () = default;
+
+        static Tracer* instance;
+
+        std::atomic<unsigned> sample_interval;
+        std::atomic<uint64_t> sample_count;
+
+        std::mutex mutex;
+        std::vector<Event> events;
+        size_t next;
+        bool wrapped;
+
+        void add (char phase, const char* name, int64_t start, int64_t end,
+                  uint64_t trace_id, const std::string& detail);
+    };
+
+
+}
+
+
+#endif
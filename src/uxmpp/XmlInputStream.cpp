@@ -247,8 +247,9 @@ void XmlInputStream::XmlParseData::normalize_namespace (XmlInputStream::XmlParse
 //------------------------------------------------------------------------------
 XmlInputStream::XmlInputStream (const XmlObject& top_element)
     :
-    parse_data {nullptr},
-    top_node   {top_element}
+    parse_data    {nullptr},
+    top_node      {top_element},
+    reset_pending {false}
 {
     reset ();
 }
@@ -377,7 +378,13 @@ void XmlInputStream::XmlParseData::start_xml_node (void* user_data,
            ")",
            to_string(xml_obj));
 
-    // Normalize namespace
+    // Push the current XML object on the stack
+    //
+    pd->element_stack.push_front (element);
+    TRACE (THIS_FILE, "start_xml_node - pushing element to stack (", element->xml_obj.get_name(), ")");
+
+    // Normalize namespace, after pushing the element since
+    // it may declare the namespace alias it is using.
     //
     normalize_namespace (*pd, xml_obj);
     TRACE (THIS_FILE,
@@ -385,11 +392,6 @@ void XmlInputStream::XmlParseData::start_xml_node (void* user_data,
            xml_obj.get_full_name(),
            ")",
            to_string(xml_obj));
-
-    // Push the current XML object on the stack
-    //
-    pd->element_stack.push_front (element);
-    TRACE (THIS_FILE, "start_xml_node - pushing element to stack (", element->xml_obj.get_name(), ")");
 }
 
 
@@ -496,14 +498,46 @@ void XmlInputStream::XmlParseData::start_stream_element (void* user_data,
 //------------------------------------------------------------------------------
 void XmlInputStream::reset ()
 {
-    std::lock_guard<std::mutex> lock (mutex);
-    free_resources ();
+    // Don't touch the parser while another thread is parsing.
+    //
+    std::unique_lock<std::mutex> lock (mutex);
+    parse_done.wait (lock, [this]{
+            return parser_thread==std::thread::id() || parser_thread==std::this_thread::get_id();
+        });
+
+    // A handler can't reset the parser it is called from,
+    // stop parsing and let parse() do it.
+    //
+    if (parser_thread == std::this_thread::get_id()) {
+        reset_pending = true;
+        XML_StopParser (parse_data->xml_parser, XML_FALSE);
+        return;
+    }
+    reset_parser ();
+}
 
-    parse_data = new XmlParseData;
-    //parse_data->xml_parser = XML_ParserCreateNS (NULL, namespace_delim);
-    parse_data->xml_parser = XML_ParserCreate (NULL);
-    parse_data->error      = false;
-    parse_data->stream     = this;
+
+//------------------------------------------------------------------------------
+// mutex assumed to be locked
+//------------------------------------------------------------------------------
+void XmlInputStream::reset_parser ()
+{
+    if (parse_data == nullptr) {
+        parse_data = new XmlParseData;
+        //parse_data->xml_parser = XML_ParserCreateNS (NULL, namespace_delim);
+        parse_data->xml_parser = XML_ParserCreate (NULL);
+        parse_data->stream     = this;
+    }else{
+        // Reusing the parser saves an allocation of the
+        // parser and its buffers on each stream restart.
+        //
+        while (!parse_data->element_stack.empty()) {
+            delete parse_data->element_stack.front ();
+            parse_data->element_stack.pop_front ();
+        }
+        XML_ParserReset (parse_data->xml_parser, NULL);
+    }
+    parse_data->error = false;
     parse_data->top_element_found = false;
 
     parse_data->default_namespace = "";
@@ -513,6 +547,7 @@ void XmlInputStream::reset ()
     XML_SetElementHandler (parse_data->xml_parser,
                            XmlInputStream::XmlParseData::start_stream_element,
                            NULL);
+    XML_SetCharacterDataHandler (parse_data->xml_parser, NULL);
 }
 
 
@@ -537,31 +572,36 @@ void XmlInputStream::free_resources ()
 
 
 //------------------------------------------------------------------------------
-// Parse a character
+// mutex assumed to be locked
 //------------------------------------------------------------------------------
-XmlInputStream& XmlInputStream::operator<< (const char ch)
+void XmlInputStream::parse (const char* data, size_t size, bool is_final)
 {
-    std::lock_guard<std::mutex> lock (mutex);
-    //std::lock_guard<std::mutex> lock (mutex);
-    //uxmpp_log_trace (THIS_FILE, "RX:\n", input, "\n");
-
     // Ignore incoming data on error.
     //
     if (parse_data->error) {
         //uxmpp_log_debug (THIS_FILE, "Ignore XML input when a parse error has occurred");
-        return *this;
+        return;
     }
 
     // Parse the incoming data
     //
-    if (!XML_Parse(parse_data->xml_parser, &ch, 1, 0)) {
+    parser_thread = std::this_thread::get_id ();
+    auto result = XML_Parse (parse_data->xml_parser, data, size, is_final);
+    parser_thread = std::thread::id ();
+    parse_done.notify_all ();
+    if (reset_pending) {
+        // reset() was called from a handler, the rest of the data is dropped.
+        reset_pending = false;
+        reset_parser ();
+        return;
+    }
+    if (!result) {
         parse_data->error = true;
         uxmpp_log_warning (THIS_FILE, "RX XML parse error");
         while (parse_data && !parse_data->element_stack.empty()) {
             delete parse_data->element_stack.front ();
             parse_data->element_stack.pop_front ();
         }
-
         if (err_func) {
             mutex.unlock ();
             auto err_code = XML_GetErrorCode (parse_data->xml_parser);
@@ -569,7 +609,16 @@ XmlInputStream& XmlInputStream::operator<< (const char ch)
             mutex.lock ();
         }
     }
+}
+
 
+//------------------------------------------------------------------------------
+// Parse a character
+//------------------------------------------------------------------------------
+XmlInputStream& XmlInputStream::operator<< (const char ch)
+{
+    std::lock_guard<std::mutex> lock (mutex);
+    parse (&ch, 1, false);
     return *this;
 }
 
@@ -580,34 +629,32 @@ XmlInputStream& XmlInputStream::operator<< (const char ch)
 XmlInputStream& XmlInputStream::operator<< (const std::string& input)
 {
     std::lock_guard<std::mutex> lock (mutex);
-    //std::lock_guard<std::mutex> lock (mutex);
     //uxmpp_log_trace (THIS_FILE, "RX:\n", input, "\n");
+    parse (input.c_str(), input.length(), false);
+    return *this;
+}
 
-    // Ignore incoming data on error.
-    //
-    if (parse_data->error) {
-        //uxmpp_log_debug (THIS_FILE, "Ignore XML input when a parse error has occurred");
-        return *this;
-    }
 
-    // Parse the incoming data
+//------------------------------------------------------------------------------
+// Parse a complete XML document
+//------------------------------------------------------------------------------
+void XmlInputStream::parse_document (const std::string& document)
+{
+    std::lock_guard<std::mutex> lock (mutex);
+    if (parse_data->error)
+        return;
+
+    // Reuse the parser, and skip looking for the top-level
+    // element since the document itself is the XML object.
     //
-    if (!XML_Parse(parse_data->xml_parser, input.c_str(), input.length(), 0)) {
-        parse_data->error = true;
-        uxmpp_log_warning (THIS_FILE, "RX XML parse error");
-        while (parse_data && !parse_data->element_stack.empty()) {
-            delete parse_data->element_stack.front ();
-            parse_data->element_stack.pop_front ();
-        }
-        if (err_func) {
-            mutex.unlock ();
-            auto err_code = XML_GetErrorCode (parse_data->xml_parser);
-            err_func (*this, err_code, string(XML_ErrorString(err_code)));
-            mutex.lock ();
-        }
-    }
+    XML_ParserReset (parse_data->xml_parser, NULL);
+    XML_SetUserData (parse_data->xml_parser, parse_data);
+    XML_SetElementHandler (parse_data->xml_parser,
+                           XmlInputStream::XmlParseData::start_xml_node,
+                           XmlInputStream::XmlParseData::end_xml_node);
+    XML_SetCharacterDataHandler (parse_data->xml_parser, XmlInputStream::XmlParseData::xml_character_data);
 
-    return *this;
+    parse (document.c_str(), document.length(), true);
 }
 
 
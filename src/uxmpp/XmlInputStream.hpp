@@ -22,6 +22,9 @@
 #include <uxmpp/types.hpp>
 #include <uxmpp/XmlObject.hpp>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
 
 
 namespace uxmpp {
@@ -78,6 +81,9 @@ namespace uxmpp {
          * Reset the stream.
          * This will reset the XML parser to the same state
          * as when the stream was originally created.
+         * The expat parser is reused, not recreated. If called from
+         * the XML object handler, parsing stops and the reset is done
+         * when the parser returns.
          */
         void reset ();
 
@@ -96,6 +102,17 @@ namespace uxmpp {
          */
         XmlInputStream& operator<< (const XmlObject& xml_obj);
 
+        /**
+         * Parse a complete XML document.
+         * This is used when the XML objects aren't sent in one continuous
+         * XML stream but one at a time, like XMPP over WebSocket (RFC 7395).
+         * The root element of the document is passed to the XML object
+         * handler. No top-level element is expected, and the parser isn't
+         * recreated for each document.
+         * @param document A complete XML document.
+         */
+        void parse_document (const std::string& document);
+
 
     private:
 
@@ -109,6 +126,18 @@ namespace uxmpp {
          */
         void free_resources ();
 
+        /**
+         * Reset the parser, or create it the first time.
+         * mutex assumed to be locked.
+         */
+        void reset_parser ();
+
+        /**
+         * Feed data to the parser and handle parse errors.
+         * mutex assumed to be locked.
+         */
+        void parse (const char* data, size_t size, bool is_final);
+
         /**
          * Callback for incoming XML object.
          */
@@ -130,6 +159,18 @@ namespace uxmpp {
         XmlObject top_node;
 
         std::mutex mutex;
+
+        /**
+         * The mutex is released while callbacks are called during
+         * parsing. Used by reset() to wait until parsing is done.
+         */
+        std::thread::id parser_thread;
+        std::condition_variable parse_done;
+
+        /**
+         * Set when reset() is called from the XML object handler.
+         */
+        bool reset_pending;
     };
 
 }
@@ -31,37 +31,49 @@ using namespace std;
 
 
 //------------------------------------------------------------------------------
+// Write a string with XML special characters escaped. Text without
+// special characters, like base64 data, is written in one piece.
 //------------------------------------------------------------------------------
-static string xml_escape (const string& str)
+static void write_escaped (ostream& os, const string& str)
 {
-    stringstream ss;
-
-    for (auto c : str) {
-        switch (c) {
+    static const char* special = "&<>'\"";
+    size_t start = 0;
+    for (auto pos=str.find_first_of(special); pos!=string::npos; pos=str.find_first_of(special, start)) {
+        os.write (str.data()+start, pos-start);
+        switch (str[pos]) {
         case '&':
-            ss << "&amp;";
+            os << "&amp;";
             break;
 
         case '<':
-            ss << "&lt;";
+            os << "&lt;";
             break;
 
         case '>':
-            ss << "&gt;";
+            os << "&gt;";
             break;
 
         case '\'':
-            ss << "&apos;";
-            break;
-
-        case '\"':
-            ss << "&quot;";
+            os << "&apos;";
             break;
 
         default:
-            ss << c;
+            os << "&quot;";
         }
+        start = pos + 1;
     }
+    os.write (str.data()+start, str.size()-start);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static string xml_escape (const string& str)
+{
+    if (str.find_first_of("&<>'\"") == string::npos)
+        return str;
+    stringstream ss;
+    write_escaped (ss, str);
     return ss.str ();
 }
 
@@ -161,7 +173,7 @@ std::string to_string (const XmlObject& xml_obj, bool pretty, const std::string&
 
     // Print the child nodes.
     //
-    for (auto node : xml_obj.nodes) {
+    for (auto& node : xml_obj.nodes) {
         //
         // Recursion... gotta love it!
         //
@@ -177,7 +189,7 @@ std::string to_string (const XmlObject& xml_obj, bool pretty, const std::string&
 
     // Print the content.
     //
-    ss << xml_escape(xml_obj.content);
+    write_escaped (ss, xml_obj.content);
 
     // Print the end tag.
     //
@@ -18,6 +18,9 @@
  */
 #include <uxmpp/Logger.hpp>
 #include <uxmpp/XmlStream.hpp>
+#include <uxmpp/xml/names.hpp>
+#include <cstring>
+#include <atomic>
 
 
 #define THIS_FILE "XmlStream"
@@ -41,16 +44,44 @@ using namespace std;
 using namespace uxmpp::io;
 
 
+static std::atomic<unsigned> stream_seq {0};
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 XmlStream::XmlStream (const XmlObject& top_element)
     :
     top_node {top_element},
     running {false},
+    rx_eof {false},
+    rx_read_time {0},
+    tx_since_rx {false},
+    round_trips {0},
+    rx_callbacks {0},
     xml_istream (top_element),
     rx_conn {nullptr},
-    tx_conn {nullptr}
+    tx_conn {nullptr},
+    framed  {false}
 {
+    // Each stream has its own set of metrics
+    //
+    auto& metrics = Metrics::get_instance ();
+    string labels = "stream=\"" + std::to_string(++stream_seq) + "\"";
+    rx_bytes_metric     = metrics.add (MetricType::counter, "uxmpp_xmlstream_rx_bytes_total",
+                                       "Bytes received on the XML stream.", labels);
+    tx_bytes_metric     = metrics.add (MetricType::counter, "uxmpp_xmlstream_tx_bytes_total",
+                                       "Bytes sent on the XML stream.", labels);
+    rx_stanzas_metric   = metrics.add (MetricType::counter, "uxmpp_xmlstream_rx_stanzas_total",
+                                       "XML objects received on the XML stream.", labels);
+    tx_stanzas_metric   = metrics.add (MetricType::counter, "uxmpp_xmlstream_tx_stanzas_total",
+                                       "XML objects sent on the XML stream.", labels);
+    rx_queue_metric     = metrics.add (MetricType::gauge, "uxmpp_xmlstream_rx_queue_depth",
+                                       "XML objects waiting to be passed to the RX callback.", labels);
+    tx_buffers_metric   = metrics.add (MetricType::gauge, "uxmpp_xmlstream_tx_buffers",
+                                       "Outstanding TX buffers.", labels);
+    parse_errors_metric = metrics.add (MetricType::counter, "uxmpp_xmlstream_parse_errors_total",
+                                       "XML parse errors on the XML stream.", labels);
+
     // Handler for incoming XML objects
     //
     xml_istream.set_xml_handler ([this](XmlInputStream& stream, XmlObject& xml_obj){
@@ -59,7 +90,30 @@ XmlStream::XmlStream (const XmlObject& top_element)
             if (running) {
                 if (uxmpp_get_log_level() >= LogLevel::trace)
                     uxmpp_log_trace (THIS_FILE, "RX: ", to_string(xml_obj));
-                rx_queue.push (xml_obj);
+                if (framed) {
+                    // Stream start and end are <open/> and <close/> elements
+                    //
+                    auto full_name = xml_obj.get_full_name ();
+                    if (full_name == xml::full_tag_framing_open || full_name == xml::full_tag_framing_close) {
+                        XmlObject top (top_node);
+                        for (auto& attr : xml_obj.get_attributes())
+                            top.set_attribute (attr.first, attr.second);
+                        top.set_part (full_name==xml::full_tag_framing_open ? XmlObjPart::start : XmlObjPart::end);
+                        xml_obj = std::move (top);
+                    }
+                }
+                // Sample stanzas, not the stream start/end or internal objects
+                //
+                uint64_t trace_id = 0;
+                int64_t parse_time = 0;
+                if (rx_read_time && xml_obj.get_part()==XmlObjPart::all &&
+                    (trace_id = Tracer::get_instance().sample()))
+                {
+                    parse_time = Tracer::now ();
+                }
+                rx_queue.emplace (xml_obj, trace_id, rx_read_time, parse_time);
+                rx_queue_metric->set (rx_queue.size());
+                rx_stanzas_metric->inc ();
                 notify = true;
             }
             rx_cond_mutex.unlock ();
@@ -72,6 +126,7 @@ XmlStream::XmlStream (const XmlObject& top_element)
     xml_istream.set_error_handler ([this](XmlInputStream& stream, int code, const std::string& msg){
             if (uxmpp_get_log_level() >= LogLevel::info)
                 uxmpp_log_info (THIS_FILE, "XML parse error: ", code, " - ", msg);
+            parse_errors_metric->inc ();
             XmlObject xml_obj ("parse-error", "http://ultramarin.se/uxmpp#internal-error");
             xml_obj.set_attribute ("code", std::to_string(code));
             xml_obj.set_content (msg);
@@ -85,6 +140,15 @@ XmlStream::XmlStream (const XmlObject& top_element)
 XmlStream::~XmlStream ()
 {
     stop ();
+
+    auto& metrics = Metrics::get_instance ();
+    metrics.remove (rx_bytes_metric);
+    metrics.remove (tx_bytes_metric);
+    metrics.remove (rx_stanzas_metric);
+    metrics.remove (tx_stanzas_metric);
+    metrics.remove (rx_queue_metric);
+    metrics.remove (tx_buffers_metric);
+    metrics.remove (parse_errors_metric);
 }
 
 
@@ -115,10 +179,14 @@ bool XmlStream::run (uxmpp::io::Connection& rx_connection,
     // Reset the XML input stream
     //
     xml_istream.reset ();
+    rx_frame.clear ();
 
     // Start the RX queue thread.
     //
     running = true;
+    rx_eof  = false;
+    tx_since_rx.store (false, std::memory_order_relaxed);
+    round_trips.store (0, std::memory_order_relaxed);
     rx_thread = std::thread (XmlStream::rx_queue_thread_func, this);
 
     // Set the connection RX callback
@@ -139,6 +207,7 @@ bool XmlStream::run (uxmpp::io::Connection& rx_connection,
 
     // Start receiving data
     //
+    rx_conn->register_buffer (rx_buf.data(), rx_buf.size());
     rx_conn->read (rx_buf.data(), rx_buf.size());
 
     // Wain until all is done
@@ -161,13 +230,22 @@ bool XmlStream::run (uxmpp::io::Connection& rx_connection,
     rx_conn->set_rx_cb (nullptr);
     tx_conn->set_tx_cb (nullptr);
     mutex.unlock ();
+
+    // The connection manager thread may still be in the RX callback
+    // that ended the stream, don't let the stream be deleted under it.
+    //
+    while (rx_callbacks.load() != 0)
+        this_thread::sleep_for (chrono::milliseconds(1));
     reset ();
+    rx_conn->unregister_buffer (rx_buf.data());
     mutex.lock ();
 
     // Free TX resources
     //
     std::lock_guard<std::mutex> tx_buf_lock (tx_buf_mutex);
     tx_buffers.clear ();
+    tx_traces.clear ();
+    tx_buffers_metric->set (0);
 
     uxmpp_log_debug (THIS_FILE, "XML stream ended");
 
@@ -200,11 +278,25 @@ void XmlStream::timer_callback (Timer& timer, const std::string& name)
 //------------------------------------------------------------------------------
 void XmlStream::rx_callback (Connection& conn, void* buf, ssize_t result, int errnum)
 {
+    struct InCallback {
+        InCallback (std::atomic<unsigned>& count) : count(count) { ++count; }
+        ~InCallback () { --count; }
+        std::atomic<unsigned>& count;
+    } in_callback (rx_callbacks);
+
     if (result > 0) {
         // We have received data, parse XML and continue reading
+        rx_bytes_metric->inc (result);
+        if (tx_since_rx.exchange(false, std::memory_order_relaxed))
+            round_trips.fetch_add (1, std::memory_order_relaxed);
+        rx_read_time = Tracer::get_instance().is_enabled() ? Tracer::now() : 0;
         string xml_data (static_cast<char*>(buf), result);
         rx_conn->read (rx_buf.data(), rx_buf.size());
-        xml_istream << xml_data;
+        if (framed)
+            parse_frames (xml_data.data(), xml_data.size());
+        else
+            xml_istream << xml_data;
+        rx_read_time = 0;
         return;
     }
 
@@ -224,12 +316,39 @@ void XmlStream::rx_callback (Connection& conn, void* buf, ssize_t result, int er
         // End-of-stream
         // Stop the stream
         //
+        // XML objects already received are still passed to the callback.
+        //
         uxmpp_log_info (THIS_FILE, "RX connection closed");
+        rx_cond_mutex.lock ();
+        rx_eof = true;
+        rx_cond_mutex.unlock ();
         stop ();
     }
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void XmlStream::parse_frames (const char* data, size_t size)
+{
+    // Each message is followed by a NUL character
+    //
+    const char* end = data + size;
+    while (data < end) {
+        auto nul = static_cast<const char*> (memchr(data, '\0', end-data));
+        if (!nul) {
+            rx_frame.append (data, end-data);
+            break;
+        }
+        rx_frame.append (data, nul-data);
+        data = nul + 1;
+        if (rx_frame.find('<') != string::npos)
+            xml_istream.parse_document (rx_frame);
+        rx_frame.clear ();
+    }
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void XmlStream::tx_callback (Connection& conn, void* buf, ssize_t result, int errnum)
@@ -240,10 +359,21 @@ void XmlStream::tx_callback (Connection& conn, void* buf, ssize_t result, int er
     // Release TX resources
     //
     tx_buf_mutex.lock ();
+    auto tx_trace = tx_traces.find (static_cast<char*>(buf));
+    if (tx_trace != tx_traces.end()) {
+        auto& trace = tx_trace->second;
+        auto& tracer = Tracer::get_instance ();
+        auto now = Tracer::now ();
+        tracer.stanza_span ("tx", trace.write_time, now, trace.trace_id);
+        tracer.stanza_span ("serialize", trace.write_time, trace.queue_time, trace.trace_id);
+        tracer.stanza_span ("send", trace.queue_time, now, trace.trace_id);
+        tx_traces.erase (tx_trace);
+    }
     auto tx_buf = tx_buffers.find (static_cast<char*>(buf));
     if (tx_buf != tx_buffers.end()) {
         TRACE (THIS_FILE, "Remove TX buffer");
         tx_buffers.erase (tx_buf);
+        tx_buffers_metric->set (tx_buffers.size());
     }
     TRACE (THIS_FILE, "TX buffers left: ", tx_buffers.size(), (tx_buffers.empty()?", empty":""));
     tx_buf_mutex.unlock ();
@@ -288,6 +418,13 @@ void XmlStream::stop ()
         if (tx_conn)
             tx_conn->cancel ();
 //*/
+        // Callbacks for cancelled write operations won't be
+        // called, release the buffers so run() can return.
+        tx_buf_mutex.lock ();
+        tx_buffers.clear ();
+        tx_traces.clear ();
+        tx_buffers_metric->set (0);
+        tx_buf_mutex.unlock ();
         running = false;
         rx_cond_mutex.unlock ();
         rx_cond.notify_all ();
@@ -304,13 +441,91 @@ bool XmlStream::write (const XmlObject& xml_obj)
     if (!xml_obj)
         return true;
 
+    auto trace_id = Tracer::get_instance().sample ();
+    if (!write_traced(serialize(xml_obj), trace_id, trace_id ? Tracer::now() : 0))
+        return false;
+    tx_stanzas_metric->inc ();
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool XmlStream::is_top_node (const XmlObject& xml_obj) const
+{
+    if (xml_obj.get_tag_name() != top_node.get_tag_name())
+        return false;
+    return xml_obj.get_namespace() == top_node.get_namespace() ||
+        xml_obj.get_namespace_alias(xml_obj.get_namespace()) == top_node.get_namespace();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string XmlStream::serialize (const XmlObject& xml_obj) const
+{
+    if (!framed)
+        return to_string (xml_obj);
+
+    // The stream start and end tags are replaced by <open/> and <close/>
+    //
+    if (is_top_node(xml_obj) && xml_obj.get_part()!=XmlObjPart::all) {
+        bool start = xml_obj.get_part() == XmlObjPart::start;
+        XmlObject obj ((start ? "open" : "close"), xml::namespace_framing, true, true);
+        if (start) {
+            XmlObject stream_obj (xml_obj);
+            for (auto& attr : stream_obj.get_attributes())
+                obj.set_attribute (attr.first, attr.second);
+        }
+        return to_string (obj);
+    }
+
+    // Each XML object must declare its namespace
+    //
+    if (xml_obj.is_namespace_default() &&
+        xml_obj.get_default_namespace_attr().empty() &&
+        !xml_obj.get_namespace().empty())
+    {
+        XmlObject obj (xml_obj);
+        obj.set_default_namespace_attr (obj.get_namespace());
+        return to_string (obj);
+    }
+    return to_string (xml_obj);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void XmlStream::set_framed (bool framed)
+{
+    std::lock_guard<std::mutex> lock (mutex);
+    this->framed = framed;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool XmlStream::write_raw (const std::string& data)
+{
+    auto trace_id = Tracer::get_instance().sample ();
+    return write_traced (data, trace_id, trace_id ? Tracer::now() : 0);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool XmlStream::write_traced (const std::string& data, uint64_t trace_id, int64_t write_time)
+{
+    if (data.empty())
+        return true;
+
     std::lock_guard<std::mutex> lock (rx_cond_mutex);
     if (!running || !tx_conn) {
         uxmpp_log_debug (THIS_FILE, "TX ignored, stream is not open");
         return false;
     }
 
-    string tx_buf (to_string(xml_obj));
+    string tx_buf (data);
 
     if (uxmpp_get_log_level() >= LogLevel::trace)
         uxmpp_log_trace (THIS_FILE, "TX: ", tx_buf);
@@ -318,8 +533,13 @@ bool XmlStream::write (const XmlObject& xml_obj)
     std::lock_guard<std::mutex> tx_buf_lock (tx_buf_mutex);
     auto key = tx_buf.c_str ();           // key is the pointer to the string buffer
     tx_buffers[key] = std::move (tx_buf); // put the string buffer in the buffer map
+    if (trace_id)
+        tx_traces[key] = tx_trace_t {trace_id, write_time, Tracer::now()};
     //tx_conn->write ((void*)(tx_buffers[key].c_str()), tx_buffers[key].length());
     tx_conn->write ((void*)key, tx_buffers[key].length());
+    tx_since_rx.store (true, std::memory_order_relaxed);
+    tx_bytes_metric->inc (data.size());
+    tx_buffers_metric->set (tx_buffers.size());
 
     return true;
 }
@@ -431,14 +651,21 @@ void XmlStream::rx_queue_thread_func (XmlStream* stream)
 
         // Check if we are done
         //
-        if (!self.running) {
+        if (!self.running && (!self.rx_eof || self.rx_queue.empty())) {
             break;
         }
 
         // Handle received XML objects
         //
         while (!self.rx_queue.empty() /*&& self.running*/) {
-            XmlObject& xml_obj = self.rx_queue.front ();
+            auto& item = self.rx_queue.front ();
+            XmlObject& xml_obj = item.xml_obj;
+            int64_t dequeue_time = 0;
+            string name;
+            if (item.trace_id) {
+                dequeue_time = Tracer::now ();
+                name = xml_obj.get_tag_name ();
+            }
 /*
             // If we got a stream error we should stop the stream after notifying
             // the callback.
@@ -449,10 +676,21 @@ void XmlStream::rx_queue_thread_func (XmlStream* stream)
             //
             if (self.rx_cb) {
                 self.rx_cond_mutex.unlock ();
+                Tracer::set_current (item.trace_id);
                 self.rx_cb (self, xml_obj);
+                Tracer::set_current (0);
                 self.rx_cond_mutex.lock ();
             }
+            if (item.trace_id) {
+                auto& tracer = Tracer::get_instance ();
+                auto now = Tracer::now ();
+                tracer.stanza_span ("rx", item.read_time, now, item.trace_id, name);
+                tracer.stanza_span ("parse", item.read_time, item.parse_time, item.trace_id);
+                tracer.stanza_span ("queue", item.parse_time, dequeue_time, item.trace_id);
+                tracer.stanza_span ("dispatch", dequeue_time, now, item.trace_id);
+            }
             self.rx_queue.pop ();
+            self.rx_queue_metric->set (self.rx_queue.size());
 /*
             // Signal the stream to stop if we have a stream error
             //
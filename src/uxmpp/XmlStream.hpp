@@ -24,6 +24,8 @@
 #include <uxmpp/io/Timer.hpp>
 #include <uxmpp/XmlObject.hpp>
 #include <uxmpp/XmlInputStream.hpp>
+#include <uxmpp/Metrics.hpp>
+#include <uxmpp/Tracer.hpp>
 #include <queue>
 #include <vector>
 #include <mutex>
@@ -32,6 +34,7 @@
 #include <condition_variable>
 #include <map>
 #include <array>
+#include <atomic>
 
 
 namespace uxmpp {
@@ -109,6 +112,41 @@ namespace uxmpp {
          */
         virtual bool write (const XmlObject& xml_obj);
 
+        /**
+         * Write already serialized XML data to the stream.
+         * @param data A string with one or more complete XML objects.
+         *             If the stream is framed it must be exactly one
+         *             XML object, as returned by serialize().
+         */
+        virtual bool write_raw (const std::string& data);
+
+        /**
+         * Serialize an XML object the way it is written to the stream.
+         * With RFC 7395 framing each top-level XML object must declare
+         * its default namespace, that is added if needed.
+         */
+        std::string serialize (const XmlObject& xml_obj) const;
+
+        /**
+         * Use XMPP over WebSocket framing (RFC 7395).
+         * Each XML object is then written as a separate message, and each
+         * message read from the RX connection, ending with a NUL character,
+         * is parsed as one complete XML document. The start and end of the
+         * stream are sent and received as &lt;open/&gt; and &lt;close/&gt;
+         * elements, but are passed to the receive callback as the start and
+         * end tags of the top element.
+         * Set this before calling run().
+         * @see uxmpp::io::WebSocketConnection
+         */
+        void set_framed (bool framed);
+
+        /**
+         * Return true if RFC 7395 framing is used.
+         */
+        bool is_framed () const {
+            return framed;
+        }
+
         /**
          * Reset the stream.
          * This will reset the XML parser to the same state as when the stream
@@ -153,6 +191,17 @@ namespace uxmpp {
             return running;
         }
 
+        /**
+         * Return the number of round trips since the stream was started,
+         * that is the number of reads that got data after something was
+         * written since the previous read. Data written before the answer
+         * to earlier data arrives (pipelining) doesn't add a round trip.
+         * A TLS handshake is not counted.
+         */
+        unsigned get_round_trips () const {
+            return round_trips.load (std::memory_order_relaxed);
+        }
+
 
     private:
         XmlObject top_node;
@@ -161,8 +210,22 @@ namespace uxmpp {
         std::thread rx_thread;
         std::mutex mutex;
         bool running;
+        bool rx_eof;
         
-        std::queue<XmlObject> rx_queue;
+        // A received XML object, with trace data if it is sampled
+        struct rx_item_t {
+            rx_item_t (const XmlObject& obj, uint64_t id, int64_t read, int64_t parsed)
+                : xml_obj{obj}, trace_id{id}, read_time{read}, parse_time{parsed} {}
+            XmlObject xml_obj;
+            uint64_t trace_id;
+            int64_t read_time;
+            int64_t parse_time;
+        };
+        std::queue<rx_item_t> rx_queue;
+        int64_t rx_read_time; // Time of the last read when tracing
+        std::atomic<bool> tx_since_rx;
+        std::atomic<unsigned> round_trips;
+        std::atomic<unsigned> rx_callbacks; // RX callbacks in progress
         std::condition_variable rx_cond;
         std::mutex rx_cond_mutex;
 
@@ -173,13 +236,35 @@ namespace uxmpp {
 
         std::map<std::string, io::Timer> timers;
 
+        bool framed;
+        std::string rx_frame;
+
         std::mutex tx_buf_mutex;
         std::map <const char*, std::string> tx_buffers;
 
+        // Trace data of sampled TX buffers
+        struct tx_trace_t {
+            uint64_t trace_id;
+            int64_t write_time;
+            int64_t queue_time;
+        };
+        std::map <const char*, tx_trace_t> tx_traces;
+
+        std::shared_ptr<Metric> rx_bytes_metric;
+        std::shared_ptr<Metric> tx_bytes_metric;
+        std::shared_ptr<Metric> rx_stanzas_metric;
+        std::shared_ptr<Metric> tx_stanzas_metric;
+        std::shared_ptr<Metric> rx_queue_metric;
+        std::shared_ptr<Metric> tx_buffers_metric;
+        std::shared_ptr<Metric> parse_errors_metric;
+
         static void rx_queue_thread_func (XmlStream* stream);
         void timer_callback (io::Timer& timer, const std::string& name);
         void rx_callback (io::Connection& conn, void* buf, ssize_t result, int errnum);
         void tx_callback (io::Connection& conn, void* buf, ssize_t result, int errnum);
+        void parse_frames (const char* data, size_t size);
+        bool write_traced (const std::string& data, uint64_t trace_id, int64_t write_time);
+        bool is_top_node (const XmlObject& xml_obj) const;
     };
 
 
@@ -71,4 +71,12 @@ std::vector<std::string> XmppModule::get_disco_features ()
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool XmppModule::allow_pipelined_bind (Session& session)
+{
+    return true;
+}
+
+
 UXMPP_END_NAMESPACE1
@@ -75,6 +75,14 @@ namespace uxmpp {
          */
         virtual std::vector<std::string> get_disco_features ();
 
+        /**
+         * Called before the resource binding request is sent together
+         * with the stream restart after authentication, see Session::reset_and_bind().
+         * @return Return false if the module wants to see the stream features
+         *         before anything is bound, like when resuming a stream.
+         */
+        virtual bool allow_pipelined_bind (Session& session);
+
 
     protected:
 
@@ -39,5 +39,11 @@ namespace uxmpp {
 #include <uxmpp/io/io_operation.hpp>
 #include <uxmpp/io/FileConnection.hpp>
 #include <uxmpp/io/ConnectionManager.hpp>
+#include <uxmpp/io/IoThreadPool.hpp>
+#include <uxmpp/io/ZlibCompressor.hpp>
+#include <uxmpp/io/WebSocketConnection.hpp>
+#ifdef UXMPP_HAVE_IO_URING
+#include <uxmpp/io/IoUringManager.hpp>
+#endif
 
 #endif
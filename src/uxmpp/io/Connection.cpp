@@ -18,6 +18,10 @@
  */
 #include <uxmpp/io/Connection.hpp>
 #include <uxmpp/io/ConnectionManager.hpp>
+#include <uxmpp/io/IoThreadPool.hpp>
+#ifdef UXMPP_HAVE_IO_URING
+#include <uxmpp/io/IoUringManager.hpp>
+#endif
 #include <uxmpp/Logger.hpp>
 
 #include <unistd.h>
@@ -39,7 +43,8 @@ Connection::Connection ()
     :
     rx_cb {nullptr},
     tx_cb {nullptr},
-    fd {-1}
+    fd {-1},
+    backend {IoBackend::poll}
 {
     ConnectionManager::getInstance().register_connection (*this);
 }
@@ -50,6 +55,18 @@ Connection::Connection ()
 Connection::~Connection ()
 {
     close ();
+    switch (backend) {
+#ifdef UXMPP_HAVE_IO_URING
+    case IoBackend::io_uring:
+        IoUringManager::getInstance().unregister_connection (*this);
+        break;
+#endif
+    case IoBackend::thread_pool:
+        IoThreadPool::getInstance().unregister_connection (*this);
+        break;
+    default:
+        break;
+    }
     ConnectionManager::getInstance().unregister_connection (*this);
 }
 
@@ -59,7 +76,19 @@ Connection::~Connection ()
 void Connection::read_offset (void* buf, size_t size, off_t offset, io_callback_t rx_cb)
 {
     io_callback_t cb = rx_cb==nullptr ? this->rx_cb : rx_cb;
-    ConnectionManager::getInstance().read (*this, buf, size, offset, cb);
+    switch (backend) {
+#ifdef UXMPP_HAVE_IO_URING
+    case IoBackend::io_uring:
+        IoUringManager::getInstance().read (*this, buf, size, offset, cb);
+        break;
+#endif
+    case IoBackend::thread_pool:
+        IoThreadPool::getInstance().read (*this, buf, size, offset, cb);
+        break;
+    default:
+        ConnectionManager::getInstance().read (*this, buf, size, offset, cb);
+        break;
+    }
 }
 
 
@@ -68,7 +97,19 @@ void Connection::read_offset (void* buf, size_t size, off_t offset, io_callback_
 void Connection::write_offset (void* buf, size_t size, off_t offset, io_callback_t tx_cb)
 {
     io_callback_t cb = tx_cb==nullptr ? this->tx_cb : tx_cb;
-    ConnectionManager::getInstance().write (*this, buf, size, offset, cb);
+    switch (backend) {
+#ifdef UXMPP_HAVE_IO_URING
+    case IoBackend::io_uring:
+        IoUringManager::getInstance().write (*this, buf, size, offset, cb);
+        break;
+#endif
+    case IoBackend::thread_pool:
+        IoThreadPool::getInstance().write (*this, buf, size, offset, cb);
+        break;
+    default:
+        ConnectionManager::getInstance().write (*this, buf, size, offset, cb);
+        break;
+    }
 }
 
 
@@ -76,7 +117,19 @@ void Connection::write_offset (void* buf, size_t size, off_t offset, io_callback
 //------------------------------------------------------------------------------
 void Connection::cancel ()
 {
-    ConnectionManager::getInstance().cancel (*this);
+    switch (backend) {
+#ifdef UXMPP_HAVE_IO_URING
+    case IoBackend::io_uring:
+        IoUringManager::getInstance().cancel (*this);
+        break;
+#endif
+    case IoBackend::thread_pool:
+        IoThreadPool::getInstance().cancel (*this);
+        break;
+    default:
+        ConnectionManager::getInstance().cancel (*this);
+        break;
+    }
 }
 
 
@@ -102,6 +155,79 @@ void Connection::set_fd (int fd)
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool Connection::set_io_backend (IoBackend backend)
+{
+    if (backend == this->backend)
+        return true;
+
+#ifdef UXMPP_HAVE_IO_URING
+    if (backend==IoBackend::io_uring && !IoUringManager::is_available())
+        return false;
+#else
+    if (backend == IoBackend::io_uring)
+        return false;
+#endif
+
+    // Leave the old backend
+    //
+    cancel ();
+    switch (this->backend) {
+#ifdef UXMPP_HAVE_IO_URING
+    case IoBackend::io_uring:
+        IoUringManager::getInstance().unregister_connection (*this);
+        break;
+#endif
+    case IoBackend::thread_pool:
+        IoThreadPool::getInstance().unregister_connection (*this);
+        break;
+    default:
+        break;
+    }
+
+    // Join the new backend
+    //
+    switch (backend) {
+#ifdef UXMPP_HAVE_IO_URING
+    case IoBackend::io_uring:
+        IoUringManager::getInstance().register_connection (*this);
+        break;
+#endif
+    case IoBackend::thread_pool:
+        IoThreadPool::getInstance().register_connection (*this);
+        break;
+    default:
+        break;
+    }
+    this->backend = backend;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Connection::register_buffer (void* buf, size_t size)
+{
+#ifdef UXMPP_HAVE_IO_URING
+    if (backend == IoBackend::io_uring)
+        IoUringManager::getInstance().register_buffer (buf, size);
+#endif
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Connection::unregister_buffer (void* buf)
+{
+#ifdef UXMPP_HAVE_IO_URING
+    if (backend == IoBackend::io_uring)
+        IoUringManager::getInstance().unregister_buffer (buf);
+#endif
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 Connection::io_callback_t Connection::set_rx_cb (io_callback_t callback)
@@ -31,6 +31,16 @@ namespace uxmpp { namespace io {
 class ConnectionManager;
 
 
+/**
+ * The I/O backend performing the operations of a connection.
+ */
+enum class IoBackend {
+    poll,     /**< Operations are performed by the ConnectionManager when poll() reports readiness. */
+    io_uring, /**< Operations are submitted to the kernel by the IoUringManager. */
+    thread_pool, /**< Operations are performed by a worker thread in the IoThreadPool. */
+};
+
+
 /**
  *
  */
@@ -109,6 +119,37 @@ public:
      */
     void set_fd (int fd);
 
+    /**
+     * Select the I/O backend used for the connection.
+     * Queued I/O operations are cancelled when the backend is changed.
+     * Connections that override do_read/do_write can't use IoBackend::io_uring.
+     * @param backend The I/O backend to use.
+     * @return False if the backend isn't available on this system.
+     */
+    bool set_io_backend (IoBackend backend);
+
+    /**
+     * Return the I/O backend used for the connection.
+     */
+    IoBackend get_io_backend () const {
+        return backend;
+    }
+
+    /**
+     * Register a buffer that will be used for many I/O operations.
+     * This is a hint to the I/O backend that may use it to
+     * avoid mapping the buffer for each operation.
+     * @param buf The start of the memory area.
+     * @param size The size of the memory area.
+     */
+    void register_buffer (void* buf, size_t size);
+
+    /**
+     * Unregister a buffer previously registered by register_buffer.
+     * @param buf The start of the memory area.
+     */
+    void unregister_buffer (void* buf);
+
     /**
      * Set RX callback.
      * @return The old callback.
@@ -155,6 +196,7 @@ protected:
 private:
 
     int fd; /**< File descriptor. */
+    IoBackend backend; /**< The I/O backend. */
 };
 
 
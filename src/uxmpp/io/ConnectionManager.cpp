@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <cstring>
 #include <fcntl.h>
+#include <chrono>
 
 
 UXMPP_START_NAMESPACE2(uxmpp, io)
@@ -108,6 +109,8 @@ static string to_string (io_command_op op) {
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 ConnectionManager::ConnectionManager () throw (IoException)
+    :
+    next_serial {0}
 {
     // Create the command pipe
     //
@@ -133,6 +136,18 @@ ConnectionManager::ConnectionManager () throw (IoException)
         }
     }
 
+    // Metrics
+    //
+    auto& metrics = Metrics::get_instance ();
+    polled_fds_metric    = metrics.add (MetricType::gauge, "uxmpp_connmgr_polled_fds",
+                                        "File descriptors polled by the connection manager.");
+    poll_wakeups_metric  = metrics.add (MetricType::counter, "uxmpp_connmgr_poll_wakeups_total",
+                                        "Number of times poll() returned in the connection manager.");
+    commands_metric      = metrics.add (MetricType::counter, "uxmpp_connmgr_commands_total",
+                                        "Commands processed by the connection manager.");
+    callback_time_metric = metrics.add (MetricType::summary, "uxmpp_connmgr_callback_seconds",
+                                        "Time spent in RX/TX callbacks.", "", 1e-9);
+
     // Start the worker thread
     //
     worker = thread ([this](){
@@ -178,7 +193,7 @@ ConnectionManager::~ConnectionManager ()
 void ConnectionManager::register_connection (Connection& connection)
 {
     lock_guard<mutex> lock (map_mutex);
-    connections.emplace (&connection, ConnectionInfo());
+    connections.emplace (&connection, ConnectionInfo(++next_serial));
 }
 
 
@@ -367,7 +382,9 @@ void ConnectionManager::run_worker (ConnectionManager& cm)
         // Poll file descriptors
         //
         DEBUG_TRACE (THIS_FILE, "Poll ", nfds, " file descriptors, timeout: ", poll_timeout);
+        cm.polled_fds_metric->set (nfds - 1);
         auto result = poll (cm.fds, nfds, poll_timeout);
+        cm.poll_wakeups_metric->inc ();
         if (result <= 0) {
             // Check for errors or timeout
             //
@@ -474,10 +491,22 @@ int ConnectionManager::handle_poll_io  (struct pollfd& pfd, int& nfds, bool rx)
 
         if (op.callback) {
             ci.cancel_in_callback = false;
+            auto serial = ci.serial;
             map_mutex.unlock ();
             DEBUG_TRACE (THIS_FILE, "Call RX/TX callback");
+            auto start = chrono::steady_clock::now ();
             op.callback (*conn, op.buf, op.result, op.errnum);
+            callback_time_metric->observe (chrono::duration_cast<chrono::nanoseconds>(
+                                               chrono::steady_clock::now() - start).count());
             map_mutex.lock ();
+
+            // The connection may have been unregistered by another
+            // thread while the callback was called, and 'ci' and
+            // 'queue' may now belong to a new connection.
+            //
+            auto i = connections.find (conn);
+            if (i==connections.end() || i->second.serial!=serial)
+                return WHILE_HELL_BURNS;
         }
         if (!queue.empty() && !ci.cancel_in_callback/*don't pop if queue was cancelled*/) {
             queue.pop ();
@@ -491,13 +520,12 @@ int ConnectionManager::handle_poll_io  (struct pollfd& pfd, int& nfds, bool rx)
         }else{
             DEBUG_TRACE (THIS_FILE, "TX queue empty for fd ", conn->get_fd(), " remove it from poll list");
         }
-        io_command_t cmd;
-        cmd.op = rx ? io_command_op::del_rx : io_command_op::del_tx;
-        cmd.conn = conn;
-        auto result = ::write (cmd_pipe[pipe_tx], &cmd, sizeof(cmd));
-        if (result <= 0) {
-            uxmpp_log_error (THIS_FILE, "Error sending command add_rx");
-        }
+        // We are in the worker thread, so there is no need to
+        // send a command to ourselves. A new operation queued
+        // after this point sends an add_rx/add_tx command.
+        short poll_op = rx ? POLLIN : POLLOUT;
+        pfd.events  &= ~poll_op;
+        pfd.revents &= ~poll_op;
     }
 
     return retval;
@@ -509,41 +537,45 @@ int ConnectionManager::handle_poll_io  (struct pollfd& pfd, int& nfds, bool rx)
 //------------------------------------------------------------------------------
 bool ConnectionManager::dispatch_command (int& nfds)
 {
-    io_command_t cmd;
-    auto result = ::read (fds[0].fd, &cmd, sizeof(cmd));
-    if (result <= 0) {
-        if (errno != EAGAIN)
-            uxmpp_log_error (THIS_FILE, "Command pipe I/O error");
-        return false;
-    }
-    DEBUG_TRACE (THIS_FILE, "Got command: ", to_string(cmd.op));
+    // Handle all pending commands, with many connections
+    // the command pipe would otherwise fill up.
+    //
+    while (true) {
+        io_command_t cmd;
+        auto result = ::read (fds[0].fd, &cmd, sizeof(cmd));
+        if (result <= 0) {
+            if (result<0 && errno!=EAGAIN)
+                uxmpp_log_error (THIS_FILE, "Command pipe I/O error");
+            return false;
+        }
+        DEBUG_TRACE (THIS_FILE, "Got command: ", to_string(cmd.op));
+        commands_metric->inc ();
 
-    switch (cmd.op) {
-    case io_command_op::quit:
-        return true;
+        switch (cmd.op) {
+        case io_command_op::quit:
+            return true;
 
-    case io_command_op::add_rx:
-        add_poll_fd (cmd.conn, nfds, true);
-        break;
+        case io_command_op::add_rx:
+            add_poll_fd (cmd.conn, nfds, true);
+            break;
 
-    case io_command_op::add_tx:
-        add_poll_fd (cmd.conn, nfds, false);
-        break;
+        case io_command_op::add_tx:
+            add_poll_fd (cmd.conn, nfds, false);
+            break;
 
-    case io_command_op::del_rx:
-        del_poll_fd (cmd.conn, nfds, true);
-        break;
+        case io_command_op::del_rx:
+            del_poll_fd (cmd.conn, nfds, true);
+            break;
 
-    case io_command_op::del_tx:
-        del_poll_fd (cmd.conn, nfds, false);
-        break;
+        case io_command_op::del_tx:
+            del_poll_fd (cmd.conn, nfds, false);
+            break;
 
-    case io_command_op::del_fd:
-        del_poll_fd (cmd.fd, nfds);
-        break;
+        case io_command_op::del_fd:
+            del_poll_fd (cmd.fd, nfds);
+            break;
+        }
     }
-
-    return false;
 }
 
 
@@ -576,11 +608,16 @@ void ConnectionManager::add_poll_fd (Connection* conn, int& nfds, bool rx)
         {
             io_operation_t& op = queue.front ();
             if (op.callback) {
+                auto serial = ci.serial;
                 map_mutex.unlock ();
                 op.callback (*conn, op.buf, -1, EBADF);
                 map_mutex.lock ();
+                auto i = connections.find (conn);
+                if (i==connections.end() || i->second.serial!=serial)
+                    return;
             }
-            queue.pop ();
+            if (!queue.empty())
+                queue.pop ();
         }
         if (queue.empty() || connections.find(conn)==connections.end())
             return; // No RX/TX operation left
@@ -610,8 +647,16 @@ void ConnectionManager::add_poll_fd (Connection* conn, int& nfds, bool rx)
         struct pollfd* tmp = fds;
         fds = new struct pollfd[fds_size + 16];
         memcpy (fds, tmp, sizeof(struct pollfd) * fds_size);
-        fds_size += 16;
         delete[] tmp;
+        bool* tmp_more = fds_rx_more;
+        fds_rx_more = new bool[fds_size + 16];
+        memcpy (fds_rx_more, tmp_more, sizeof(bool) * fds_size);
+        delete[] tmp_more;
+        tmp_more = fds_tx_more;
+        fds_tx_more = new bool[fds_size + 16];
+        memcpy (fds_tx_more, tmp_more, sizeof(bool) * fds_size);
+        delete[] tmp_more;
+        fds_size += 16;
     }
     fds[nfds].fd      = conn->get_fd ();
     fds[nfds].events  = poll_op;
@@ -23,6 +23,7 @@
 #include <uxmpp/io/IoException.hpp>
 #include <uxmpp/io/Connection.hpp>
 #include <uxmpp/io/io_operation.hpp>
+#include <uxmpp/Metrics.hpp>
 
 #include <queue>
 #include <map>
@@ -106,10 +107,14 @@ protected:
 private:
     class ConnectionInfo {
     public:
+        ConnectionInfo (unsigned long s=0) : cancel_in_callback{false}, serial{s} {}
         std::queue<io_operation_t> rx_queue;
         std::queue<io_operation_t> tx_queue;
         // Flag to see if I/O operations have been cancelled from a callback
         bool cancel_in_callback;
+        // Unique for each registration, a new connection
+        // may get the address of an unregistered one
+        unsigned long serial;
     };
 
     // This is a singleton
@@ -125,6 +130,9 @@ private:
     // Protect the above maps
     std::mutex map_mutex;
 
+    // Serial number of the next registered connection
+    unsigned long next_serial;
+
     // Worker thread
     std::thread worker;
 
@@ -141,6 +149,12 @@ private:
     bool*          fds_tx_more;
     bool*          fds_rx_more;
     int            fds_size;
+
+    // Metrics
+    std::shared_ptr<Metric> polled_fds_metric;
+    std::shared_ptr<Metric> poll_wakeups_metric;
+    std::shared_ptr<Metric> commands_metric;
+    std::shared_ptr<Metric> callback_time_metric;
 };
 
 
@@ -46,6 +46,12 @@ FileConnection::FileConnection (const std::string& file, int flags)
     }else{
         set_fd (fd);
 
+        // poll() always reports regular files as ready, use io_uring
+        // or the I/O thread pool to keep slow disk I/O from stalling
+        // the connection manager.
+        if (!set_io_backend(IoBackend::io_uring))
+            set_io_backend (IoBackend::thread_pool);
+
         int result = 0;
         int flags  = fcntl (fd, F_GETFL, 0);
         if (flags != -1)
@@ -69,6 +75,12 @@ FileConnection::FileConnection (const std::string& file, int flags, int mode)
     }else{
         set_fd (fd);
 
+        // poll() always reports regular files as ready, use io_uring
+        // or the I/O thread pool to keep slow disk I/O from stalling
+        // the connection manager.
+        if (!set_io_backend(IoBackend::io_uring))
+            set_io_backend (IoBackend::thread_pool);
+
         int result = 0;
         int flags  = fcntl (fd, F_GETFL, 0);
         if (flags != -1)
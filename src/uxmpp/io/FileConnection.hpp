@@ -21,6 +21,7 @@
 
 #include <uxmpp/types.hpp>
 #include <uxmpp/io/Connection.hpp>
+#include <string>
 
 #include <sys/types.h>
 #include <sys/stat.h>
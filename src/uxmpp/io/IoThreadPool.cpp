@@ -0,0 +1,334 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/io/IoThreadPool.hpp>
+#include <uxmpp/io/Connection.hpp>
+#include <uxmpp/io/io_operation.hpp>
+#include <uxmpp/Logger.hpp>
+
+#include <cerrno>
+
+
+UXMPP_START_NAMESPACE2(uxmpp, io)
+
+#define THIS_FILE "IoThreadPool"
+
+#ifdef DEBUG_TRACE
+#undef DEBUG_TRACE
+#endif
+
+#if 0
+#define DEBUG_TRACE(prefix, ...) uxmpp_log_trace(prefix, ## __VA_ARGS__)
+#else
+#define DEBUG_TRACE(prefix, ...)
+#endif
+
+
+using namespace std;
+using namespace uxmpp;
+
+
+/*
+ * Static class attributes.
+ */
+IoThreadPool* IoThreadPool::instance = nullptr;
+
+/*
+ * File scope variables.
+ */
+static std::mutex instance_mutex;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IoThreadPool::IoThreadPool ()
+    :
+    done {false}
+{
+    // Start the worker threads
+    //
+    for (int i=0; i<UXMPP_IO_THREAD_POOL_SIZE; ++i) {
+        workers.emplace_back ([this](){
+                run_worker (*this);
+            });
+    }
+
+    DEBUG_TRACE (THIS_FILE, "Install 'atexit' function to clean up the I/O thread pool");
+    atexit ([](){
+            if (IoThreadPool::instance)
+                delete IoThreadPool::instance;
+        });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IoThreadPool::~IoThreadPool ()
+{
+    map_mutex.lock ();
+    connections.clear ();
+    ready.clear ();
+    done = true;
+    map_mutex.unlock ();
+    work_cond.notify_all ();
+
+    DEBUG_TRACE (THIS_FILE, "End worker threads");
+    for (auto& worker : workers)
+        worker.join ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IoThreadPool& IoThreadPool::getInstance ()
+{
+    if (!instance) {
+        lock_guard<mutex> lock (instance_mutex);
+        if (!instance) {
+            uxmpp_log_debug (THIS_FILE, "Creating the IoThreadPool instance");
+            instance = new IoThreadPool;
+        }
+    }
+    return *instance;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool IoThreadPool::is_worker_thread ()
+{
+    for (auto& worker : workers) {
+        if (worker.get_id() == this_thread::get_id())
+            return true;
+    }
+    return false;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoThreadPool::register_connection (Connection& connection)
+{
+    lock_guard<mutex> lock (map_mutex);
+    connections.emplace (&connection, ConnectionInfo());
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoThreadPool::unregister_connection (Connection& connection)
+{
+    unique_lock<mutex> lock (map_mutex);
+    auto ci = connections.find (&connection);
+    if (ci == connections.end())
+        return;
+
+    // Don't pull the connection away from under a worker thread
+    //
+    if (!is_worker_thread()) {
+        idle_cond.wait (lock, [this, &connection]{
+                auto i = connections.find (&connection);
+                return i==connections.end() || i->second.active==0;
+            });
+    }
+    connections.erase (&connection);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoThreadPool::read (Connection& conn,
+                         void* buf,
+                         size_t size,
+                         off_t offset,
+                         Connection::io_callback_t rx_cb)
+{
+    io_operation_t rx_op;
+    rx_op.connection = &conn;
+    rx_op.buf        = buf;
+    rx_op.size       = size;
+    rx_op.offset     = offset;
+    rx_op.result     = 0;
+    rx_op.errnum     = 0;
+    rx_op.callback   = rx_cb;
+
+    DEBUG_TRACE (THIS_FILE, "read, fd: ", conn.get_fd(), ", size: ", size);
+    queue_op (conn, rx_op, true);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoThreadPool::write (Connection& conn,
+                          void* buf,
+                          size_t size,
+                          off_t offset,
+                          Connection::io_callback_t tx_cb)
+{
+    io_operation_t tx_op;
+    tx_op.connection = &conn;
+    tx_op.buf        = buf;
+    tx_op.size       = size;
+    tx_op.offset     = offset;
+    tx_op.result     = 0;
+    tx_op.errnum     = 0;
+    tx_op.callback   = tx_cb;
+
+    DEBUG_TRACE (THIS_FILE, "write, fd: ", conn.get_fd(), ", size: ", size);
+    queue_op (conn, tx_op, false);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoThreadPool::queue_op (Connection& conn, io_operation_t& op, bool rx)
+{
+    lock_guard<mutex> lock (map_mutex);
+    auto ci = connections.find (&conn);
+    if (ci == connections.end()) {
+        uxmpp_log_debug (THIS_FILE, (rx?"read":"write"), " - connection not registered");
+        return;
+    }
+
+    auto& queue = rx ? ci->second.rx_queue : ci->second.tx_queue;
+    bool& busy  = rx ? ci->second.rx_busy  : ci->second.tx_busy;
+    queue.push (op);
+    if (!busy) {
+        busy = true;
+        ready.emplace_back (&conn, rx);
+        work_cond.notify_one ();
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoThreadPool::cancel (Connection& conn)
+{
+    unique_lock<mutex> lock (map_mutex);
+    auto ci = connections.find (&conn);
+    if (ci == connections.end())
+        return;
+
+    DEBUG_TRACE (THIS_FILE, "Cancel I/O operations for fd " , conn.get_fd());
+
+    ConnectionInfo& info = ci->second;
+    while (!info.rx_queue.empty())
+        info.rx_queue.pop ();
+    while (!info.tx_queue.empty())
+        info.tx_queue.pop ();
+    ++info.generation;
+
+    // Wait for operations and callbacks in progress so the caller
+    // can release the buffers when we return. Drop the operations
+    // queued by those callbacks.
+    //
+    if (!is_worker_thread()) {
+        idle_cond.wait (lock, [this, &conn]{
+                auto i = connections.find (&conn);
+                return i==connections.end() || i->second.active==0;
+            });
+        ci = connections.find (&conn);
+        if (ci == connections.end())
+            return;
+        while (!ci->second.rx_queue.empty())
+            ci->second.rx_queue.pop ();
+        while (!ci->second.tx_queue.empty())
+            ci->second.tx_queue.pop ();
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoThreadPool::run_worker (IoThreadPool& tp)
+{
+    unique_lock<mutex> lock (tp.map_mutex);
+
+    DEBUG_TRACE (THIS_FILE, "Worker thread started");
+
+    while (!tp.done) {
+        tp.work_cond.wait (lock, [&tp]{return tp.done || !tp.ready.empty();});
+        if (tp.done)
+            break;
+
+        Connection* conn = tp.ready.front().first;
+        bool rx          = tp.ready.front().second;
+        tp.ready.pop_front ();
+
+        auto ci = tp.connections.find (conn);
+        if (ci == tp.connections.end())
+            continue;
+        auto& queue = rx ? ci->second.rx_queue : ci->second.tx_queue;
+        if (queue.empty()) {
+            (rx ? ci->second.rx_busy : ci->second.tx_busy) = false;
+            continue;
+        }
+
+        // Perform the blocking operation without holding the lock
+        //
+        io_operation_t op = queue.front ();
+        unsigned generation = ci->second.generation;
+        ++ci->second.active;
+        lock.unlock ();
+        if (rx) {
+            op.result = conn->do_read (op.buf, op.size, op.offset, op.errnum);
+            DEBUG_TRACE (THIS_FILE, "RX result from ", conn->get_fd(), ": ", op.result);
+        }else{
+            op.result = conn->do_write (op.buf, op.size, op.offset, op.errnum);
+            DEBUG_TRACE (THIS_FILE, "TX result from ", conn->get_fd(), ": ", op.result);
+        }
+        lock.lock ();
+
+        ci = tp.connections.find (conn);
+        if (ci == tp.connections.end())
+            continue;
+
+        // Don't call the callback if the operation was cancelled.
+        // The connection stays active until the callback returns.
+        //
+        if (ci->second.generation == generation) {
+            queue.pop ();
+            if (op.callback) {
+                lock.unlock ();
+                op.callback (*conn, op.buf, op.result, op.errnum);
+                lock.lock ();
+            }
+        }
+
+        // Schedule the next operation for this connection, if any
+        //
+        ci = tp.connections.find (conn);
+        if (ci != tp.connections.end()) {
+            --ci->second.active;
+            tp.idle_cond.notify_all ();
+            auto& next_queue = rx ? ci->second.rx_queue : ci->second.tx_queue;
+            if (next_queue.empty()) {
+                (rx ? ci->second.rx_busy : ci->second.tx_busy) = false;
+            }else{
+                tp.ready.emplace_back (conn, rx);
+                tp.work_cond.notify_one ();
+            }
+        }
+    }
+
+    DEBUG_TRACE (THIS_FILE, "Worker thread ending");
+}
+
+
+UXMPP_END_NAMESPACE2
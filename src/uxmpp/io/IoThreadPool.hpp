@@ -0,0 +1,160 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_IO_IOTHREADPOOL_HPP
+#define UXMPP_IO_IOTHREADPOOL_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/io/Connection.hpp>
+#include <uxmpp/io/io_operation.hpp>
+
+#include <queue>
+#include <deque>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+
+namespace uxmpp { namespace io {
+
+
+/**
+ * Number of worker threads in the I/O thread pool.
+ */
+#define UXMPP_IO_THREAD_POOL_SIZE 4
+
+
+/**
+ * Class to handle blocking connection I/O operations in a
+ * bounded pool of worker threads.
+ * Singleton.
+ *
+ * This is used for regular files when io_uring isn't available.
+ * poll() always reports a regular file as ready, so a slow disk
+ * would otherwise stall the ConnectionManager thread and every
+ * network connection behind it.
+ *
+ * Operations are performed in order, one read and one write at a
+ * time per connection, by calling Connection::do_read and
+ * Connection::do_write from a worker thread.
+ */
+class IoThreadPool {
+public:
+    /**
+     * Destructor.
+     */
+    virtual ~IoThreadPool ();
+
+    /**
+     * Disabled copy constructor.
+     */
+    IoThreadPool (const IoThreadPool& tp) = delete;
+
+    /**
+     * Disabled assignment operator.
+     */
+    IoThreadPool& operator= (const IoThreadPool& tp) = delete;
+
+    /**
+     * Return a reference to the IoThreadPool instance.
+     */
+    static IoThreadPool& getInstance ();
+
+    /**
+     *
+     */
+    void register_connection (Connection& connection);
+
+    /**
+     * Unregister a connection.
+     * Waits for operations being performed on the connection to finish.
+     */
+    void unregister_connection (Connection& connection);
+
+    /**
+     * Queue a read operation for a connection.
+     */
+    void read (Connection& conn,
+               void* buf,
+               size_t size,
+               off_t offset,
+               Connection::io_callback_t rx_cb=nullptr);
+
+    /**
+     * Queue a write operation for a connection.
+     */
+    void write (Connection& conn,
+                void* buf,
+                size_t size,
+                off_t offset,
+                Connection::io_callback_t tx_cb=nullptr);
+
+    /**
+     * Cancel all operation for a connection.
+     * Waits for operations being performed on the connection, and for
+     * callbacks in progress, to finish. Callbacks of the cancelled
+     * operations will not be called.
+     */
+    void cancel (Connection& conn);
+
+
+private:
+    class ConnectionInfo {
+    public:
+        ConnectionInfo () : rx_busy{false}, tx_busy{false}, active{0}, generation{0} {}
+        std::queue<io_operation_t> rx_queue;
+        std::queue<io_operation_t> tx_queue;
+        // A worker thread is assigned to the queue
+        bool rx_busy;
+        bool tx_busy;
+        // Number of operations, and their callbacks, currently
+        // performed by worker threads
+        unsigned active;
+        // Incremented when operations are cancelled
+        unsigned generation;
+    };
+
+    // This is a singleton
+    IoThreadPool ();
+    static IoThreadPool* instance;
+
+    // Map a connection pointer to a ConnectionInfo object
+    std::map<Connection*, ConnectionInfo> connections;
+
+    // Connections with a queue waiting for a worker thread, (connection, rx)
+    std::deque<std::pair<Connection*, bool> > ready;
+
+    // Protect the above
+    std::mutex map_mutex;
+    std::condition_variable work_cond;
+    std::condition_variable idle_cond;
+
+    // Worker threads
+    std::vector<std::thread> workers;
+    bool done;
+
+    static void run_worker (IoThreadPool& tp);
+    void queue_op (Connection& conn, io_operation_t& op, bool rx);
+    bool is_worker_thread ();
+};
+
+
+}}
+#endif
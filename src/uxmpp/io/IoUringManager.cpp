@@ -0,0 +1,757 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/io/IoUringManager.hpp>
+#include <uxmpp/io/Connection.hpp>
+#include <uxmpp/io/io_operation.hpp>
+#include <uxmpp/Logger.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+UXMPP_START_NAMESPACE2(uxmpp, io)
+
+#define THIS_FILE "IoUringManager"
+
+#ifdef DEBUG_TRACE
+#undef DEBUG_TRACE
+#endif
+
+#if 0
+#define DEBUG_TRACE(prefix, ...) uxmpp_log_trace(prefix, ## __VA_ARGS__)
+#else
+#define DEBUG_TRACE(prefix, ...)
+#endif
+
+
+using namespace std;
+using namespace uxmpp;
+
+
+/*
+ * Reserved user_data values.
+ */
+static constexpr uint64_t quit_id   = 0;
+static constexpr uint64_t first_id  = 1;
+
+
+/*
+ * Static class attributes.
+ */
+IoUringManager* IoUringManager::instance = nullptr;
+
+/*
+ * File scope variables.
+ */
+static std::mutex instance_mutex;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static inline int sys_io_uring_setup (unsigned entries, struct io_uring_params* p)
+{
+    return (int) syscall (__NR_io_uring_setup, entries, p);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static inline int sys_io_uring_enter (int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int) syscall (__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static inline int sys_io_uring_register (int fd, unsigned opcode, const void* arg, unsigned nr_args)
+{
+    return (int) syscall (__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static inline void* ring_ptr (void* ring, unsigned offset)
+{
+    return static_cast<char*>(ring) + offset;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IoUringManager::IoUringManager ()
+    :
+    next_id {first_id},
+    have_fixed_buffers {false},
+    ring_fd {-1},
+    sq_ring {nullptr},
+    cq_ring {nullptr},
+    sqes {nullptr},
+    to_submit {0}
+{
+    // Create the io_uring instance
+    //
+    struct io_uring_params params;
+    memset (&params, 0, sizeof(params));
+    ring_fd = sys_io_uring_setup (UXMPP_IO_URING_ENTRIES, &params);
+    if (ring_fd < 0) {
+        string error_message = string("Unable to create io_uring instance: ") + string(strerror(errno));
+        uxmpp_log_info (THIS_FILE, error_message);
+        throw IoException (error_message);
+    }
+
+    // Map the submission and completion rings
+    //
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        sq_ring_size = cq_ring_size = max (sq_ring_size, cq_ring_size);
+    }
+    sq_ring = mmap (nullptr, sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                    ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+        sq_ring = nullptr;
+    }
+    else if (single_mmap) {
+        cq_ring = sq_ring;
+    }else{
+        cq_ring = mmap (nullptr, cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                        ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED)
+            cq_ring = nullptr;
+    }
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap (nullptr, sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                 ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        sqes = nullptr;
+
+    if (!sq_ring || !cq_ring || !sqes) {
+        string error_message = string("Unable to map io_uring rings: ") + string(strerror(errno));
+        uxmpp_log_error (THIS_FILE, error_message);
+        if (sqes)
+            munmap (sqes, sqes_size);
+        if (cq_ring && cq_ring!=sq_ring)
+            munmap (cq_ring, cq_ring_size);
+        if (sq_ring)
+            munmap (sq_ring, sq_ring_size);
+        ::close (ring_fd);
+        throw IoException (error_message);
+    }
+
+    sq_head    = static_cast<unsigned*> (ring_ptr(sq_ring, params.sq_off.head));
+    sq_tail    = static_cast<unsigned*> (ring_ptr(sq_ring, params.sq_off.tail));
+    sq_mask    = static_cast<unsigned*> (ring_ptr(sq_ring, params.sq_off.ring_mask));
+    sq_entries = static_cast<unsigned*> (ring_ptr(sq_ring, params.sq_off.ring_entries));
+    sq_array   = static_cast<unsigned*> (ring_ptr(sq_ring, params.sq_off.array));
+    cq_head    = static_cast<unsigned*> (ring_ptr(cq_ring, params.cq_off.head));
+    cq_tail    = static_cast<unsigned*> (ring_ptr(cq_ring, params.cq_off.tail));
+    cq_mask    = static_cast<unsigned*> (ring_ptr(cq_ring, params.cq_off.ring_mask));
+    cqes       = ring_ptr (cq_ring, params.cq_off.cqes);
+
+#ifdef IORING_RSRC_REGISTER_SPARSE
+    // Register an empty buffer table, slots are filled in by register_buffer
+    //
+    struct io_uring_rsrc_register rr;
+    memset (&rr, 0, sizeof(rr));
+    rr.nr    = UXMPP_IO_URING_MAX_BUFFERS;
+    rr.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (sys_io_uring_register(ring_fd, IORING_REGISTER_BUFFERS2, &rr, sizeof(rr)) == 0) {
+        have_fixed_buffers = true;
+        buffer_slots.resize (UXMPP_IO_URING_MAX_BUFFERS, false);
+    }else{
+        uxmpp_log_debug (THIS_FILE, "Registered buffers not supported: ", string(strerror(errno)));
+    }
+#endif
+
+    // Start the worker thread
+    //
+    worker = thread ([this](){
+            run_worker (*this);
+        });
+    worker_id = worker.get_id ();
+
+    DEBUG_TRACE (THIS_FILE, "Install 'atexit' function to clean up io_uring manager");
+    atexit ([](){
+            if (IoUringManager::instance)
+                delete IoUringManager::instance;
+        });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IoUringManager::~IoUringManager ()
+{
+    map_mutex.lock ();
+    connections.clear ();
+    inflight.clear ();
+    cancelling.clear ();
+
+    // Wake up the worker thread with a no-op
+    //
+    DEBUG_TRACE (THIS_FILE, "End worker thread");
+    auto sqe = static_cast<struct io_uring_sqe*> (get_sqe());
+    sqe->opcode    = IORING_OP_NOP;
+    sqe->user_data = quit_id;
+    flush_sqes ();
+    map_mutex.unlock ();
+    worker.join ();
+
+    munmap (sqes, sqes_size);
+    if (cq_ring != sq_ring)
+        munmap (cq_ring, cq_ring_size);
+    munmap (sq_ring, sq_ring_size);
+    ::close (ring_fd);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IoUringManager& IoUringManager::getInstance ()
+{
+    if (!instance) {
+        lock_guard<mutex> lock (instance_mutex);
+        if (!instance) {
+            uxmpp_log_debug (THIS_FILE, "Creating the IoUringManager instance");
+            instance = new IoUringManager;
+        }
+    }
+    return *instance;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool IoUringManager::is_available ()
+{
+    try {
+        getInstance ();
+    }
+    catch (IoException& ioe) {
+        return false;
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoUringManager::register_connection (Connection& connection)
+{
+    lock_guard<mutex> lock (map_mutex);
+    connections.emplace (&connection, ConnectionInfo());
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoUringManager::unregister_connection (Connection& connection)
+{
+    unique_lock<mutex> lock (map_mutex);
+
+    // Don't pull the connection away from under an I/O callback
+    //
+    bool worker_thread = this_thread::get_id() == worker_id;
+    if (!worker_thread)
+        wait_idle (lock, connection);
+
+    auto ci = connections.find (&connection);
+    if (ci == connections.end())
+        return;
+    vector<uint64_t> wait_ids;
+    if (ci->second.rx_id)
+        submit_cancel (ci->second.rx_id, wait_ids);
+    if (ci->second.tx_id)
+        submit_cancel (ci->second.tx_id, wait_ids);
+    connections.erase (ci);
+    if (!worker_thread) {
+        flush_sqes ();
+        wait_cancelled (lock, wait_ids);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoUringManager::read (Connection& conn,
+                           void* buf,
+                           size_t size,
+                           off_t offset,
+                           Connection::io_callback_t rx_cb)
+{
+    io_operation_t rx_op;
+    rx_op.connection = &conn;
+    rx_op.buf        = buf;
+    rx_op.size       = size;
+    rx_op.offset     = offset;
+    rx_op.result     = 0;
+    rx_op.errnum     = 0;
+    rx_op.callback   = rx_cb;
+
+    DEBUG_TRACE (THIS_FILE, "read, fd: ", conn.get_fd(), ", size: ", size);
+    queue_op (conn, rx_op, true);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoUringManager::write (Connection& conn,
+                            void* buf,
+                            size_t size,
+                            off_t offset,
+                            Connection::io_callback_t tx_cb)
+{
+    io_operation_t tx_op;
+    tx_op.connection = &conn;
+    tx_op.buf        = buf;
+    tx_op.size       = size;
+    tx_op.offset     = offset;
+    tx_op.result     = 0;
+    tx_op.errnum     = 0;
+    tx_op.callback   = tx_cb;
+
+    DEBUG_TRACE (THIS_FILE, "write, fd: ", conn.get_fd(), ", size: ", size);
+    queue_op (conn, tx_op, false);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoUringManager::queue_op (Connection& conn, io_operation_t& op, bool rx)
+{
+    lock_guard<mutex> lock (map_mutex);
+    auto ci = connections.find (&conn);
+    if (ci == connections.end()) {
+        uxmpp_log_debug (THIS_FILE, (rx?"read":"write"), " - connection not registered");
+        return;
+    }
+
+    auto& queue = rx ? ci->second.rx_queue : ci->second.tx_queue;
+    queue.push (op);
+
+    // Submit the operation now if there is no other operation in progress.
+    // Operations queued from the worker thread (i.e. from an I/O callback)
+    // are submitted in a batch when the worker thread waits for completions.
+    //
+    if ((rx ? ci->second.rx_id : ci->second.tx_id) == 0) {
+        submit_op (&conn, ci->second, rx);
+        if (this_thread::get_id() != worker_id)
+            flush_sqes ();
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoUringManager::cancel (Connection& conn)
+{
+    unique_lock<mutex> lock (map_mutex);
+
+    // Wait for I/O callbacks in progress first,
+    // they may queue new operations.
+    //
+    bool worker_thread = this_thread::get_id() == worker_id;
+    if (!worker_thread)
+        wait_idle (lock, conn);
+
+    auto ci = connections.find (&conn);
+    if (ci == connections.end())
+        return;
+
+    DEBUG_TRACE (THIS_FILE, "Cancel I/O operations for fd " , conn.get_fd());
+    ConnectionInfo& info = ci->second;
+    while (!info.rx_queue.empty())
+        info.rx_queue.pop ();
+    while (!info.tx_queue.empty())
+        info.tx_queue.pop ();
+
+    // Cancel operations already submitted to the kernel
+    //
+    vector<uint64_t> wait_ids;
+    if (info.rx_id) {
+        submit_cancel (info.rx_id, wait_ids);
+        info.rx_id = 0;
+    }
+    if (info.tx_id) {
+        submit_cancel (info.tx_id, wait_ids);
+        info.tx_id = 0;
+    }
+
+    // A read from a regular file that the kernel has already started
+    // can't be stopped, wait for it so the caller can release the
+    // buffer when we return. The worker thread can't wait for itself.
+    //
+    if (!worker_thread) {
+        flush_sqes ();
+        wait_cancelled (lock, wait_ids);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool IoUringManager::register_buffer (void* buf, size_t size)
+{
+#ifdef IORING_RSRC_REGISTER_SPARSE
+    lock_guard<mutex> lock (map_mutex);
+    if (!have_fixed_buffers || !buf || !size)
+        return false;
+
+    unsigned slot;
+    for (slot=0; slot<buffer_slots.size(); ++slot) {
+        if (!buffer_slots[slot])
+            break;
+    }
+    if (slot == buffer_slots.size()) {
+        uxmpp_log_debug (THIS_FILE, "No free slot for registered buffer");
+        return false;
+    }
+
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len  = size;
+    struct io_uring_rsrc_update2 update;
+    memset (&update, 0, sizeof(update));
+    update.offset = slot;
+    update.data   = reinterpret_cast<uint64_t> (&iov);
+    update.nr     = 1;
+    if (sys_io_uring_register(ring_fd, IORING_REGISTER_BUFFERS_UPDATE, &update, sizeof(update)) < 0) {
+        uxmpp_log_debug (THIS_FILE, "Unable to register buffer: ", string(strerror(errno)));
+        return false;
+    }
+    buffer_slots[slot] = true;
+    buffers[static_cast<char*>(buf)] = std::make_pair (slot, size);
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoUringManager::unregister_buffer (void* buf)
+{
+#ifdef IORING_RSRC_REGISTER_SPARSE
+    lock_guard<mutex> lock (map_mutex);
+    auto i = buffers.find (static_cast<char*>(buf));
+    if (i == buffers.end())
+        return;
+
+    // An empty iovec clears the slot. Submitted operations
+    // keep a reference to the old buffer until they complete.
+    //
+    struct iovec iov;
+    iov.iov_base = nullptr;
+    iov.iov_len  = 0;
+    struct io_uring_rsrc_update2 update;
+    memset (&update, 0, sizeof(update));
+    update.offset = i->second.first;
+    update.data   = reinterpret_cast<uint64_t> (&iov);
+    update.nr     = 1;
+    if (sys_io_uring_register(ring_fd, IORING_REGISTER_BUFFERS_UPDATE, &update, sizeof(update)) < 0)
+        uxmpp_log_debug (THIS_FILE, "Unable to unregister buffer: ", string(strerror(errno)));
+    buffer_slots[i->second.first] = false;
+    buffers.erase (i);
+#endif
+}
+
+
+//------------------------------------------------------------------------------
+// Called with map_mutex locked
+//------------------------------------------------------------------------------
+void* IoUringManager::get_sqe ()
+{
+    unsigned tail = *sq_tail;
+    if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= *sq_entries) {
+        // Submission queue is full
+        flush_sqes ();
+        while (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= *sq_entries) {
+            this_thread::yield ();
+            flush_sqes ();
+        }
+    }
+    unsigned index = tail & *sq_mask;
+    auto sqe = static_cast<struct io_uring_sqe*>(sqes) + index;
+    memset (sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    __atomic_store_n (sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++to_submit;
+    return sqe;
+}
+
+
+//------------------------------------------------------------------------------
+// Called with map_mutex locked
+//------------------------------------------------------------------------------
+void IoUringManager::flush_sqes ()
+{
+    if (!to_submit)
+        return;
+    int result = sys_io_uring_enter (ring_fd, to_submit, 0, 0);
+    if (result > 0) {
+        to_submit -= min ((unsigned)result, to_submit);
+    }
+    else if (result < 0 && errno != EAGAIN && errno != EBUSY && errno != EINTR) {
+        uxmpp_log_error (THIS_FILE, "io_uring_enter failed: ", string(strerror(errno)));
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Called with map_mutex locked
+//------------------------------------------------------------------------------
+void IoUringManager::submit_op (Connection* conn, ConnectionInfo& ci, bool rx)
+{
+    auto& queue = rx ? ci.rx_queue : ci.tx_queue;
+    if (queue.empty())
+        return;
+    io_operation_t& op = queue.front ();
+    uint64_t id = next_id++;
+
+    auto sqe = static_cast<struct io_uring_sqe*> (get_sqe());
+    sqe->opcode    = rx ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd        = conn->get_fd ();
+    sqe->addr      = reinterpret_cast<uint64_t> (op.buf);
+    sqe->len       = op.size;
+    sqe->off       = op.offset==-1 ? (uint64_t)-1 : (uint64_t)op.offset;
+    sqe->user_data = id;
+
+    // Use a registered buffer if the operation is within one
+    //
+    if (!buffers.empty() && op.buf) {
+        auto i = buffers.upper_bound (static_cast<char*>(op.buf));
+        if (i != buffers.begin()) {
+            --i;
+            if (static_cast<char*>(op.buf) + op.size <= i->first + i->second.second) {
+                sqe->opcode    = rx ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+                sqe->buf_index = i->second.first;
+            }
+        }
+    }
+
+    if (rx)
+        ci.rx_id = id;
+    else
+        ci.tx_id = id;
+    inflight[id] = InflightInfo {conn, rx, false};
+
+    DEBUG_TRACE (THIS_FILE, "Submit ", (rx?"read":"write"), " for fd ", conn->get_fd(), ", id: ", id);
+}
+
+
+//------------------------------------------------------------------------------
+// Called with map_mutex locked
+//------------------------------------------------------------------------------
+void IoUringManager::submit_poll (Connection* conn, ConnectionInfo& ci, bool rx)
+{
+    uint64_t id = next_id++;
+
+    auto sqe = static_cast<struct io_uring_sqe*> (get_sqe());
+    sqe->opcode       = IORING_OP_POLL_ADD;
+    sqe->fd           = conn->get_fd ();
+    sqe->poll32_events = rx ? POLLIN : POLLOUT;
+    sqe->user_data    = id;
+
+    if (rx)
+        ci.rx_id = id;
+    else
+        ci.tx_id = id;
+    inflight[id] = InflightInfo {conn, rx, true};
+}
+
+
+//------------------------------------------------------------------------------
+// Called with map_mutex locked
+//------------------------------------------------------------------------------
+void IoUringManager::submit_cancel (uint64_t id, std::vector<uint64_t>& wait_ids)
+{
+    inflight.erase (id);
+    uint64_t cancel_id = next_id++;
+    auto sqe = static_cast<struct io_uring_sqe*> (get_sqe());
+    sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+    sqe->fd        = -1;
+    sqe->addr      = id;
+    sqe->user_data = cancel_id;
+
+    // Both the cancelled operation and the cancel operation complete
+    cancelling.insert (id);
+    cancelling.insert (cancel_id);
+    wait_ids.push_back (id);
+    wait_ids.push_back (cancel_id);
+}
+
+
+//------------------------------------------------------------------------------
+// Called with map_mutex locked
+//------------------------------------------------------------------------------
+void IoUringManager::wait_cancelled (std::unique_lock<std::mutex>& lock, const std::vector<uint64_t>& wait_ids)
+{
+    cancel_cond.wait (lock, [this, &wait_ids]{
+            for (auto id : wait_ids) {
+                if (cancelling.find(id) != cancelling.end())
+                    return false;
+            }
+            return true;
+        });
+}
+
+
+//------------------------------------------------------------------------------
+// Called with map_mutex locked, not from the worker thread
+//------------------------------------------------------------------------------
+void IoUringManager::wait_idle (std::unique_lock<std::mutex>& lock, Connection& conn)
+{
+    idle_cond.wait (lock, [this, &conn]{
+            auto i = connections.find (&conn);
+            return i==connections.end() || i->second.active==0;
+        });
+}
+
+
+//------------------------------------------------------------------------------
+// Called from worker thread with map_mutex locked
+//------------------------------------------------------------------------------
+void IoUringManager::handle_completion (uint64_t id, int32_t res)
+{
+    auto i = inflight.find (id);
+    if (i == inflight.end()) {
+        DEBUG_TRACE (THIS_FILE, "Ignore completion for cancelled operation ", id);
+        return;
+    }
+    InflightInfo info = i->second;
+    inflight.erase (i);
+
+    auto ci = connections.find (info.conn);
+    if (ci == connections.end())
+        return;
+    uint64_t& active_id = info.rx ? ci->second.rx_id : ci->second.tx_id;
+    auto& queue = info.rx ? ci->second.rx_queue : ci->second.tx_queue;
+    if (active_id != id || queue.empty())
+        return;
+    active_id = 0;
+
+    // The file descriptor is ready after an EAGAIN, re-submit the operation
+    //
+    if (info.poll) {
+        submit_op (info.conn, ci->second, info.rx);
+        return;
+    }
+
+    // Non-blocking file descriptor without data, wait for it to be ready
+    //
+    if (res == -EAGAIN) {
+        submit_poll (info.conn, ci->second, info.rx);
+        return;
+    }
+
+    io_operation_t op = queue.front ();
+    queue.pop ();
+    op.result = res<0 ? -1 : res;
+    op.errnum = res<0 ? -res : 0;
+
+    DEBUG_TRACE (THIS_FILE, (info.rx?"RX":"TX"), " result from ", info.conn->get_fd(), ": ", op.result);
+
+    // The connection stays active until the callback returns,
+    // cancel() and unregister_connection() wait for it.
+    //
+    if (op.callback) {
+        ++ci->second.active;
+        map_mutex.unlock ();
+        op.callback (*info.conn, op.buf, op.result, op.errnum);
+        map_mutex.lock ();
+    }
+
+    // Submit the next queued operation, if any,
+    // unless a callback already did that.
+    //
+    ci = connections.find (info.conn);
+    if (ci != connections.end()) {
+        if (op.callback) {
+            --ci->second.active;
+            idle_cond.notify_all ();
+        }
+        if ((info.rx ? ci->second.rx_id : ci->second.tx_id) == 0)
+            submit_op (info.conn, ci->second, info.rx);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IoUringManager::run_worker (IoUringManager& um)
+{
+    bool done = false;
+    auto cqes = static_cast<struct io_uring_cqe*> (um.cqes);
+
+    DEBUG_TRACE (THIS_FILE, "Worker thread started");
+
+    while (!done) {
+        // Submit batched operations and wait for at least one completion
+        //
+        // The entries are claimed under the lock, other threads
+        // only flush entries queued after this point.
+        //
+        um.map_mutex.lock ();
+        unsigned submit = um.to_submit;
+        um.to_submit = 0;
+        um.map_mutex.unlock ();
+
+        auto result = sys_io_uring_enter (um.ring_fd, submit, 1, IORING_ENTER_GETEVENTS);
+        if (result < 0) {
+            if (errno!=EINTR && errno!=EAGAIN && errno!=EBUSY)
+                uxmpp_log_error (THIS_FILE, "io_uring_enter failed: ", string(strerror(errno)));
+        }
+
+        // Reap completions
+        //
+        lock_guard<mutex> lock (um.map_mutex);
+        if ((unsigned) max(result, 0) < submit)
+            um.to_submit += submit - max (result, 0);
+        unsigned head = *um.cq_head;
+        while (head != __atomic_load_n(um.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe cqe = cqes[head & *um.cq_mask];
+            ++head;
+            __atomic_store_n (um.cq_head, head, __ATOMIC_RELEASE);
+
+            if (cqe.user_data == quit_id) {
+                done = true;
+                continue;
+            }
+            if (um.cancelling.erase(cqe.user_data)) {
+                um.cancel_cond.notify_all ();
+                continue;
+            }
+            um.handle_completion (cqe.user_data, cqe.res);
+        }
+    }
+
+    DEBUG_TRACE (THIS_FILE, "Worker thread ending");
+}
+
+
+UXMPP_END_NAMESPACE2
@@ -0,0 +1,240 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_IO_IOURINGMANAGER_HPP
+#define UXMPP_IO_IOURINGMANAGER_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/io/IoException.hpp>
+#include <uxmpp/io/Connection.hpp>
+#include <uxmpp/io/io_operation.hpp>
+
+#include <queue>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+
+#include <sys/uio.h>
+
+
+namespace uxmpp { namespace io {
+
+
+/**
+ * Maximum number of buffers that can be registered with the io_uring backend.
+ */
+#define UXMPP_IO_URING_MAX_BUFFERS 64
+
+/**
+ * Number of submission queue entries in the io_uring instance.
+ */
+#define UXMPP_IO_URING_ENTRIES 256
+
+
+/**
+ * Class to handle connection I/O operations using Linux io_uring.
+ * Singleton.
+ *
+ * Read and write operations are submitted directly to the kernel as
+ * submission queue entries, the connection doesn't wait for poll
+ * readiness before the data is transferred. Operations queued from
+ * an I/O callback are batched and submitted together with the next
+ * wait for completions, this makes a typical read-callback-read cycle
+ * cost one system call.
+ *
+ * Operations are performed in order, one read and one write at a time
+ * per connection, just like the ConnectionManager.
+ * Note that the methods Connection::do_read and Connection::do_write
+ * are never called, connections that need to process the data (for
+ * example to encrypt it) must use the ConnectionManager.
+ */
+class IoUringManager {
+public:
+    /**
+     * Destructor.
+     */
+    virtual ~IoUringManager ();
+
+    /**
+     * Disabled copy constructor.
+     */
+    IoUringManager (const IoUringManager& um) = delete;
+
+    /**
+     * Disabled assignment operator.
+     */
+    IoUringManager& operator= (const IoUringManager& um) = delete;
+
+    /**
+     * Return a reference to the IoUringManager instance.
+     * @throw IoException If the io_uring instance can't be created.
+     */
+    static IoUringManager& getInstance ();
+
+    /**
+     * Check if io_uring is supported by the running kernel.
+     */
+    static bool is_available ();
+
+    /**
+     *
+     */
+    void register_connection (Connection& connection);
+
+    /**
+     * Unregister a connection, operations in progress are cancelled.
+     * Unless called from an I/O callback, this method doesn't return
+     * until the kernel is done with the buffers of the connection
+     * and the I/O callbacks in progress have returned.
+     */
+    void unregister_connection (Connection& connection);
+
+    /**
+     * Queue a read operation for a connection.
+     */
+    void read (Connection& conn,
+               void* buf,
+               size_t size,
+               off_t offset,
+               Connection::io_callback_t rx_cb=nullptr);
+
+    /**
+     * Queue a write operation for a connection.
+     */
+    void write (Connection& conn,
+                void* buf,
+                size_t size,
+                off_t offset,
+                Connection::io_callback_t tx_cb=nullptr);
+
+    /**
+     * Cancel all operation for a connection, their callbacks will not
+     * be called. Unless called from an I/O callback, this method waits
+     * for operations already submitted to the kernel to end, and for
+     * I/O callbacks in progress to return, so the caller can release
+     * the buffers when it returns.
+     */
+    void cancel (Connection& conn);
+
+    /**
+     * Register a buffer with the kernel.
+     * Reads and writes to/from a registered buffer are done
+     * without mapping the user pages for each operation.
+     * @param buf The start of the memory area.
+     * @param size The size of the memory area.
+     * @return True if the buffer was registered.
+     */
+    bool register_buffer (void* buf, size_t size);
+
+    /**
+     * Unregister a buffer previously registered by register_buffer.
+     * @param buf The start of the memory area.
+     */
+    void unregister_buffer (void* buf);
+
+
+private:
+    class ConnectionInfo {
+    public:
+        ConnectionInfo () : rx_id{0}, tx_id{0}, active{0} {}
+        std::queue<io_operation_t> rx_queue;
+        std::queue<io_operation_t> tx_queue;
+        // ID of the submitted operation, 0 if none
+        uint64_t rx_id;
+        uint64_t tx_id;
+        // Number of I/O callbacks currently running
+        unsigned active;
+    };
+
+    class InflightInfo {
+    public:
+        Connection* conn;
+        bool rx;   // Read or write operation
+        bool poll; // Waiting for readiness after EAGAIN
+    };
+
+    // This is a singleton
+    IoUringManager ();
+    static IoUringManager* instance;
+
+    // Map a connection pointer to a ConnectionInfo object
+    std::map<Connection*, ConnectionInfo> connections;
+
+    // Submitted operations
+    std::unordered_map<uint64_t, InflightInfo> inflight;
+    uint64_t next_id;
+
+    // Registered buffers, start address -> (slot, size)
+    std::map<char*, std::pair<unsigned, size_t> > buffers;
+    std::vector<bool> buffer_slots;
+    bool have_fixed_buffers;
+
+    // Cancelled operations, and the cancel operations,
+    // whose completions haven't been reaped yet
+    std::unordered_set<uint64_t> cancelling;
+    std::condition_variable cancel_cond;
+
+    // Signalled when an I/O callback returns
+    std::condition_variable idle_cond;
+
+    // Protects all of the above and the submission queue
+    std::mutex map_mutex;
+
+    // Worker thread reaping completions
+    std::thread worker;
+    std::thread::id worker_id;
+
+    // io_uring instance
+    int ring_fd;
+    void*    sq_ring;
+    size_t   sq_ring_size;
+    void*    cq_ring;
+    size_t   cq_ring_size;
+    void*    sqes;
+    size_t   sqes_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_entries;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    void*     cqes;
+    unsigned  to_submit;
+
+    static void run_worker (IoUringManager& um);
+    void queue_op (Connection& conn, io_operation_t& op, bool rx);
+    void submit_op (Connection* conn, ConnectionInfo& ci, bool rx);
+    void submit_poll (Connection* conn, ConnectionInfo& ci, bool rx);
+    void submit_cancel (uint64_t id, std::vector<uint64_t>& wait_ids);
+    void wait_cancelled (std::unique_lock<std::mutex>& lock, const std::vector<uint64_t>& wait_ids);
+    void wait_idle (std::unique_lock<std::mutex>& lock, Connection& conn);
+    void* get_sqe ();
+    void flush_sqes ();
+    void handle_completion (uint64_t id, int32_t res);
+};
+
+
+}}
+#endif
@@ -24,8 +24,13 @@
 #include <netinet/in.h>
 #include <netinet/ip6.h>
 #include <arpa/inet.h>
+#ifdef UXMPP_HAVE_SPLICE
+#include <sys/sendfile.h>
+#endif
 #include <cstring>
+#include <algorithm>
 #include <openssl/err.h>
+#include <openssl/pem.h>
 
 
 UXMPP_START_NAMESPACE2(uxmpp, io)
@@ -35,6 +40,13 @@ using namespace std;
 
 static const std::string log_unit {"SocketConnection"};
 
+// Size of the buffers used when file data is copied
+static constexpr size_t file_buf_size = 65536;
+
+// Size of the pipe used by splice(), the most
+// data moved from the socket by one read
+static constexpr int splice_pipe_size = 1024 * 1024;
+
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
@@ -54,6 +66,31 @@ static string get_tls_error_text (int result)
 }
 
 
+//------------------------------------------------------------------------------
+// Load the PEM encoded certificate and private key of a TLS server.
+//------------------------------------------------------------------------------
+static bool use_certificate (SSL_CTX* ssl_ctx, const TlsConfig& tls_cfg)
+{
+    bool result = false;
+    BIO* cert_bio = BIO_new_mem_buf (tls_cfg.cert_pem.data(), tls_cfg.cert_pem.size());
+    BIO* key_bio  = BIO_new_mem_buf (tls_cfg.key_pem.data(), tls_cfg.key_pem.size());
+    X509* cert    = PEM_read_bio_X509 (cert_bio, nullptr, nullptr, nullptr);
+    EVP_PKEY* key = PEM_read_bio_PrivateKey (key_bio, nullptr, nullptr, nullptr);
+    if (cert && key) {
+        result = SSL_CTX_use_certificate(ssl_ctx, cert) == 1 &&
+            SSL_CTX_use_PrivateKey(ssl_ctx, key) == 1 &&
+            SSL_CTX_check_private_key(ssl_ctx) == 1;
+    }
+    if (cert)
+        X509_free (cert);
+    if (key)
+        EVP_PKEY_free (key);
+    BIO_free (cert_bio);
+    BIO_free (key_bio);
+    return result;
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 SocketConnection::SocketConnection ()
@@ -63,8 +100,15 @@ SocketConnection::SocketConnection ()
     bind_to_local_addr (false),
     bind_to_local_port (false),
     ssl_ctx (nullptr),
-    ssl (nullptr)
+    ssl (nullptr),
+    tx_wire_pos (0),
+    tx_data_buf (nullptr),
+    tx_data_size (0),
+    tx_file {-1},
+    rx_file {-1},
+    zero_copy (true)
 {
+    splice_pipe[0] = splice_pipe[1] = -1;
 }
 
 
@@ -76,8 +120,15 @@ SocketConnection::SocketConnection (const IpHostAddr& bind_addr)
     connected (false),
     tls_enabled (false),
     ssl_ctx (nullptr),
-    ssl (nullptr)
+    ssl (nullptr),
+    tx_wire_pos (0),
+    tx_data_buf (nullptr),
+    tx_data_size (0),
+    tx_file {-1},
+    rx_file {-1},
+    zero_copy (true)
 {
+    splice_pipe[0] = splice_pipe[1] = -1;
     bind_to_local_port = local_addr.port != 0;
 
     switch (local_addr.type) {
@@ -112,6 +163,7 @@ SocketConnection::SocketConnection (const IpHostAddr& bind_addr)
 SocketConnection::~SocketConnection ()
 {
     disconnect ();
+    close_splice_pipe ();
 }
 
 
@@ -121,6 +173,15 @@ void SocketConnection::disconnect ()
 {
     close ();
     connected = false;
+    tls_enabled = false;
+    if (ssl) {
+        SSL_free (ssl);
+        ssl = nullptr;
+    }
+    if (ssl_ctx) {
+        SSL_CTX_free (ssl_ctx);
+        ssl_ctx = nullptr;
+    }
 }
 
 
@@ -320,6 +381,10 @@ void SocketConnection::connect (const IpHostAddr& addr, const TlsConfig& tls_cfg
     peer_addr = addr;
     this->tls_cfg = tls_cfg;
     connected = false;
+    compressor.reset ();
+    tx_wire_buf.clear ();
+    tx_wire_pos = 0;
+    tx_data_buf = nullptr;
 
     int errnum = 0;
     struct sockaddr_in  saddr4;
@@ -379,6 +444,55 @@ void SocketConnection::connect (const IpHostAddr& addr, const TlsConfig& tls_cfg
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void SocketConnection::attach (int fd)
+{
+    if (get_fd() != -1)
+        disconnect ();
+
+    connected = false;
+    compressor.reset ();
+    tx_wire_buf.clear ();
+    tx_wire_pos = 0;
+    tx_data_buf = nullptr;
+
+    int flags = fcntl (fd, F_GETFL, 0);
+    if (flags==-1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK)==-1)
+        uxmpp_log_warning (log_unit, "Unable to set the socket in non-blocking mode - ", string(strerror(errno)));
+
+    // Get the peer and local addresses
+    //
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len = sizeof (saddr);
+    for (auto addr : {&peer_addr, &local_addr}) {
+        saddr_len = sizeof (saddr);
+        int result = addr==&peer_addr ?
+            getpeername (fd, reinterpret_cast<struct sockaddr*>(&saddr), &saddr_len) :
+            getsockname (fd, reinterpret_cast<struct sockaddr*>(&saddr), &saddr_len);
+        if (result)
+            continue;
+        addr->proto = AddrProto::tcp;
+        if (saddr.ss_family == AF_INET) {
+            auto saddr4 = reinterpret_cast<struct sockaddr_in*> (&saddr);
+            addr->type = AddrType::ipv4;
+            addr->ipv4 = saddr4->sin_addr.s_addr;
+            addr->port = saddr4->sin_port;
+        }
+        else if (saddr.ss_family == AF_INET6) {
+            auto saddr6 = reinterpret_cast<struct sockaddr_in6*> (&saddr);
+            addr->type = AddrType::ipv6;
+            memcpy (&addr->ipv6, &saddr6->sin6_addr, sizeof(saddr6->sin6_addr));
+            addr->port = saddr6->sin6_port;
+        }
+    }
+
+    set_fd (fd);
+    connected = true;
+    uxmpp_log_debug (log_unit, "Attached to connection from ", to_string(peer_addr));
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void SocketConnection::handle_connection_result ()
@@ -463,7 +577,9 @@ void SocketConnection::enable_tls (const TlsConfig& tls_cfg)
     const SSL_METHOD* method = nullptr;
     switch (tls_cfg.method) {
     case TlsMethod::sslv3:
+#ifndef OPENSSL_NO_SSL3_METHOD
         method = SSLv3_method ();
+#endif
         break;
     case TlsMethod::tlsv1:
         method = TLSv1_method ();
@@ -497,6 +613,21 @@ void SocketConnection::enable_tls (const TlsConfig& tls_cfg)
     //
     SSL_CTX_set_verify (ssl_ctx, tls_cfg.verify_server ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, nullptr);
 
+    // Set the certificate and private key in server mode
+    //
+    if (tls_cfg.server && !use_certificate(ssl_ctx, tls_cfg)) {
+        string tls_error = get_tls_error_text (0);
+        uxmpp_log_error (log_unit, "Unable to use the TLS certificate - ", tls_error);
+        SSL_CTX_free (ssl_ctx);
+        ssl_ctx = nullptr;
+        msg_timer.set (Timer::now, [tls_error, this](){
+                // Notify the TLS connection result.
+                if (tls_connected_cb)
+                    tls_connected_cb (*this, SSL_ERROR_SSL, tls_error);
+            });
+        return;
+    }
+
     // Create the SSL stream object
     //
     uxmpp_log_trace (log_unit, "Create SSL object");
@@ -556,7 +687,8 @@ void SocketConnection::enable_tls (const TlsConfig& tls_cfg)
 //------------------------------------------------------------------------------
 void SocketConnection::handle_tls_connection_result (Connection& c, void* p, ssize_t r, int e)
 {
-    int result = SSL_connect (ssl); // Perform (partial) connection
+    // Perform (partial) connection
+    int result = tls_cfg.server ? SSL_accept(ssl) : SSL_connect(ssl);
     int err = SSL_get_error (ssl, result);
 
     if (result == 1) {
@@ -597,7 +729,33 @@ void SocketConnection::handle_tls_connection_result (Connection& c, void* p, ssi
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-ssize_t SocketConnection::do_read (void* buf, size_t size, off_t offset, int& errnum)
+bool SocketConnection::enable_compression (int level)
+{
+    std::unique_ptr<ZlibCompressor> zc (new ZlibCompressor(level));
+    if (!zc->is_valid())
+        return false;
+    compressor = std::move (zc);
+    tx_wire_buf.clear ();
+    tx_wire_pos = 0;
+    tx_data_buf = nullptr;
+    uxmpp_log_debug (log_unit, "Stream compression enabled");
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+compression_stats_t SocketConnection::get_compression_stats () const
+{
+    if (compressor)
+        return compressor->get_stats ();
+    return compression_stats_t {0, 0, 0, 0};
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+ssize_t SocketConnection::raw_read (void* buf, size_t size, int& errnum)
 {
     if (is_tls_enabled()) {
         int result = SSL_read (ssl, buf, size);
@@ -613,7 +771,7 @@ ssize_t SocketConnection::do_read (void* buf, size_t size, off_t offset, int& er
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-ssize_t SocketConnection::do_write (void* buf, size_t size, off_t offset, int& errnum)
+ssize_t SocketConnection::raw_write (void* buf, size_t size, int& errnum)
 {
     if (is_tls_enabled()) {
         int result = SSL_write (ssl, buf, size);
@@ -627,4 +785,276 @@ ssize_t SocketConnection::do_write (void* buf, size_t size, off_t offset, int& e
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+ssize_t SocketConnection::do_read (void* buf, size_t size, off_t offset, int& errnum)
+{
+    if (buf == &rx_file)
+        return read_file_data (size, offset, errnum);
+
+    if (!compressor)
+        return raw_read (buf, size, errnum);
+
+    // Read compressed data until there is
+    // something to return to the caller.
+    //
+    while (true) {
+        if (compressor->have_rx_data()) {
+            ssize_t result = compressor->decompress (buf, size);
+            if (result < 0) {
+                errnum = EIO;
+                return -1;
+            }
+            if (result > 0)
+                return result;
+        }
+        ssize_t result = raw_read (compressor->get_rx_buf(), compressor->get_rx_buf_size(), errnum);
+        if (result <= 0)
+            return result;
+        compressor->set_rx_size (result);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool SocketConnection::flush_tx_wire_buf (int& errnum)
+{
+    while (tx_wire_pos < tx_wire_buf.size()) {
+        ssize_t result = raw_write (&tx_wire_buf[tx_wire_pos],
+                                    tx_wire_buf.size() - tx_wire_pos,
+                                    errnum);
+        if (result <= 0) {
+            if (result == 0)
+                errnum = EPIPE;
+            return false;
+        }
+        tx_wire_pos += result;
+        compressor->add_tx_wire (result);
+    }
+    tx_wire_buf.clear ();
+    tx_wire_pos = 0;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+ssize_t SocketConnection::do_write (void* buf, size_t size, off_t offset, int& errnum)
+{
+    if (buf == &tx_file)
+        return write_file_data (size, offset, errnum);
+
+    if (!compressor)
+        return raw_write (buf, size, errnum);
+
+    // If the socket wasn't writable the last time, this is the same
+    // write operation again. The data is already compressed, keep
+    // sending it. Otherwise, compress the whole buffer as one
+    // block ending with a sync flush.
+    //
+    bool retry = tx_data_buf==buf && tx_data_size==size && !tx_wire_buf.empty();
+    if (!retry) {
+        // Data compressed for a cancelled write must still be sent,
+        // the peer needs it to decompress what follows.
+        if (!flush_tx_wire_buf(errnum))
+            return -1;
+        if (!compressor->compress(buf, size, tx_wire_buf)) {
+            errnum = EIO;
+            return -1;
+        }
+        tx_data_buf  = buf;
+        tx_data_size = size;
+    }
+    if (!flush_tx_wire_buf(errnum))
+        return -1;
+
+    tx_data_buf = nullptr;
+    return size;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void SocketConnection::write_from_file (int file_fd, size_t size, off_t offset, io_callback_t tx_cb)
+{
+    tx_file.fd = file_fd;
+    write_offset (&tx_file, size, offset, tx_cb);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void SocketConnection::read_to_file (int file_fd, size_t size, off_t offset, io_callback_t rx_cb)
+{
+    rx_file.fd = file_fd;
+    read_offset (&rx_file, size, offset, rx_cb);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool SocketConnection::is_zero_copy () const
+{
+#ifdef UXMPP_HAVE_SPLICE
+    return zero_copy && !tls_enabled && !compressor;
+#else
+    return false;
+#endif
+}
+
+
+//------------------------------------------------------------------------------
+// Called from the I/O thread.
+//------------------------------------------------------------------------------
+ssize_t SocketConnection::write_file_data (size_t size, off_t offset, int& errnum)
+{
+#ifdef UXMPP_HAVE_SPLICE
+    if (is_zero_copy()) {
+        ssize_t result = sendfile (get_fd(), tx_file.fd, offset==-1 ? nullptr : &offset, size);
+        errnum = result<0 ? errno : 0;
+        // sendfile() can't read from all kinds of files, copy the data instead
+        if (result>=0 || (errnum!=EINVAL && errnum!=ENOSYS))
+            return result;
+    }
+#endif
+
+    if (!tx_file_buf)
+        tx_file_buf.reset (new char[file_buf_size]);
+    size = std::min (size, file_buf_size);
+    ssize_t result = offset==-1 ?
+        ::read (tx_file.fd, tx_file_buf.get(), size) :
+        ::pread (tx_file.fd, tx_file_buf.get(), size, offset);
+    if (result <= 0) {
+        errnum = result<0 ? errno : 0;
+        return result;
+    }
+    size_t read_size = result;
+    result = do_write (tx_file_buf.get(), read_size, -1, errnum);
+
+    // Data read but not sent is read again the next time
+    //
+    size_t sent = result>0 ? result : 0;
+    if (offset==-1 && sent<read_size)
+        lseek (tx_file.fd, -static_cast<off_t>(read_size-sent), SEEK_CUR);
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+// Called from the I/O thread.
+//------------------------------------------------------------------------------
+ssize_t SocketConnection::read_file_data (size_t size, off_t offset, int& errnum)
+{
+#ifdef UXMPP_HAVE_SPLICE
+    if (is_zero_copy() && open_splice_pipe()) {
+        ssize_t result = splice (get_fd(), nullptr, splice_pipe[1], nullptr, size,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (result <= 0) {
+            errnum = result<0 ? errno : 0;
+            return result;
+        }
+
+        // Move all of it from the pipe to the file
+        //
+        size_t left = result;
+        while (left > 0) {
+            ssize_t moved = splice (splice_pipe[0], nullptr, rx_file.fd, offset==-1 ? nullptr : &offset,
+                                    left, SPLICE_F_MOVE);
+            if (moved > 0) {
+                left -= moved;
+                continue;
+            }
+            errnum = moved<0 ? errno : EIO;
+            if (errnum != EINVAL) {
+                close_splice_pipe ();
+                return -1;
+            }
+
+            // splice() can't write to all kinds of files, copy the data instead
+            //
+            if (!rx_file_buf)
+                rx_file_buf.reset (new char[file_buf_size]);
+            while (left > 0) {
+                ssize_t n = ::read (splice_pipe[0], rx_file_buf.get(), std::min(left, file_buf_size));
+                if (n<=0 || copy_to_file(rx_file_buf.get(), n, offset, errnum) < 0) {
+                    if (n <= 0)
+                        errnum = n<0 ? errno : EIO;
+                    close_splice_pipe ();
+                    return -1;
+                }
+                left -= n;
+                if (offset != -1)
+                    offset += n;
+            }
+        }
+        errnum = 0;
+        return result;
+    }
+#endif
+
+    if (!rx_file_buf)
+        rx_file_buf.reset (new char[file_buf_size]);
+    ssize_t result = do_read (rx_file_buf.get(), std::min(size, file_buf_size), -1, errnum);
+    if (result <= 0)
+        return result;
+    return copy_to_file (rx_file_buf.get(), result, offset, errnum);
+}
+
+
+//------------------------------------------------------------------------------
+// Write all data to the file, return the size or -1 on error.
+//------------------------------------------------------------------------------
+ssize_t SocketConnection::copy_to_file (const char* buf, size_t size, off_t offset, int& errnum)
+{
+    size_t written = 0;
+    while (written < size) {
+        ssize_t result = offset==-1 ?
+            ::write (rx_file.fd, buf+written, size-written) :
+            ::pwrite (rx_file.fd, buf+written, size-written, offset+written);
+        if (result <= 0) {
+            errnum = result<0 ? errno : EIO;
+            return -1;
+        }
+        written += result;
+    }
+    errnum = 0;
+    return size;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool SocketConnection::open_splice_pipe ()
+{
+#ifdef UXMPP_HAVE_SPLICE
+    if (splice_pipe[0] != -1)
+        return true;
+    if (pipe2(splice_pipe, O_CLOEXEC)) {
+        uxmpp_log_warning (log_unit, "Unable to create a pipe: ", string(strerror(errno)));
+        splice_pipe[0] = splice_pipe[1] = -1;
+        return false;
+    }
+    // A larger pipe moves more data for each read, it is
+    // fine if the system limit doesn't allow it
+    fcntl (splice_pipe[1], F_SETPIPE_SZ, splice_pipe_size);
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void SocketConnection::close_splice_pipe ()
+{
+    if (splice_pipe[0] != -1) {
+        ::close (splice_pipe[0]);
+        ::close (splice_pipe[1]);
+        splice_pipe[0] = splice_pipe[1] = -1;
+    }
+}
+
+
 UXMPP_END_NAMESPACE2
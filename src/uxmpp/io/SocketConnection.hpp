@@ -24,6 +24,7 @@
 #include <uxmpp/io/TlsConfig.hpp>
 #include <uxmpp/io/IpHostAddr.hpp>
 #include <uxmpp/io/Timer.hpp>
+#include <uxmpp/io/ZlibCompressor.hpp>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -32,6 +33,8 @@
 #include <netinet/in.h>
 #include <netinet/ip6.h>
 #include <arpa/inet.h>
+#include <memory>
+#include <string>
 
 
 namespace uxmpp { namespace io {
@@ -105,6 +108,15 @@ namespace uxmpp { namespace io {
          */
         void connect (const IpHostAddr& peer_addr, const TlsConfig& tls_config);
 
+        /**
+         * Use a socket that is already connected, for example
+         * one returned by accept(). The socket is set to
+         * non-blocking mode and the connection is considered
+         * connected, no connect callback is called.
+         * @param fd A connected TCP socket.
+         */
+        void attach (int fd);
+
         /**
          * Disconnect the socket.
          */
@@ -146,6 +158,83 @@ namespace uxmpp { namespace io {
             return tls_enabled;
         }
 
+        /**
+         * Compress all data read and written from now on (XEP-0138).
+         * Compression is done before TLS encryption.
+         * Cancel all I/O operations before calling this.
+         * Compression is disabled when a new connection is made.
+         * @param level zlib compression level, 0-9 or Z_DEFAULT_COMPRESSION.
+         * @return True if compression is enabled.
+         */
+        bool enable_compression (int level=Z_DEFAULT_COMPRESSION);
+
+        /**
+         * Return true if stream compression is enabled.
+         */
+        bool is_compression_enabled () const {
+            return compressor != nullptr;
+        }
+
+        /**
+         * Return the byte counters for the compressed stream.
+         * All counters are zero if compression isn't enabled.
+         */
+        compression_stats_t get_compression_stats () const;
+
+        /**
+         * Queue a write of data read from a file.
+         * With sendfile() the data is moved from the file to the
+         * socket by the kernel, without being copied to user space.
+         * Without sendfile(), or if TLS or compression is enabled, the
+         * data is copied through a buffer. The write callback is called
+         * with the number of bytes sent, that may be less than 'size',
+         * and 0 at the end of the file. The buffer pointer passed to
+         * the callback doesn't point to the data.
+         * Only one file at a time can be written from.
+         * @param file_fd A file descriptor open for reading.
+         * @param size The maximum number of bytes to send.
+         * @param offset The offset in the file where to start reading,
+         *               or -1 to read from, and update, the file position.
+         * @param tx_cb An optional callback, if nullptr the callback
+         *              set with set_tx_cb is used.
+         */
+        void write_from_file (int file_fd, size_t size, off_t offset=-1, io_callback_t tx_cb=nullptr);
+
+        /**
+         * Queue a read of data that is written to a file.
+         * With splice() the data is moved from the socket to the
+         * file through a pipe by the kernel, without being copied
+         * to user space. Without splice(), or if TLS or compression
+         * is enabled, the data is copied through a buffer. The read
+         * callback is called with the number of bytes written to the
+         * file, and 0 when the peer has closed the connection. The
+         * buffer pointer passed to the callback doesn't point to the data.
+         * Only one file at a time can be read to. splice() can't
+         * write to a file opened with O_APPEND.
+         * @param file_fd A file descriptor open for writing.
+         * @param size The maximum number of bytes to receive.
+         * @param offset The offset in the file where to start writing,
+         *               or -1 to write at, and update, the file position.
+         * @param rx_cb An optional callback, if nullptr the callback
+         *              set with set_rx_cb is used.
+         */
+        void read_to_file (int file_fd, size_t size, off_t offset=-1, io_callback_t rx_cb=nullptr);
+
+        /**
+         * Use sendfile() and splice() in write_from_file and read_to_file,
+         * if they are available. This is enabled by default.
+         * When disabled, data is always copied through a buffer.
+         */
+        void set_zero_copy (bool enable) {
+            zero_copy = enable;
+        }
+
+        /**
+         * Return true if the data of write_from_file and read_to_file
+         * is moved by the kernel and not copied through a buffer.
+         */
+        bool is_zero_copy () const;
+
         /**
          * Do the actual reading from the file descriptor.
          * This method should not be called directly and should
@@ -198,6 +287,38 @@ namespace uxmpp { namespace io {
          */
         SSL* ssl;
 
+        /**
+         * Stream compression, nullptr if not enabled.
+         */
+        std::unique_ptr<ZlibCompressor> compressor;
+
+        /**
+         * Compressed data not yet written, and the buffer it was made from.
+         */
+        std::string tx_wire_buf;
+        size_t      tx_wire_pos;
+        void*       tx_data_buf;
+        size_t      tx_data_size;
+
+        /**
+         * The files of write_from_file and read_to_file. The address of
+         * these is the buffer of the queued I/O operation.
+         */
+        struct file_io_t {
+            int fd;
+        };
+        file_io_t tx_file;
+        file_io_t rx_file;
+        bool zero_copy;
+
+        /**
+         * The pipe used by splice(), and the buffers used
+         * when the file data is copied.
+         */
+        int splice_pipe[2];
+        std::unique_ptr<char[]> tx_file_buf;
+        std::unique_ptr<char[]> rx_file_buf;
+
         bool open_socket (const IpHostAddr& addr,
                           struct sockaddr_in& saddr4,
                           struct sockaddr_in6& saddr6,
@@ -207,6 +328,14 @@ namespace uxmpp { namespace io {
         bool bind_socket ();
         void handle_connection_result ();
         void handle_tls_connection_result (Connection& c, void* p, ssize_t r, int e);
+        ssize_t raw_read (void* buf, size_t size, int& errnum);
+        ssize_t raw_write (void* buf, size_t size, int& errnum);
+        bool flush_tx_wire_buf (int& errnum);
+        ssize_t write_file_data (size_t size, off_t offset, int& errnum);
+        ssize_t read_file_data (size_t size, off_t offset, int& errnum);
+        ssize_t copy_to_file (const char* buf, size_t size, off_t offset, int& errnum);
+        bool open_splice_pipe ();
+        void close_splice_pipe ();
     };
 
 
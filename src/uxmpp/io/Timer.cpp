@@ -18,6 +18,7 @@
  */
 #include <uxmpp/io/Timer.hpp>
 #include <uxmpp/Logger.hpp>
+#include <uxmpp/Metrics.hpp>
 #include <condition_variable>
 #include <functional>
 #include <map>
@@ -74,6 +75,27 @@ std::chrono::microseconds Timer::now  {Timer::microseconds (0)};
 std::chrono::microseconds Timer::zero {Timer::microseconds (0)};
 
 
+//------------------------------------------------------------------------------
+// The metrics are never removed from the registry, so the raw
+// pointers stay valid even while static objects are destroyed.
+//------------------------------------------------------------------------------
+static Metric& armed_metric ()
+{
+    static Metric* metric = Metrics::get_instance().add (MetricType::gauge,
+                                                         "uxmpp_timer_armed",
+                                                         "Number of armed timers.").get ();
+    return *metric;
+}
+static Metric& lag_metric ()
+{
+    static Metric* metric = Metrics::get_instance().add (MetricType::summary,
+                                                         "uxmpp_timer_expiry_lag_seconds",
+                                                         "Delay between the timeout and the timer callback.",
+                                                         "", 1e-9).get ();
+    return *metric;
+}
+
+
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
@@ -91,10 +113,15 @@ static void worker_function ()
         // sleep until entry.timeout or set is modified
         if (resource_cond.wait_until(lock, timeout) != std::cv_status::timeout)
             continue; // Set is modified, start again
+        if (iter == timer_set.end())
+            continue; // Nothing scheduled
 
         auto& entry = iter->get ();
+        lag_metric().observe (std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  std::chrono::steady_clock::now() - entry.timeout).count());
         if (entry.repeat == Timer::zero) {
             timer_set.erase (iter);
+            armed_metric().set (timer_set.size());
         }else{
             entry.timeout = entry.timeout + entry.repeat;
             timer_set.erase (iter);
@@ -179,6 +206,7 @@ void Timer::set_impl (std::chrono::microseconds duration,
     if (pos != timer_set.end())
         timer_set.erase (pos);
     timer_set.insert (i->second);
+    armed_metric().set (timer_set.size());
 
     resource_cond.notify_all ();
 }
@@ -192,6 +220,7 @@ void Timer::cancel ()
     auto pos = timer_set.find (timer_map[*this]);
     if (pos != timer_set.end()) {
         timer_set.erase (pos);
+        armed_metric().set (timer_set.size());
         resource_cond.notify_all ();
     }
 }
@@ -74,7 +74,7 @@ namespace uxmpp { namespace io {
          * The default configuration uses TLS v1.2 as protocol and does not verify
          * the server certificate.
          */
-        TlsConfig () : method{TlsMethod::tlsv1_2}, verify_server{false} {
+        TlsConfig () : method{TlsMethod::tlsv1_2}, verify_server{false}, server{false} {
         }
 
         /**
@@ -89,6 +89,22 @@ namespace uxmpp { namespace io {
          * server certificate can be verified.
          */
         bool verify_server;
+
+        /**
+         * Act as the server in the TLS handshake.
+         * A certificate and a private key are then required.
+         */
+        bool server;
+
+        /**
+         * PEM encoded certificate used when acting as server.
+         */
+        std::string cert_pem;
+
+        /**
+         * PEM encoded private key used when acting as server.
+         */
+        std::string key_pem;
     };
 
 
@@ -0,0 +1,691 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/Logger.hpp>
+#include <uxmpp/utils.hpp>
+#include <uxmpp/io/WebSocketConnection.hpp>
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <openssl/rand.h>
+
+
+UXMPP_START_NAMESPACE2(uxmpp, io)
+
+
+using namespace std;
+
+static const std::string log_unit {"WebSocketConnection"};
+
+static const std::string ws_guid {"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"};
+
+// Frame opcodes
+static constexpr uint8_t op_continuation = 0x0;
+static constexpr uint8_t op_text         = 0x1;
+static constexpr uint8_t op_binary       = 0x2;
+static constexpr uint8_t op_close        = 0x8;
+static constexpr uint8_t op_ping         = 0x9;
+static constexpr uint8_t op_pong         = 0xa;
+
+// Frame header bits
+static constexpr uint8_t bit_fin  = 0x80;
+static constexpr uint8_t bit_rsv1 = 0x40;
+static constexpr uint8_t bit_mask = 0x80;
+
+// Maximum size of the HTTP response to the opening handshake
+static constexpr size_t max_handshake_size = 16384;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static string to_lower (string str)
+{
+    transform (str.begin(), str.end(), str.begin(), ::tolower);
+    return str;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static string trim (const string& str)
+{
+    auto start = str.find_first_not_of (" \t");
+    if (start == string::npos)
+        return "";
+    auto end = str.find_last_not_of (" \t");
+    return str.substr (start, end-start+1);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+WebSocketConnection::WebSocketConnection ()
+    :
+    upgraded (false),
+    hs_buf (1024),
+    client_no_context_takeover (false),
+    server_no_context_takeover (false),
+    rx_buf (UXMPP_WS_RX_BUF_SIZE),
+    rx_wire_pos (0),
+    rx_msg_compressed (false),
+    rx_msg_started (false),
+    rx_data_pos (0),
+    rx_closed (false),
+    tx_frame_pos (0),
+    tx_data_buf (nullptr),
+    tx_data_size (0)
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+WebSocketConnection::~WebSocketConnection ()
+{
+    ctl_timer.cancel ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void WebSocketConnection::clear_state ()
+{
+    upgraded = false;
+    deflater.reset ();
+    client_no_context_takeover = false;
+    server_no_context_takeover = false;
+    hs_response.clear ();
+    rx_wire.clear ();
+    rx_wire_pos = 0;
+    rx_msg.clear ();
+    rx_msg_compressed = false;
+    rx_msg_started = false;
+    rx_data.clear ();
+    rx_data_pos = 0;
+    rx_closed = false;
+    tx_frame_buf.clear ();
+    tx_frame_pos = 0;
+    tx_data_buf = nullptr;
+    tx_data_size = 0;
+    std::lock_guard<std::mutex> lock (ctl_mutex);
+    tx_ctl_frames.clear ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void WebSocketConnection::close ()
+{
+    ctl_timer.cancel ();
+    SocketConnection::close ();
+    clear_state ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+WebSocketConnection::upgraded_cb_t WebSocketConnection::set_upgraded_cb (upgraded_cb_t upgraded_cb)
+{
+    upgraded_cb_t old_cb {this->upgraded_cb};
+    this->upgraded_cb = upgraded_cb;
+    return old_cb;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void WebSocketConnection::upgrade (const std::string& host,
+                                   const std::string& path,
+                                   const std::string& protocol,
+                                   bool deflate)
+{
+    clear_state ();
+
+    // A random 16 byte nonce, base64 encoded
+    //
+    unsigned char nonce[16];
+    if (RAND_bytes(nonce, sizeof(nonce)) != 1) {
+        ctl_timer.set (Timer::now, [this](){
+                handshake_done (EIO, "Unable to create WebSocket key");
+            });
+        return;
+    }
+    hs_key = to_base64 (nonce, sizeof(nonce));
+    hs_protocol = protocol;
+
+    hs_request  = string("GET ") + (path.empty() ? "/" : path) + " HTTP/1.1\r\n";
+    hs_request += string("Host: ") + host + "\r\n";
+    hs_request += "Upgrade: websocket\r\n";
+    hs_request += "Connection: Upgrade\r\n";
+    hs_request += string("Sec-WebSocket-Key: ") + hs_key + "\r\n";
+    hs_request += "Sec-WebSocket-Version: 13\r\n";
+    if (!protocol.empty())
+        hs_request += string("Sec-WebSocket-Protocol: ") + protocol + "\r\n";
+    if (deflate)
+        hs_request += "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n";
+    hs_request += "\r\n";
+
+    uxmpp_log_debug (log_unit, "Start WebSocket handshake, ", host, path);
+    write (&hs_request[0], hs_request.size(), [this](Connection& c, void* p, ssize_t r, int e){
+            handle_handshake_write (r, e);
+        });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void WebSocketConnection::handle_handshake_write (ssize_t result, int errnum)
+{
+    if (result <= 0) {
+        handshake_done (errnum ? errnum : EPIPE, "Error sending WebSocket handshake");
+        return;
+    }
+
+    // Send the rest of the request, if any
+    //
+    hs_request.erase (0, result);
+    if (!hs_request.empty()) {
+        write (&hs_request[0], hs_request.size(), [this](Connection& c, void* p, ssize_t r, int e){
+                handle_handshake_write (r, e);
+            });
+        return;
+    }
+
+    read (hs_buf.data(), hs_buf.size(), [this](Connection& c, void* p, ssize_t r, int e){
+            handle_handshake_read (r, e);
+        });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void WebSocketConnection::handle_handshake_read (ssize_t result, int errnum)
+{
+    if (result <= 0) {
+        handshake_done (errnum ? errnum : ECONNRESET, "Connection closed during WebSocket handshake");
+        return;
+    }
+    hs_response.append (hs_buf.data(), result);
+
+    // Read until we have the complete HTTP header
+    //
+    auto end = hs_response.find ("\r\n\r\n");
+    if (end == string::npos) {
+        if (hs_response.size() > max_handshake_size) {
+            handshake_done (EPROTO, "WebSocket handshake response too large");
+        }else{
+            read (hs_buf.data(), hs_buf.size(), [this](Connection& c, void* p, ssize_t r, int e){
+                    handle_handshake_read (r, e);
+                });
+        }
+        return;
+    }
+
+    // Anything after the header is WebSocket frames
+    //
+    rx_wire = hs_response.substr (end + 4);
+    hs_response.erase (end + 2);
+
+    string errstr;
+    if (!check_handshake_response(errstr)) {
+        handshake_done (EPROTO, errstr);
+        return;
+    }
+    upgraded = true;
+    handshake_done (0, "");
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool WebSocketConnection::check_handshake_response (std::string& errstr)
+{
+    // Status line
+    //
+    auto eol = hs_response.find ("\r\n");
+    string status = hs_response.substr (0, eol);
+    if (status.compare(0, 9, "HTTP/1.1 ") || status.compare(9, 3, "101")) {
+        errstr = string("WebSocket upgrade refused: ") + status;
+        return false;
+    }
+
+    // Header fields
+    //
+    bool have_upgrade = false;
+    bool have_connection = false;
+    string accept;
+    string protocol;
+    string extensions;
+    size_t pos = eol + 2;
+    while (pos < hs_response.size()) {
+        eol = hs_response.find ("\r\n", pos);
+        string line = hs_response.substr (pos, eol-pos);
+        pos = eol + 2;
+
+        auto colon = line.find (':');
+        if (colon == string::npos)
+            continue;
+        string name  = to_lower (trim(line.substr(0, colon)));
+        string value = trim (line.substr(colon+1));
+
+        if (name == "upgrade")
+            have_upgrade = to_lower(value) == "websocket";
+        else if (name == "connection")
+            have_connection = to_lower(value).find("upgrade") != string::npos;
+        else if (name == "sec-websocket-accept")
+            accept = value;
+        else if (name == "sec-websocket-protocol")
+            protocol = value;
+        else if (name == "sec-websocket-extensions")
+            extensions += (extensions.empty() ? "" : ",") + value;
+    }
+
+    if (!have_upgrade || !have_connection) {
+        errstr = "Missing WebSocket upgrade header";
+        return false;
+    }
+    auto digest = get_sha1 (hs_key + ws_guid);
+    if (accept != to_base64(digest.data(), digest.size())) {
+        errstr = "Invalid Sec-WebSocket-Accept";
+        return false;
+    }
+    if (protocol != hs_protocol) {
+        errstr = string("Server didn't accept WebSocket protocol '") + hs_protocol + "'";
+        return false;
+    }
+
+    // Extensions, only permessage-deflate is requested
+    //
+    if (!extensions.empty()) {
+        int window_bits = 15;
+        stringstream ss (extensions);
+        string param;
+        bool first = true;
+        while (getline(ss, param, ';')) {
+            param = trim (param);
+            if (first) {
+                if (param != "permessage-deflate") {
+                    errstr = string("Unexpected WebSocket extension: ") + param;
+                    return false;
+                }
+                first = false;
+                continue;
+            }
+            auto eq = param.find ('=');
+            string name  = trim (param.substr(0, eq));
+            string value = eq==string::npos ? "" : trim(param.substr(eq+1));
+            if (name == "client_no_context_takeover") {
+                client_no_context_takeover = true;
+            }
+            else if (name == "server_no_context_takeover") {
+                server_no_context_takeover = true;
+            }
+            else if (name == "client_max_window_bits") {
+                window_bits = atoi (value.c_str());
+                // zlib can't produce raw deflate data with a 256 byte window
+                if (window_bits < 9 || window_bits > 15) {
+                    errstr = string("Unsupported client_max_window_bits: ") + value;
+                    return false;
+                }
+            }
+            else if (name != "server_max_window_bits") {
+                errstr = string("Unexpected permessage-deflate parameter: ") + name;
+                return false;
+            }
+        }
+        deflater.reset (new ZlibCompressor(Z_DEFAULT_COMPRESSION, -window_bits));
+        if (!deflater->is_valid()) {
+            deflater.reset ();
+            errstr = "Unable to initialize permessage-deflate";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void WebSocketConnection::handshake_done (int errnum, const std::string& errstr)
+{
+    if (errnum)
+        uxmpp_log_info (log_unit, "WebSocket handshake failed - ", errstr);
+    else
+        uxmpp_log_debug (log_unit, "WebSocket handshake successful",
+                         (deflater ? ", using permessage-deflate" : ""));
+    if (upgraded_cb)
+        upgraded_cb (*this, errnum, errstr);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+compression_stats_t WebSocketConnection::get_deflate_stats () const
+{
+    if (deflater)
+        return deflater->get_stats ();
+    return compression_stats_t {0, 0, 0, 0};
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void WebSocketConnection::append_frame (std::string& out,
+                                        uint8_t first_byte,
+                                        const char* payload,
+                                        size_t size)
+{
+    // Frame header, frames sent by a client are always masked
+    //
+    out.push_back (first_byte);
+    if (size < 126) {
+        out.push_back (bit_mask | size);
+    }
+    else if (size < 65536) {
+        out.push_back (bit_mask | 126);
+        out.push_back ((size >> 8) & 0xff);
+        out.push_back (size & 0xff);
+    }else{
+        out.push_back (bit_mask | 127);
+        for (int shift=56; shift>=0; shift-=8)
+            out.push_back ((static_cast<uint64_t>(size) >> shift) & 0xff);
+    }
+    unsigned char mask[4];
+    if (RAND_bytes(mask, sizeof(mask)) != 1)
+        memset (mask, 0, sizeof(mask));
+    out.append (reinterpret_cast<char*>(mask), sizeof(mask));
+
+    // Masked payload
+    //
+    size_t start = out.size ();
+    out.append (payload, size);
+    char* p = &out[start];
+    for (size_t i=0; i<size; ++i)
+        p[i] ^= mask[i & 3];
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void WebSocketConnection::queue_ctl_frame (uint8_t opcode, const std::string& payload)
+{
+    ctl_mutex.lock ();
+    append_frame (tx_ctl_frames, bit_fin | opcode, payload.data(), payload.size());
+    ctl_mutex.unlock ();
+
+    // Control frames are sent before the next message.
+    // Queue an empty write in case there is no message to send.
+    //
+    ctl_timer.set (Timer::now, [this](){
+            write (nullptr, 0, [](Connection& c, void* p, ssize_t r, int e){});
+        });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool WebSocketConnection::parse_frames (int& errnum)
+{
+    while (!rx_closed) {
+        size_t avail = rx_wire.size() - rx_wire_pos;
+        if (avail < 2)
+            break;
+        auto p = reinterpret_cast<const uint8_t*> (rx_wire.data() + rx_wire_pos);
+
+        bool    fin    = p[0] & bit_fin;
+        bool    rsv1   = p[0] & bit_rsv1;
+        uint8_t opcode = p[0] & 0x0f;
+        bool    masked = p[1] & bit_mask;
+        uint64_t len   = p[1] & 0x7f;
+        size_t  hdr    = 2;
+
+        if (len == 126) {
+            if (avail < 4)
+                break;
+            len = (p[2] << 8) | p[3];
+            hdr = 4;
+        }
+        else if (len == 127) {
+            if (avail < 10)
+                break;
+            len = 0;
+            for (int i=2; i<10; ++i)
+                len = (len << 8) | p[i];
+            hdr = 10;
+        }
+        if (len > UXMPP_WS_MAX_MESSAGE_SIZE || rx_msg.size()+len > UXMPP_WS_MAX_MESSAGE_SIZE) {
+            uxmpp_log_warning (log_unit, "WebSocket message too large");
+            errnum = EMSGSIZE;
+            return false;
+        }
+        const uint8_t* mask = p + hdr;
+        if (masked)
+            hdr += 4;
+        if (avail < hdr + len)
+            break; // Wait for the rest of the frame
+
+        if ((p[0] & 0x30) || (rsv1 && !deflater) || (opcode >= op_close && (!fin || len > 125))) {
+            uxmpp_log_warning (log_unit, "WebSocket protocol error");
+            errnum = EPROTO;
+            return false;
+        }
+
+        const char* payload = rx_wire.data() + rx_wire_pos + hdr;
+        if (masked) {
+            // Servers shouldn't mask frames, but unmask in place if they do.
+            char* data = &rx_wire[rx_wire_pos + hdr];
+            for (size_t i=0; i<len; ++i)
+                data[i] ^= mask[i & 3];
+        }
+        rx_wire_pos += hdr + len;
+
+        switch (opcode) {
+        case op_text:
+        case op_binary:
+        case op_continuation:
+            if ((opcode == op_continuation) != rx_msg_started) {
+                uxmpp_log_warning (log_unit, "WebSocket protocol error, unexpected frame");
+                errnum = EPROTO;
+                return false;
+            }
+            if (!rx_msg_started) {
+                rx_msg_started = true;
+                rx_msg_compressed = rsv1;
+            }
+            if (!fin) {
+                rx_msg.append (payload, len);
+                break;
+            }
+            if (rx_msg_compressed) {
+                rx_msg.append (payload, len);
+                rx_msg.append ("\x00\x00\xff\xff", 4);
+                if (!deflater->decompress(rx_msg.data(), rx_msg.size(), rx_data)) {
+                    errnum = EIO;
+                    return false;
+                }
+                if (server_no_context_takeover)
+                    deflater->reset_inflate ();
+            }
+            else if (rx_msg.empty()) {
+                rx_data.append (payload, len); // Common case, a single frame message
+            }else{
+                rx_data.append (rx_msg);
+                rx_data.append (payload, len);
+            }
+            rx_data.push_back ('\0');
+            rx_msg.clear ();
+            rx_msg_started = false;
+            break;
+
+        case op_close:
+            uxmpp_log_debug (log_unit, "Got WebSocket close frame");
+            rx_closed = true;
+            queue_ctl_frame (op_close, string(payload, min(len, (uint64_t)2)));
+            break;
+
+        case op_ping:
+            queue_ctl_frame (op_pong, string(payload, len));
+            break;
+
+        case op_pong:
+            break;
+
+        default:
+            uxmpp_log_warning (log_unit, "WebSocket protocol error, unknown opcode: ", (int)opcode);
+            errnum = EPROTO;
+            return false;
+        }
+    }
+
+    // Remove parsed frames
+    //
+    if (rx_wire_pos == rx_wire.size()) {
+        rx_wire.clear ();
+        rx_wire_pos = 0;
+    }
+    else if (rx_wire_pos >= UXMPP_WS_RX_BUF_SIZE) {
+        rx_wire.erase (0, rx_wire_pos);
+        rx_wire_pos = 0;
+    }
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+ssize_t WebSocketConnection::do_read (void* buf, size_t size, off_t offset, int& errnum)
+{
+    if (!upgraded || size == 0)
+        return SocketConnection::do_read (buf, size, offset, errnum);
+
+    char*  out   = static_cast<char*> (buf);
+    size_t count = 0;
+
+    while (true) {
+        // Return message data already parsed
+        //
+        if (rx_data_pos < rx_data.size()) {
+            size_t n = min (size - count, rx_data.size() - rx_data_pos);
+            memcpy (out + count, rx_data.data() + rx_data_pos, n);
+            count += n;
+            rx_data_pos += n;
+            if (rx_data_pos == rx_data.size()) {
+                rx_data.clear ();
+                rx_data_pos = 0;
+            }
+            if (count == size)
+                return count;
+        }
+        if (rx_closed)
+            return count; // End-of-stream when all data is returned
+
+        // Parse frames already received
+        //
+        if (!parse_frames(errnum))
+            return -1;
+        if (rx_data_pos < rx_data.size() || rx_closed)
+            continue;
+
+        // Read more frames from the socket
+        //
+        ssize_t result = SocketConnection::do_read (rx_buf.data(), rx_buf.size(), offset, errnum);
+        if (result <= 0)
+            return count>0 ? count : result;
+        rx_wire.append (rx_buf.data(), result);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool WebSocketConnection::flush_tx_frame_buf (int& errnum)
+{
+    while (tx_frame_pos < tx_frame_buf.size()) {
+        ssize_t result = SocketConnection::do_write (&tx_frame_buf[tx_frame_pos],
+                                                     tx_frame_buf.size() - tx_frame_pos,
+                                                     -1,
+                                                     errnum);
+        if (result <= 0) {
+            if (result == 0)
+                errnum = EPIPE;
+            return false;
+        }
+        tx_frame_pos += result;
+    }
+    tx_frame_buf.clear ();
+    tx_frame_pos = 0;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+ssize_t WebSocketConnection::do_write (void* buf, size_t size, off_t offset, int& errnum)
+{
+    if (!upgraded)
+        return SocketConnection::do_write (buf, size, offset, errnum);
+
+    // If the socket wasn't writable the last time, this is the same
+    // write operation again and the frame is already made.
+    //
+    bool retry = tx_data_buf==buf && tx_data_size==size && !tx_frame_buf.empty();
+    if (!retry) {
+        // A frame partially written by a cancelled operation
+        // must be completed before anything else is sent.
+        if (!flush_tx_frame_buf(errnum))
+            return -1;
+
+        // Pending control frames go first
+        //
+        ctl_mutex.lock ();
+        tx_frame_buf.swap (tx_ctl_frames);
+        ctl_mutex.unlock ();
+
+        if (size > 0) {
+            if (deflater) {
+                string payload;
+                if (!deflater->compress(buf, size, payload)) {
+                    errnum = EIO;
+                    return -1;
+                }
+                // Remove the empty block ending the sync flush (RFC 7692, 7.2.1)
+                if (payload.size() >= 4 && !payload.compare(payload.size()-4, 4, "\x00\x00\xff\xff", 4))
+                    payload.resize (payload.size() - 4);
+                if (client_no_context_takeover)
+                    deflater->reset_deflate ();
+                deflater->add_tx_wire (payload.size());
+                append_frame (tx_frame_buf, bit_fin | bit_rsv1 | op_text, payload.data(), payload.size());
+            }else{
+                append_frame (tx_frame_buf, bit_fin | op_text, static_cast<char*>(buf), size);
+            }
+        }
+        tx_data_buf  = buf;
+        tx_data_size = size;
+    }
+    if (!flush_tx_frame_buf(errnum))
+        return -1;
+
+    tx_data_buf = nullptr;
+    return size;
+}
+
+
+UXMPP_END_NAMESPACE2
@@ -0,0 +1,199 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_IO_WEBSOCKETCONNECTION_HPP
+#define UXMPP_IO_WEBSOCKETCONNECTION_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/io/SocketConnection.hpp>
+#include <uxmpp/io/ZlibCompressor.hpp>
+#include <uxmpp/io/Timer.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+
+
+namespace uxmpp { namespace io {
+
+
+/**
+ * Maximum size of a received WebSocket message.
+ */
+#define UXMPP_WS_MAX_MESSAGE_SIZE (1024*1024)
+
+/**
+ * Size of the buffer used when reading WebSocket frames from the socket.
+ */
+#define UXMPP_WS_RX_BUF_SIZE 4096
+
+
+    /**
+     * A socket connection speaking the WebSocket protocol (RFC 6455).
+     *
+     * Until upgrade() is successfully called this behaves exactly like a
+     * SocketConnection. After the upgrade, each write operation is sent
+     * as one text message and received text messages are returned by
+     * read operations, each message followed by a NUL character. NUL
+     * can't appear in an XML document, so a reader can use it to find
+     * where each message ends.
+     *
+     * Ping frames are answered and a close frame from the peer is
+     * answered and reported as end-of-stream. Messages are compressed
+     * with the permessage-deflate extension (RFC 7692) if the server
+     * accepts it.
+     *
+     * The WebSocket framing is done before TLS encryption, so for
+     * a secure WebSocket (wss) call enable_tls() before upgrade().
+     */
+    class WebSocketConnection : public SocketConnection {
+    public:
+
+        /**
+         * Callback that is called when the WebSocket handshake is finished (or failed).
+         * @param connection The connection object.
+         * @param errnum 0 if successful, otherwise an errno value.
+         * @param errstr An error string describing the error. This could be an empty string.
+         */
+        typedef std::function<void (WebSocketConnection& connection,
+                                    int errnum, const std::string& errstr)> upgraded_cb_t;
+
+        /**
+         * Creates a WebSocketConnection object.
+         */
+        WebSocketConnection ();
+
+        /**
+         * Destructor.
+         */
+        virtual ~WebSocketConnection ();
+
+        /**
+         * Perform the WebSocket opening handshake on the connected socket.
+         * The result is reported to the callback set by set_upgraded_cb().
+         * @param host The value of the HTTP 'Host' header.
+         * @param path The path of the WebSocket URL.
+         * @param protocol The WebSocket subprotocol to request,
+         *                 an empty string requests none.
+         * @param deflate Offer the permessage-deflate extension.
+         */
+        void upgrade (const std::string& host,
+                      const std::string& path,
+                      const std::string& protocol="xmpp",
+                      bool deflate=true);
+
+        /**
+         * Set the upgrade callback.
+         */
+        upgraded_cb_t set_upgraded_cb (upgraded_cb_t upgraded_cb);
+
+        /**
+         * Return true if the WebSocket handshake is done.
+         */
+        bool is_upgraded () const {
+            return upgraded;
+        }
+
+        /**
+         * Return true if the permessage-deflate extension is in use.
+         */
+        bool is_deflate_enabled () const {
+            return deflater != nullptr;
+        }
+
+        /**
+         * Return the byte counters for permessage-deflate.
+         * The wire counters are payload bytes, frame headers are not included.
+         * All counters are zero if the extension isn't in use.
+         */
+        compression_stats_t get_deflate_stats () const;
+
+        /**
+         * Read WebSocket messages.
+         * Returns payload data from received text messages, each message
+         * is followed by a NUL character.
+         */
+        virtual ssize_t do_read (void* buf, size_t size, off_t offset, int& errnum);
+
+        /**
+         * Write a WebSocket message.
+         * Each write operation is sent as one text message.
+         */
+        virtual ssize_t do_write (void* buf, size_t size, off_t offset, int& errnum);
+
+        /**
+         * Close the socket.
+         * The connection is a plain socket connection again
+         * until the next call to upgrade().
+         */
+        virtual void close ();
+
+
+    private:
+        bool upgraded;
+        upgraded_cb_t upgraded_cb;
+        Timer ctl_timer;
+
+        // Opening handshake
+        std::string hs_key;
+        std::string hs_protocol;
+        std::string hs_request;
+        std::string hs_response;
+        std::vector<char> hs_buf;
+
+        // permessage-deflate
+        std::unique_ptr<ZlibCompressor> deflater;
+        bool client_no_context_takeover;
+        bool server_no_context_takeover;
+
+        // Received frames not yet parsed, and parsed
+        // message data not yet returned to the reader.
+        std::vector<char> rx_buf;
+        std::string rx_wire;
+        size_t      rx_wire_pos;
+        std::string rx_msg;
+        bool        rx_msg_compressed;
+        bool        rx_msg_started;
+        std::string rx_data;
+        size_t      rx_data_pos;
+        bool        rx_closed;
+
+        // Frame not yet written, and the buffer it was made from.
+        std::string tx_frame_buf;
+        size_t      tx_frame_pos;
+        void*       tx_data_buf;
+        size_t      tx_data_size;
+
+        // Control frames (pong, close) waiting to be sent.
+        std::mutex  ctl_mutex;
+        std::string tx_ctl_frames;
+
+        void handle_handshake_write (ssize_t result, int errnum);
+        void handle_handshake_read (ssize_t result, int errnum);
+        bool check_handshake_response (std::string& errstr);
+        void handshake_done (int errnum, const std::string& errstr);
+        void clear_state ();
+        bool parse_frames (int& errnum);
+        void queue_ctl_frame (uint8_t opcode, const std::string& payload);
+        void append_frame (std::string& out, uint8_t first_byte, const char* payload, size_t size);
+        bool flush_tx_frame_buf (int& errnum);
+    };
+
+
+}}
+#endif
@@ -0,0 +1,195 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/io/ZlibCompressor.hpp>
+#include <uxmpp/Logger.hpp>
+#include <cstring>
+
+
+UXMPP_START_NAMESPACE2(uxmpp, io)
+
+#define THIS_FILE "ZlibCompressor"
+
+
+using namespace std;
+using namespace uxmpp;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+ZlibCompressor::ZlibCompressor (int level, int window_bits)
+    :
+    valid   {false},
+    rx_more {false},
+    rx_buf  (UXMPP_ZLIB_RX_BUF_SIZE),
+    rx_wire {0},
+    rx_data {0},
+    tx_data {0},
+    tx_wire {0}
+{
+    memset (&deflate_strm, 0, sizeof(deflate_strm));
+    memset (&inflate_strm, 0, sizeof(inflate_strm));
+
+    if (deflateInit2(&deflate_strm, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        uxmpp_log_error (THIS_FILE, "deflateInit failed");
+        return;
+    }
+    if (inflateInit2(&inflate_strm, window_bits<0 ? -MAX_WBITS : MAX_WBITS) != Z_OK) {
+        uxmpp_log_error (THIS_FILE, "inflateInit failed");
+        deflateEnd (&deflate_strm);
+        return;
+    }
+    valid = true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+ZlibCompressor::~ZlibCompressor ()
+{
+    if (valid) {
+        deflateEnd (&deflate_strm);
+        inflateEnd (&inflate_strm);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool ZlibCompressor::compress (const void* buf, size_t size, std::string& out)
+{
+    if (!valid)
+        return false;
+
+    deflate_strm.next_in  = static_cast<Bytef*> (const_cast<void*>(buf));
+    deflate_strm.avail_in = size;
+
+    // Deflate until the sync flush is complete,
+    // that is when the output buffer isn't filled.
+    //
+    unsigned char chunk[4096];
+    do {
+        deflate_strm.next_out  = chunk;
+        deflate_strm.avail_out = sizeof (chunk);
+        int result = deflate (&deflate_strm, Z_SYNC_FLUSH);
+        if (result != Z_OK && result != Z_BUF_ERROR) {
+            uxmpp_log_warning (THIS_FILE, "deflate failed: ", result);
+            return false;
+        }
+        out.append (reinterpret_cast<char*>(chunk), sizeof(chunk) - deflate_strm.avail_out);
+    } while (deflate_strm.avail_out == 0);
+
+    tx_data += size;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool ZlibCompressor::decompress (const void* buf, size_t size, std::string& out)
+{
+    if (!valid || have_rx_data())
+        return false;
+
+    inflate_strm.next_in  = static_cast<Bytef*> (const_cast<void*>(buf));
+    inflate_strm.avail_in = size;
+    rx_wire += size;
+
+    unsigned char chunk[4096];
+    do {
+        ssize_t result = decompress (chunk, sizeof(chunk));
+        if (result < 0)
+            return false;
+        out.append (reinterpret_cast<char*>(chunk), result);
+    } while (have_rx_data());
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void ZlibCompressor::reset_deflate ()
+{
+    if (valid)
+        deflateReset (&deflate_strm);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void ZlibCompressor::reset_inflate ()
+{
+    if (valid) {
+        inflateReset (&inflate_strm);
+        inflate_strm.avail_in = 0;
+        rx_more = false;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void ZlibCompressor::set_rx_size (size_t size)
+{
+    inflate_strm.next_in  = rx_buf.data ();
+    inflate_strm.avail_in = size;
+    rx_wire += size;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+ssize_t ZlibCompressor::decompress (void* buf, size_t size)
+{
+    if (!valid)
+        return -1;
+
+    inflate_strm.next_out  = static_cast<Bytef*> (buf);
+    inflate_strm.avail_out = size;
+    int result = inflate (&inflate_strm, Z_SYNC_FLUSH);
+    if (result == Z_STREAM_END) {
+        // The peer ended the deflate stream, what follows starts a new one
+        inflateReset (&inflate_strm);
+    }
+    else if (result != Z_OK && result != Z_BUF_ERROR) {
+        uxmpp_log_warning (THIS_FILE, "inflate failed: ", result);
+        return -1;
+    }
+
+    size_t produced = size - inflate_strm.avail_out;
+    rx_more = inflate_strm.avail_out == 0;
+    rx_data += produced;
+    return produced;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+compression_stats_t ZlibCompressor::get_stats () const
+{
+    compression_stats_t stats;
+    stats.rx_wire = rx_wire;
+    stats.rx_data = rx_data;
+    stats.tx_data = tx_data;
+    stats.tx_wire = tx_wire;
+    return stats;
+}
+
+
+UXMPP_END_NAMESPACE2
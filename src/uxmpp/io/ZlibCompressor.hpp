@@ -0,0 +1,183 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_IO_ZLIBCOMPRESSOR_HPP
+#define UXMPP_IO_ZLIBCOMPRESSOR_HPP
+
+#include <uxmpp/types.hpp>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <sys/types.h>
+#include <zlib.h>
+
+
+namespace uxmpp { namespace io {
+
+
+/**
+ * Size of the buffer holding compressed data read from the connection.
+ */
+#define UXMPP_ZLIB_RX_BUF_SIZE 4096
+
+
+    /**
+     * Byte counters for a compressed stream.
+     */
+    struct compression_stats_t {
+        uint64_t rx_wire; /**< Compressed bytes received. */
+        uint64_t rx_data; /**< Bytes received after decompression. */
+        uint64_t tx_data; /**< Bytes sent before compression. */
+        uint64_t tx_wire; /**< Compressed bytes sent. */
+    };
+
+
+    /**
+     * zlib compression state for one stream (XEP-0138).
+     * There is one deflate and one inflate stream that lives as long as the
+     * object, so the compression dictionary is kept across stanzas.
+     * Each block of data to send is compressed with a sync flush so the
+     * peer can parse it as soon as it is received.
+     */
+    class ZlibCompressor {
+    public:
+        /**
+         * Constructor.
+         * @param level zlib compression level, 0-9 or Z_DEFAULT_COMPRESSION.
+         * @param window_bits Base two logarithm of the deflate window size, 9-15.
+         *                    A negative value gives raw deflate data without
+         *                    the zlib header and checksum, as used by the
+         *                    WebSocket permessage-deflate extension (RFC 7692).
+         *                    Inflate always uses the largest window.
+         */
+        ZlibCompressor (int level=Z_DEFAULT_COMPRESSION, int window_bits=15);
+
+        /**
+         * Destructor.
+         */
+        ~ZlibCompressor ();
+
+        /**
+         * Disabled copy constructor.
+         */
+        ZlibCompressor (const ZlibCompressor& zc) = delete;
+
+        /**
+         * Disabled assignment operator.
+         */
+        ZlibCompressor& operator= (const ZlibCompressor& zc) = delete;
+
+        /**
+         * Return true if the zlib streams were successfully initialized.
+         */
+        bool is_valid () const {
+            return valid;
+        }
+
+        /**
+         * Compress a block of data and append it to <code>out</code>,
+         * ending with a sync flush.
+         * @return False on zlib error.
+         */
+        bool compress (const void* buf, size_t size, std::string& out);
+
+        /**
+         * Decompress a complete block of data and append it to <code>out</code>.
+         * This is an alternative to the get_rx_buf()/decompress() interface
+         * when the data isn't read directly from the connection.
+         * @return False on zlib error.
+         */
+        bool decompress (const void* buf, size_t size, std::string& out);
+
+        /**
+         * Reset the deflate stream, the compression dictionary is discarded.
+         */
+        void reset_deflate ();
+
+        /**
+         * Reset the inflate stream, the compression dictionary is discarded.
+         */
+        void reset_inflate ();
+
+        /**
+         * Decompress received data that was previously put in
+         * the buffer returned by get_rx_buf().
+         * @param buf Where to put decompressed data.
+         * @param size The size of buf.
+         * @return The number of decompressed bytes, 0 if more input is needed,
+         *         or -1 on zlib error.
+         */
+        ssize_t decompress (void* buf, size_t size);
+
+        /**
+         * Return true if there is received data that hasn't been decompressed.
+         */
+        bool have_rx_data () const {
+            return rx_more || inflate_strm.avail_in > 0;
+        }
+
+        /**
+         * Return a buffer where compressed data can be read from the connection.
+         * Only valid when have_rx_data() returns false.
+         */
+        void* get_rx_buf () {
+            return rx_buf.data ();
+        }
+
+        /**
+         * Return the size of the buffer returned by get_rx_buf().
+         */
+        size_t get_rx_buf_size () const {
+            return rx_buf.size ();
+        }
+
+        /**
+         * Tell how many bytes were read into the buffer returned by get_rx_buf().
+         */
+        void set_rx_size (size_t size);
+
+        /**
+         * Count compressed bytes actually written to the connection.
+         */
+        void add_tx_wire (size_t size) {
+            tx_wire += size;
+        }
+
+        /**
+         * Return the byte counters.
+         */
+        compression_stats_t get_stats () const;
+
+
+    private:
+        z_stream deflate_strm;
+        z_stream inflate_strm;
+        bool valid;
+        bool rx_more; // The last decompress filled the output buffer
+        std::vector<unsigned char> rx_buf;
+
+        std::atomic<uint64_t> rx_wire;
+        std::atomic<uint64_t> rx_data;
+        std::atomic<uint64_t> tx_data;
+        std::atomic<uint64_t> tx_wire;
+    };
+
+
+}}
+#endif
@@ -35,12 +35,18 @@ namespace uxmpp {
 #include <uxmpp/mod/KeepAliveModule.hpp>
 #include <uxmpp/mod/DiscoIdentity.hpp>
 #include <uxmpp/mod/DiscoInfo.hpp>
+#include <uxmpp/mod/CapsCache.hpp>
+#include <uxmpp/mod/DiscoTree.hpp>
 #include <uxmpp/mod/DiscoModule.hpp>
 #include <uxmpp/mod/RosterItem.hpp>
 #include <uxmpp/mod/Roster.hpp>
+#include <uxmpp/mod/RosterCache.hpp>
 #include <uxmpp/mod/RosterModule.hpp>
+#include <uxmpp/mod/PresenceTable.hpp>
 #include <uxmpp/mod/PresenceModule.hpp>
 #include <uxmpp/mod/MessageModule.hpp>
+#include <uxmpp/mod/MucRoom.hpp>
+#include <uxmpp/mod/MultiUserChatModule.hpp>
 #include <uxmpp/mod/SessionModule.hpp>
 #include <uxmpp/mod/PingModule.hpp>
 #include <uxmpp/mod/PrivateDataModule.hpp>
@@ -50,7 +56,11 @@ namespace uxmpp {
 #include <uxmpp/mod/VcardModule.hpp>
 #include <uxmpp/mod/VersionModule.hpp>
 #include <uxmpp/mod/IBBModule.hpp>
+#include <uxmpp/mod/S5BModule.hpp>
 #include <uxmpp/mod/PepModule.hpp>
+#include <uxmpp/mod/PubSubItemCache.hpp>
 #include <uxmpp/mod/PubSubModule.hpp>
+#include <uxmpp/mod/StreamManagementModule.hpp>
+#include <uxmpp/mod/CompressionModule.hpp>
 
 #endif
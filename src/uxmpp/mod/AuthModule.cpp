@@ -21,6 +21,7 @@
 #include <uxmpp/Session.hpp>
 #include <uxmpp/utils.hpp>
 #include <uxmpp/xml/names.hpp>
+#include <cstdlib>
 
 
 #define THIS_FILE "AuthModule"
@@ -117,6 +118,30 @@ bool AuthModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject&
     //
     // Handle 'challenge'
     //
+    if (xml_obj.get_full_name() == XmlChallengeTagFull && auth_mechanism == "SCRAM-SHA-1") {
+        string challenge = from_base64 (xml_obj.get_content());
+        XmlObject response ("response", XmlSaslNs);
+        if (challenge.compare(0, 2, "v=") == 0) {
+            // Additional data with success, sent as a challenge by some servers
+            if (challenge.substr(2) != scram_server_signature) {
+                uxmpp_log_warning (THIS_FILE, "Invalid SCRAM server signature");
+                session.set_app_error ("authentication-failure", "Invalid server signature");
+                session.stop ();
+                return true;
+            }
+            scram_server_signature = "";
+        }else{
+            string client_final = scram_client_final (challenge);
+            if (client_final.empty()) {
+                uxmpp_log_warning (THIS_FILE, "Invalid SCRAM challenge");
+                xs.write (XmlObject("abort", XmlSaslNs));
+                return true;
+            }
+            response.set_content (to_base64(client_final));
+        }
+        xs.write (response);
+        return true;
+    }
     if (xml_obj.get_full_name() == XmlChallengeTagFull) {
         // If method == PLAIN
         string challange_str = string("_") + auth_user + string("_") + auth_pass;
@@ -132,8 +157,17 @@ bool AuthModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject&
     // Handle 'success'
     //
     if (xml_obj.get_full_name() == XmlSuccessTagFull) {
+        if (auth_mechanism=="SCRAM-SHA-1" && !scram_server_signature.empty()) {
+            string outcome = from_base64 (xml_obj.get_content());
+            if (outcome.compare(0, 2, "v=") || outcome.substr(2) != scram_server_signature) {
+                uxmpp_log_warning (THIS_FILE, "Invalid SCRAM server signature");
+                session.set_app_error ("authentication-failure", "Invalid server signature");
+                session.stop ();
+                return true;
+            }
+        }
         uxmpp_log_info (THIS_FILE, "Logged in to ", to_string(session.get_socket().get_peer_addr()));
-        session.reset ();
+        session.reset_and_bind ();
         return true;
     }
 
@@ -162,10 +196,40 @@ void AuthModule::authenticate ()
 
     XmlStream& xs = sess->get_xml_stream ();
 
-    //
-    // Right now we only support PLAIN
-    //
-    if (mechanisms.find("PLAIN") != mechanisms.end()) {
+    auth_mechanism = mechanism;
+    if (auth_mechanism.empty()) {
+        if (mechanisms.find("SCRAM-SHA-1") != mechanisms.end())
+            auth_mechanism = "SCRAM-SHA-1";
+        else
+            auth_mechanism = "PLAIN";
+    }
+    if (mechanisms.find(auth_mechanism) == mechanisms.end())
+        auth_mechanism = "";
+
+    if (auth_mechanism == "SCRAM-SHA-1") {
+        //
+        // SCRAM-SHA-1, RFC 5802. The user name is not SASLprep:ed.
+        //
+        string user;
+        for (auto ch : auth_user) {
+            if (ch == ',')
+                user += "=2C";
+            else if (ch == '=')
+                user += "=3D";
+            else
+                user += ch;
+        }
+        scram_nonce = make_uuid_v4 ();
+        scram_client_first = string("n=") + user + ",r=" + scram_nonce;
+        scram_server_signature = "";
+
+        XmlObject auth ("auth", XmlSaslNs);
+        auth.set_attribute ("mechanism", auth_mechanism);
+        uxmpp_log_trace (THIS_FILE, "Authenticate user: ", auth_user);
+        auth.set_content (to_base64(string("n,,") + scram_client_first));
+        xs.write (auth);
+    }
+    else if (auth_mechanism == "PLAIN") {
         XmlObject auth ("auth", XmlSaslNs);
         auth.set_attribute ("mechanism", "PLAIN");
 
@@ -185,4 +249,56 @@ void AuthModule::authenticate ()
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string AuthModule::scram_client_final (const std::string& server_first)
+{
+    // Get the attributes of the server-first-message
+    //
+    string nonce;
+    string salt;
+    unsigned iterations = 0;
+    size_t pos = 0;
+    while (pos < server_first.size()) {
+        size_t end = server_first.find (',', pos);
+        if (end == string::npos)
+            end = server_first.size ();
+        string attr = server_first.substr (pos, end-pos);
+        if (attr.compare(0, 2, "r=") == 0)
+            nonce = attr.substr (2);
+        else if (attr.compare(0, 2, "s=") == 0)
+            salt = from_base64 (attr.substr(2));
+        else if (attr.compare(0, 2, "i=") == 0)
+            iterations = strtoul (attr.c_str()+2, nullptr, 10);
+        pos = end + 1;
+    }
+    if (nonce.compare(0, scram_nonce.size(), scram_nonce) || nonce.size()==scram_nonce.size() ||
+        salt.empty() || iterations==0)
+    {
+        return "";
+    }
+
+    // Calculate the client proof and the expected server signature
+    //
+    string client_final = string("c=biws,r=") + nonce;
+    string auth_message = scram_client_first + "," + server_first + "," + client_final;
+
+    auto salted = get_pbkdf2_sha1 (auth_pass, salt, iterations);
+    string salted_pass (reinterpret_cast<char*>(salted.data()), salted.size());
+    auto client_key = get_hmac_sha1 (salted_pass, "Client Key");
+    auto stored_key = get_sha1 (client_key.data(), client_key.size());
+    auto signature  = get_hmac_sha1 (string(reinterpret_cast<char*>(stored_key.data()), stored_key.size()),
+                                     auth_message);
+    for (size_t i=0; i<client_key.size(); ++i)
+        client_key[i] ^= signature[i];
+
+    auto server_key = get_hmac_sha1 (salted_pass, "Server Key");
+    auto server_sig = get_hmac_sha1 (string(reinterpret_cast<char*>(server_key.data()), server_key.size()),
+                                     auth_message);
+    scram_server_signature = to_base64 (server_sig.data(), server_sig.size());
+
+    return client_final + ",p=" + to_base64 (client_key.data(), client_key.size());
+}
+
+
 UXMPP_END_NAMESPACE2
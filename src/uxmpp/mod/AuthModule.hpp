@@ -80,6 +80,13 @@ namespace uxmpp { namespace mod {
          */
         bool auto_login;
 
+        /**
+         * SASL mechanism to use, "SCRAM-SHA-1" or "PLAIN".
+         * If empty, SCRAM-SHA-1 is used when the server offers it,
+         * otherwise PLAIN.
+         */
+        std::string mechanism;
+
 
     protected:
         /**
@@ -91,6 +98,32 @@ namespace uxmpp { namespace mod {
          * Authentication mechanisms
          */
         std::unordered_set<std::string> mechanisms;
+
+        /**
+         * The mechanism used in the ongoing authentication.
+         */
+        std::string auth_mechanism;
+
+        /**
+         * SCRAM-SHA-1 client nonce.
+         */
+        std::string scram_nonce;
+
+        /**
+         * SCRAM-SHA-1 client-first-message without the GS2 header.
+         */
+        std::string scram_client_first;
+
+        /**
+         * SCRAM-SHA-1 server signature expected in the outcome, base64 encoded.
+         */
+        std::string scram_server_signature;
+
+        /**
+         * Return the SCRAM-SHA-1 client-final-message for a server-first-message,
+         * or an empty string if the server-first-message is invalid.
+         */
+        std::string scram_client_final (const std::string& server_first);
     };
 
 
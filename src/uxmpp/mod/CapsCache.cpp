@@ -0,0 +1,270 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/Logger.hpp>
+#include <uxmpp/mod/CapsCache.hpp>
+#include <uxmpp/XmlInputStream.hpp>
+#include <uxmpp/utils.hpp>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+
+
+#define THIS_FILE "CapsCache"
+
+
+UXMPP_START_NAMESPACE2(uxmpp, mod)
+
+
+using namespace std;
+using namespace uxmpp;
+
+
+static const string cache_namespace {"http://ultramarin.se/uxmpp#caps-cache"};
+static const string disco_info_namespace {"http://jabber.org/protocol/disco#info"};
+static const string data_forms_namespace {"jabber:x:data"};
+
+CapsCache* CapsCache::instance = nullptr;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+CapsCache& CapsCache::get_instance ()
+{
+    static std::mutex instance_mutex;
+    if (instance == nullptr) {
+        lock_guard<std::mutex> lock (instance_mutex);
+        if (instance == nullptr)
+            instance = new CapsCache;
+    }
+    return *instance;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+CapsCache::CapsCache ()
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+XmlObject CapsCache::make_entry (const std::string& ver, const uxmpp::XmlObject& info)
+{
+    XmlObject query (info);
+    query.remove_attribute ("node");
+    query.set_default_namespace_attr (disco_info_namespace);
+
+    XmlObject entry ("info", cache_namespace, false);
+    entry.set_attribute ("ver", ver);
+    entry.add_node (query);
+    return entry;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool CapsCache::set_file (const std::string& file)
+{
+    lock_guard<std::mutex> lock (mutex);
+    this->file = file;
+
+    ifstream in (file);
+    if (!in) {
+        uxmpp_log_debug (THIS_FILE, "No caps cache in ", file);
+        return false;
+    }
+    ostringstream data;
+    data << in.rdbuf ();
+
+    // The file is appended to, verify each entry in case
+    // it was changed or partly written.
+    //
+    bool error = false;
+    size_t loaded = 0;
+    XmlInputStream xis (XmlObject("caps-cache", cache_namespace));
+    xis.set_xml_handler ([&](XmlInputStream& stream, XmlObject& xml_obj){
+            if (xml_obj.get_tag_name() != "info" || xml_obj.get_nodes().empty())
+                return;
+            auto ver = xml_obj.get_attribute ("ver");
+            auto& query = xml_obj.get_nodes().front ();
+            if (query.get_full_name() != disco_info_namespace + ":query" || make_ver(query) != ver) {
+                uxmpp_log_warning (THIS_FILE, "Ignoring invalid cache entry ", ver);
+                return;
+            }
+            entries[ver] = std::move (query);
+            ++loaded;
+        });
+    xis.set_error_handler ([&](XmlInputStream& stream, int code, const std::string& msg){
+            error = true;
+        });
+    xis << data.str ();
+
+    if (error)
+        uxmpp_log_warning (THIS_FILE, "Invalid caps cache ", file);
+    uxmpp_log_debug (THIS_FILE, "Loaded ", loaded, " entries from ", file);
+    return !error;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+const uxmpp::XmlObject* CapsCache::find (const std::string& ver)
+{
+    lock_guard<std::mutex> lock (mutex);
+    auto i = entries.find (ver);
+    return i==entries.end() ? nullptr : &i->second;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool CapsCache::add (const std::string& ver, const uxmpp::XmlObject& info)
+{
+    XmlObject query (info);
+    if (ver.empty() || make_ver(query) != ver) {
+        uxmpp_log_info (THIS_FILE, "Not adding ", ver, ", the verification string doesn't match");
+        return false;
+    }
+    query.remove_attribute ("node");
+
+    lock_guard<std::mutex> lock (mutex);
+    auto result = entries.emplace (ver, std::move(query));
+    if (!result.second || file.empty())
+        return true;
+
+    // Creating the file with the XML declaration and the
+    // top element if it is new, it is never closed.
+    // The entry is flushed to disk before returning, with the
+    // directory entry of a new file.
+    //
+    bool exists = ::access (file.c_str(), F_OK) == 0;
+    string data;
+    if (!exists)
+        data = "<?xml version='1.0'?><caps-cache xmlns='" + cache_namespace + "'>\n";
+    data += to_string(make_entry(ver, result.first->second)) + "\n";
+    if (!write_file(file, O_APPEND, data, true))
+        uxmpp_log_warning (THIS_FILE, "Unable to write ", file);
+    else if (!exists)
+        sync_dir (file);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+size_t CapsCache::size ()
+{
+    lock_guard<std::mutex> lock (mutex);
+    return entries.size ();
+}
+
+
+//------------------------------------------------------------------------------
+// Return true if the sorted strings has duplicates.
+//------------------------------------------------------------------------------
+static bool has_duplicates (const vector<string>& sorted)
+{
+    return std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string CapsCache::make_ver (uxmpp::XmlObject& info)
+{
+    vector<string> identities;
+    vector<string> features;
+    vector<pair<string, string>> forms; // FORM_TYPE and the rest of the form
+
+    for (auto& node : info.get_nodes()) {
+        auto name = node.get_tag_name ();
+        if (name == "identity") {
+            identities.push_back (node.get_attribute("category") + "/" + node.get_attribute("type") + "/" +
+                                  node.get_attribute("xml:lang") + "/" + node.get_attribute("name"));
+        }
+        else if (name == "feature") {
+            features.push_back (node.get_attribute("var"));
+        }
+        else if (node.get_full_name() == data_forms_namespace + ":x") {
+            // An extended info form (XEP-0128), the fields are
+            // sorted by 'var' and the values of each field sorted.
+            string form_type;
+            bool valid_form_type = false;
+            vector<pair<string, string>> fields;
+            for (auto& field : node.get_nodes()) {
+                if (field.get_tag_name() != "field")
+                    continue;
+                vector<string> values;
+                for (auto& value : field.get_nodes()) {
+                    if (value.get_tag_name() == "value")
+                        values.push_back (value.get_content());
+                }
+                auto var = field.get_attribute ("var");
+                if (var == "FORM_TYPE") {
+                    if (!form_type.empty() || values.size()!=1)
+                        return "";
+                    form_type = values[0];
+                    valid_form_type = field.get_attribute("type") == "hidden";
+                    continue;
+                }
+                std::sort (values.begin(), values.end());
+                string field_str = var + "<";
+                for (auto& value : values)
+                    field_str += value + "<";
+                fields.emplace_back (var, field_str);
+            }
+            // Forms without a hidden FORM_TYPE are ignored
+            if (form_type.empty() || !valid_form_type)
+                continue;
+            std::sort (fields.begin(), fields.end());
+            string form_str;
+            for (auto& field : fields)
+                form_str += field.second;
+            forms.emplace_back (form_type, form_str);
+        }
+    }
+
+    std::sort (identities.begin(), identities.end());
+    std::sort (features.begin(), features.end());
+    std::sort (forms.begin(), forms.end());
+    if (has_duplicates(identities) || has_duplicates(features))
+        return "";
+    for (size_t i=1; i<forms.size(); ++i) {
+        if (forms[i].first == forms[i-1].first)
+            return "";
+    }
+
+    string s;
+    for (auto& identity : identities)
+        s += identity + "<";
+    for (auto& feature : features)
+        s += feature + "<";
+    for (auto& form : forms)
+        s += form.first + "<" + form.second;
+
+    auto digest = get_sha1 (s);
+    return to_base64 (digest.data(), digest.size());
+}
+
+
+UXMPP_END_NAMESPACE2
@@ -0,0 +1,114 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_MOD_CAPSCACHE_HPP
+#define UXMPP_MOD_CAPSCACHE_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/XmlObject.hpp>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+
+
+namespace uxmpp { namespace mod {
+
+
+    /**
+     * A cache of entity capabilities (XEP-0115), the disco#info
+     * result for each verification string.
+     * <p/>
+     * A verification string identifies a set of identities and
+     * features, so the disco#info result of a client version only needs
+     * to be queried once. The cache is shared by all sessions in the
+     * process, see get_instance(), and can be stored in a file so it is
+     * kept between restarts. Only results that match their verification
+     * string are added. The cache is thread safe.
+     */
+    class CapsCache {
+    public:
+        /**
+         * Return the cache shared by all DiscoModule instances.
+         * It is never deleted.
+         */
+        static CapsCache& get_instance ();
+
+        /**
+         * Constructor.
+         * Create an empty cache that is not stored in a file.
+         */
+        CapsCache ();
+
+        /**
+         * Store the cache in a file.
+         * The entries in the file are loaded, and added entries
+         * are then appended to the file.
+         * @param file The file to store the cache in.
+         * @return false if the file doesn't exist or can't be parsed.
+         */
+        bool set_file (const std::string& file);
+
+        /**
+         * Find the disco#info result of a verification string.
+         * @return A disco#info 'query' element, or nullptr if the
+         *         verification string isn't in the cache.
+         *         Entries are never removed, the pointer is valid
+         *         as long as the cache.
+         */
+        const uxmpp::XmlObject* find (const std::string& ver);
+
+        /**
+         * Add the disco#info result of a verification string.
+         * @param ver The verification string.
+         * @param info The disco#info 'query' element.
+         * @return false if the verification string of the info doesn't match,
+         *         the info is then not added.
+         */
+        bool add (const std::string& ver, const uxmpp::XmlObject& info);
+
+        /**
+         * Return the number of cached verification strings.
+         */
+        size_t size ();
+
+        /**
+         * Generate the verification string of a disco#info result
+         * using SHA-1, as defined in XEP-0115, section 5.
+         * @param info A disco#info 'query' element.
+         * @return The base64 encoded verification string, or an empty
+         *         string if the info has duplicate identities, features
+         *         or forms and must not be used for entity capabilities.
+         */
+        static std::string make_ver (uxmpp::XmlObject& info);
+
+
+    private:
+        static CapsCache* instance;
+
+        std::mutex mutex;
+        std::string file;
+        std::unordered_map<std::string, uxmpp::XmlObject> entries;
+
+        static uxmpp::XmlObject make_entry (const std::string& ver, const uxmpp::XmlObject& info);
+    };
+
+
+}}
+
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/Logger.hpp>
+#include <uxmpp/mod/CompressionModule.hpp>
+#include <uxmpp/Session.hpp>
+#include <uxmpp/xml/names.hpp>
+#include <uxmpp/io/SocketConnection.hpp>
+
+
+#define THIS_FILE "CompressionModule"
+
+
+UXMPP_START_NAMESPACE2(uxmpp, mod)
+
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::io;
+
+
+static const std::string XmlCompressFeatureNs      = "http://jabber.org/features/compress";
+static const std::string XmlCompressionTagFull     = XmlCompressFeatureNs + std::string(":compression");
+static const std::string XmlCompressNs             = "http://jabber.org/protocol/compress";
+static const std::string XmlCompressedTagFull      = XmlCompressNs + std::string(":compressed");
+static const std::string XmlFailureTagFull         = XmlCompressNs + std::string(":failure");
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+CompressionModule::CompressionModule (int level)
+    : uxmpp::XmppModule ("mod_compression"),
+      level     {level},
+      requested {false}
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool CompressionModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj)
+{
+    XmlStream& xs = session.get_xml_stream ();
+
+    //
+    // Handle 'features'
+    // Only compress after authentication, when we are offered resource binding.
+    //
+    if (xml_obj.get_full_name() == xml::full_tag_features) {
+        requested = false;
+        if (session.get_socket().is_compression_enabled())
+            return false;
+
+        bool have_zlib = false;
+        bool have_bind = false;
+        for (auto& node : xml_obj.get_nodes()) {
+            if (node.get_full_name() == XmlCompressionTagFull) {
+                for (auto& method : node.get_nodes()) {
+                    if (method.get_tag_name()=="method" && method.get_content()=="zlib")
+                        have_zlib = true;
+                }
+            }
+            else if (node.get_tag_name() == xml::tag_bind) {
+                have_bind = true;
+            }
+        }
+        if (have_zlib && have_bind) {
+            requested = true;
+            xs.write (XmlObject("compress", XmlCompressNs).
+                      add_node(XmlObject("method", XmlCompressNs, false).set_content("zlib")));
+            return true;
+        }
+        return false;
+    }
+
+    if (!requested)
+        return false;
+
+    //
+    // Handle 'compressed'
+    //
+    if (xml_obj.get_full_name() == XmlCompressedTagFull) {
+        requested = false;
+        SocketConnection& s = session.get_socket ();
+        s.cancel (); // Cancel all I/O operations
+        if (!s.enable_compression(level)) {
+            uxmpp_log_error (THIS_FILE, "Unable to restart the stream with compression enabled");
+            session.set_app_error ("compression-error", "Unable to initialize zlib");
+            session.stop ();
+        }else{
+            uxmpp_log_info (THIS_FILE, "Restart the stream with compression enabled");
+            session.reset ();
+        }
+        return true;
+    }
+
+    //
+    // Handle 'failure'
+    //
+    if (xml_obj.get_full_name() == XmlFailureTagFull) {
+        requested = false;
+        uxmpp_log_warning (THIS_FILE, "Stream compression failed: ",
+                           xml_obj.get_nodes().empty() ? "unknown" : xml_obj.get_nodes()[0].get_tag_name());
+        //
+        // Continue without compression, the session binds a
+        // resource when an XML object isn't handled by any module.
+        //
+        return false;
+    }
+
+    return false;
+}
+
+
+
+UXMPP_END_NAMESPACE2
@@ -0,0 +1,74 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_MOD_COMPRESSIONMODULE_HPP
+#define UXMPP_MOD_COMPRESSIONMODULE_HPP
+
+#include <string>
+#include <uxmpp/types.hpp>
+#include <uxmpp/XmppModule.hpp>
+#include <uxmpp/io/ZlibCompressor.hpp>
+
+
+namespace uxmpp { namespace mod {
+
+
+    /**
+     * An XMPP stream compression module (XEP-0138).
+     * When the server offers zlib compression after authentication, the
+     * stream is restarted with compression enabled in the session socket.
+     * Use Session::get_socket().get_compression_stats() to get the number
+     * of bytes sent and received, before and after compression.
+     * The module must be registered after the AuthModule and
+     * before the StreamManagementModule.
+     */
+    class CompressionModule : public uxmpp::XmppModule {
+    public:
+
+        /**
+         * Constructor.
+         * @param level zlib compression level, 0-9 or Z_DEFAULT_COMPRESSION.
+         */
+        CompressionModule (int level=Z_DEFAULT_COMPRESSION);
+
+        /**
+         * Destructor.
+         */
+        virtual ~CompressionModule () = default;
+
+        /**
+         * Called whan an XML object is received.
+         * @return Return true if this XML object was processed and no further work should be done.
+         */
+        virtual bool process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj) override;
+
+        /**
+         * zlib compression level.
+         */
+        int level;
+
+
+    private:
+        bool requested;
+    };
+
+
+}}
+
+
+#endif
@@ -20,6 +20,7 @@
 #include <uxmpp/mod/DiscoModule.hpp>
 #include <uxmpp/Stanza.hpp>
 #include <uxmpp/xml/names.hpp>
+#include <algorithm>
 
 #define THIS_FILE "DiscoModule"
 
@@ -38,37 +39,9 @@ static const string XmlDiscoInfoQueryTagFull {"http://jabber.org/protocol/disco#
 static const string XmlDiscoItemsNS           {"http://jabber.org/protocol/disco#items"};
 static const string XmlDiscoItemsQueryTagFull {"http://jabber.org/protocol/disco#items:query"};
 
-
-//------------------------------------------------------------------------------
-//------------------------------------------------------------------------------
-static void query_server_features (uxmpp::Session& session, string& query_id)
-{
-    for (auto& node : session.get_features()) {
-        if (node.get_full_name() != "http://jabber.org/protocol/caps:c" || query_id != "")
-            continue;
-
-        string node_attr = node.get_attribute ("node");
-        string ver_attr  = node.get_attribute ("ver");
-
-        query_id = Stanza::make_id ();
-
-        if (node_attr.empty() || ver_attr.empty()) {
-            session.send_stanza (IqStanza(IqType::get,
-                                          session.get_stream_from_attr(),
-                                          session.get_jid(),
-                                          query_id).
-                                 add_node(XmlObject("query", XmlDiscoInfoNS)));
-        }else{
-            session.send_stanza (IqStanza(IqType::get,
-                                          session.get_stream_from_attr(),
-                                          session.get_jid(),
-                                          query_id).
-                                 add_node(XmlObject("query", XmlDiscoInfoNS).
-                                          set_attribute("node", node_attr + string("#") + ver_attr)));
-        };
-        break;
-    }
-}
+static const string XmlCapsNS                 {"http://jabber.org/protocol/caps"};
+static const string XmlCapsTagFull            {"http://jabber.org/protocol/caps:c"};
+static const string default_caps_node         {"http://ultramarin.se/uxmpp"};
 
 
 //------------------------------------------------------------------------------
@@ -79,8 +52,20 @@ DiscoModule::DiscoModule ()
       server_feature_request_id {""},
       server_feature_version {""},
       info_handler {nullptr},
-      items_handler {nullptr}
+      items_handler {nullptr},
+      identity {"client", "pc", "uxmpp"},
+      caps_node {default_caps_node},
+      caps_cache {&CapsCache::get_instance()},
+      caps_handler {nullptr}
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+DiscoModule::~DiscoModule ()
 {
+    iq_tracker.cancel_all ();
 }
 
 
@@ -93,7 +78,11 @@ void DiscoModule::module_registered (uxmpp::Session& session)
 
     if (sess->get_state() == SessionState::bound && server_features.empty()) {
         server_features.clear ();
-        query_server_features (session, server_feature_request_id);
+        query_server_features (session);
+
+        // Contacts send their capabilities again
+        lock_guard<std::mutex> lock (caps_mutex);
+        entity_ver.clear ();
     }
 }
 
@@ -102,11 +91,56 @@ void DiscoModule::module_registered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 void DiscoModule::module_unregistered (uxmpp::Session& session)
 {
+    iq_tracker.cancel_all ();
+    server_feature_request_id = "";
     sess->del_session_listener (*this);
     sess = nullptr;
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::query_server_features (uxmpp::Session& session)
+{
+    for (auto& node : session.get_features()) {
+        if (node.get_full_name() != "http://jabber.org/protocol/caps:c" || server_feature_request_id != "")
+            continue;
+
+        string node_attr = node.get_attribute ("node");
+        string ver_attr  = node.get_attribute ("ver");
+
+        XmlObject query ("query", XmlDiscoInfoNS);
+        if (!node_attr.empty() && !ver_attr.empty())
+            query.set_attribute ("node", node_attr + string("#") + ver_attr);
+
+        // Set the request id before sending, the response may be handled before send_iq returns
+        string id = Stanza::make_id ();
+        server_feature_request_id = id;
+        id = iq_tracker.send_iq (
+            session,
+            IqStanza(IqType::get, session.get_stream_from_attr(), session.get_jid(), id).add_node(query),
+            [this](Session& session, IqStanza* iq){
+                StanzaError error (StanzaError::type_wait, StanzaError::remote_server_timeout);
+                if (!iq) {
+                    uxmpp_log_info (THIS_FILE, "No response to the server disco query");
+                }else{
+                    error = iq->get_error ();
+                    if (iq->get_type() == IqType::result)
+                        handle_feature_request_result (*iq);
+                    else if (error)
+                        uxmpp_log_info (THIS_FILE, "Got disco query error: ", error.get_condition());
+                }
+                server_feature_request_id = "";
+                if (on_server_disco_cb)
+                    on_server_disco_cb (session, *this, error);
+            });
+        if (id.empty())
+            server_feature_request_id = "";
+        break;
+    }
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void DiscoModule::handle_feature_request_result (IqStanza& iq)
@@ -154,43 +188,15 @@ bool DiscoModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject&
         return false;
 
     IqStanza& iq = reinterpret_cast<IqStanza&> (xml_obj);
-    StanzaError error = iq.get_error ();
-
-    // Chec for server feature query result
-    //
-    if (iq.get_id() == server_feature_request_id) {
-        if (iq.get_type() == IqType::result) {
-            handle_feature_request_result (iq);
-        }
-        else if (error) {
-            uxmpp_log_info (THIS_FILE, "Got disco query error: ", error.get_condition());
-        }
-        server_feature_request_id = "";
-        if (on_server_disco_cb)
-            on_server_disco_cb (*sess, *this, error);
-        return true;
-    }
-
-    // Handle query results
-    //
-    auto id_iter = query_ids.find (iq.get_id());
-    if (id_iter != query_ids.end()) {
-        // handle query result
-
-        query_ids.erase (id_iter);
-        return true;
-    }
 
     // Check for incoming info request/response
     //
     if (iq.get_type() == IqType::get) {
         XmlObject query = iq.find_node (XmlDiscoInfoQueryTagFull, true);
         if (query) {
+            handle_info_request (iq, query);
+            return true;
         }
-    }else{
-        //
-        // Check for result
-        //
     }
 
     return false;
@@ -204,8 +210,11 @@ void DiscoModule::on_state_change (uxmpp::Session& session,
                                    uxmpp::SessionState old_state)
 {
     if (new_state==SessionState::bound && old_state!=SessionState::bound) {
+        // The server features are still valid in a resumed stream
+        if (session.is_resumed() && !server_features.empty())
+            return;
         server_features.clear ();
-        query_server_features (session, server_feature_request_id);
+        query_server_features (session);
     }
 }
 
@@ -228,33 +237,500 @@ std::vector<std::string>& DiscoModule::get_server_features ()
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-std::string DiscoModule::query_info (const uxmpp::Jid& jid)
+std::vector<std::string>& DiscoModule::get_server_items ()
+{
+    return server_items;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool DiscoModule::crawl (const uxmpp::Jid& root,
+                         crawl_cb_t cb,
+                         const DiscoCrawlConfig& cfg,
+                         bool refresh)
+{
+    if (!sess || sess->get_state()!=SessionState::bound)
+        return false;
+
+    string key = to_string (root);
+    shared_ptr<const DiscoTree> cached;
+    crawl_ptr crawl;
+    {
+        lock_guard<std::mutex> lock (crawl_mutex);
+        auto i = crawls.find (key);
+        if (i != crawls.end()) {
+            // Already crawling
+            if (cb)
+                i->second->callbacks.push_back (cb);
+            return true;
+        }
+        auto j = crawl_results.find (key);
+        if (j!=crawl_results.end() && !refresh) {
+            cached = j->second;
+        }else{
+            crawl = make_shared<Crawl> ();
+            crawl->tree      = make_shared<DiscoTree> (root);
+            crawl->cfg       = cfg;
+            crawl->in_flight = 0;
+            crawl->timeouts  = 0;
+            if (crawl->cfg.window == 0)
+                crawl->cfg.window = 1;
+            if (cb)
+                crawl->callbacks.push_back (cb);
+            crawl->queue.emplace_back (0, false);
+            if (cfg.max_depth > 0)
+                crawl->queue.emplace_back (0, true);
+            crawls.emplace (key, crawl);
+        }
+    }
+
+    if (cached) {
+        if (cb)
+            cb (*this, cached);
+        return true;
+    }
+    uxmpp_log_debug (THIS_FILE, "Crawl ", key);
+    send_crawl_queries (crawl);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::shared_ptr<const DiscoTree> DiscoModule::get_crawl_result (const uxmpp::Jid& root)
+{
+    lock_guard<std::mutex> lock (crawl_mutex);
+    auto i = crawl_results.find (to_string(root));
+    return i==crawl_results.end() ? nullptr : i->second;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::clear_crawl_results ()
+{
+    lock_guard<std::mutex> lock (crawl_mutex);
+    crawl_results.clear ();
+}
+
+
+//------------------------------------------------------------------------------
+// Send queued queries until the window is full.
+//------------------------------------------------------------------------------
+void DiscoModule::send_crawl_queries (crawl_ptr crawl)
+{
+    vector<pair<size_t, bool>> queries;
+    vector<IqStanza> requests;
+    {
+        lock_guard<std::mutex> lock (crawl_mutex);
+        while (crawl->in_flight < crawl->cfg.window && !crawl->queue.empty()) {
+            auto query = crawl->queue.front ();
+            crawl->queue.pop_front ();
+            auto& entity = (*crawl->tree)[query.first];
+            XmlObject payload (XmlDiscoQueryTag, query.second ? XmlDiscoItemsNS : XmlDiscoInfoNS);
+            if (!entity.node.empty())
+                payload.set_attribute ("node", entity.node);
+            requests.push_back (IqStanza(IqType::get, entity.jid, sess ? sess->get_jid() : Jid()));
+            requests.back().add_node (payload);
+            queries.push_back (query);
+            ++crawl->in_flight;
+        }
+    }
+
+    // Send the queries without holding the lock,
+    // a response may be handled before send_iq returns.
+    //
+    for (size_t i=0; i<requests.size(); ++i) {
+        auto index = queries[i].first;
+        auto items = queries[i].second;
+        auto id = sess ? iq_tracker.send_iq (*sess, requests[i],
+                                             [this, crawl, index, items](Session& session, IqStanza* iq){
+                                                 handle_crawl_result (crawl, index, items, iq);
+                                             },
+                                             crawl->cfg.timeout)
+                       : "";
+        if (id.empty()) {
+            // The session is closing, give up
+            bool done;
+            {
+                lock_guard<std::mutex> lock (crawl_mutex);
+                crawl->in_flight -= requests.size() - i;
+                crawl->queue.clear ();
+                ++crawl->timeouts;
+                done = crawl->in_flight == 0;
+            }
+            if (done)
+                end_crawl (crawl);
+            return;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::handle_crawl_result (crawl_ptr crawl, size_t index, bool items, uxmpp::IqStanza* iq)
+{
+    bool done;
+    {
+        lock_guard<std::mutex> lock (crawl_mutex);
+        --crawl->in_flight;
+        auto& tree = *crawl->tree;
+
+        if (!iq) {
+            tree.set_error (index, StanzaError::remote_server_timeout);
+            ++crawl->timeouts;
+        }
+        else if (iq->get_type() != IqType::result) {
+            auto error = iq->get_error ();
+            tree.set_error (index, error ? error.get_condition() : StanzaError::undefined_condition);
+        }
+        else if (!items) {
+            auto query = iq->find_node (XmlDiscoInfoQueryTagFull, true);
+            if (query)
+                tree.set_info (index, query);
+        }else{
+            auto query = iq->find_node (XmlDiscoItemsQueryTagFull, true);
+            for (auto& item : query.get_nodes()) {
+                if (item.get_tag_name()!="item" || item.get_attribute("jid").empty())
+                    continue;
+                if (tree.size() >= crawl->cfg.max_entities && !tree.find(Jid(item.get_attribute("jid")),
+                                                                           item.get_attribute("node")))
+                {
+                    continue;
+                }
+                bool added;
+                auto child = tree.add_item (index, item, added);
+                if (!added)
+                    continue;
+                crawl->queue.emplace_back (child, false);
+                if (tree[child].depth < crawl->cfg.max_depth)
+                    crawl->queue.emplace_back (child, true);
+            }
+            tree[index].has_items = true;
+
+            if (index==0 && sess && tree[0].jid==Jid(sess->get_stream_from_attr())) {
+                server_items.clear ();
+                for (auto child : tree[0].children)
+                    server_items.push_back (to_string(tree[child].jid));
+            }
+        }
+        done = crawl->in_flight==0 && crawl->queue.empty ();
+    }
+
+    if (done)
+        end_crawl (crawl);
+    else
+        send_crawl_queries (crawl);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::end_crawl (crawl_ptr crawl)
+{
+    vector<crawl_cb_t> callbacks;
+    shared_ptr<const DiscoTree> tree = crawl->tree;
+    {
+        lock_guard<std::mutex> lock (crawl_mutex);
+        string key = to_string (tree->get_root().jid);
+        crawls.erase (key);
+        if (crawl->timeouts == 0)
+            crawl_results[key] = tree;
+        callbacks.swap (crawl->callbacks);
+    }
+    uxmpp_log_debug (THIS_FILE, "Crawled ", tree->size(), " entities of ", to_string(tree->get_root().jid));
+    for (auto& cb : callbacks)
+        cb (*this, tree);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string DiscoModule::query_info (const uxmpp::Jid& jid, const std::string& node, info_cb_t cb)
 {
     // Sanity check
     //
     if (!sess)
         return "";
 
-    // Save the query id
+    XmlObject query (XmlDiscoQueryTag, XmlDiscoInfoNS);
+    if (!node.empty())
+        query.set_attribute ("node", node);
+
+    Session::iq_callback_t iq_cb = nullptr;
+    if (cb) {
+        iq_cb = [this, jid, cb](Session& session, IqStanza* iq){
+            XmlObject info;
+            if (iq && iq->get_type()==IqType::result)
+                info = iq->find_node (XmlDiscoInfoQueryTagFull, true);
+            cb (*this, jid, info ? &info : nullptr);
+        };
+    }
+    return iq_tracker.send_iq (*sess, IqStanza(IqType::get, jid, sess->get_jid()).add_node(query), iq_cb);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::set_on_server_disco (on_server_disco_cb_t callback)
+{
+    on_server_disco_cb = callback;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::set_identity (const DiscoIdentity& identity)
+{
+    this->identity = identity;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+uxmpp::XmlObject DiscoModule::get_info (const std::string& node)
+{
+    XmlObject query (XmlDiscoQueryTag, XmlDiscoInfoNS);
+    if (!node.empty())
+        query.set_attribute ("node", node);
+    query.add_node (identity);
+
+    vector<string> features {XmlDiscoInfoNS, XmlCapsNS};
+    if (sess) {
+        for (auto module : sess->get_modules()) {
+            for (auto& feature : module->get_disco_features())
+                features.push_back (feature);
+        }
+    }
+    std::sort (features.begin(), features.end());
+    features.erase (std::unique(features.begin(), features.end()), features.end());
+    for (auto& feature : features)
+        query.add_node (XmlObject("feature", XmlDiscoInfoNS, false).set_attribute("var", feature));
+
+    return query;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::set_caps_node (const std::string& node)
+{
+    caps_node = node;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+uxmpp::XmlObject DiscoModule::get_caps ()
+{
+    auto info = get_info ();
+    auto ver = CapsCache::make_ver (info);
+
+    // Our own info doesn't need to be queried
+    caps_cache->add (ver, info);
+
+    XmlObject caps ("c", XmlCapsNS);
+    caps.set_attribute ("hash", "sha-1");
+    caps.set_attribute ("node", caps_node);
+    caps.set_attribute ("ver", ver);
+    return caps;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::set_caps_cache (CapsCache& cache)
+{
+    caps_cache = &cache;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+const uxmpp::XmlObject* DiscoModule::get_caps_info (const uxmpp::Jid& jid)
+{
+    string ver;
+    {
+        lock_guard<std::mutex> lock (caps_mutex);
+        auto i = entity_ver.find (to_string(jid));
+        if (i == entity_ver.end())
+            return nullptr;
+        ver = i->second;
+    }
+    return caps_cache->find (ver);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool DiscoModule::has_feature (const uxmpp::Jid& jid, const std::string& feature)
+{
+    auto info = get_caps_info (jid);
+    if (!info)
+        return false;
+    for (auto& node : const_cast<XmlObject*>(info)->get_nodes()) {
+        if (node.get_tag_name()=="feature" && node.get_attribute("var")==feature)
+            return true;
+    }
+    return false;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::set_caps_handler (caps_cb_t callback)
+{
+    caps_handler = callback;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::handle_info_request (uxmpp::IqStanza& iq, uxmpp::XmlObject& query)
+{
+    // Answer queries without a node, and queries for the node
+    // in our entity capabilities.
     //
-    string qid = Stanza::make_id ();
-    query_ids.insert (qid);
+    string node = query.get_attribute ("node");
+    if (!node.empty() && node.compare(0, caps_node.size()+1, caps_node + "#") != 0) {
+        sess->send_stanza (IqStanza(IqType::error, iq.get_from(), iq.get_to(), iq.get_id()).
+                           add_node(StanzaError(StanzaError::type_cancel, StanzaError::item_not_found)));
+        return;
+    }
+    sess->send_stanza (IqStanza(IqType::result, iq.get_from(), iq.get_to(), iq.get_id()).
+                       add_node(get_info(node)));
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::on_stanza_received (uxmpp::Session& session, uxmpp::XmlObject& stanza)
+{
+    if (stanza.get_full_name() != xml::full_tag_presence_stanza)
+        return;
+
+    auto from = stanza.get_attribute ("from");
+    auto type = stanza.get_attribute ("type");
+    if (from.empty() || (!type.empty() && type!="unavailable"))
+        return;
+
+    if (type.empty()) {
+        for (auto& node : stanza.get_nodes()) {
+            if (node.get_full_name() == XmlCapsTagFull) {
+                handle_caps (session, from, node);
+                return;
+            }
+        }
+    }
+
+    // No capabilities, or unavailable
+    lock_guard<std::mutex> lock (caps_mutex);
+    entity_ver.erase (from);
+}
+
 
-    // Send the query
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::handle_caps (uxmpp::Session& session, const std::string& from, uxmpp::XmlObject& caps)
+{
+    // Only SHA-1 is supported, legacy caps without
+    // a 'hash' attribute can't be verified.
     //
-    sess->send_stanza (IqStanza(IqType::get, jid, sess->get_jid(), qid).
-                       add_node(XmlObject(XmlDiscoQueryTag, XmlDiscoInfoNS)));
-//                       add_node(XmlObject(XmlDiscoQueryTag, "http://jabber.org/protocol/disco#info")));
+    auto ver  = caps.get_attribute ("ver");
+    auto node = caps.get_attribute ("node");
+    if (caps.get_attribute("hash")!="sha-1" || ver.empty())
+        return;
 
-    return qid;
+    auto info = caps_cache->find (ver);
+    {
+        lock_guard<std::mutex> lock (caps_mutex);
+        auto& current = entity_ver[from];
+        if (current == ver)
+            return; // Not changed
+        current = ver;
+
+        if (!info) {
+            // Query each verification string once
+            auto& pending = caps_pending[ver];
+            pending.push_back (from);
+            if (pending.size() > 1)
+                return;
+        }
+    }
+
+    if (info) {
+        if (caps_handler)
+            caps_handler (*this, Jid(from), *info);
+    }else{
+        query_caps (from, node, ver);
+    }
 }
 
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-void DiscoModule::set_on_server_disco (on_server_disco_cb_t callback)
+void DiscoModule::query_caps (const std::string& jid, const std::string& node, const std::string& ver)
 {
-    on_server_disco_cb = callback;
+    uxmpp_log_debug (THIS_FILE, "Query capabilities ", ver, " of ", jid);
+
+    XmlObject query (XmlDiscoQueryTag, XmlDiscoInfoNS);
+    query.set_attribute ("node", node + "#" + ver);
+    auto id = sess ? iq_tracker.send_iq (*sess, IqStanza(IqType::get, jid, sess->get_jid()).add_node(query),
+                                         [this, jid, node, ver](Session& session, IqStanza* iq){
+                                             handle_caps_result (jid, node, ver, iq);
+                                         })
+                   : "";
+    if (id.empty()) {
+        lock_guard<std::mutex> lock (caps_mutex);
+        caps_pending.erase (ver);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoModule::handle_caps_result (const std::string& jid,
+                                      const std::string& node,
+                                      const std::string& ver,
+                                      uxmpp::IqStanza* iq)
+{
+    XmlObject query;
+    if (iq && iq->get_type()==IqType::result)
+        query = iq->find_node (XmlDiscoInfoQueryTagFull, true);
+
+    bool verified = query && caps_cache->add(ver, query);
+    if (!verified)
+        uxmpp_log_info (THIS_FILE, "Unable to verify capabilities ", ver, " of ", jid);
+
+    vector<string> jids;
+    string next_jid;
+    {
+        lock_guard<std::mutex> lock (caps_mutex);
+        auto& pending = caps_pending[ver];
+        if (verified) {
+            jids.swap (pending);
+            caps_pending.erase (ver);
+        }else{
+            // Ask another entity with the same verification string
+            pending.erase (std::remove(pending.begin(), pending.end(), jid), pending.end());
+            if (pending.empty())
+                caps_pending.erase (ver);
+            else
+                next_jid = pending.front ();
+        }
+    }
+
+    if (!next_jid.empty()) {
+        query_caps (next_jid, node, ver);
+        return;
+    }
+    auto info = verified ? caps_cache->find(ver) : nullptr;
+    if (info && caps_handler) {
+        for (auto& entity : jids)
+            caps_handler (*this, Jid(entity), *info);
+    }
 }
 
 
@@ -22,19 +22,50 @@
 #include <functional>
 #include <uxmpp/types.hpp>
 #include <uxmpp/XmppModule.hpp>
+#include <uxmpp/IqTracker.hpp>
 #include <uxmpp/Session.hpp>
 #include <uxmpp/IqStanza.hpp>
 #include <uxmpp/mod/DiscoIdentity.hpp>
+#include <uxmpp/mod/CapsCache.hpp>
+#include <uxmpp/mod/DiscoTree.hpp>
 //#include <uxmpp/mod/DiscoInfo.hpp>
 #include <vector>
-#include <set>
+#include <string>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
 
 
 namespace uxmpp { namespace mod {
 
 
+    /**
+     * Limits of a service discovery crawl, see DiscoModule::crawl().
+     */
+    struct DiscoCrawlConfig {
+        unsigned window       {8};     /**< Max number of queries waiting for a response. */
+        unsigned timeout      {10000}; /**< Milliseconds to wait for the response to each query. */
+        unsigned max_depth    {1};     /**< Query the items of entities up to this depth, the root has depth 0. */
+        size_t   max_entities {1000};  /**< Ignore items found when the tree has this many entities. */
+    };
+
+
     /**
      * An XMPP Service Discovery module (XEP-0030, XEP-0115).
+     * <p/>
+     * The module answers disco#info queries with its identity and the
+     * features of all registered modules, and generates the entity
+     * capabilities that PresenceModule adds to our presence.
+     * <p/>
+     * Entity capabilities received in presence are looked up in a
+     * CapsCache, the process wide instance unless set_caps_cache() is
+     * called. Only unknown verification strings are queried, once per
+     * verification string even if many contacts use it at the same
+     * time, and the result is verified before it is cached.
+     * <p/>
+     * Services like MUC, pubsub and file upload are found by crawling
+     * the items of the server with crawl().
      */
     class DiscoModule : public uxmpp::XmppModule, uxmpp::SessionListener {
     public:
@@ -46,6 +77,31 @@ namespace uxmpp { namespace mod {
                                      DiscoModule& module,
                                      uxmpp::StanzaError& error)> on_server_disco_cb_t;
 
+        /**
+         * Called with the result of query_info().
+         * @param info The disco#info 'query' element, or nullptr on error or timeout.
+         */
+        typedef std::function <void (DiscoModule& module,
+                                     const uxmpp::Jid& jid,
+                                     uxmpp::XmlObject* info)> info_cb_t;
+
+        /**
+         * Called when the capabilities of an entity are known, or changed.
+         * @param jid The full JID of the entity.
+         * @param info The disco#info 'query' element of the entity.
+         */
+        typedef std::function <void (DiscoModule& module,
+                                     const uxmpp::Jid& jid,
+                                     const uxmpp::XmlObject& info)> caps_cb_t;
+
+        /**
+         * Called when a crawl is done.
+         * @param tree All entities found. Entities that couldn't be
+         *             queried have an error condition.
+         */
+        typedef std::function <void (DiscoModule& module,
+                                     std::shared_ptr<const DiscoTree> tree)> crawl_cb_t;
+
         /**
          * Default Constructor.
          */
@@ -53,8 +109,9 @@ namespace uxmpp { namespace mod {
 
         /**
          * Destructor.
+         * Cancels the pending IQ requests.
          */
-        virtual ~DiscoModule () = default;
+        virtual ~DiscoModule ();
 
         /**
          * Called when the module is registered to a session.
@@ -89,15 +146,118 @@ namespace uxmpp { namespace mod {
          */
         std::vector<std::string>& get_server_features ();
 
+        /**
+         * Return the JIDs of the server items, found when
+         * the server domain is crawled.
+         */
+        std::vector<std::string>& get_server_items ();
+
+        /**
+         * Called when a stanza is received, before it is handled by the modules.
+         * Entity capabilities in presence stanzas are handled here so it
+         * doesn't matter if PresenceModule is registered before this module.
+         */
+        virtual void on_stanza_received (uxmpp::Session& session, uxmpp::XmlObject& stanza) override;
+
         /**
          * Send an info query to a specific jid.
-         * This will send a 
          * @param jid The JID where to send the query.
-         * @param query_id An optional identifier for the query. If not given,
-         *                 <code>uxmpp::Stanza::makeId()</code> will be used.
-         *                 The identifier must be unique.
+         * @param node An optional 'node' attribute of the query.
+         * @param cb An optional callback called with the result.
+         * @return The id of the IQ request, or an empty string if it wasn't sent.
+         */
+        std::string query_info (const uxmpp::Jid& jid, const std::string& node="", info_cb_t cb=nullptr);
+
+        /**
+         * Crawl the service discovery tree of an entity, typically the
+         * server domain to find its services.
+         * <p/>
+         * The disco#info and disco#items of the root are queried, then the
+         * info of all its items, and the items of the items down to the
+         * configured depth. Each entity is queried once even if it is
+         * listed by more than one entity. At most cfg.window queries are
+         * waiting for a response at the same time, to be fast without
+         * triggering the rate limits of the server.
+         * <p/>
+         * The result is cached, by root JID, unless a query timed out.
+         * A cached result is passed to the callback before this method
+         * returns, other results from the session thread. If a crawl of
+         * the same root is in progress the callback is called when that
+         * crawl is done.
+         * @param root The entity to crawl.
+         * @param cb Called with the result.
+         * @param cfg The limits of the crawl.
+         * @param refresh Crawl again even if there is a cached result.
+         * @return false if the crawl can't be started, the session isn't bound.
+         */
+        bool crawl (const uxmpp::Jid& root,
+                    crawl_cb_t cb,
+                    const DiscoCrawlConfig& cfg=DiscoCrawlConfig(),
+                    bool refresh=false);
+
+        /**
+         * Return the cached result of a crawl.
+         * @param root The root JID of the crawl.
+         * @return The result, or nullptr if the entity hasn't been crawled.
+         */
+        std::shared_ptr<const DiscoTree> get_crawl_result (const uxmpp::Jid& root);
+
+        /**
+         * Remove all cached crawl results.
+         */
+        void clear_crawl_results ();
+
+        /**
+         * Set our identity, by default category 'client', type 'pc' and name 'uxmpp'.
          */
-        std::string query_info (const uxmpp::Jid& jid);
+        void set_identity (const DiscoIdentity& identity);
+
+        /**
+         * Return our disco#info, the identity and the features of all registered modules.
+         * @param node The 'node' attribute of the query, if any.
+         */
+        uxmpp::XmlObject get_info (const std::string& node="");
+
+        /**
+         * Set the node used in our entity capabilities,
+         * a URI identifying the software.
+         */
+        void set_caps_node (const std::string& node);
+
+        /**
+         * Return our entity capabilities, a 'c' element
+         * in namespace http://jabber.org/protocol/caps.
+         * Our disco#info is added to the caps cache.
+         */
+        uxmpp::XmlObject get_caps ();
+
+        /**
+         * Use a caps cache other than the process wide instance.
+         * The cache must outlive the module.
+         */
+        void set_caps_cache (CapsCache& cache);
+
+        /**
+         * Return the disco#info of an entity that has announced
+         * its capabilities in presence.
+         * @param jid The full JID of the entity.
+         * @return The disco#info 'query' element, or nullptr if the
+         *         capabilities of the entity aren't known (yet).
+         */
+        const uxmpp::XmlObject* get_caps_info (const uxmpp::Jid& jid);
+
+        /**
+         * Return true if an entity has announced a feature in its capabilities.
+         * @param jid The full JID of the entity.
+         * @param feature The feature, like "urn:xmpp:ping".
+         */
+        bool has_feature (const uxmpp::Jid& jid, const std::string& feature);
+
+        /**
+         * Set a callback to be called when the capabilities of an entity are known.
+         * It is called from the session thread.
+         */
+        void set_caps_handler (caps_cb_t callback);
 
         /**
          * Set a callback to be called when the server features has been received.
@@ -116,8 +276,7 @@ namespace uxmpp { namespace mod {
         std::vector<std::string> server_items;       /**< The server itemd. */
         uxmpp::XmlObject server_info_query_result;    /**< The xmlobject returned when querying server features. */
 
-        std::set<std::string> query_ids; /**< A set of id strings of sent stanzas. */
-
+        void query_server_features (uxmpp::Session& session);
         void handle_feature_request_result (uxmpp::IqStanza& iq);
 
         //std::function<void (DiscoModule&, DiscoInfo&)>  info_handler;
@@ -126,6 +285,46 @@ namespace uxmpp { namespace mod {
         std::function<void (DiscoModule&, XmlObject&)> items_handler;
 
         on_server_disco_cb_t on_server_disco_cb;
+
+        DiscoIdentity identity;
+        std::string caps_node;
+        CapsCache* caps_cache;
+        caps_cb_t caps_handler;
+
+        std::mutex caps_mutex;
+        std::unordered_map<std::string, std::string> entity_ver;                // Verification string by full JID
+        std::unordered_map<std::string, std::vector<std::string>> caps_pending; // Full JIDs by queried verification string
+
+        /**
+         * A crawl in progress.
+         */
+        struct Crawl {
+            std::shared_ptr<DiscoTree> tree;
+            DiscoCrawlConfig cfg;
+            std::vector<crawl_cb_t> callbacks;
+            std::deque<std::pair<size_t, bool>> queue; // Entity index, and true for disco#items
+            unsigned in_flight;
+            unsigned timeouts;
+        };
+        typedef std::shared_ptr<Crawl> crawl_ptr;
+
+        std::mutex crawl_mutex;
+        std::unordered_map<std::string, crawl_ptr> crawls;                               // In progress, by root JID
+        std::unordered_map<std::string, std::shared_ptr<const DiscoTree>> crawl_results; // By root JID
+
+        uxmpp::IqTracker iq_tracker; // Pending IQ requests sent by the module
+
+        void send_crawl_queries (crawl_ptr crawl);
+        void handle_crawl_result (crawl_ptr crawl, size_t index, bool items, uxmpp::IqStanza* iq);
+        void end_crawl (crawl_ptr crawl);
+
+        void handle_info_request (uxmpp::IqStanza& iq, uxmpp::XmlObject& query);
+        void handle_caps (uxmpp::Session& session, const std::string& from, uxmpp::XmlObject& caps);
+        void query_caps (const std::string& jid, const std::string& node, const std::string& ver);
+        void handle_caps_result (const std::string& jid,
+                                 const std::string& node,
+                                 const std::string& ver,
+                                 uxmpp::IqStanza* iq);
     };
 
 
@@ -0,0 +1,174 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/mod/DiscoTree.hpp>
+#include <algorithm>
+
+
+UXMPP_START_NAMESPACE2(uxmpp, mod)
+
+
+using namespace std;
+using namespace uxmpp;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static string make_key (const string& jid, const string& node)
+{
+    return node.empty() ? jid : jid + '\n' + node;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool DiscoEntity::has_feature (const std::string& feature) const
+{
+    return std::binary_search (features.begin(), features.end(), feature);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool DiscoEntity::has_identity (const std::string& category, const std::string& type) const
+{
+    for (auto& identity : identities) {
+        if (identity.get_category()==category && (type.empty() || identity.get_type()==type))
+            return true;
+    }
+    return false;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+DiscoTree::DiscoTree (const uxmpp::Jid& root, const std::string& node)
+{
+    DiscoEntity entity;
+    entity.jid       = root;
+    entity.node      = node;
+    entity.parent    = 0;
+    entity.depth     = 0;
+    entity.has_info  = false;
+    entity.has_items = false;
+    entities.push_back (std::move(entity));
+    index.emplace (make_key(to_string(root), node), 0);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+const DiscoEntity* DiscoTree::find (const uxmpp::Jid& jid, const std::string& node) const
+{
+    auto i = index.find (make_key(to_string(jid), node));
+    return i==index.end() ? nullptr : &entities[i->second];
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::vector<const DiscoEntity*> DiscoTree::find_by_feature (const std::string& feature) const
+{
+    vector<const DiscoEntity*> result;
+    for (auto& entity : entities) {
+        if (entity.has_feature(feature))
+            result.push_back (&entity);
+    }
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::vector<const DiscoEntity*> DiscoTree::find_by_identity (const std::string& category,
+                                                              const std::string& type) const
+{
+    vector<const DiscoEntity*> result;
+    for (auto& entity : entities) {
+        if (entity.has_identity(category, type))
+            result.push_back (&entity);
+    }
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+size_t DiscoTree::add_item (size_t parent, const uxmpp::XmlObject& item, bool& added)
+{
+    Jid jid (item.get_attribute("jid"));
+    string node = item.get_attribute ("node");
+
+    auto result = index.emplace (make_key(to_string(jid), node), entities.size());
+    added = result.second;
+    size_t i = result.first->second;
+    if (added) {
+        DiscoEntity entity;
+        entity.jid       = jid;
+        entity.node      = node;
+        entity.name      = item.get_attribute ("name");
+        entity.parent    = parent;
+        entity.depth     = entities[parent].depth + 1;
+        entity.has_info  = false;
+        entity.has_items = false;
+        entities.push_back (std::move(entity));
+    }
+
+    // Don't let an entity list itself, or the same item twice
+    auto& children = entities[parent].children;
+    if (i != parent && std::find(children.begin(), children.end(), i) == children.end())
+        children.push_back (i);
+    return i;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoTree::set_info (size_t index, uxmpp::XmlObject& info)
+{
+    auto& entity = entities[index];
+    entity.identities.clear ();
+    entity.features.clear ();
+    for (auto& node : info.get_nodes()) {
+        if (node.get_tag_name() == "identity") {
+            entity.identities.push_back (DiscoIdentity(node));
+        }
+        else if (node.get_tag_name() == "feature") {
+            auto var = node.get_attribute ("var");
+            if (!var.empty())
+                entity.features.push_back (var);
+        }
+    }
+    std::sort (entity.features.begin(), entity.features.end());
+    entity.features.erase (std::unique(entity.features.begin(), entity.features.end()),
+                           entity.features.end());
+    entity.has_info = true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void DiscoTree::set_error (size_t index, const std::string& condition)
+{
+    auto& entity = entities[index];
+    if (entity.error.empty())
+        entity.error = condition;
+}
+
+
+UXMPP_END_NAMESPACE2
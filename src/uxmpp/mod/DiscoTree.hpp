@@ -0,0 +1,161 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_MOD_DISCOTREE_HPP
+#define UXMPP_MOD_DISCOTREE_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/XmlObject.hpp>
+#include <uxmpp/Jid.hpp>
+#include <uxmpp/mod/DiscoIdentity.hpp>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+
+namespace uxmpp { namespace mod {
+
+
+    /**
+     * An entity found by a service discovery crawl,
+     * identified by its JID and an optional node.
+     */
+    struct DiscoEntity {
+        uxmpp::Jid jid;
+        std::string node;
+        std::string name;                       /**< The 'name' of the disco#items item, if any. */
+        std::vector<DiscoIdentity> identities;
+        std::vector<std::string> features;      /**< Sorted. */
+        std::vector<size_t> children;           /**< Indices of the items of the entity. */
+        size_t parent;                          /**< Index of the parent, the root is its own parent. */
+        unsigned depth;                         /**< The root has depth 0. */
+        bool has_info;                          /**< The disco#info query was successful. */
+        bool has_items;                         /**< The disco#items query was successful. */
+        std::string error;                      /**< The error condition of a failed query. */
+
+        /**
+         * Return true if the entity has a feature.
+         */
+        bool has_feature (const std::string& feature) const;
+
+        /**
+         * Return true if the entity has an identity.
+         * @param category The identity category.
+         * @param type The identity type, or an empty string for any type.
+         */
+        bool has_identity (const std::string& category, const std::string& type="") const;
+    };
+
+
+    /**
+     * The result of a service discovery crawl (XEP-0030).
+     * <p/>
+     * The entities are stored in the order they were found, the root
+     * first, and the tree is formed by the parent and child indices.
+     * An entity listed as an item by more than one entity is stored
+     * once, as a child of each of them.
+     */
+    class DiscoTree {
+    public:
+        /**
+         * Constructor.
+         * @param root The JID of the root entity.
+         * @param node The node of the root entity, if any.
+         */
+        DiscoTree (const uxmpp::Jid& root, const std::string& node="");
+
+        /**
+         * Return the root entity.
+         */
+        const DiscoEntity& get_root () const {
+            return entities[0];
+        }
+
+        /**
+         * Return all entities, the root first.
+         */
+        const std::vector<DiscoEntity>& get_entities () const {
+            return entities;
+        }
+
+        /**
+         * Return the number of entities.
+         */
+        size_t size () const {
+            return entities.size ();
+        }
+
+        /**
+         * Find an entity.
+         * @return The entity, or nullptr if it isn't in the tree.
+         *         The pointer is valid until the tree is modified.
+         */
+        const DiscoEntity* find (const uxmpp::Jid& jid, const std::string& node="") const;
+
+        /**
+         * Return all entities with a feature, like "http://jabber.org/protocol/muc".
+         */
+        std::vector<const DiscoEntity*> find_by_feature (const std::string& feature) const;
+
+        /**
+         * Return all entities with an identity, like category
+         * "conference" and type "text".
+         * @param type The identity type, or an empty string for any type.
+         */
+        std::vector<const DiscoEntity*> find_by_identity (const std::string& category,
+                                                           const std::string& type="") const;
+
+        /**
+         * Add an item to an entity.
+         * @param parent The index of the entity listing the item.
+         * @param item An 'item' element of a disco#items result.
+         * @param added Set to true if the item wasn't already in the tree.
+         * @return The index of the entity.
+         */
+        size_t add_item (size_t parent, const uxmpp::XmlObject& item, bool& added);
+
+        /**
+         * Set the identities and features of an entity.
+         * @param index The index of the entity.
+         * @param info The 'query' element of a disco#info result.
+         */
+        void set_info (size_t index, uxmpp::XmlObject& info);
+
+        /**
+         * Set the error condition of an entity.
+         */
+        void set_error (size_t index, const std::string& condition);
+
+        /**
+         * Return a modifiable entity, used when the tree is built.
+         */
+        DiscoEntity& operator[] (size_t index) {
+            return entities[index];
+        }
+
+
+    private:
+        std::vector<DiscoEntity> entities;
+        std::unordered_map<std::string, size_t> index; // Entity index by JID and node
+    };
+
+
+}}
+
+
+#endif
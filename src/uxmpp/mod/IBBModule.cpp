@@ -16,7 +16,13 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <uxmpp/Logger.hpp>
 #include <uxmpp/mod/IBBModule.hpp>
+#include <uxmpp/StanzaError.hpp>
+#include <uxmpp/utils.hpp>
+#include <uxmpp/xml/names.hpp>
+#include <algorithm>
+#include <cstdlib>
 
 
 UXMPP_START_NAMESPACE2(uxmpp, mod)
@@ -28,12 +34,28 @@ static const string log_module {"IBBModule"};
 
 static const string namespace_iq_ibb {"http://jabber.org/protocol/ibb"};
 
+// The 'block-size' attribute is an unsigned short
+static constexpr size_t max_ibb_block_size = 65535;
+
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-IBBModule::IBBModule () : XmppModule ("mod_ibb")
+IBBModule::IBBModule ()
+    : XmppModule ("mod_ibb"),
+      sess {nullptr},
+      max_block_size {max_ibb_block_size},
+      open_handler {nullptr},
+      data_handler {nullptr},
+      close_handler {nullptr}
 {
-    sess = nullptr;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+IBBModule::~IBBModule ()
+{
+    iq_tracker.cancel_all ();
 }
 
 
@@ -42,6 +64,7 @@ IBBModule::IBBModule () : XmppModule ("mod_ibb")
 void IBBModule::module_registered (uxmpp::Session& session)
 {
     sess = &session;
+    sess->add_session_listener (*this);
 }
 
 
@@ -49,6 +72,8 @@ void IBBModule::module_registered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 void IBBModule::module_unregistered (uxmpp::Session& session)
 {
+    iq_tracker.cancel_all ();
+    sess->del_session_listener (*this);
     sess = nullptr;
 }
 
@@ -57,8 +82,702 @@ void IBBModule::module_unregistered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 bool IBBModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj)
 {
+    // Sanity check
+    //
+    if (!sess || xml_obj.get_full_name()!=xml::full_tag_iq_stanza)
+        return false;
+
+    IqStanza& iq = reinterpret_cast<IqStanza&> (xml_obj);
+    if (iq.get_type() != IqType::set)
+        return false;
+
+    // Don't copy the 'data' element, it may be large
+    //
+    for (auto& node : iq.get_nodes()) {
+        if (node.get_namespace() != namespace_iq_ibb)
+            continue;
+        auto tag = node.get_tag_name ();
+        if (tag == "data")
+            handle_data (iq, node);
+        else if (tag == "open")
+            handle_open (iq, node);
+        else if (tag == "close")
+            handle_close (iq, node);
+        else
+            send_error (iq, StanzaError::type_cancel, StanzaError::bad_request);
+        return true;
+    }
     return false;
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::vector<std::string> IBBModule::get_disco_features ()
+{
+    return {namespace_iq_ibb};
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::on_state_change (uxmpp::Session& session,
+                                 uxmpp::SessionState new_state,
+                                 uxmpp::SessionState old_state)
+{
+    if (new_state != SessionState::closed)
+        return;
+
+    vector<rx_stream_t> rx;
+    vector<tx_stream_t> tx;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        for (auto& i : rx_streams)
+            rx.push_back (i.second);
+        for (auto& i : tx_streams)
+            tx.push_back (i.second);
+    }
+    for (auto& stream : rx)
+        end_rx_stream (stream, StanzaError::remote_server_timeout);
+    for (auto& stream : tx)
+        end_tx_stream (stream, StanzaError::remote_server_timeout, false);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string IBBModule::open (const Jid& to, size_t block_size, unsigned window)
+{
+    auto stream = make_shared<TxStream> ();
+    stream->peer       = to;
+    stream->block_size = block_size;
+    stream->window     = window;
+    stream->source     = nullptr;
+    return open_stream (stream);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string IBBModule::open (const Jid& to, io::Connection& source, size_t block_size, unsigned window)
+{
+    auto stream = make_shared<TxStream> ();
+    stream->peer       = to;
+    stream->block_size = block_size;
+    stream->window     = window;
+    stream->source     = &source;
+    stream->block.resize (std::min(block_size, max_ibb_block_size));
+    return open_stream (stream);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string IBBModule::open_stream (tx_stream_t stream)
+{
+    if (!sess || stream->block_size==0 || stream->block_size>max_ibb_block_size)
+        return "";
+
+    stream->sid         = make_uuid_v4 ();
+    stream->seq         = 0;
+    stream->in_flight   = 0;
+    stream->bytes       = 0;
+    stream->opened      = false;
+    stream->closing     = false;
+    stream->reading     = false;
+    stream->done        = false;
+    stream->pending_pos = 0;
+    if (stream->window == 0)
+        stream->window = 1;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        tx_streams.emplace (stream->sid, stream);
+    }
+
+    XmlObject open ("open", namespace_iq_ibb);
+    open.set_attribute ("block-size", std::to_string(stream->block_size));
+    open.set_attribute ("sid", stream->sid);
+    open.set_attribute ("stanza", "iq");
+    auto id = iq_tracker.send_iq (*sess, IqStanza(IqType::set, stream->peer, sess->get_jid()).add_node(open),
+                                         [this, stream](Session& session, IqStanza* iq){
+                                             if (iq && iq->get_type()==IqType::result) {
+                                                 {
+                                                     lock_guard<std::mutex> lock (mutex);
+                                                     stream->opened = true;
+                                                 }
+                                                 pump (stream);
+                                             }else{
+                                                 string condition = StanzaError::remote_server_timeout;
+                                                 if (iq) {
+                                                     auto error = iq->get_error ();
+                                                     condition = error ? error.get_condition() : StanzaError::undefined_condition;
+                                                 }
+                                                 end_tx_stream (stream, condition, false);
+                                             }
+                                         });
+    if (id.empty()) {
+        lock_guard<std::mutex> lock (mutex);
+        tx_streams.erase (stream->sid);
+        return "";
+    }
+    uxmpp_log_debug (log_module, "Open byte stream ", stream->sid, " to ", to_string(stream->peer),
+                     ", block size ", stream->block_size, ", window ", stream->window);
+    return stream->sid;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::send (const std::string& sid, const void* data, size_t size)
+{
+    tx_stream_t stream;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto i = tx_streams.find (sid);
+        if (i==tx_streams.end() || i->second->source || i->second->closing)
+            return;
+        stream = i->second;
+
+        // Drop the data already sent before adding more
+        if (stream->pending_pos > stream->pending.size()/2) {
+            stream->pending.erase (0, stream->pending_pos);
+            stream->pending_pos = 0;
+        }
+        stream->pending.append (static_cast<const char*>(data), size);
+    }
+    pump (stream);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::close (const std::string& sid)
+{
+    tx_stream_t tx;
+    rx_stream_t rx;
+    bool requested = false;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto i = tx_streams.find (sid);
+        if (i != tx_streams.end()) {
+            tx = i->second;
+            tx->closing = true;
+        }else{
+            auto j = rx_streams.find (sid);
+            if (j != rx_streams.end()) {
+                rx = j->second;
+                requested = !rx->open_id.empty ();
+            }
+        }
+    }
+    if (tx) {
+        pump (tx);
+    }
+    else if (requested) {
+        deny (sid);
+    }
+    else if (rx) {
+        if (sess) {
+            XmlObject close ("close", namespace_iq_ibb);
+            close.set_attribute ("sid", sid);
+            sess->send_iq (IqStanza(IqType::set, rx->peer, sess->get_jid()).add_node(close), nullptr);
+        }
+        end_rx_stream (rx, "");
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Send as many blocks as the window allows, and read the next
+// block from the source. When all data is sent the stream is closed.
+//------------------------------------------------------------------------------
+void IBBModule::pump (tx_stream_t stream)
+{
+    bool read = false;
+    bool finished = false;
+    bool failed = false;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (stream->done || !stream->opened)
+            return;
+
+        while (stream->in_flight < stream->window && stream->pending_pos < stream->pending.size()) {
+            size_t size = std::min (stream->block_size, stream->pending.size() - stream->pending_pos);
+            if (!send_block(stream, stream->pending.data() + stream->pending_pos, size)) {
+                failed = true;
+                break;
+            }
+            stream->pending_pos += size;
+        }
+        if (stream->pending_pos == stream->pending.size()) {
+            stream->pending.clear ();
+            stream->pending_pos = 0;
+        }
+
+        if (stream->source && !stream->reading && !stream->closing && stream->in_flight < stream->window) {
+            stream->reading = true;
+            read = true;
+        }
+        finished = stream->closing && !stream->reading && stream->in_flight==0 && stream->pending.empty();
+    }
+
+    if (failed) {
+        end_tx_stream (stream, StanzaError::remote_server_timeout, false);
+    }
+    else if (read) {
+        stream->source->read (stream->block.data(), stream->block.size(),
+                              [this, stream](io::Connection& conn, void* buf, ssize_t result, int errnum){
+                                  handle_read (stream, result);
+                              });
+    }
+    else if (finished) {
+        end_tx_stream (stream, "", true);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Called with the mutex locked. The block is base64 encoded
+// straight into the content of the 'data' element, and the
+// stanza is moved to the session, not copied.
+//------------------------------------------------------------------------------
+bool IBBModule::send_block (tx_stream_t stream, const char* data, size_t size)
+{
+    if (!sess)
+        return false;
+
+    string content (base64_size(size), '=');
+    to_base64 (data, size, &content[0]);
+
+    XmlObject data_obj ("data", namespace_iq_ibb);
+    data_obj.set_attribute ("seq", std::to_string(stream->seq));
+    data_obj.set_attribute ("sid", stream->sid);
+    data_obj.set_content (std::move(content));
+
+    IqStanza iq (IqType::set, stream->peer, sess->get_jid());
+    iq.add_node (std::move(data_obj));
+    auto id = iq_tracker.send_iq (*sess, std::move(iq), [this, stream, size](Session& session, IqStanza* response){
+            handle_data_result (stream, size, response);
+        });
+    if (id.empty())
+        return false;
+
+    ++stream->seq; // Wraps around to 0 after 65535
+    ++stream->in_flight;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::handle_read (tx_stream_t stream, ssize_t result)
+{
+    bool failed = false;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        stream->reading = false;
+        if (stream->done)
+            return;
+        if (result > 0)
+            failed = !send_block (stream, stream->block.data(), result);
+        else
+            stream->closing = true; // End of data, or a read error
+    }
+
+    if (result < 0) {
+        uxmpp_log_info (log_module, "Unable to read data for byte stream ", stream->sid);
+        end_tx_stream (stream, StanzaError::undefined_condition, true);
+    }
+    else if (failed) {
+        end_tx_stream (stream, StanzaError::remote_server_timeout, false);
+    }else{
+        pump (stream);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::handle_data_result (tx_stream_t stream, size_t size, uxmpp::IqStanza* iq)
+{
+    if (!iq) {
+        end_tx_stream (stream, StanzaError::remote_server_timeout, true);
+        return;
+    }
+    if (iq->get_type() != IqType::result) {
+        // The receiver has closed the stream
+        auto error = iq->get_error ();
+        end_tx_stream (stream, error ? error.get_condition() : StanzaError::undefined_condition, false);
+        return;
+    }
+    {
+        lock_guard<std::mutex> lock (mutex);
+        --stream->in_flight;
+        stream->bytes += size;
+    }
+    pump (stream);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::end_tx_stream (tx_stream_t stream, const std::string& error, bool send_close)
+{
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (stream->done)
+            return;
+        stream->done = true;
+        tx_streams.erase (stream->sid);
+    }
+    if (!error.empty())
+        uxmpp_log_info (log_module, "Byte stream ", stream->sid, " failed: ", error);
+
+    if (send_close && sess) {
+        XmlObject close ("close", namespace_iq_ibb);
+        close.set_attribute ("sid", stream->sid);
+        IqStanza iq (IqType::set, stream->peer, sess->get_jid());
+        iq.add_node (close);
+        if (error.empty()) {
+            // Done when the receiver has closed its end
+            auto id = iq_tracker.send_iq (*sess, iq, [this, stream](Session& session, IqStanza* response){
+                    string condition;
+                    if (!response)
+                        condition = StanzaError::remote_server_timeout;
+                    else if (response->get_type() != IqType::result)
+                        condition = response->get_error().get_condition ();
+                    if (close_handler)
+                        close_handler (*this, stream->sid, stream->bytes, condition);
+                });
+            if (!id.empty())
+                return;
+        }else{
+            sess->send_iq (iq, nullptr);
+        }
+    }
+    if (close_handler)
+        close_handler (*this, stream->sid, stream->bytes, error);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::accept (const std::string& sid)
+{
+    rx_stream_t stream;
+    string id;
+    {
+        // Data may be received as soon as the result is sent
+        lock_guard<std::mutex> lock (mutex);
+        auto i = rx_streams.find (sid);
+        if (i==rx_streams.end() || i->second->open_id.empty())
+            return;
+        stream = i->second;
+        id.swap (stream->open_id);
+    }
+    if (sess)
+        sess->send_stanza (IqStanza(IqType::result, stream->peer, sess->get_jid(), id));
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::accept (const std::string& sid, io::Connection& sink)
+{
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto i = rx_streams.find (sid);
+        if (i==rx_streams.end() || i->second->open_id.empty())
+            return;
+        i->second->sink = &sink;
+    }
+    accept (sid);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::deny (const std::string& sid)
+{
+    rx_stream_t stream;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto i = rx_streams.find (sid);
+        if (i==rx_streams.end() || i->second->open_id.empty())
+            return;
+        stream = i->second;
+        stream->done = true;
+        rx_streams.erase (i);
+    }
+    if (sess) {
+        sess->send_stanza (IqStanza(IqType::error, stream->peer, sess->get_jid(), stream->open_id).
+                           add_node(StanzaError(StanzaError::type_cancel, StanzaError::not_acceptable)));
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::set_open_handler (open_handler_t handler)
+{
+    open_handler = handler;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::set_data_handler (data_handler_t handler)
+{
+    data_handler = handler;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::set_close_handler (close_handler_t handler)
+{
+    close_handler = handler;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::set_max_block_size (size_t size)
+{
+    max_block_size = std::min (size, max_ibb_block_size);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::handle_open (uxmpp::IqStanza& iq, uxmpp::XmlObject& open)
+{
+    string sid   = open.get_attribute ("sid");
+    string type  = open.get_attribute ("stanza");
+    size_t block_size = strtoul (open.get_attribute("block-size").c_str(), nullptr, 10);
+
+    if (sid.empty() || block_size==0 || block_size>max_ibb_block_size) {
+        send_error (iq, StanzaError::type_modify, StanzaError::bad_request);
+        return;
+    }
+    if (!type.empty() && type!="iq") {
+        send_error (iq, StanzaError::type_cancel, StanzaError::feature_not_implemented);
+        return;
+    }
+    if (block_size > max_block_size) {
+        send_error (iq, StanzaError::type_modify, StanzaError::resource_constraint);
+        return;
+    }
+    if (!open_handler) {
+        send_error (iq, StanzaError::type_cancel, StanzaError::not_acceptable);
+        return;
+    }
+
+    auto stream = make_shared<RxStream> ();
+    stream->sid        = sid;
+    stream->peer       = iq.get_from ();
+    stream->block_size = block_size;
+    stream->seq        = 0;
+    stream->bytes      = 0;
+    stream->open_id    = iq.get_id ();
+    stream->sink       = nullptr;
+    stream->writing    = 0;
+    stream->done       = false;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (!rx_streams.emplace(sid, stream).second)
+            stream = nullptr;
+    }
+    if (!stream) {
+        send_error (iq, StanzaError::type_cancel, StanzaError::not_acceptable);
+        return;
+    }
+    uxmpp_log_debug (log_module, "Byte stream ", sid, " requested by ", to_string(iq.get_from()),
+                     ", block size ", block_size);
+    open_handler (*this, sid, iq.get_from(), block_size);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::handle_data (uxmpp::IqStanza& iq, uxmpp::XmlObject& data)
+{
+    string sid = data.get_attribute ("sid");
+    auto seq = strtoul (data.get_attribute("seq").c_str(), nullptr, 10);
+    string error;
+    rx_stream_t stream;
+    block_t block;
+    size_t size = 0;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto i = rx_streams.find (sid);
+        if (i==rx_streams.end() || !i->second->open_id.empty() ||
+            to_string(i->second->peer) != to_string(iq.get_from()))
+        {
+            error = StanzaError::item_not_found;
+        }else{
+            stream = i->second;
+            if (seq != stream->seq) {
+                error = StanzaError::unexpected_request;
+            }else{
+                if (stream->free_blocks.empty()) {
+                    // One extra byte to detect blocks that are too large
+                    block = make_shared<vector<char>> (stream->block_size + 1);
+                }else{
+                    block = stream->free_blocks.back ();
+                    stream->free_blocks.pop_back ();
+                }
+                auto& content = data.get_content ();
+                size = from_base64 (content.data(), content.size(), block->data(), block->size());
+                if (size > stream->block_size) {
+                    error = StanzaError::bad_request;
+                }else{
+                    ++stream->seq; // Wraps around to 0 after 65535
+                    stream->bytes += size;
+                    if (stream->sink && size)
+                        ++stream->writing;
+                }
+            }
+        }
+    }
+
+    if (!error.empty()) {
+        send_error (iq, StanzaError::type_cancel, error);
+        if (stream)
+            end_rx_stream (stream, error);
+        return;
+    }
+
+    if (stream->sink && size) {
+        write_block (stream, block, 0, size, iq.get_id());
+        return;
+    }
+    if (!stream->sink && data_handler && size)
+        data_handler (*this, sid, block->data(), size);
+    sess->send_stanza (IqStanza(IqType::result, iq.get_from(), sess->get_jid(), iq.get_id()));
+
+    lock_guard<std::mutex> lock (mutex);
+    stream->free_blocks.push_back (block);
+}
+
+
+//------------------------------------------------------------------------------
+// Write a received block to the sink, and acknowledge it when all
+// of it is written. Writes to a connection are done in order, so
+// the blocks are acknowledged in order.
+//------------------------------------------------------------------------------
+void IBBModule::write_block (rx_stream_t stream, block_t block, size_t offset, size_t size, std::string id)
+{
+    stream->sink->write (block->data()+offset, size-offset,
+                         [this, stream, block, offset, size, id](io::Connection& conn, void* buf,
+                                                                  ssize_t result, int errnum)
+        {
+            if (result>0 && offset+result<size) {
+                write_block (stream, block, offset+result, size, id);
+                return;
+            }
+
+            bool ok = result > 0;
+            bool closed = false;
+            {
+                lock_guard<std::mutex> lock (mutex);
+                --stream->writing;
+                stream->free_blocks.push_back (block);
+                if (stream->done)
+                    return;
+                closed = ok && stream->writing==0 && !stream->close_id.empty();
+            }
+
+            if (!ok) {
+                uxmpp_log_info (log_module, "Unable to write data of byte stream ", stream->sid);
+                if (sess) {
+                    sess->send_stanza (IqStanza(IqType::error, stream->peer, sess->get_jid(), id).
+                                       add_node(StanzaError(StanzaError::type_cancel,
+                                                            StanzaError::internal_server_error)));
+                }
+                end_rx_stream (stream, StanzaError::internal_server_error);
+                return;
+            }
+            if (sess)
+                sess->send_stanza (IqStanza(IqType::result, stream->peer, sess->get_jid(), id));
+            if (closed) {
+                if (sess)
+                    sess->send_stanza (IqStanza(IqType::result, stream->peer, sess->get_jid(), stream->close_id));
+                end_rx_stream (stream, "");
+            }
+        });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::handle_close (uxmpp::IqStanza& iq, uxmpp::XmlObject& close)
+{
+    string sid  = close.get_attribute ("sid");
+    string from = to_string (iq.get_from());
+    rx_stream_t rx;
+    tx_stream_t tx;
+    bool wait = false;
+    bool complete = false;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto i = rx_streams.find (sid);
+        if (i!=rx_streams.end() && to_string(i->second->peer)==from) {
+            rx = i->second;
+            // Acknowledge the close when all data is written
+            wait = rx->writing > 0;
+            if (wait)
+                rx->close_id = iq.get_id ();
+        }else{
+            auto j = tx_streams.find (sid);
+            if (j!=tx_streams.end() && to_string(j->second->peer)==from) {
+                tx = j->second;
+                complete = tx->closing && !tx->reading && tx->in_flight==0 && tx->pending.empty();
+            }
+        }
+    }
+
+    if (!rx && !tx) {
+        send_error (iq, StanzaError::type_cancel, StanzaError::item_not_found);
+        return;
+    }
+    if (wait)
+        return;
+
+    sess->send_stanza (IqStanza(IqType::result, iq.get_from(), sess->get_jid(), iq.get_id()));
+    if (rx)
+        end_rx_stream (rx, "");
+    else
+        end_tx_stream (tx, complete ? "" : StanzaError::gone, false);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::end_rx_stream (rx_stream_t stream, const std::string& error)
+{
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (stream->done)
+            return;
+        stream->done = true;
+        rx_streams.erase (stream->sid);
+    }
+    uxmpp_log_debug (log_module, "Byte stream ", stream->sid, " closed, ", stream->bytes, " bytes received");
+    if (close_handler)
+        close_handler (*this, stream->sid, stream->bytes, error);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void IBBModule::send_error (uxmpp::IqStanza& iq, const std::string& type, const std::string& condition)
+{
+    if (sess) {
+        sess->send_stanza (IqStanza(IqType::error, iq.get_from(), sess->get_jid(), iq.get_id()).
+                           add_node(StanzaError(type, condition)));
+    }
+}
+
+
 UXMPP_END_NAMESPACE2
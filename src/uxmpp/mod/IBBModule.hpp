@@ -21,10 +21,19 @@
 
 #include <uxmpp/types.hpp>
 #include <uxmpp/XmppModule.hpp>
+#include <uxmpp/IqTracker.hpp>
+#include <uxmpp/Session.hpp>
+#include <uxmpp/IqStanza.hpp>
 #include <uxmpp/Jid.hpp>
+#include <uxmpp/io/Connection.hpp>
 
 #include <string>
+#include <vector>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <cstdint>
 
 
 namespace uxmpp { namespace mod {
@@ -32,10 +41,60 @@ namespace uxmpp { namespace mod {
 
     /**
      * In-band Bytestream (XEP-0047).
+     * <p/>
+     * Data is sent in 'data' IQ stanzas of at most the block size
+     * negotiated when the stream is opened. Instead of waiting for
+     * the response to each block before the next is sent, up to
+     * 'window' blocks are waiting for a response at the same time.
+     * <p/>
+     * Data can be sent from memory with send(), or streamed from any
+     * io::Connection, like a FileConnection, one block at a time.
+     * Blocks are base64 encoded straight into the content of the
+     * 'data' element and received blocks are decoded straight into
+     * a block buffer that is written to the sink, or passed to the
+     * data handler. A received block is acknowledged when it has
+     * been written to the sink, so the window of the sender also
+     * limits the data buffered by the receiver.
+     * <p/>
+     * Only IQ stanzas are supported, not message stanzas.
      */
-    class IBBModule : public uxmpp::XmppModule {
+    class IBBModule : public uxmpp::XmppModule, uxmpp::SessionListener {
     public:
 
+        /**
+         * Called when an entity wants to open a byte stream to us.
+         * Call accept() or deny(), from the callback or later.
+         * @param sid The ID of the byte stream.
+         * @param from The sender of the byte stream.
+         * @param block_size The block size of the byte stream.
+         */
+        typedef std::function<void (IBBModule& module,
+                                     const std::string& sid,
+                                     const uxmpp::Jid& from,
+                                     size_t block_size)> open_handler_t;
+
+        /**
+         * Called with each block received in a byte stream accepted
+         * without a sink. It is called from the session thread.
+         */
+        typedef std::function<void (IBBModule& module,
+                                     const std::string& sid,
+                                     const void* data,
+                                     size_t size)> data_handler_t;
+
+        /**
+         * Called when a byte stream is closed, sent or received.
+         * @param sid The ID of the byte stream.
+         * @param bytes The number of bytes sent and acknowledged, or received.
+         * @param error An empty string if the byte stream was closed after
+         *              all data was transferred, otherwise the stanza
+         *              error condition that ended the byte stream.
+         */
+        typedef std::function<void (IBBModule& module,
+                                     const std::string& sid,
+                                     uint64_t bytes,
+                                     const std::string& error)> close_handler_t;
+
         /**
          * Default Constructor.
          */
@@ -43,8 +102,11 @@ namespace uxmpp { namespace mod {
 
         /**
          * Destructor.
+         * Byte streams sending from, or receiving to,
+         * a connection must be closed before this.
+         * Cancels the pending IQ requests.
          */
-        virtual ~IBBModule () = default;
+        virtual ~IBBModule ();
 
         /**
          * Called when the module is registered to a session.
@@ -62,16 +124,48 @@ namespace uxmpp { namespace mod {
          */
         virtual bool process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj) override;
 
+        /**
+         * Return the service discovery features of the module.
+         */
+        virtual std::vector<std::string> get_disco_features () override;
+
+        /**
+         * Called when the state of the session changes.
+         * Received byte streams are closed when the session is closed.
+         */
+        virtual void on_state_change (uxmpp::Session& session,
+                                      uxmpp::SessionState new_state,
+                                      uxmpp::SessionState old_state) override;
+
         /**
          * Open a byte stream to a JID.
+         * Data passed to send() is sent when the receiver has accepted
+         * the byte stream.
+         * @param to The receiver of the byte stream.
+         * @param block_size Size of the transmitted blocks, at most 65535.
+         * @param window The number of blocks that may wait for a response.
+         * @return A byte stream ID used when sending data and ending the stream,
+         *         or an empty string if the stream can't be opened.
+         */
+        std::string open (const Jid& to, size_t block_size=4096, unsigned window=8);
+
+        /**
+         * Open a byte stream to a JID, send all data read from a
+         * connection, and close the byte stream at the end of the data.
+         * One block at a time is read from the connection.
          * @param to The receiver of the byte stream.
-         * @param block_size Size of the transmitted blocks.
-         * @return A byte stream ID used when sending data and ending the stream.
+         * @param source The connection to read from. It must not be used
+         *               for reading by anyone else, and must not be
+         *               deleted until the byte stream is closed.
+         * @param block_size Size of the transmitted blocks, at most 65535.
+         * @param window The number of blocks that may wait for a response.
+         * @return A byte stream ID, or an empty string if the stream can't be opened.
          */
-        std::string open (const Jid& to, size_t block_size=4096);
+        std::string open (const Jid& to, io::Connection& source, size_t block_size=4096, unsigned window=8);
 
         /**
          * Send a piece of data in a byte stream.
+         * The data is copied and sent in blocks.
          * @param sid The ID of the byte stream.
          * @param data A pointer to a data chunk to send.
          * @param size The size of the data chunk to send.
@@ -80,31 +174,122 @@ namespace uxmpp { namespace mod {
 
         /**
          * Close a byte stream.
+         * An outgoing byte stream is closed when all data is sent,
+         * an incoming byte stream is closed at once.
          * @param sid The ID of the byte stream to close.
          */
         void close (const std::string& sid);
 
         /**
          * Accept a byte stream request.
+         * The received data is passed to the data handler.
          */
         void accept (const std::string& sid);
 
+        /**
+         * Accept a byte stream request.
+         * @param sid The ID of the byte stream.
+         * @param sink The received data is written to this connection.
+         *             It must not be deleted until the byte stream is closed.
+         */
+        void accept (const std::string& sid, io::Connection& sink);
+
         /**
          * Deny a byte stream request.
          */
         void deny (const std::string& sid);
 
+        /**
+         * Set the handler called when an entity wants to open a byte stream.
+         * Without a handler all byte streams are denied.
+         */
+        void set_open_handler (open_handler_t handler);
+
+        /**
+         * Set the handler called with the data of accepted byte streams without a sink.
+         */
+        void set_data_handler (data_handler_t handler);
+
+        /**
+         * Set the handler called when a byte stream is closed.
+         */
+        void set_close_handler (close_handler_t handler);
+
+        /**
+         * Set the largest block size accepted, 65535 by default.
+         * Requests with a larger block size are rejected.
+         */
+        void set_max_block_size (size_t size);
+
 
     private:
-        struct ibb_session_t {
-            Jid peer;
-            unsigned short seq;
-            size_t chunk_size;
+        typedef std::shared_ptr<std::vector<char>> block_t;
+
+        /**
+         * An outgoing byte stream.
+         */
+        struct TxStream {
+            std::string sid;
+            uxmpp::Jid peer;
+            size_t block_size;
+            unsigned window;
+            uint16_t seq;         // Sequence number of the next block
+            unsigned in_flight;   // Blocks waiting for a response
+            uint64_t bytes;       // Bytes acknowledged
+            bool opened;          // The receiver accepted the byte stream
+            bool closing;         // No more data will be added
+            bool reading;         // A read from the source is pending
+            bool done;
+            io::Connection* source;
+            std::vector<char> block; // Read buffer
+            std::string pending;     // Data from send()
+            size_t pending_pos;
+        };
+        typedef std::shared_ptr<TxStream> tx_stream_t;
+
+        /**
+         * An incoming byte stream.
+         */
+        struct RxStream {
+            std::string sid;
+            uxmpp::Jid peer;
+            size_t block_size;
+            uint16_t seq;           // Expected sequence number
+            uint64_t bytes;         // Bytes received
+            std::string open_id;    // Id of the open request, until accepted
+            std::string close_id;   // Id of the close request, when closed by the peer
+            io::Connection* sink;
+            unsigned writing;       // Blocks being written to the sink
+            bool done;
+            std::vector<block_t> free_blocks;
         };
+        typedef std::shared_ptr<RxStream> rx_stream_t;
 
         uxmpp::Session* sess;
-        std::map<std::string, ibb_session_t> rx_streams;
-        std::map<std::string, ibb_session_t> tx_streams;
+        std::mutex mutex;
+        std::map<std::string, rx_stream_t> rx_streams;
+        std::map<std::string, tx_stream_t> tx_streams;
+        size_t max_block_size;
+
+        open_handler_t  open_handler;
+        data_handler_t  data_handler;
+        close_handler_t close_handler;
+
+        uxmpp::IqTracker iq_tracker; // Pending IQ requests sent by the module
+
+        std::string open_stream (tx_stream_t stream);
+        void pump (tx_stream_t stream);
+        bool send_block (tx_stream_t stream, const char* data, size_t size);
+        void handle_read (tx_stream_t stream, ssize_t result);
+        void handle_data_result (tx_stream_t stream, size_t size, uxmpp::IqStanza* iq);
+        void end_tx_stream (tx_stream_t stream, const std::string& error, bool send_close);
+
+        void handle_open (uxmpp::IqStanza& iq, uxmpp::XmlObject& open);
+        void handle_data (uxmpp::IqStanza& iq, uxmpp::XmlObject& data);
+        void handle_close (uxmpp::IqStanza& iq, uxmpp::XmlObject& close);
+        void write_block (rx_stream_t stream, block_t block, size_t offset, size_t size, std::string id);
+        void end_rx_stream (rx_stream_t stream, const std::string& error);
+        void send_error (uxmpp::IqStanza& iq, const std::string& type, const std::string& condition);
     };
 
 
@@ -44,6 +44,8 @@ MessageModule::MessageModule ()
     always_send_receipt {false},
     correction_supported {true},
     sess {nullptr},
+    roster_module {nullptr},
+    roster_module_version {0},
     message_handler {nullptr},
     receipt_handler {nullptr}
 {
@@ -55,6 +57,7 @@ MessageModule::MessageModule ()
 void MessageModule::module_registered (uxmpp::Session& session)
 {
     sess = &session;
+    find_roster_module (session);
     //sess->addSessionListener (*this);
 }
 
@@ -65,34 +68,42 @@ void MessageModule::module_unregistered (uxmpp::Session& session)
 {
     //sess->delSessionListener (*this);
     sess = nullptr;
+    roster_module = nullptr;
 }
 
 
 //------------------------------------------------------------------------------
-// Return true if the jid is in our roster and is authorized to se our presence
 //------------------------------------------------------------------------------
-static bool is_jid_authorized (uxmpp::Session& session, uxmpp::Jid jid)
+void MessageModule::find_roster_module (uxmpp::Session& session)
 {
+    roster_module_version = session.get_modules_version ();
+    roster_module = nullptr;
     for (auto mod : session.get_modules()) {
         if (!mod) // Sanity check
             continue;
-        if (RosterModule* rm = dynamic_cast<RosterModule*>(mod)) {
-            for (auto& item : rm->get_roster().get_items()) {
-                if (item.get_jid().bare() != jid)
-                    continue;
-                //
-                // Jid found.
-                //
-                string s = item.get_subscription ();
-                if (s=="from" || s=="both") {
-                    return true;  // Authorized
-                }else{
-                    uxmpp_log_debug (THIS_FILE, to_string(jid),
-                                     " is not authorized to view our presence, don't send a message receipt");
-                    return false; // Not authorized
-                }
-            }
-        }
+        if ((roster_module = dynamic_cast<RosterModule*>(mod)))
+            break;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Return true if the jid is in our roster and is authorized to se our presence
+//------------------------------------------------------------------------------
+bool MessageModule::is_jid_authorized (uxmpp::Session& session, const uxmpp::Jid& jid)
+{
+    // Look up the roster module again only if the registered modules have changed
+    //
+    if (roster_module_version != session.get_modules_version())
+        find_roster_module (session);
+
+    string s = roster_module ? roster_module->subscription_of (jid) : "";
+    if (s=="from" || s=="both")
+        return true;  // Authorized
+    if (!s.empty()) {
+        uxmpp_log_debug (THIS_FILE, to_string(jid),
+                         " is not authorized to view our presence, don't send a message receipt");
+        return false; // Not authorized
     }
     uxmpp_log_debug (THIS_FILE, to_string(jid), " is not found in our roster, don't send a message receipt");
     return false;
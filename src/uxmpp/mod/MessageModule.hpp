@@ -31,6 +31,9 @@
 namespace uxmpp { namespace mod {
 
 
+    class RosterModule;
+
+
     /**
      * An XMPP presence module.
      * Supports XEP-0308 - Last Message Correction, XEP-0184 - Message Delivery Recepits.
@@ -133,8 +136,21 @@ namespace uxmpp { namespace mod {
 
 
     protected:
+        /**
+         * Return true if the JID is in our roster and is
+         * authorized to see our presence.
+         */
+        bool is_jid_authorized (uxmpp::Session& session, const uxmpp::Jid& jid);
+
+        /**
+         * Look up the roster module of the session, if any.
+         */
+        void find_roster_module (uxmpp::Session& session);
+
         bool correction_supported;
         uxmpp::Session* sess;
+        RosterModule* roster_module;       // Looked up when the session modules change
+        unsigned roster_module_version;    // Session::get_modules_version() of the lookup
         std::map<std::string, uxmpp::MessageStanza> correctable_messages;
         std::function<void (MessageModule&, uxmpp::MessageStanza&, bool corr, const std::string& id)> message_handler;
         std::function<void (MessageModule&, const uxmpp::Jid& from, const std::string& id)> receipt_handler;
@@ -0,0 +1,200 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/mod/MucRoom.hpp>
+
+
+UXMPP_START_NAMESPACE2(uxmpp, mod)
+
+
+using namespace std;
+using namespace uxmpp;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string to_string (const MucRole& role)
+{
+    switch (role) {
+    case MucRole::visitor:
+        return "visitor";
+    case MucRole::participant:
+        return "participant";
+    case MucRole::moderator:
+        return "moderator";
+    case MucRole::none:
+    default:
+        return "none";
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string to_string (const MucAffiliation& affiliation)
+{
+    switch (affiliation) {
+    case MucAffiliation::outcast:
+        return "outcast";
+    case MucAffiliation::member:
+        return "member";
+    case MucAffiliation::admin:
+        return "admin";
+    case MucAffiliation::owner:
+        return "owner";
+    case MucAffiliation::none:
+    default:
+        return "none";
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+MucRole parse_role (const std::string& role)
+{
+    if (role == "participant")
+        return MucRole::participant;
+    else if (role == "moderator")
+        return MucRole::moderator;
+    else if (role == "visitor")
+        return MucRole::visitor;
+    else
+        return MucRole::none;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+MucAffiliation parse_affiliation (const std::string& affiliation)
+{
+    if (affiliation == "member")
+        return MucAffiliation::member;
+    else if (affiliation == "owner")
+        return MucAffiliation::owner;
+    else if (affiliation == "admin")
+        return MucAffiliation::admin;
+    else if (affiliation == "outcast")
+        return MucAffiliation::outcast;
+    else
+        return MucAffiliation::none;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+MucRoom::MucRoom (const uxmpp::Jid& jid, const std::string& nick)
+    : jid (jid.bare()),
+      nick (nick),
+      state (MucRoomState::joining)
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+const MucOccupant* MucRoom::find (const std::string& nick) const
+{
+    auto i = occupants.find (nick);
+    return i==occupants.end() ? nullptr : &i->second;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+const MucOccupant* MucRoom::find_by_jid (const std::string& real_jid) const
+{
+    auto i = nicks.find (real_jid);
+    return i==nicks.end() ? nullptr : find (i->second);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+const MucOccupant* MucRoom::set_occupant (MucOccupant& occupant, bool& added)
+{
+    auto i = occupants.find (occupant.nick);
+    if (i == occupants.end()) {
+        added = true;
+        if (!occupant.jid.empty())
+            nicks[occupant.jid] = occupant.nick;
+        auto nick = occupant.nick;
+        return &occupants.emplace(std::move(nick), std::move(occupant)).first->second;
+    }
+
+    added = false;
+    auto& entry = i->second;
+    if (entry.jid==occupant.jid && entry.role==occupant.role && entry.affiliation==occupant.affiliation &&
+        entry.show==occupant.show && entry.status==occupant.status)
+    {
+        return nullptr;
+    }
+    if (entry.jid != occupant.jid) {
+        if (!entry.jid.empty())
+            nicks.erase (entry.jid);
+        if (!occupant.jid.empty())
+            nicks[occupant.jid] = occupant.nick;
+    }
+    entry = std::move (occupant);
+    return &entry;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool MucRoom::remove_occupant (const std::string& nick, MucOccupant* removed)
+{
+    auto i = occupants.find (nick);
+    if (i == occupants.end())
+        return false;
+    if (!i->second.jid.empty())
+        nicks.erase (i->second.jid);
+    if (removed)
+        *removed = std::move (i->second);
+    occupants.erase (i);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+const MucOccupant* MucRoom::rename_occupant (const std::string& nick, const std::string& new_nick)
+{
+    auto i = occupants.find (nick);
+    if (i==occupants.end() || occupants.find(new_nick)!=occupants.end())
+        return nullptr;
+
+    MucOccupant occupant (std::move(i->second));
+    occupants.erase (i);
+    occupant.nick = new_nick;
+    if (!occupant.jid.empty())
+        nicks[occupant.jid] = new_nick;
+    return &occupants.emplace(new_nick, std::move(occupant)).first->second;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void MucRoom::clear ()
+{
+    occupants.clear ();
+    nicks.clear ();
+}
+
+
+UXMPP_END_NAMESPACE2
@@ -0,0 +1,240 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_MOD_MUCROOM_HPP
+#define UXMPP_MOD_MUCROOM_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/Jid.hpp>
+#include <uxmpp/mod/PresenceTable.hpp>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+
+namespace uxmpp { namespace mod {
+
+
+    /**
+     * The role of an occupant in a multi-user chat room.
+     */
+    enum class MucRole : uint8_t {
+        none        = 0,
+        visitor     = 1,
+        participant = 2,
+        moderator   = 3,
+    };
+
+    /**
+     * The affiliation of a user with a multi-user chat room.
+     */
+    enum class MucAffiliation : uint8_t {
+        outcast = 0,
+        none    = 1,
+        member  = 2,
+        admin   = 3,
+        owner   = 4,
+    };
+
+    /**
+     * Return the 'role' attribute value of a role.
+     */
+    std::string to_string (const MucRole& role);
+
+    /**
+     * Return the 'affiliation' attribute value of an affiliation.
+     */
+    std::string to_string (const MucAffiliation& affiliation);
+
+    /**
+     * Return the role of a 'role' attribute value, MucRole::none if unknown.
+     */
+    MucRole parse_role (const std::string& role);
+
+    /**
+     * Return the affiliation of an 'affiliation' attribute value,
+     * MucAffiliation::none if unknown.
+     */
+    MucAffiliation parse_affiliation (const std::string& affiliation);
+
+
+    /**
+     * An occupant of a multi-user chat room.
+     */
+    struct MucOccupant {
+        std::string nick;           /**< The nickname in the room. */
+        std::string jid;            /**< The real full JID, empty if the room doesn't reveal it. */
+        MucRole role;
+        MucAffiliation affiliation;
+        PresenceShow show;
+        std::string status;
+    };
+
+
+    /**
+     * The state of a multi-user chat room we are in.
+     */
+    enum class MucRoomState {
+        joining, /**< Waiting for the presence of the occupants and our own. */
+        joined,  /**< In the room. */
+        left     /**< Not in the room. */
+    };
+
+
+    /**
+     * How much discussion history to request when joining a room.
+     * A negative value, or an empty 'since', is not sent, leaving it
+     * to the room. Setting max_stanzas to 0 requests no history.
+     */
+    struct MucHistory {
+        MucHistory (int max_stanzas=-1, int seconds=-1, const std::string& since="")
+            : max_stanzas {max_stanzas}, max_chars {-1}, seconds {seconds}, since {since}
+        {
+        }
+        int max_stanzas;   /**< The 'maxstanzas' attribute. */
+        int max_chars;     /**< The 'maxchars' attribute. */
+        int seconds;       /**< The 'seconds' attribute. */
+        std::string since; /**< The 'since' attribute, a UTC time like 1970-01-01T00:00:00Z. */
+    };
+
+
+    /**
+     * A multi-user chat room (XEP-0045) and its occupants.
+     * <p/>
+     * The occupants are hashed by nickname, and by real JID when
+     * the room reveals it, so a presence update from a room with
+     * many thousand occupants is a constant time update.
+     */
+    class MucRoom {
+    public:
+        /**
+         * Constructor.
+         * @param jid The bare JID of the room.
+         * @param nick Our nickname in the room.
+         */
+        MucRoom (const uxmpp::Jid& jid, const std::string& nick);
+
+        /**
+         * Return the bare JID of the room.
+         */
+        const uxmpp::Jid& get_jid () const {
+            return jid;
+        }
+
+        /**
+         * Return our nickname in the room.
+         */
+        const std::string& get_nick () const {
+            return nick;
+        }
+
+        /**
+         * Return the state of the room.
+         */
+        MucRoomState get_state () const {
+            return state;
+        }
+
+        /**
+         * Return the subject of the room.
+         */
+        const std::string& get_subject () const {
+            return subject;
+        }
+
+        /**
+         * Find an occupant by nickname.
+         * @return The occupant, or nullptr if not found.
+         *         The pointer is valid until the occupant leaves.
+         */
+        const MucOccupant* find (const std::string& nick) const;
+
+        /**
+         * Find an occupant by real JID.
+         * @param real_jid The full real JID of the occupant.
+         * @return The occupant, or nullptr if not found or if the room
+         *         doesn't reveal real JIDs.
+         */
+        const MucOccupant* find_by_jid (const std::string& real_jid) const;
+
+        /**
+         * Return our own occupant entry, or nullptr if not joined.
+         */
+        const MucOccupant* get_self () const {
+            return find (nick);
+        }
+
+        /**
+         * Return the number of occupants, including us.
+         */
+        size_t size () const {
+            return occupants.size ();
+        }
+
+        /**
+         * Return all occupants, keyed by nickname.
+         */
+        const std::unordered_map<std::string, MucOccupant>& get_occupants () const {
+            return occupants;
+        }
+
+        /**
+         * Add an occupant, or update it if the nickname is in the room.
+         * @param occupant The occupant. It is moved into the table if added or changed.
+         * @param added Set to true if the occupant was added.
+         * @return The occupant in the table, or nullptr if nothing changed.
+         */
+        const MucOccupant* set_occupant (MucOccupant& occupant, bool& added);
+
+        /**
+         * Remove an occupant.
+         * @param nick The nickname of the occupant.
+         * @param removed If not nullptr, the removed occupant is moved here.
+         * @return false if the occupant wasn't found.
+         */
+        bool remove_occupant (const std::string& nick, MucOccupant* removed=nullptr);
+
+        /**
+         * Change the nickname of an occupant.
+         * @return The renamed occupant, or nullptr if not found
+         *         or if the new nickname is taken.
+         */
+        const MucOccupant* rename_occupant (const std::string& nick, const std::string& new_nick);
+
+        /**
+         * Remove all occupants.
+         */
+        void clear ();
+
+
+    private:
+        friend class MultiUserChatModule;
+
+        uxmpp::Jid jid;
+        std::string nick;
+        MucRoomState state;
+        std::string subject;
+        std::unordered_map<std::string, MucOccupant> occupants; // By nickname
+        std::unordered_map<std::string, std::string> nicks;     // Nickname by real JID
+    };
+
+
+}}
+
+
+#endif
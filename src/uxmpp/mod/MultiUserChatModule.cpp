@@ -0,0 +1,504 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/Logger.hpp>
+#include <uxmpp/mod/MultiUserChatModule.hpp>
+#include <uxmpp/Session.hpp>
+#include <uxmpp/SessionState.hpp>
+#include <uxmpp/PresenceStanza.hpp>
+#include <uxmpp/MessageStanza.hpp>
+#include <uxmpp/StanzaError.hpp>
+#include <uxmpp/xml/names.hpp>
+#include <vector>
+
+
+UXMPP_START_NAMESPACE2(uxmpp, mod)
+
+
+using namespace std;
+using namespace uxmpp;
+
+static const std::string log_module {"MultiUserChatModule"};
+
+static const std::string namespace_muc      {"http://jabber.org/protocol/muc"};
+static const std::string namespace_muc_user {"http://jabber.org/protocol/muc#user"};
+static const std::string namespace_delay    {"urn:xmpp:delay"};
+
+
+//------------------------------------------------------------------------------
+// Return the reason we were removed from a room, from a status code.
+//------------------------------------------------------------------------------
+static const char* get_removed_reason (const std::string& code)
+{
+    if (code == "307")
+        return "kicked";
+    else if (code == "301")
+        return "banned";
+    else if (code=="321" || code=="322")
+        return "removed";
+    else if (code == "332")
+        return "shutdown";
+    else
+        return nullptr;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+MultiUserChatModule::MultiUserChatModule ()
+    : uxmpp::XmppModule ("mod_muc"),
+      sess (nullptr)
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void MultiUserChatModule::module_registered (uxmpp::Session& session)
+{
+    sess = &session;
+    sess->add_session_listener (*this);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void MultiUserChatModule::module_unregistered (uxmpp::Session& session)
+{
+    {
+        lock_guard<std::mutex> lock (mutex);
+        rooms.clear ();
+    }
+    sess->del_session_listener (*this);
+    sess = nullptr;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::vector<std::string> MultiUserChatModule::get_disco_features ()
+{
+    return {namespace_muc};
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void MultiUserChatModule::on_state_change (uxmpp::Session& session,
+                                           uxmpp::SessionState new_state,
+                                           uxmpp::SessionState old_state)
+{
+    if (old_state!=SessionState::bound || new_state==SessionState::bound)
+        return;
+
+    vector<MucRoom*> ended;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        for (auto& room : rooms)
+            ended.push_back (room.second.get());
+    }
+    for (auto room : ended)
+        end_room (*room, StanzaError::remote_server_timeout);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool MultiUserChatModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj)
+{
+    // Sanity check
+    //
+    if (!sess)
+        return false;
+
+    auto full_name = xml_obj.get_full_name ();
+    bool is_presence = full_name == xml::full_tag_presence_stanza;
+    if (!is_presence && full_name!=xml::full_tag_message_stanza)
+        return false;
+
+    // Only stanzas from the rooms we are in, the resource is the nickname
+    //
+    auto& attributes = xml_obj.get_attributes ();
+    auto from = attributes.find ("from");
+    if (from == attributes.end())
+        return false;
+    auto slash = from->second.find ('/');
+    auto room = find_room (from->second.substr(0, slash));
+    if (!room)
+        return false;
+    string nick = slash==string::npos ? "" : from->second.substr (slash+1);
+
+    if (is_presence)
+        return handle_presence (*room, xml_obj, nick);
+    else
+        return handle_message (*room, xml_obj, nick);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+MucRoom* MultiUserChatModule::join (const uxmpp::Jid& room, const std::string& nick, const std::string& password)
+{
+    MucHistory history;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        history = history_limit;
+    }
+    return join (room, nick, history, password);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+MucRoom* MultiUserChatModule::join (const uxmpp::Jid& room,
+                                    const std::string& nick,
+                                    const MucHistory& history,
+                                    const std::string& password)
+{
+    if (!sess || sess->get_state()!=SessionState::bound) {
+        uxmpp_log_debug (log_module, "Can't join room, no session or session not bound");
+        return nullptr;
+    }
+
+    auto room_jid = to_string (room.bare());
+    MucRoom* joining;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto& entry = rooms[room_jid];
+        if (entry) {
+            uxmpp_log_info (log_module, "Already in room ", room_jid);
+            return nullptr;
+        }
+        entry.reset (new MucRoom(room, nick));
+        joining = entry.get ();
+    }
+
+    XmlObject x ("x", namespace_muc);
+    XmlObject limit ("history", namespace_muc, false);
+    if (history.max_stanzas >= 0)
+        limit.set_attribute ("maxstanzas", std::to_string(history.max_stanzas));
+    if (history.max_chars >= 0)
+        limit.set_attribute ("maxchars", std::to_string(history.max_chars));
+    if (history.seconds >= 0)
+        limit.set_attribute ("seconds", std::to_string(history.seconds));
+    if (!history.since.empty())
+        limit.set_attribute ("since", history.since);
+    if (!limit.get_attributes().empty())
+        x.add_node (std::move(limit));
+    if (!password.empty())
+        x.add_node (XmlObject("password", namespace_muc, false).set_content(password));
+
+    uxmpp_log_debug (log_module, "Join room ", room_jid, " as ", nick);
+    PresenceStanza pr (room_jid + "/" + nick, "");
+    pr.add_node (std::move(x));
+    sess->send_stanza (pr);
+    return joining;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void MultiUserChatModule::leave (const uxmpp::Jid& room, const std::string& status)
+{
+    auto room_jid = to_string (room.bare());
+    string nick;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto i = rooms.find (room_jid);
+        if (i != rooms.end())
+            nick = i->second->get_nick ();
+    }
+    if (!sess || nick.empty()) {
+        uxmpp_log_debug (log_module, "Can't leave room ", room_jid, ", not in the room");
+        return;
+    }
+
+    PresenceStanza pr (room_jid + "/" + nick, "");
+    pr.set_attribute ("type", "unavailable");
+    if (!status.empty())
+        pr.add_node (XmlObject("status", xml::namespace_jabber_client, false).set_content(status));
+    sess->send_stanza (pr);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void MultiUserChatModule::change_nick (const uxmpp::Jid& room, const std::string& nick)
+{
+    auto room_jid = to_string (room.bare());
+    if (!sess || !find_room(room_jid)) {
+        uxmpp_log_debug (log_module, "Can't change nickname in room ", room_jid, ", not in the room");
+        return;
+    }
+    sess->send_stanza (PresenceStanza(room_jid + "/" + nick, ""));
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string MultiUserChatModule::send_message (const uxmpp::Jid& room, const std::string& body)
+{
+    auto room_jid = to_string (room.bare());
+    if (!sess || !find_room(room_jid)) {
+        uxmpp_log_debug (log_module, "Can't send message to room ", room_jid, ", not in the room");
+        return "";
+    }
+    auto id = Stanza::make_id ();
+    sess->send_stanza (MessageStanza(room_jid, "", body, MessageType::groupchat, ChatState::none, id));
+    return id;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void MultiUserChatModule::set_subject (const uxmpp::Jid& room, const std::string& subject)
+{
+    auto room_jid = to_string (room.bare());
+    if (!sess || !find_room(room_jid)) {
+        uxmpp_log_debug (log_module, "Can't set subject of room ", room_jid, ", not in the room");
+        return;
+    }
+    MessageStanza msg (room_jid, "", "", MessageType::groupchat, ChatState::none, Stanza::make_id());
+    msg.add_node (XmlObject("subject", xml::namespace_jabber_client, false).set_content(subject));
+    sess->send_stanza (msg);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+MucRoom* MultiUserChatModule::get_room (const uxmpp::Jid& room)
+{
+    return find_room (to_string(room.bare()));
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void MultiUserChatModule::set_history_limit (const MucHistory& history)
+{
+    lock_guard<std::mutex> lock (mutex);
+    history_limit = history;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void MultiUserChatModule::add_listener (MucListener& listener)
+{
+    for (auto l : listeners) {
+        if (l == &listener)
+            return;
+    }
+    listeners.push_back (&listener);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void MultiUserChatModule::del_listener (MucListener& listener)
+{
+    listeners.remove (&listener);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+MucRoom* MultiUserChatModule::find_room (const std::string& room_jid)
+{
+    lock_guard<std::mutex> lock (mutex);
+    auto i = rooms.find (room_jid);
+    return i==rooms.end() ? nullptr : i->second.get();
+}
+
+
+//------------------------------------------------------------------------------
+// The fields are read from the stanza without copying it. When we join
+// a room the server sends the presence of every occupant, ending with
+// our own, so the occupants are only reported when our own arrives.
+//------------------------------------------------------------------------------
+bool MultiUserChatModule::handle_presence (MucRoom& room, uxmpp::XmlObject& presence, const std::string& nick)
+{
+    auto& attributes = presence.get_attributes ();
+    auto type_attr = attributes.find ("type");
+    string type = type_attr==attributes.end() ? "" : type_attr->second;
+
+    if (type == "error") {
+        // Failed to join the room, or to change nickname
+        auto condition = reinterpret_cast<Stanza&>(presence).get_error().get_condition ();
+        if (room.state == MucRoomState::joining)
+            end_room (room, condition);
+        else
+            uxmpp_log_info (log_module, "Presence error from room ", to_string(room.jid), ": ", condition);
+        return true;
+    }
+    if ((!type.empty() && type!="unavailable") || nick.empty())
+        return false;
+
+    MucOccupant occupant {nick, "", MucRole::none, MucAffiliation::none, PresenceShow::online, ""};
+    string new_nick;
+    bool self = nick == room.nick;
+    bool nick_changed = false;
+    const char* removed = nullptr;
+    for (auto& node : presence.get_nodes()) {
+        auto name = node.get_tag_name ();
+        if (name == "show") {
+            occupant.show = parse_show (node.get_content());
+        }
+        else if (name == "status") {
+            occupant.status = node.get_content ();
+        }
+        else if (name=="x" && node.get_namespace()==namespace_muc_user) {
+            for (auto& child : node.get_nodes()) {
+                auto child_name = child.get_tag_name ();
+                if (child_name == "item") {
+                    for (auto& attr : child.get_attributes()) {
+                        if (attr.first == "jid")
+                            occupant.jid = attr.second;
+                        else if (attr.first == "role")
+                            occupant.role = parse_role (attr.second);
+                        else if (attr.first == "affiliation")
+                            occupant.affiliation = parse_affiliation (attr.second);
+                        else if (attr.first == "nick")
+                            new_nick = attr.second;
+                    }
+                }
+                else if (child_name == "status") {
+                    auto code = child.get_attribute ("code");
+                    if (code == "110")
+                        self = true;
+                    else if (code == "303")
+                        nick_changed = true;
+                    else if (get_removed_reason(code))
+                        removed = get_removed_reason (code);
+                }
+            }
+        }
+    }
+
+    if (type == "unavailable") {
+        if (nick_changed && !new_nick.empty()) {
+            // The available presence with the new nickname follows
+            auto renamed = room.rename_occupant (nick, new_nick);
+            if (self)
+                room.nick = new_nick;
+            if (renamed && room.state==MucRoomState::joined) {
+                for (auto& listener : listeners)
+                    listener->on_nick_changed (*this, room, *renamed, nick);
+            }
+        }
+        else if (self) {
+            end_room (room, removed ? removed : "");
+        }
+        else if (room.remove_occupant(nick, &occupant) && room.state==MucRoomState::joined) {
+            for (auto& listener : listeners)
+                listener->on_occupant_left (*this, room, occupant);
+        }
+        return true;
+    }
+
+    // The room may have changed our nickname when we joined
+    if (self)
+        room.nick = nick;
+
+    bool added = false;
+    auto entry = room.set_occupant (occupant, added);
+    if (room.state == MucRoomState::joining) {
+        if (self) {
+            room.state = MucRoomState::joined;
+            uxmpp_log_debug (log_module, "Joined room ", to_string(room.jid), " with ", room.size(), " occupants");
+            for (auto& listener : listeners)
+                listener->on_room_joined (*this, room);
+        }
+    }
+    else if (entry) {
+        for (auto& listener : listeners) {
+            if (added)
+                listener->on_occupant_joined (*this, room, *entry);
+            else
+                listener->on_occupant_changed (*this, room, *entry);
+        }
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// All listeners get the received stanza, it is never copied.
+//------------------------------------------------------------------------------
+bool MultiUserChatModule::handle_message (MucRoom& room, uxmpp::XmlObject& msg, const std::string& nick)
+{
+    // Private messages from occupants, and errors, are left to other modules
+    //
+    if (msg.get_attribute("type") != "groupchat")
+        return false;
+
+    bool have_body = false;
+    bool history = false;
+    const string* subject = nullptr;
+    for (auto& node : msg.get_nodes()) {
+        auto name = node.get_tag_name ();
+        if (name == "body")
+            have_body = true;
+        else if (name == "subject")
+            subject = &node.get_content ();
+        else if (name=="delay" && node.get_namespace()==namespace_delay)
+            history = true;
+    }
+
+    // A message with a subject and no body changes the subject
+    //
+    if (subject && !have_body) {
+        room.subject = *subject;
+        for (auto& listener : listeners)
+            listener->on_subject (*this, room, nick);
+        return true;
+    }
+
+    auto& stanza = reinterpret_cast<MessageStanza&> (msg);
+    for (auto& listener : listeners)
+        listener->on_message (*this, room, stanza, history);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// The room is removed before the listeners are called,
+// so they can join it again.
+//------------------------------------------------------------------------------
+void MultiUserChatModule::end_room (MucRoom& room, const std::string& error)
+{
+    room_t ended;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto i = rooms.find (to_string(room.jid));
+        if (i==rooms.end() || i->second.get()!=&room)
+            return;
+        ended = std::move (i->second);
+        rooms.erase (i);
+    }
+    ended->state = MucRoomState::left;
+    if (error.empty())
+        uxmpp_log_debug (log_module, "Left room ", to_string(ended->jid));
+    else
+        uxmpp_log_info (log_module, "Not in room ", to_string(ended->jid), " - ", error);
+    for (auto& listener : listeners)
+        listener->on_room_left (*this, *ended, error);
+}
+
+
+UXMPP_END_NAMESPACE2
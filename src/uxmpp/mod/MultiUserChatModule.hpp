@@ -19,14 +19,242 @@
 #ifndef UXMPP_MOD_MULTIUSERCHATMODULE_HPP
 #define UXMPP_MOD_MULTIUSERCHATMODULE_HPP
 
+#include <uxmpp/types.hpp>
+#include <uxmpp/XmppModule.hpp>
+#include <uxmpp/Session.hpp>
+#include <uxmpp/SessionListener.hpp>
+#include <uxmpp/MessageStanza.hpp>
+#include <uxmpp/Jid.hpp>
+#include <uxmpp/mod/MucRoom.hpp>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+
 namespace uxmpp { namespace mod {
 
 
+    class MultiUserChatModule;
+
+
+    /**
+     * Receives events from the rooms of a MultiUserChatModule.
+     * All methods are called from the session thread, where the
+     * rooms are updated, and do nothing by default.
+     */
+    class MucListener {
+    public:
+        /**
+         * Destructor.
+         */
+        virtual ~MucListener () = default;
+
+        /**
+         * Called when we have joined a room. The occupants present
+         * when we joined are in the room, and are not reported one by one.
+         */
+        virtual void on_room_joined (MultiUserChatModule& module, MucRoom& room) {
+        }
+
+        /**
+         * Called when we are no longer in a room, or failed to join it.
+         * The room is deleted after the call.
+         * @param error Empty if we left the room. If we failed to join,
+         *              the stanza error condition. If we were removed from
+         *              the room, "kicked", "banned", "removed" or "shutdown".
+         */
+        virtual void on_room_left (MultiUserChatModule& module, MucRoom& room, const std::string& error) {
+        }
+
+        /**
+         * Called when an occupant has joined a room we are in.
+         */
+        virtual void on_occupant_joined (MultiUserChatModule& module, MucRoom& room,
+                                         const MucOccupant& occupant) {
+        }
+
+        /**
+         * Called when the presence, role or affiliation of an occupant has changed.
+         */
+        virtual void on_occupant_changed (MultiUserChatModule& module, MucRoom& room,
+                                          const MucOccupant& occupant) {
+        }
+
+        /**
+         * Called when an occupant has left a room, after it is removed from the room.
+         */
+        virtual void on_occupant_left (MultiUserChatModule& module, MucRoom& room,
+                                       const MucOccupant& occupant) {
+        }
+
+        /**
+         * Called when an occupant, or we, changed nickname.
+         */
+        virtual void on_nick_changed (MultiUserChatModule& module, MucRoom& room,
+                                      const MucOccupant& occupant, const std::string& old_nick) {
+        }
+
+        /**
+         * Called with each groupchat message from a room.
+         * All listeners get the received stanza, not a copy,
+         * don't keep a reference to it after the call.
+         * @param history true if the message is from the discussion
+         *                history sent when we joined.
+         */
+        virtual void on_message (MultiUserChatModule& module, MucRoom& room,
+                                 uxmpp::MessageStanza& msg, bool history) {
+        }
+
+        /**
+         * Called when the subject of a room is received or changed.
+         * @param nick The nickname of the occupant that set the subject,
+         *             empty if set by the room.
+         */
+        virtual void on_subject (MultiUserChatModule& module, MucRoom& room, const std::string& nick) {
+        }
+    };
+
+
     /**
      * Multi user chat functionality by implementing XEP-0045.
+     * <p/>
+     * Each room we are in has a table with its occupants, see MucRoom,
+     * updated from the session thread as presence is received. When we
+     * join a room the presence of all occupants is put in the table
+     * and delivered as one batch, MucListener::on_room_joined. After
+     * that, each change is reported as it happens.
+     * <p/>
+     * Register the module before the PresenceModule and the
+     * MessageModule, they would otherwise consume the presence and
+     * groupchat messages from the rooms. Private messages from
+     * occupants are left to the MessageModule.
      */
-    class MutliUserChatModule : public uxmpp::XmppModule {
+    class MultiUserChatModule : public uxmpp::XmppModule, uxmpp::SessionListener {
     public:
+        /**
+         * Default Constructor.
+         */
+        MultiUserChatModule ();
+
+        /**
+         * Destructor.
+         */
+        virtual ~MultiUserChatModule () = default;
+
+        /**
+         * Called when the module is registered to a session.
+         */
+        virtual void module_registered (uxmpp::Session& session) override;
+
+        /**
+         * Called when the module is unregistered from a session.
+         */
+        virtual void module_unregistered (uxmpp::Session& session) override;
+
+        /**
+         * Called whan an XML object is received.
+         * @return Return true if this XML object was processed and no further work should be done.
+         */
+        virtual bool process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj) override;
+
+        /**
+         * Return the supported disco features.
+         */
+        virtual std::vector<std::string> get_disco_features () override;
+
+        /**
+         * Called when the state if the session changes.
+         * We are no longer in any room when the session is closed.
+         */
+        virtual void on_state_change (uxmpp::Session& session,
+                                      uxmpp::SessionState new_state,
+                                      uxmpp::SessionState old_state) override;
+
+        /**
+         * Join a room, requesting the default discussion history,
+         * see set_history_limit().
+         * @param room The bare JID of the room.
+         * @param nick Our nickname in the room.
+         * @param password The room password, if any.
+         * @return The room, or nullptr if the session isn't bound or
+         *         we are already in the room. Use it from the session
+         *         thread, it is deleted after MucListener::on_room_left.
+         */
+        MucRoom* join (const uxmpp::Jid& room, const std::string& nick, const std::string& password="");
+
+        /**
+         * Join a room.
+         * @param room The bare JID of the room.
+         * @param nick Our nickname in the room.
+         * @param history The discussion history to request.
+         * @param password The room password, if any.
+         * @return The room, or nullptr if the session isn't bound or
+         *         we are already in the room.
+         */
+        MucRoom* join (const uxmpp::Jid& room, const std::string& nick, const MucHistory& history,
+                       const std::string& password="");
+
+        /**
+         * Leave a room.
+         * MucListener::on_room_left is called when the room confirms it.
+         * @param status An optional status message.
+         */
+        void leave (const uxmpp::Jid& room, const std::string& status="");
+
+        /**
+         * Change our nickname in a room.
+         */
+        void change_nick (const uxmpp::Jid& room, const std::string& nick);
+
+        /**
+         * Send a message to all occupants of a room.
+         * @return The ID of the message, or an empty string if we are not in the room.
+         */
+        std::string send_message (const uxmpp::Jid& room, const std::string& body);
+
+        /**
+         * Change the subject of a room.
+         */
+        void set_subject (const uxmpp::Jid& room, const std::string& subject);
+
+        /**
+         * Return a room we are in, or joining.
+         * @return The room, or nullptr if we are not in the room.
+         */
+        MucRoom* get_room (const uxmpp::Jid& room);
+
+        /**
+         * Set the discussion history requested when joining a room,
+         * by default the room decides.
+         */
+        void set_history_limit (const MucHistory& history);
+
+        /**
+         * Add a listener.
+         */
+        void add_listener (MucListener& listener);
+
+        /**
+         * Remove a listener.
+         */
+        void del_listener (MucListener& listener);
+
+
+    private:
+        typedef std::unique_ptr<MucRoom> room_t;
+
+        uxmpp::Session* sess;
+        std::mutex mutex;
+        std::unordered_map<std::string, room_t> rooms; // By bare room JID
+        std::list<MucListener*> listeners;
+        MucHistory history_limit;
+
+        MucRoom* find_room (const std::string& room_jid);
+        bool handle_presence (MucRoom& room, uxmpp::XmlObject& presence, const std::string& nick);
+        bool handle_message (MucRoom& room, uxmpp::XmlObject& msg, const std::string& nick);
+        void end_room (MucRoom& room, const std::string& error);
     };
 
 
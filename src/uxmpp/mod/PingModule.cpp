@@ -47,6 +47,14 @@ PingModule::PingModule ()
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+PingModule::~PingModule ()
+{
+    iq_tracker.cancel_all ();
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void PingModule::module_registered (uxmpp::Session& session)
@@ -59,6 +67,7 @@ void PingModule::module_registered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 void PingModule::module_unregistered (uxmpp::Session& session)
 {
+    iq_tracker.cancel_all ();
     sess = nullptr;
 }
 
@@ -86,28 +95,6 @@ bool PingModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject&
                 sess->send_stanza (IqStanza(IqType::result, iq.get_from(), sess->get_jid(), iq.get_id()));
                 return true;
             }
-        }else{
-            //
-            // Check for ping result
-            //
-            auto i = ping_map.find (iq.get_id());
-            if (i != ping_map.end()) {
-                auto now = chrono::duration_cast<chrono::milliseconds> (chrono::system_clock::now().
-                                                                        time_since_epoch()).count();
-                if (iq.get_type() == IqType::result) {
-                    uxmpp_log_debug (THIS_FILE, "Got ping result from ",
-                                     to_string(i->second.first),
-                                     ", rtt: ", (now - i->second.second), "ms");
-                }
-                else if (iq.get_type() == IqType::error) {
-                    uxmpp_log_info (THIS_FILE, "Got ping error from ",
-                                    to_string(i->second.first), ": ",
-                                    iq.get_error().get_condition());
-                }
-
-                ping_map.erase (i);
-                return true;
-            }
         }
     }
 
@@ -117,21 +104,28 @@ bool PingModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject&
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-static void do_ping (const uxmpp::Jid& target,
-                     uxmpp::Session* sess,
-                     std::map<std::string, std::pair<uxmpp::Jid, unsigned long> >& ping_map)
+static void do_ping (const uxmpp::Jid& target, uxmpp::Session* sess, uxmpp::IqTracker& iq_tracker)
 {
-    string ping_id = Stanza::make_id ();
-
     uxmpp_log_debug (THIS_FILE, "Send ping to ", to_string(target));
 
-    auto now = chrono::duration_cast<chrono::milliseconds> (chrono::system_clock::now().
-                                                            time_since_epoch()).count();
-
-    ping_map[ping_id] = std::pair<uxmpp::Jid, unsigned long> (target, now);
-
-    sess->send_stanza (IqStanza(IqType::get, target, sess->get_jid(), ping_id).
-                       add_node(XmlObject(XmlPingTag, XmlPingNs)));
+    auto start = chrono::steady_clock::now ();
+    iq_tracker.send_iq (*sess,
+                        IqStanza(IqType::get, target, sess->get_jid()).add_node(XmlObject(XmlPingTag, XmlPingNs)),
+                        [target, start](Session& session, IqStanza* iq){
+                            if (!iq) {
+                                uxmpp_log_info (THIS_FILE, "No ping response from ", to_string(target));
+                            }
+                            else if (iq->get_type() == IqType::result) {
+                                auto rtt = chrono::duration_cast<chrono::milliseconds> (chrono::steady_clock::now() - start);
+                                uxmpp_log_debug (THIS_FILE, "Got ping result from ",
+                                                 to_string(target),
+                                                 ", rtt: ", rtt.count(), "ms");
+                            }else{
+                                uxmpp_log_info (THIS_FILE, "Got ping error from ",
+                                                to_string(target), ": ",
+                                                iq->get_error().get_condition());
+                            }
+                        });
 }
 
 
@@ -143,7 +137,7 @@ void PingModule::ping ()
     //
     if (!sess || sess->get_state() != SessionState::bound)
         return;
-    do_ping (sess->get_domain(), sess, ping_map);
+    do_ping (sess->get_domain(), sess, iq_tracker);
 }
 
 
@@ -155,7 +149,7 @@ void PingModule::ping (const uxmpp::Jid& jid)
     //
     if (!sess || sess->get_state() != SessionState::bound)
         return;
-    do_ping (jid, sess, ping_map);
+    do_ping (jid, sess, iq_tracker);
 }
 
 
@@ -23,8 +23,8 @@
 #include <vector>
 #include <uxmpp/types.hpp>
 #include <uxmpp/XmppModule.hpp>
+#include <uxmpp/IqTracker.hpp>
 #include <uxmpp/Jid.hpp>
-#include <map>
 //#include <uxmpp/mod/PingModuleListener.hpp>
 
 
@@ -44,8 +44,9 @@ namespace uxmpp { namespace mod {
 
         /**
          * Destructor.
+         * Cancels the pending IQ requests.
          */
-        virtual ~PingModule () = default;
+        virtual ~PingModule ();
 
         /**
          * Called when the module is registered to a session.
@@ -83,9 +84,7 @@ namespace uxmpp { namespace mod {
     protected:
 
         uxmpp::Session* sess;
-
-        // messade_id, (jid, timestamp)
-        std::map<std::string, std::pair<uxmpp::Jid, unsigned long> > ping_map;
+        uxmpp::IqTracker iq_tracker; // Pending IQ requests sent by the module
     };
 
 
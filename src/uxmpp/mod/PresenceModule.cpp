@@ -22,6 +22,7 @@
 #include <uxmpp/SessionState.hpp>
 #include <uxmpp/PresenceStanza.hpp>
 #include <uxmpp/xml/names.hpp>
+#include <uxmpp/mod/DiscoModule.hpp>
 
 
 UXMPP_START_NAMESPACE2(uxmpp, mod)
@@ -31,6 +32,7 @@ using namespace std;
 using namespace uxmpp;
 
 static const std::string log_module {"PresenceModule"};
+static const std::string batch_timer {"presence-batch"};
 
 
 //------------------------------------------------------------------------------
@@ -38,7 +40,11 @@ static const std::string log_module {"PresenceModule"};
 PresenceModule::PresenceModule ()
     : uxmpp::XmppModule ("mod_presence"),
       sess (nullptr),
-      presence_handler (nullptr)
+      presence_handler (nullptr),
+      batch_handler (nullptr),
+      batch_quiet (std::chrono::milliseconds(50)),
+      batch_max (std::chrono::milliseconds(1000)),
+      batch_timer_set (false)
 {
 }
 
@@ -48,7 +54,7 @@ PresenceModule::PresenceModule ()
 void PresenceModule::module_registered (uxmpp::Session& session)
 {
     sess = &session;
-    //sess->addSessionListener (*this);
+    sess->add_session_listener (*this);
 }
 
 
@@ -56,7 +62,14 @@ void PresenceModule::module_registered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 void PresenceModule::module_unregistered (uxmpp::Session& session)
 {
-    //sess->delSessionListener (*this);
+    sess->get_xml_stream().cancel_timeout (batch_timer);
+    {
+        lock_guard<std::mutex> lock (batch_mutex);
+        batch.clear ();
+        batch_index.clear ();
+        batch_timer_set = false;
+    }
+    sess->del_session_listener (*this);
     sess = nullptr;
 }
 
@@ -70,10 +83,27 @@ bool PresenceModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObje
     if (!sess)
         return false;
 
-    // Handle iq stanzas
+    // Handle presence stanzas
     //
-    if (xml_obj.get_full_name() == xml::full_tag_presence_stanza) {
+    auto full_name = xml_obj.get_full_name ();
+    if (full_name == xml::full_tag_presence_stanza) {
         PresenceStanza& pr = reinterpret_cast<PresenceStanza&> (xml_obj);
+        table.update (pr);
+
+        // Collect availability updates in a batch
+        bool batching;
+        {
+            lock_guard<std::mutex> lock (batch_mutex);
+            batching = batch_handler != nullptr;
+        }
+        if (batching) {
+            auto type = pr.get_attribute ("type");
+            if (type.empty() || type=="unavailable") {
+                add_to_batch (pr);
+                return true;
+            }
+        }
+
         // Call registered presence handler
         if (presence_handler)
             presence_handler (*this, pr);
@@ -81,10 +111,36 @@ bool PresenceModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObje
         return true;
     }
 
+    // Check the batch timer
+    //
+    if (full_name==xml::full_tag_uxmpp_timeout && xml_obj.get_attribute("id")==batch_timer) {
+        check_batch ();
+        return true;
+    }
+
     return false;
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PresenceModule::on_state_change (uxmpp::Session& session,
+                                      uxmpp::SessionState new_state,
+                                      uxmpp::SessionState old_state)
+{
+    // The server sends the presence of all contacts again when
+    // we announce our presence, unless the stream was resumed.
+    //
+    if (new_state==SessionState::bound && !session.is_resumed())
+        table.clear ();
+
+    // Don't hold back presence received before the stream closed
+    //
+    if (old_state==SessionState::bound && new_state!=SessionState::bound)
+        flush_batch ();
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void PresenceModule::announce (const unsigned last_active)
@@ -93,7 +149,16 @@ void PresenceModule::announce (const unsigned last_active)
         uxmpp_log_trace (log_module, "Can't announce our presence, no session or session not bound");
         return;
     }
-    sess->send_stanza (PresenceStanza("", "", last_active));
+    // Include our entity capabilities if service discovery is used
+    //
+    PresenceStanza pr ("", "", last_active);
+    for (auto module : sess->get_modules()) {
+        if (DiscoModule* dm = dynamic_cast<DiscoModule*>(module)) {
+            pr.add_node (dm->get_caps());
+            break;
+        }
+    }
+    sess->send_stanza (pr);
 }
 
 
@@ -178,5 +243,133 @@ void PresenceModule::set_presence_handler (std::function<void (PresenceModule&,
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PresenceModule::set_batch_handler (batch_handler_t on_batch, unsigned quiet_msec, unsigned max_msec)
+{
+    vector<PresenceStanza> pending;
+    {
+        lock_guard<std::mutex> lock (batch_mutex);
+        if (!on_batch) {
+            // Batching is disabled, pass the pending presence on one by one
+            pending.swap (batch);
+            batch_index.clear ();
+        }
+        batch_handler = on_batch;
+        batch_quiet   = std::chrono::milliseconds (quiet_msec);
+        batch_max     = std::chrono::milliseconds (std::max(quiet_msec, max_msec));
+    }
+    for (auto& pr : pending) {
+        if (presence_handler)
+            presence_handler (*this, pr);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PresenceModule::flush_batch ()
+{
+    vector<PresenceStanza> delivered;
+    batch_handler_t handler;
+    {
+        lock_guard<std::mutex> lock (batch_mutex);
+        take_batch (delivered, handler);
+    }
+    deliver_batch (delivered, handler);
+}
+
+
+//------------------------------------------------------------------------------
+// Called from the session thread. Timer events are injected from the
+// timer thread, so the batch is protected by a mutex.
+//------------------------------------------------------------------------------
+void PresenceModule::add_to_batch (uxmpp::XmlObject& presence)
+{
+    auto now = clock::now ();
+    vector<PresenceStanza> delivered;
+    batch_handler_t handler;
+    {
+        lock_guard<std::mutex> lock (batch_mutex);
+
+        // The last presence from a full JID replaces the previous one.
+        // The received object is discarded after this call, so move it.
+        //
+        auto inserted = batch_index.emplace (presence.get_attribute("from"), batch.size());
+        if (inserted.second) {
+            batch.emplace_back ();
+            if (batch.size() == 1)
+                batch_start = now;
+        }
+        static_cast<XmlObject&>(batch[inserted.first->second]) = std::move (presence);
+        batch_last = now;
+
+        if (now - batch_start >= batch_max) {
+            take_batch (delivered, handler);
+        }
+        else if (!batch_timer_set && sess) {
+            // If the timer is already set it is checked when it expires
+            auto msec = std::chrono::duration_cast<std::chrono::milliseconds>(batch_quiet).count ();
+            sess->get_xml_stream().set_timeout (batch_timer, msec);
+            batch_timer_set = true;
+        }
+    }
+    deliver_batch (delivered, handler);
+}
+
+
+//------------------------------------------------------------------------------
+// The timer isn't restarted for each presence, when it expires
+// it is restarted if the burst is still going on.
+//------------------------------------------------------------------------------
+void PresenceModule::check_batch ()
+{
+    vector<PresenceStanza> delivered;
+    batch_handler_t handler;
+    {
+        lock_guard<std::mutex> lock (batch_mutex);
+        batch_timer_set = false;
+        if (batch.empty())
+            return;
+
+        auto now = clock::now ();
+        auto wait = std::min (batch_last + batch_quiet, batch_start + batch_max) - now;
+        if (wait <= clock::duration::zero()) {
+            take_batch (delivered, handler);
+        }else if (sess) {
+            auto msec = std::chrono::duration_cast<std::chrono::milliseconds>(wait).count ();
+            sess->get_xml_stream().set_timeout (batch_timer, msec+1);
+            batch_timer_set = true;
+        }
+    }
+    deliver_batch (delivered, handler);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PresenceModule::take_batch (std::vector<uxmpp::PresenceStanza>& delivered, batch_handler_t& handler)
+{
+    delivered.swap (batch);
+    batch_index.clear ();
+    handler = batch_handler;
+}
+
+
+//------------------------------------------------------------------------------
+// The handler is called without the lock, so it
+// can call flush_batch() and set_batch_handler().
+//------------------------------------------------------------------------------
+void PresenceModule::deliver_batch (std::vector<uxmpp::PresenceStanza>& delivered, const batch_handler_t& handler)
+{
+    if (delivered.empty())
+        return;
+
+    uxmpp_log_debug (log_module, "Deliver ", delivered.size(), " presence updates");
+    if (handler)
+        handler (*this, delivered);
+}
+
+
 
 UXMPP_END_NAMESPACE2
@@ -21,10 +21,16 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <functional>
+#include <chrono>
+#include <mutex>
 #include <uxmpp/types.hpp>
 #include <uxmpp/XmppModule.hpp>
 #include <uxmpp/Jid.hpp>
 #include <uxmpp/PresenceStanza.hpp>
+#include <uxmpp/SessionListener.hpp>
+#include <uxmpp/mod/PresenceTable.hpp>
 
 
 namespace uxmpp { namespace mod {
@@ -32,9 +38,22 @@ namespace uxmpp { namespace mod {
 
     /**
      * An XMPP presence module.
+     * Received presence stanzas update a presence table with the
+     * available resources of each contact, see get_table().
+     * <p/>
+     * After we announce our presence the server sends the presence of
+     * every available contact in a burst. With a batch handler set,
+     * availability updates are collected and delivered in batches
+     * instead of one presence handler call each, see set_batch_handler().
      */
-    class PresenceModule : public uxmpp::XmppModule {
+    class PresenceModule : public uxmpp::XmppModule, uxmpp::SessionListener {
     public:
+        /**
+         * Called with a batch of availability updates.
+         * The batch has at most one presence stanza per full JID,
+         * the last one received, in the order the JIDs were first seen.
+         */
+        typedef std::function<void (PresenceModule&, std::vector<uxmpp::PresenceStanza>&)> batch_handler_t;
 
         /**
          * Default Constructor.
@@ -62,8 +81,17 @@ namespace uxmpp { namespace mod {
          */
         virtual bool process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj) override;
 
+        /**
+         * Called when the state if the session changes.
+         * The presence table is cleared when a new resource is bound.
+         */
+        virtual void on_state_change (uxmpp::Session& session,
+                                      uxmpp::SessionState new_state,
+                                      uxmpp::SessionState old_state);
+
         /**
          * Announce our presence.
+         * If a DiscoModule is registered, our entity capabilities are included.
          * @param last_active Time in seconds since the clients last activity. Not used if 0.
          */
         void announce (const unsigned last_active=0);
@@ -103,10 +131,64 @@ namespace uxmpp { namespace mod {
          */
         void set_presence_handler (std::function<void (PresenceModule&, uxmpp::PresenceStanza&)> on_presence);
 
+        /**
+         * Return the presence table, updated before the presence handler is called.
+         * The table is updated from the session thread, use it from that thread,
+         * for example from the presence handler or the table's change handler.
+         */
+        PresenceTable& get_table () {
+            return table;
+        }
+
+        /**
+         * Deliver available and unavailable presence in batches.
+         * A batch is delivered when no presence has been received for
+         * quiet_msec milliseconds, or when the batch is max_msec milliseconds
+         * old, whichever comes first. Subscription requests and probes are
+         * still passed to the presence handler one by one.
+         * <p/>
+         * The handler is called from the session thread, or from the
+         * thread calling flush_batch(). It may call set_batch_handler()
+         * and flush_batch().
+         * @param on_batch The batch handler. Set to nullptr to disable batching,
+         *                 any pending batch is then delivered to the presence handler.
+         * @param quiet_msec Deliver the batch when no presence has been received
+         *                   for this many milliseconds.
+         * @param max_msec The longest time a presence is held back.
+         */
+        void set_batch_handler (batch_handler_t on_batch,
+                                unsigned quiet_msec=50,
+                                unsigned max_msec=1000);
+
+        /**
+         * Deliver any pending batch now.
+         */
+        void flush_batch ();
+
 
     protected:
         uxmpp::Session* sess;
         std::function<void (PresenceModule&, uxmpp::PresenceStanza&)> presence_handler;
+        PresenceTable table;
+
+        typedef std::chrono::steady_clock clock;
+
+        std::mutex batch_mutex;
+        batch_handler_t batch_handler;
+        clock::duration batch_quiet;
+        clock::duration batch_max;
+        std::vector<uxmpp::PresenceStanza> batch;
+        std::unordered_map<std::string, size_t> batch_index; // Position in the batch by full JID
+        clock::time_point batch_start;
+        clock::time_point batch_last;
+        bool batch_timer_set;
+
+        void add_to_batch (uxmpp::XmlObject& presence);
+        void check_batch ();
+        void take_batch (std::vector<uxmpp::PresenceStanza>& delivered,
+                         batch_handler_t& handler); // Called with batch_mutex locked
+        void deliver_batch (std::vector<uxmpp::PresenceStanza>& delivered,
+                            const batch_handler_t& handler); // Called without batch_mutex locked
     };
 
 
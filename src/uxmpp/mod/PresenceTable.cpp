@@ -0,0 +1,294 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/Logger.hpp>
+#include <uxmpp/mod/PresenceTable.hpp>
+#include <algorithm>
+#include <cstdlib>
+
+
+#define THIS_FILE "PresenceTable"
+
+
+UXMPP_START_NAMESPACE2(uxmpp, mod)
+
+
+using namespace std;
+using namespace uxmpp;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string to_string (const PresenceShow& show)
+{
+    switch (show) {
+    case PresenceShow::dnd:
+        return "dnd";
+    case PresenceShow::xa:
+        return "xa";
+    case PresenceShow::away:
+        return "away";
+    case PresenceShow::chat:
+        return "chat";
+    case PresenceShow::online:
+    default:
+        return "";
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+PresenceShow parse_show (const std::string& show)
+{
+    if (show == "away")
+        return PresenceShow::away;
+    else if (show == "chat")
+        return PresenceShow::chat;
+    else if (show == "dnd")
+        return PresenceShow::dnd;
+    else if (show == "xa")
+        return PresenceShow::xa;
+    else
+        return PresenceShow::online;
+}
+
+
+//------------------------------------------------------------------------------
+// Higher priority wins, and if equal, the more available resource.
+//------------------------------------------------------------------------------
+static inline bool is_better (const ResourcePresence& lhs, const ResourcePresence& rhs)
+{
+    if (lhs.priority != rhs.priority)
+        return lhs.priority > rhs.priority;
+    return lhs.show > rhs.show;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static size_t find_resource (const ContactPresence& contact, const std::string& resource)
+{
+    // A contact has few resources, a linear search is fine
+    size_t pos = 0;
+    for (; pos<contact.resources.size(); ++pos) {
+        if (contact.resources[pos].resource == resource)
+            break;
+    }
+    return pos;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+PresenceTable::PresenceTable ()
+    : change_handler (nullptr)
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool PresenceTable::update (uxmpp::XmlObject& presence)
+{
+    auto& attributes = presence.get_attributes ();
+    auto from = attributes.find ("from");
+    if (from==attributes.end() || from->second.empty())
+        return false;
+
+    auto type = attributes.find ("type");
+    if (type!=attributes.end() && !type->second.empty()) {
+        if (type->second=="unavailable" || type->second=="error")
+            return set_unavailable (Jid(from->second));
+        return false; // Subscription handling or probe
+    }
+
+    auto lang = attributes.find ("xml:lang");
+    PresenceShow show = PresenceShow::online;
+    int priority = 0;
+    const string* status = nullptr;
+    for (auto& node : presence.get_nodes()) {
+        auto name = node.get_tag_name ();
+        if (name == "show") {
+            show = parse_show (node.get_content());
+        }
+        else if (name == "priority") {
+            priority = atoi (node.get_content().c_str());
+        }
+        else if (name=="status" && status==nullptr) {
+            auto node_lang = node.get_attribute ("xml:lang");
+            if (node_lang.empty() || (lang!=attributes.end() && node_lang==lang->second))
+                status = &node.get_content ();
+        }
+    }
+    return set_available (Jid(from->second), show, status ? *status : "", priority);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool PresenceTable::set_available (const uxmpp::Jid& jid,
+                                   PresenceShow show,
+                                   const std::string& status,
+                                   int priority)
+{
+    auto prio = static_cast<int8_t> (std::max(-128, std::min(127, priority)));
+    auto bare = to_string (jid.bare());
+    auto& contact = contacts[bare];
+    auto& resources = contact.resources;
+
+    auto pos = find_resource (contact, jid.get_resource());
+    if (pos == resources.size()) {
+        resources.push_back (ResourcePresence{jid.get_resource(), status, prio, show});
+        if (pos==0 || is_better(resources[pos], resources[contact.best])) {
+            contact.best = pos;
+            notify (bare, &contact);
+        }
+        return true;
+    }
+
+    auto& res = resources[pos];
+    if (res.show==show && res.priority==prio && res.status==status)
+        return false;
+    res.show     = show;
+    res.priority = prio;
+    res.status   = status;
+
+    if (pos == contact.best) {
+        // The best resource changed, it may no longer be the best
+        find_best (contact);
+        notify (bare, &contact);
+    }
+    else if (is_better(res, resources[contact.best])) {
+        contact.best = pos;
+        notify (bare, &contact);
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool PresenceTable::set_unavailable (const uxmpp::Jid& jid)
+{
+    auto bare = to_string (jid.bare());
+    auto i = contacts.find (bare);
+    if (i == contacts.end())
+        return false;
+
+    auto& contact = i->second;
+    auto& resources = contact.resources;
+    if (jid.is_bare()) {
+        resources.clear ();
+    }else{
+        auto pos = find_resource (contact, jid.get_resource());
+        if (pos == resources.size())
+            return false;
+
+        // Replace the removed resource with the last one
+        bool was_best = pos == contact.best;
+        if (pos != resources.size()-1)
+            resources[pos] = std::move (resources.back());
+        resources.pop_back ();
+
+        if (!resources.empty()) {
+            if (was_best) {
+                find_best (contact);
+                notify (bare, &contact);
+            }
+            else if (contact.best == resources.size()) {
+                contact.best = pos; // The best resource was moved
+            }
+            return true;
+        }
+    }
+
+    contacts.erase (i);
+    notify (bare, nullptr);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+const ContactPresence* PresenceTable::find (const uxmpp::Jid& jid) const
+{
+    auto i = contacts.find (to_string(jid.bare()));
+    return i==contacts.end() ? nullptr : &i->second;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+const ResourcePresence* PresenceTable::get_best (const uxmpp::Jid& jid) const
+{
+    auto contact = find (jid);
+    return contact ? &contact->get_best() : nullptr;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+const ResourcePresence* PresenceTable::get_resource (const uxmpp::Jid& jid) const
+{
+    auto contact = find (jid);
+    if (!contact)
+        return nullptr;
+    auto pos = find_resource (*contact, jid.get_resource());
+    return pos==contact->resources.size() ? nullptr : &contact->resources[pos];
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PresenceTable::clear ()
+{
+    contacts.clear ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PresenceTable::set_change_handler (change_handler_t handler)
+{
+    change_handler = handler;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PresenceTable::find_best (ContactPresence& contact)
+{
+    contact.best = 0;
+    for (size_t pos=1; pos<contact.resources.size(); ++pos) {
+        if (is_better(contact.resources[pos], contact.resources[contact.best]))
+            contact.best = pos;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PresenceTable::notify (const std::string& bare, const ContactPresence* contact)
+{
+    if (change_handler)
+        change_handler (*this, Jid(bare), contact ? &contact->get_best() : nullptr);
+}
+
+
+UXMPP_END_NAMESPACE2
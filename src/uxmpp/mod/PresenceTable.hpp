@@ -0,0 +1,212 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_MOD_PRESENCETABLE_HPP
+#define UXMPP_MOD_PRESENCETABLE_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/XmlObject.hpp>
+#include <uxmpp/Jid.hpp>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+
+namespace uxmpp { namespace mod {
+
+
+    /**
+     * The availability of an available resource, the 'show' element
+     * of a presence stanza. The values are ordered from the least to the
+     * most available, a missing 'show' element is 'online'.
+     */
+    enum class PresenceShow : uint8_t {
+        dnd    = 0,
+        xa     = 1,
+        away   = 2,
+        online = 3,
+        chat   = 4,
+    };
+
+    /**
+     * Return the 'show' value of an availability,
+     * an empty string for PresenceShow::online.
+     */
+    std::string to_string (const PresenceShow& show);
+
+    /**
+     * Return the availability of a 'show' value,
+     * PresenceShow::online for an empty or unknown value.
+     */
+    PresenceShow parse_show (const std::string& show);
+
+
+    /**
+     * The presence of an available resource.
+     */
+    struct ResourcePresence {
+        std::string resource;
+        std::string status;   /**< The status without, or with the stanza's, 'xml:lang'. */
+        int8_t priority;      /**< The priority, -128 to 127 (RFC 6121, section 4.7.2.3). */
+        PresenceShow show;
+    };
+
+
+    /**
+     * The presence of a contact, all its available resources.
+     */
+    struct ContactPresence {
+        std::vector<ResourcePresence> resources;
+        size_t best; /**< Index of the best resource. */
+
+        /**
+         * Return the best resource, the one with the highest
+         * priority, and if equal, the most available one.
+         */
+        const ResourcePresence& get_best () const {
+            return resources[best];
+        }
+    };
+
+
+    /**
+     * A table with the presence of contacts, keyed by bare JID.
+     * <p/>
+     * Only available resources are stored, a contact without available
+     * resources is removed from the table. The best resource of each
+     * contact is updated as presence stanzas are received so all queries
+     * are hash lookups.
+     */
+    class PresenceTable {
+    public:
+        /**
+         * Called when the best resource of a contact has changed,
+         * or one of its presence fields.
+         * @param table The presence table.
+         * @param jid The bare JID of the contact.
+         * @param best The new best resource, or nullptr if the contact is now unavailable.
+         */
+        typedef std::function<void (PresenceTable& table,
+                                    const uxmpp::Jid& jid,
+                                    const ResourcePresence* best)> change_handler_t;
+
+        /**
+         * Default constructor.
+         */
+        PresenceTable ();
+
+        /**
+         * Update the table from a received presence stanza.
+         * The fields are read from the stanza without copying it.
+         * Subscription requests and stanzas without a 'from'
+         * attribute are ignored.
+         * @param presence A presence stanza.
+         * @return true if the table was changed.
+         */
+        bool update (uxmpp::XmlObject& presence);
+
+        /**
+         * Set or update the presence of a resource.
+         * @param jid The full JID of the resource.
+         * @return true if the table was changed.
+         */
+        bool set_available (const uxmpp::Jid& jid,
+                            PresenceShow show=PresenceShow::online,
+                            const std::string& status="",
+                            int priority=0);
+
+        /**
+         * Remove the presence of a resource.
+         * @param jid The full JID of the resource. If this is a
+         *            bare JID, all resources of the contact are removed.
+         * @return true if the table was changed.
+         */
+        bool set_unavailable (const uxmpp::Jid& jid);
+
+        /**
+         * Find the presence of a contact. Only the bare JID is used.
+         * @return The presence of the contact, or nullptr if the contact is unavailable.
+         *         The pointer is valid until the table is modified.
+         */
+        const ContactPresence* find (const uxmpp::Jid& jid) const;
+
+        /**
+         * Return the best resource of a contact. Only the bare JID is used.
+         * @return The best resource, or nullptr if the contact is unavailable.
+         *         The pointer is valid until the table is modified.
+         */
+        const ResourcePresence* get_best (const uxmpp::Jid& jid) const;
+
+        /**
+         * Return the presence of a resource.
+         * @param jid The full JID of the resource.
+         * @return The presence of the resource, or nullptr if the resource is unavailable.
+         *         The pointer is valid until the table is modified.
+         */
+        const ResourcePresence* get_resource (const uxmpp::Jid& jid) const;
+
+        /**
+         * Return true if a contact has at least one available resource.
+         * Only the bare JID is used.
+         */
+        bool is_available (const uxmpp::Jid& jid) const {
+            return find (jid) != nullptr;
+        }
+
+        /**
+         * Return the number of available contacts.
+         */
+        size_t size () const {
+            return contacts.size ();
+        }
+
+        /**
+         * Return all available contacts, keyed by bare JID.
+         */
+        const std::unordered_map<std::string, ContactPresence>& get_contacts () const {
+            return contacts;
+        }
+
+        /**
+         * Remove all contacts from the table.
+         * The change handler is not called.
+         */
+        void clear ();
+
+        /**
+         * Set the handler called when the best resource of a contact changes.
+         * Presence stanzas that don't change the best resource don't call the handler.
+         */
+        void set_change_handler (change_handler_t handler);
+
+
+    private:
+        std::unordered_map<std::string, ContactPresence> contacts;
+        change_handler_t change_handler;
+
+        void find_best (ContactPresence& contact);
+        void notify (const std::string& bare, const ContactPresence* contact);
+    };
+
+
+}}
+
+
+#endif
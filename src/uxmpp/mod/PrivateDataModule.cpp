@@ -41,12 +41,18 @@ PrivateDataModule::PrivateDataModule () : XmppModule ("PrivateDataModule")
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+PrivateDataModule::~PrivateDataModule ()
+{
+    iq_tracker.cancel_all ();
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void PrivateDataModule::module_registered (uxmpp::Session& session)
 {
-    set_ids.clear ();
-    get_ids.clear ();
     sess = &session;
 }
 
@@ -55,8 +61,7 @@ void PrivateDataModule::module_registered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 void PrivateDataModule::module_unregistered (uxmpp::Session& session)
 {
-    set_ids.clear ();
-    get_ids.clear ();
+    iq_tracker.cancel_all ();
     sess = nullptr;
 }
 
@@ -81,26 +86,20 @@ std::string PrivateDataModule::set (const uxmpp::XmlObject& data,
         return "";
     }
 
-    // Set IQ id to use
-    //
-    string id = stanza_id.empty() ? Stanza::make_id() : stanza_id;
-
-    // Check for duplicate IQ iq
-    //
-    if (set_ids.find(id) != set_ids.end()) {
-        uxmpp_log_warning (log_module, "Duplicate stanza id, don't set XML object ", data.get_full_name());
-        return "";
-    }
-
     // Send the stanza
     //
     uxmpp_log_debug (log_module, "Set private XML object ", data.get_full_name());
-    set_ids[id].first  = data.get_full_name ();
-    set_ids[id].second = cb!=nullptr ? cb : set_cb;
-    sess->send_stanza (IqStanza(IqType::set, "", to_string(sess->get_jid()), id).
-                       add_node(XmlObject("query", namespace_iq_private).
-                                add_node(data)));
-    return id;
+    string data_tag = data.get_full_name ();
+    string id = stanza_id.empty() ? Stanza::make_id() : stanza_id;
+    if (cb == nullptr)
+        cb = set_cb;
+    return iq_tracker.send_iq (*sess,
+                               IqStanza(IqType::set, "", to_string(sess->get_jid()), id).
+                               add_node(XmlObject("query", namespace_iq_private).
+                                        add_node(data)),
+                               [this, id, data_tag, cb](Session& session, IqStanza* iq){
+                                   handle_set_result (id, data_tag, cb, iq);
+                               });
 }
 
 
@@ -127,26 +126,19 @@ std::string PrivateDataModule::get (const std::string& tag_name,
     XmlObject xml_obj (tag_name, tag_namespace);
     string xml_full_name = xml_obj.get_full_name ();
 
-    // Set IQ id to use
-    //
-    string id = stanza_id.empty() ? Stanza::make_id() : stanza_id;
-
-    // Check for duplicate IQ iq
-    //
-    if (get_ids.find(id) != get_ids.end()) {
-        uxmpp_log_warning (log_module, "Duplicate stanza id, don't get XML object ", xml_full_name);
-        return "";
-    }
-
     // Send the stanza
     //
     uxmpp_log_debug (log_module, "Get private xml obj ", xml_full_name);
-    get_ids[id].first  = xml_full_name;
-    get_ids[id].second = cb!=nullptr ? cb : get_cb;
-    sess->send_stanza (IqStanza(IqType::get, "", to_string(sess->get_jid()), id).
-                       add_node(XmlObject("query", namespace_iq_private).
-                                add_node(xml_obj)));
-    return id;
+    string id = stanza_id.empty() ? Stanza::make_id() : stanza_id;
+    if (cb == nullptr)
+        cb = get_cb;
+    return iq_tracker.send_iq (*sess,
+                               IqStanza(IqType::get, "", to_string(sess->get_jid()), id).
+                               add_node(XmlObject("query", namespace_iq_private).
+                                        add_node(xml_obj)),
+                               [this, id, xml_full_name, cb](Session& session, IqStanza* iq){
+                                   handle_get_result (id, xml_full_name, cb, iq);
+                               });
 }
 
 
@@ -154,39 +146,33 @@ std::string PrivateDataModule::get (const std::string& tag_name,
 //------------------------------------------------------------------------------
 bool PrivateDataModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj)
 {
-    // Check for IQ stanzas
+    // Responses to our requests are handled by Session::send_iq callbacks
     //
-    if (xml_obj.get_full_name() != xml::full_tag_iq_stanza)
-        return false;
-
-    // Check the id
-    //
-    string id = xml_obj.get_attribute ("id");
-    if (set_ids.find(id) != set_ids.end())
-        return handle_set_result (id, reinterpret_cast<IqStanza&>(xml_obj));
-    if (get_ids.find(id) != get_ids.end())
-        return handle_get_result (id, reinterpret_cast<IqStanza&>(xml_obj));
-
     return false;
 }
 
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-bool PrivateDataModule::handle_set_result (const std::string& id, uxmpp::IqStanza& iq_result)
+void PrivateDataModule::handle_set_result (const std::string& id,
+                                           const std::string& data_tag,
+                                           priv_data_set_callback_t cb,
+                                           uxmpp::IqStanza* iq)
 {
-    string data_tag = set_ids[id].first;
-    priv_data_set_callback_t cb = set_ids[id].second;
-    set_ids.erase (id);
     string error_cond {""};
 
-    if (iq_result.get_type() == IqType::result) {
+    if (!iq) {
+        // No response
+        error_cond = StanzaError::remote_server_timeout;
+        uxmpp_log_warning (log_module, "No response setting private data ", data_tag);
+    }
+    else if (iq->get_type() == IqType::result) {
         // Ok
         uxmpp_log_debug (log_module, "Successfully set xml object ", data_tag);
     }
-    else if (iq_result.get_type() == IqType::error) {
+    else if (iq->get_type() == IqType::error) {
         // Error
-        error_cond = iq_result.get_error().get_condition ();
+        error_cond = iq->get_error().get_condition ();
         uxmpp_log_warning (log_module, "Error setting private data ", data_tag, " - ", error_cond);
     }
     else {
@@ -197,33 +183,36 @@ bool PrivateDataModule::handle_set_result (const std::string& id, uxmpp::IqStanz
 
     // Call callback
     //
-    if (cb)
+    if (cb && sess)
         cb (*sess, data_tag, id, error_cond);
-
-    return true;
 }
 
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-bool PrivateDataModule::handle_get_result (const std::string& id, uxmpp::IqStanza& iq_result)
+void PrivateDataModule::handle_get_result (const std::string& id,
+                                           const std::string& data_tag,
+                                           priv_data_get_callback_t cb,
+                                           uxmpp::IqStanza* iq)
 {
-    string data_tag = get_ids[id].first;
-    priv_data_get_callback_t cb = get_ids[id].second;
-    get_ids.erase (id);
     string error_cond {""};
     std::vector<uxmpp::XmlObject> priv_data;
 
-    if (iq_result.get_type() == IqType::result) {
+    if (!iq) {
+        // No response
+        error_cond = StanzaError::remote_server_timeout;
+        uxmpp_log_warning (log_module, "No response getting private data ", data_tag);
+    }
+    else if (iq->get_type() == IqType::result) {
         // Ok
         uxmpp_log_debug (log_module, "Successfully got xml object ", data_tag);
-        auto query_node = iq_result.find_node (tag_name_query, true);
+        auto query_node = iq->find_node (tag_name_query, true);
         if (query_node)
             priv_data = std::move (query_node.get_nodes());
     }
-    else if (iq_result.get_type() == IqType::error) {
+    else if (iq->get_type() == IqType::error) {
         // Error
-        error_cond = iq_result.get_error().get_condition ();
+        error_cond = iq->get_error().get_condition ();
         uxmpp_log_warning (log_module, "Error setting private data ", data_tag, " - ", error_cond);
     }
     else {
@@ -234,10 +223,8 @@ bool PrivateDataModule::handle_get_result (const std::string& id, uxmpp::IqStanz
 
     // Call callback
     //
-    if (cb)
+    if (cb && sess)
         cb (*sess, priv_data, id, error_cond);
-
-    return true;
 }
 
 
@@ -21,13 +21,13 @@
 
 #include <uxmpp/types.hpp>
 #include <uxmpp/XmppModule.hpp>
+#include <uxmpp/IqTracker.hpp>
 #include <uxmpp/Session.hpp>
 #include <uxmpp/IqStanza.hpp>
 
 #include <functional>
 #include <string>
 #include <list>
-#include <map>
 
 
 namespace uxmpp { namespace mod {
@@ -73,8 +73,9 @@ namespace uxmpp { namespace mod {
 
         /**
          * Destructor.
+         * Cancels the pending IQ requests.
          */
-        virtual ~PrivateDataModule () = default;
+        virtual ~PrivateDataModule ();
 
         /**
          * Called when the module is registered to a session.
@@ -139,14 +140,19 @@ namespace uxmpp { namespace mod {
 
     private:
         uxmpp::Session* sess;
-        std::map<std::string, std::pair<std::string, priv_data_set_callback_t> > set_ids;
-        std::map<std::string, std::pair<std::string, priv_data_get_callback_t> > get_ids;
 
-        bool handle_get_result (const std::string& id, uxmpp::IqStanza& iq_result);
-        bool handle_set_result (const std::string& id, uxmpp::IqStanza& iq_result);
+        void handle_get_result (const std::string& id,
+                                const std::string& data_tag,
+                                priv_data_get_callback_t cb,
+                                uxmpp::IqStanza* iq);
+        void handle_set_result (const std::string& id,
+                                const std::string& data_tag,
+                                priv_data_set_callback_t cb,
+                                uxmpp::IqStanza* iq);
 
         priv_data_set_callback_t set_cb;
         priv_data_get_callback_t get_cb;
+        uxmpp::IqTracker iq_tracker; // Pending IQ requests sent by the module
     };
 
 
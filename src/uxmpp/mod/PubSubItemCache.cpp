@@ -0,0 +1,198 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/mod/PubSubItemCache.hpp>
+#include <functional>
+
+
+UXMPP_START_NAMESPACE2(uxmpp, mod)
+
+
+using namespace std;
+using namespace uxmpp;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+PubSubItemCache::PubSubItemCache (size_t max_items)
+    : max_items (max_items ? max_items : 1)
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PubSubItemCache::set_max_items (size_t max_items)
+{
+    lock_guard<std::mutex> lock (mutex);
+    this->max_items = max_items ? max_items : 1;
+    for (auto& node : nodes)
+        trim (node.second, this->max_items);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+size_t PubSubItemCache::get_max_items ()
+{
+    lock_guard<std::mutex> lock (mutex);
+    return max_items;
+}
+
+
+//------------------------------------------------------------------------------
+// Hash the payload of an item. The 'item' element itself is skipped, it
+// is in different namespaces in event notifications and items results.
+// The attributes are combined in any order.
+//------------------------------------------------------------------------------
+static void hash_payload (XmlObject& xml_obj, size_t& seed)
+{
+    std::hash<string> h;
+    auto combine = [&seed](size_t value) {
+        seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    };
+    combine (h(xml_obj.get_content()));
+    for (auto& node : xml_obj.get_nodes()) {
+        combine (h(node.get_full_name()));
+        size_t attributes = 0;
+        for (auto& attr : node.get_attributes())
+            attributes += h(attr.first) ^ (h(attr.second) * 31);
+        combine (attributes);
+        hash_payload (node, seed);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool PubSubItemCache::put (const std::string& service, const std::string& node, const uxmpp::XmlObject& item)
+{
+    Entry entry {item.get_attribute("id"), 0, item};
+    if (entry.id.empty())
+        return false;
+    hash_payload (entry.item, entry.hash);
+
+    lock_guard<std::mutex> lock (mutex);
+    auto& n = nodes[node_key(service, node)];
+    auto i = n.index.find (entry.id);
+    if (i != n.index.end()) {
+        if (i->second->hash == entry.hash)
+            return false;
+        n.items.erase (i->second);
+        n.index.erase (i);
+    }
+    n.items.push_back (std::move(entry));
+    n.index.emplace (n.items.back().id, std::prev(n.items.end()));
+    trim (n, max_items);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool PubSubItemCache::find (const std::string& service, const std::string& node, const std::string& id,
+                            uxmpp::XmlObject& item)
+{
+    lock_guard<std::mutex> lock (mutex);
+    auto n = nodes.find (node_key(service, node));
+    if (n == nodes.end())
+        return false;
+    auto i = n->second.index.find (id);
+    if (i == n->second.index.end())
+        return false;
+    item = i->second->item;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::vector<uxmpp::XmlObject> PubSubItemCache::get_items (const std::string& service, const std::string& node)
+{
+    vector<XmlObject> items;
+    lock_guard<std::mutex> lock (mutex);
+    auto n = nodes.find (node_key(service, node));
+    if (n != nodes.end()) {
+        items.reserve (n->second.items.size());
+        for (auto& entry : n->second.items)
+            items.push_back (entry.item);
+    }
+    return items;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool PubSubItemCache::remove (const std::string& service, const std::string& node, const std::string& id)
+{
+    lock_guard<std::mutex> lock (mutex);
+    auto n = nodes.find (node_key(service, node));
+    if (n == nodes.end())
+        return false;
+    auto i = n->second.index.find (id);
+    if (i == n->second.index.end())
+        return false;
+    n->second.items.erase (i->second);
+    n->second.index.erase (i);
+    if (n->second.items.empty())
+        nodes.erase (n);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PubSubItemCache::clear (const std::string& service, const std::string& node)
+{
+    lock_guard<std::mutex> lock (mutex);
+    nodes.erase (node_key(service, node));
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PubSubItemCache::clear ()
+{
+    lock_guard<std::mutex> lock (mutex);
+    nodes.clear ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+size_t PubSubItemCache::size (const std::string& service, const std::string& node)
+{
+    lock_guard<std::mutex> lock (mutex);
+    auto n = nodes.find (node_key(service, node));
+    return n==nodes.end() ? 0 : n->second.items.size();
+}
+
+
+//------------------------------------------------------------------------------
+// Remove the items published longest ago.
+//------------------------------------------------------------------------------
+void PubSubItemCache::trim (Node& node, size_t max_items)
+{
+    while (node.items.size() > max_items) {
+        node.index.erase (node.items.front().id);
+        node.items.pop_front ();
+    }
+}
+
+
+UXMPP_END_NAMESPACE2
@@ -0,0 +1,134 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_MOD_PUBSUBITEMCACHE_HPP
+#define UXMPP_MOD_PUBSUBITEMCACHE_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/XmlObject.hpp>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+
+namespace uxmpp { namespace mod {
+
+
+    /**
+     * A cache of the items of pubsub nodes (XEP-0060), keyed by
+     * service, node and item ID.
+     * <p/>
+     * Each node keeps at most a fixed number of items. When a node is
+     * full, the item published or updated longest ago is removed. The
+     * cache remembers a hash of each item's payload. An item received
+     * again with the same payload, both as an event notification and in
+     * the result of an items request for example, is recognized as a
+     * duplicate. The cache is thread safe.
+     */
+    class PubSubItemCache {
+    public:
+        /**
+         * Constructor.
+         * @param max_items The largest number of items kept per node.
+         */
+        PubSubItemCache (size_t max_items=256);
+
+        /**
+         * Set the largest number of items kept per node.
+         * Nodes with more items are trimmed.
+         */
+        void set_max_items (size_t max_items);
+
+        /**
+         * Return the largest number of items kept per node.
+         */
+        size_t get_max_items ();
+
+        /**
+         * Add or update an item.
+         * @param service The JID of the pubsub service.
+         * @param node The node.
+         * @param item The 'item' element, with an 'id' attribute.
+         * @return false if the item is already in the cache with the
+         *         same payload, or has no ID. It is then not added.
+         */
+        bool put (const std::string& service, const std::string& node, const uxmpp::XmlObject& item);
+
+        /**
+         * Find an item.
+         * @param item Set to the 'item' element if found.
+         * @return false if the item isn't in the cache.
+         */
+        bool find (const std::string& service, const std::string& node, const std::string& id,
+                   uxmpp::XmlObject& item);
+
+        /**
+         * Return the cached items of a node, the most recently published last.
+         */
+        std::vector<uxmpp::XmlObject> get_items (const std::string& service, const std::string& node);
+
+        /**
+         * Remove an item.
+         * @return false if the item isn't in the cache.
+         */
+        bool remove (const std::string& service, const std::string& node, const std::string& id);
+
+        /**
+         * Remove all items of a node.
+         */
+        void clear (const std::string& service, const std::string& node);
+
+        /**
+         * Remove all items.
+         */
+        void clear ();
+
+        /**
+         * Return the number of cached items of a node.
+         */
+        size_t size (const std::string& service, const std::string& node);
+
+
+    private:
+        struct Entry {
+            std::string id;
+            size_t hash;          // Hash of the payload
+            uxmpp::XmlObject item;
+        };
+        struct Node {
+            std::list<Entry> items; // The most recently published last
+            std::unordered_map<std::string, std::list<Entry>::iterator> index; // By item ID
+        };
+
+        std::mutex mutex;
+        size_t max_items;
+        std::unordered_map<std::string, Node> nodes; // By service and node
+
+        static std::string node_key (const std::string& service, const std::string& node) {
+            return service + '\n' + node;
+        }
+        static void trim (Node& node, size_t max_items);
+    };
+
+
+}}
+
+
+#endif
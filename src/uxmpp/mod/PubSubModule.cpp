@@ -20,6 +20,8 @@
 #include <uxmpp/mod/PubSubModule.hpp>
 #include <uxmpp/Session.hpp>
 #include <uxmpp/SessionState.hpp>
+#include <uxmpp/StanzaError.hpp>
+#include <uxmpp/utils.hpp>
 #include <uxmpp/xml/names.hpp>
 
 
@@ -31,22 +33,64 @@ using namespace uxmpp;
 
 static const std::string log_module {"PubSubModule"};
 
+static const std::string namespace_pubsub       {"http://jabber.org/protocol/pubsub"};
+static const std::string namespace_pubsub_event {"http://jabber.org/protocol/pubsub#event"};
+static const std::string full_tag_pubsub        {namespace_pubsub + ":pubsub"};
+static const std::string full_tag_event         {namespace_pubsub_event + ":event"};
+
+static constexpr unsigned default_publish_window = 8;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static std::string subscription_key (const std::string& service, const std::string& node)
+{
+    return service + '\n' + node;
+}
+
+
+//------------------------------------------------------------------------------
+// Return the error condition of a response, empty if it is a result.
+//------------------------------------------------------------------------------
+static std::string get_error_condition (IqStanza* iq)
+{
+    if (!iq)
+        return StanzaError::remote_server_timeout;
+    if (iq->get_type() == IqType::result)
+        return "";
+    auto error = iq->get_error ();
+    auto condition = error ? error.get_condition() : "";
+    return condition.empty() ? StanzaError::undefined_condition : condition;
+}
+
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 PubSubModule::PubSubModule ()
-    : uxmpp::XmppModule ("mod_pep"),
-      sess (nullptr)
+    : uxmpp::XmppModule ("mod_pubsub"),
+      sess (nullptr),
+      timeout (UXMPP_DEFAULT_IQ_TIMEOUT),
+      publish_window (default_publish_window),
+      publish_batch (1),
+      in_flight (0)
 {
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+PubSubModule::~PubSubModule ()
+{
+    iq_tracker.cancel_all ();
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void PubSubModule::module_registered (uxmpp::Session& session)
 {
     sess = &session;
-    //sess->addSessionListener (*this);
+    sess->add_session_listener (*this);
 }
 
 
@@ -54,11 +98,46 @@ void PubSubModule::module_registered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 void PubSubModule::module_unregistered (uxmpp::Session& session)
 {
-    //sess->delSessionListener (*this);
+    // Cancelled publish requests are never answered
+    //
+    iq_tracker.cancel_all ();
+    {
+        lock_guard<std::mutex> lock (publish_mutex);
+        in_flight = 0;
+    }
+    sess->del_session_listener (*this);
     sess = nullptr;
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PubSubModule::on_state_change (uxmpp::Session& session,
+                                    uxmpp::SessionState new_state,
+                                    uxmpp::SessionState old_state)
+{
+    if (old_state!=SessionState::bound || new_state==SessionState::bound)
+        return;
+
+    // Requests in flight are failed by the session,
+    // the queued items are never sent.
+    //
+    deque<Publish> queue;
+    {
+        lock_guard<std::mutex> lock (publish_mutex);
+        queue.swap (publish_queue);
+    }
+    {
+        lock_guard<std::mutex> lock (subscription_mutex);
+        subscriptions.clear ();
+    }
+    for (auto& publish : queue) {
+        if (publish.cb)
+            publish.cb (*this, publish.item.get_attribute("id"), StanzaError::remote_server_timeout);
+    }
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 bool PubSubModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj)
@@ -68,13 +147,413 @@ bool PubSubModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject
     if (!sess)
         return false;
 
-    // Handle iq stanzas
+    // Event notifications
     //
-    if (xml_obj.get_full_name() == xml::full_tag_iq_stanza) {
+    if (xml_obj.get_full_name() != xml::full_tag_message_stanza)
         return false;
+
+    bool handled = false;
+    for (auto& node : xml_obj.get_nodes()) {
+        if (node.get_full_name() == full_tag_event) {
+            handle_event (xml_obj.get_attribute("from"), node);
+            handled = true;
+        }
+    }
+    return handled;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PubSubModule::handle_event (const std::string& service, uxmpp::XmlObject& event)
+{
+    for (auto& child : event.get_nodes()) {
+        auto tag  = child.get_tag_name ();
+        auto node = child.get_attribute ("node");
+
+        if (tag == "items") {
+            for (auto& item : child.get_nodes()) {
+                if (item.get_tag_name() == "item") {
+                    handle_item (service, node, item);
+                }
+                else if (item.get_tag_name() == "retract") {
+                    auto id = item.get_attribute ("id");
+                    cache.remove (service, node, id);
+                    if (retract_handler)
+                        retract_handler (*this, Jid(service), node, id);
+                }
+            }
+        }
+        else if (tag=="purge" || tag=="delete") {
+            uxmpp_log_debug (log_module, "Node ", node, " at ", service, ": ", tag);
+            cache.clear (service, node);
+        }
     }
+}
 
-    return false;
+
+//------------------------------------------------------------------------------
+// Items without an ID, from transient nodes, can't be cached.
+//------------------------------------------------------------------------------
+void PubSubModule::handle_item (const std::string& service, const std::string& node, uxmpp::XmlObject& item)
+{
+    if (!item.get_attribute("id").empty() && !cache.put(service, node, item)) {
+        uxmpp_log_trace (log_module, "Ignoring known item ", item.get_attribute("id"), " of node ", node);
+        return;
+    }
+    if (item_handler)
+        item_handler (*this, Jid(service), node, item);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string PubSubModule::publish (const uxmpp::Jid& service,
+                                   const std::string& node,
+                                   const uxmpp::XmlObject& payload,
+                                   const std::string& id,
+                                   publish_cb_t cb)
+{
+    if (!sess || sess->get_state()!=SessionState::bound) {
+        uxmpp_log_debug (log_module, "Can't publish, no session or session not bound");
+        return "";
+    }
+
+    string item_id = id.empty() ? make_uuid_v4() : id;
+    XmlObject item ("item", namespace_pubsub, false);
+    item.set_attribute ("id", item_id);
+    item.add_node (payload);
+    {
+        lock_guard<std::mutex> lock (publish_mutex);
+        publish_queue.push_back (Publish{to_string(service), node, std::move(item), cb});
+    }
+    send_publish ();
+    return item_id;
+}
+
+
+//------------------------------------------------------------------------------
+// Send queued items until the window is full. Consecutive
+// items to the same node are sent in the same request,
+// up to the batch size.
+//------------------------------------------------------------------------------
+void PubSubModule::send_publish ()
+{
+    vector<IqStanza> requests;
+    vector<batch_ptr> batches;
+    {
+        lock_guard<std::mutex> lock (publish_mutex);
+        while (in_flight < publish_window && !publish_queue.empty()) {
+            auto& first = publish_queue.front ();
+            string service = std::move (first.service);
+            string node    = std::move (first.node);
+
+            XmlObject publish ("publish", namespace_pubsub, false);
+            publish.set_attribute ("node", node);
+            batch_ptr batch = make_shared<batch_ptr::element_type> ();
+            do {
+                auto& queued = publish_queue.front ();
+                batch->emplace_back (queued.item.get_attribute("id"), std::move(queued.cb));
+                publish.add_node (std::move(queued.item));
+                publish_queue.pop_front ();
+            } while (batch->size() < publish_batch && !publish_queue.empty() &&
+                     publish_queue.front().service==service && publish_queue.front().node==node);
+
+            requests.push_back (IqStanza(IqType::set, Jid(service), sess ? sess->get_jid() : Jid()));
+            requests.back().add_node (std::move(XmlObject("pubsub", namespace_pubsub).add_node(std::move(publish))));
+            batches.push_back (batch);
+            ++in_flight;
+        }
+    }
+
+    // Send the requests without holding the lock,
+    // a response may be handled before send_iq returns.
+    //
+    for (size_t i=0; i<requests.size(); ++i) {
+        auto batch = batches[i];
+        auto id = sess ? iq_tracker.send_iq (*sess, std::move(requests[i]),
+                                             [this, batch](Session& session, IqStanza* iq){
+                                                 handle_publish_result (batch, iq);
+                                             },
+                                             timeout)
+                       : "";
+        if (id.empty()) {
+            // The session is closing, give up
+            vector<batch_ptr> failed (batches.begin()+i, batches.end());
+            {
+                lock_guard<std::mutex> lock (publish_mutex);
+                in_flight -= failed.size ();
+            }
+            fail_batches (failed, StanzaError::remote_server_timeout);
+            return;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PubSubModule::handle_publish_result (batch_ptr batch, uxmpp::IqStanza* iq)
+{
+    {
+        lock_guard<std::mutex> lock (publish_mutex);
+        --in_flight;
+    }
+    auto error = get_error_condition (iq);
+    if (!error.empty())
+        uxmpp_log_debug (log_module, "Failed to publish ", batch->size(), " items: ", error);
+
+    vector<batch_ptr> done {batch};
+    fail_batches (done, error);
+    send_publish ();
+}
+
+
+//------------------------------------------------------------------------------
+// Call the publish callbacks of sent items, error is empty on success.
+//------------------------------------------------------------------------------
+void PubSubModule::fail_batches (std::vector<batch_ptr>& batches, const std::string& error)
+{
+    for (auto& batch : batches) {
+        for (auto& entry : *batch) {
+            if (entry.second)
+                entry.second (*this, entry.first, error);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string PubSubModule::send_request (const uxmpp::Jid& service,
+                                        uxmpp::IqType type,
+                                        uxmpp::XmlObject&& payload,
+                                        std::function<void (const std::string& error, uxmpp::XmlObject& pubsub)> cb)
+{
+    if (!sess)
+        return "";
+
+    IqStanza iq (type, service, sess->get_jid());
+    iq.add_node (std::move(XmlObject("pubsub", namespace_pubsub).add_node(std::move(payload))));
+    return iq_tracker.send_iq (*sess, std::move(iq), [cb](Session& session, IqStanza* response){
+            auto error = get_error_condition (response);
+            XmlObject pubsub;
+            if (error.empty())
+                pubsub = response->find_node (full_tag_pubsub, true);
+            cb (error, pubsub);
+        },
+        timeout);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string PubSubModule::retract (const uxmpp::Jid& service,
+                                   const std::string& node,
+                                   const std::string& id,
+                                   result_cb_t cb)
+{
+    XmlObject retract ("retract", namespace_pubsub, false);
+    retract.set_attribute ("node", node);
+    retract.set_attribute ("notify", "true");
+    retract.add_node (XmlObject("item", namespace_pubsub, false).set_attribute("id", id));
+
+    auto key = to_string (service);
+    return send_request (service, IqType::set, std::move(retract),
+                         [this, key, node, id, cb](const std::string& error, XmlObject& pubsub){
+                             if (error.empty())
+                                 cache.remove (key, node, id);
+                             if (cb)
+                                 cb (*this, error);
+                         });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string PubSubModule::subscribe (const uxmpp::Jid& service, const std::string& node, result_cb_t cb)
+{
+    if (!sess)
+        return "";
+
+    auto jid = sess->get_jid().bare ();
+    XmlObject subscribe ("subscribe", namespace_pubsub, false);
+    subscribe.set_attribute ("node", node);
+    subscribe.set_attribute ("jid", to_string(jid));
+
+    return send_request (service, IqType::set, std::move(subscribe),
+                         [this, service, node, jid, cb](const std::string& error, XmlObject& pubsub){
+                             if (error.empty()) {
+                                 // The service may return an empty result
+                                 PubSubSubscription subscription {service, node, jid, "", "subscribed"};
+                                 auto result = pubsub.find_node ("subscription");
+                                 if (result) {
+                                     subscription.subid = result.get_attribute ("subid");
+                                     if (!result.get_attribute("subscription").empty())
+                                         subscription.state = result.get_attribute ("subscription");
+                                 }
+                                 lock_guard<std::mutex> lock (subscription_mutex);
+                                 subscriptions[subscription_key(to_string(service), node)] = subscription;
+                             }
+                             if (cb)
+                                 cb (*this, error);
+                         });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string PubSubModule::unsubscribe (const uxmpp::Jid& service, const std::string& node, result_cb_t cb)
+{
+    if (!sess)
+        return "";
+
+    auto key = subscription_key (to_string(service), node);
+    XmlObject unsubscribe ("unsubscribe", namespace_pubsub, false);
+    unsubscribe.set_attribute ("node", node);
+    unsubscribe.set_attribute ("jid", to_string(sess->get_jid().bare()));
+    {
+        lock_guard<std::mutex> lock (subscription_mutex);
+        auto i = subscriptions.find (key);
+        if (i!=subscriptions.end() && !i->second.subid.empty())
+            unsubscribe.set_attribute ("subid", i->second.subid);
+    }
+
+    return send_request (service, IqType::set, std::move(unsubscribe),
+                         [this, key, cb](const std::string& error, XmlObject& pubsub){
+                             if (error.empty()) {
+                                 lock_guard<std::mutex> lock (subscription_mutex);
+                                 subscriptions.erase (key);
+                             }
+                             if (cb)
+                                 cb (*this, error);
+                         });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string PubSubModule::get_subscriptions (const uxmpp::Jid& service, subscriptions_cb_t cb)
+{
+    return send_request (service, IqType::get, XmlObject("subscriptions", namespace_pubsub, false),
+                         [this, service, cb](const std::string& error, XmlObject& pubsub){
+                             vector<PubSubSubscription> result;
+                             if (error.empty()) {
+                                 auto list = pubsub.find_node ("subscriptions");
+                                 for (auto& node : list.get_nodes()) {
+                                     if (node.get_tag_name() != "subscription")
+                                         continue;
+                                     result.push_back (PubSubSubscription{service,
+                                                                          node.get_attribute("node"),
+                                                                          Jid(node.get_attribute("jid")),
+                                                                          node.get_attribute("subid"),
+                                                                          node.get_attribute("subscription")});
+                                 }
+                                 auto prefix = subscription_key (to_string(service), "");
+                                 lock_guard<std::mutex> lock (subscription_mutex);
+                                 for (auto i=subscriptions.begin(); i!=subscriptions.end(); ) {
+                                     if (i->first.compare(0, prefix.size(), prefix) == 0)
+                                         i = subscriptions.erase (i);
+                                     else
+                                         ++i;
+                                 }
+                                 for (auto& subscription : result)
+                                     subscriptions[prefix + subscription.node] = subscription;
+                             }
+                             if (cb)
+                                 cb (*this, error, result);
+                         });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool PubSubModule::get_subscription (const uxmpp::Jid& service,
+                                     const std::string& node,
+                                     PubSubSubscription& subscription)
+{
+    lock_guard<std::mutex> lock (subscription_mutex);
+    auto i = subscriptions.find (subscription_key(to_string(service), node));
+    if (i == subscriptions.end())
+        return false;
+    subscription = i->second;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string PubSubModule::fetch_items (const uxmpp::Jid& service,
+                                       const std::string& node,
+                                       items_cb_t cb,
+                                       unsigned max_items)
+{
+    XmlObject items ("items", namespace_pubsub, false);
+    items.set_attribute ("node", node);
+    if (max_items)
+        items.set_attribute ("max_items", std::to_string(max_items));
+
+    auto key = to_string (service);
+    return send_request (service, IqType::get, std::move(items),
+                         [this, key, node, cb](const std::string& error, XmlObject& pubsub){
+                             vector<XmlObject> result;
+                             if (error.empty()) {
+                                 auto list = pubsub.find_node ("items");
+                                 for (auto& item : list.get_nodes()) {
+                                     if (item.get_tag_name() != "item")
+                                         continue;
+                                     handle_item (key, node, item);
+                                     result.push_back (std::move(item));
+                                 }
+                             }
+                             if (cb)
+                                 cb (*this, error, result);
+                         });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PubSubModule::set_item_handler (item_cb_t callback)
+{
+    item_handler = callback;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PubSubModule::set_retract_handler (retract_cb_t callback)
+{
+    retract_handler = callback;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PubSubModule::set_publish_window (unsigned window)
+{
+    {
+        lock_guard<std::mutex> lock (publish_mutex);
+        publish_window = window ? window : 1;
+    }
+    send_publish ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PubSubModule::set_publish_batch (unsigned max_items)
+{
+    lock_guard<std::mutex> lock (publish_mutex);
+    publish_batch = max_items ? max_items : 1;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void PubSubModule::set_timeout (unsigned timeout)
+{
+    this->timeout = timeout;
 }
 
 
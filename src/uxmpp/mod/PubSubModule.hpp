@@ -19,21 +19,104 @@
 #ifndef UXMPP_MOD_PUBSUBMODULE_HPP
 #define UXMPP_MOD_PUBSUBMODULE_HPP
 
+#include <functional>
 #include <string>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
 #include <uxmpp/types.hpp>
+#include <uxmpp/Jid.hpp>
 #include <uxmpp/XmppModule.hpp>
+#include <uxmpp/IqTracker.hpp>
+#include <uxmpp/Session.hpp>
+#include <uxmpp/IqStanza.hpp>
+#include <uxmpp/mod/PubSubItemCache.hpp>
 
 
 namespace uxmpp { namespace mod {
 
 
+    /**
+     * A subscription to a pubsub node.
+     */
+    struct PubSubSubscription {
+        uxmpp::Jid service;   /**< The pubsub service. */
+        std::string node;     /**< The node. */
+        uxmpp::Jid jid;       /**< The subscribed JID. */
+        std::string subid;    /**< The subscription ID, if any. */
+        std::string state;    /**< 'none', 'pending', 'unconfigured' or 'subscribed'. */
+    };
+
+
     /**
      * XEP-0060: Publish-Subscribe.
+     * <p/>
+     * Items are published through a queue. At most a window of publish
+     * requests wait for a response at the same time, so a stream of
+     * items isn't limited by the round trip time. If the service accepts
+     * more than one item per publish request, set_publish_batch() lets
+     * items queued for the same node share a request.
+     * <p/>
+     * Items received in event notifications and in the results of
+     * fetch_items() are stored in a PubSubItemCache. The item handler is
+     * only called for items that are new or changed, an item received
+     * both as an event and in a fetch result is passed once.
      */
-    class PubSubModule : public uxmpp::XmppModule {
+    class PubSubModule : public uxmpp::XmppModule, uxmpp::SessionListener {
     public:
 
+        /**
+         * Called with a new or changed item, from the session thread.
+         * @param item The 'item' element.
+         */
+        typedef std::function <void (PubSubModule& module,
+                                     const uxmpp::Jid& service,
+                                     const std::string& node,
+                                     const uxmpp::XmlObject& item)> item_cb_t;
+
+        /**
+         * Called when an item is retracted.
+         */
+        typedef std::function <void (PubSubModule& module,
+                                     const uxmpp::Jid& service,
+                                     const std::string& node,
+                                     const std::string& id)> retract_cb_t;
+
+        /**
+         * Called with the result of a published item.
+         * @param id The item ID.
+         * @param error Empty if the item was published, otherwise the stanza error condition.
+         */
+        typedef std::function <void (PubSubModule& module,
+                                     const std::string& id,
+                                     const std::string& error)> publish_cb_t;
+
+        /**
+         * Called with the result of a request.
+         * @param error Empty on success, otherwise the stanza error condition.
+         */
+        typedef std::function <void (PubSubModule& module,
+                                     const std::string& error)> result_cb_t;
+
+        /**
+         * Called with the result of fetch_items().
+         * @param error Empty on success, otherwise the stanza error condition.
+         * @param items The 'item' elements, new or not.
+         */
+        typedef std::function <void (PubSubModule& module,
+                                     const std::string& error,
+                                     const std::vector<uxmpp::XmlObject>& items)> items_cb_t;
+
+        /**
+         * Called with the result of get_subscriptions().
+         * @param error Empty on success, otherwise the stanza error condition.
+         */
+        typedef std::function <void (PubSubModule& module,
+                                     const std::string& error,
+                                     const std::vector<PubSubSubscription>& subscriptions)> subscriptions_cb_t;
+
         /**
          * Default Constructor.
          */
@@ -41,8 +124,9 @@ namespace uxmpp { namespace mod {
 
         /**
          * Destructor.
+         * Cancels the pending IQ requests.
          */
-        virtual ~PubSubModule () = default;
+        virtual ~PubSubModule ();
 
         /**
          * Called when the module is registered to a session.
@@ -60,9 +144,153 @@ namespace uxmpp { namespace mod {
          */
         virtual bool process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj) override;
 
+        /**
+         * Called when the state if the session changes.
+         * Queued items are failed when the session is no longer bound.
+         */
+        virtual void on_state_change (uxmpp::Session& session,
+                                      uxmpp::SessionState new_state,
+                                      uxmpp::SessionState old_state) override;
+
+        /**
+         * Publish an item to a node.
+         * The item is queued and sent when the publish window has room.
+         * @param service The pubsub service.
+         * @param node The node.
+         * @param payload The payload of the item.
+         * @param id The item ID, one is generated if empty.
+         * @param cb An optional callback called with the result.
+         * @return The item ID, or an empty string if the session isn't bound.
+         */
+        std::string publish (const uxmpp::Jid& service,
+                             const std::string& node,
+                             const uxmpp::XmlObject& payload,
+                             const std::string& id="",
+                             publish_cb_t cb=nullptr);
+
+        /**
+         * Retract an item from a node, subscribers are notified.
+         * @return The id of the IQ request, or an empty string if it wasn't sent.
+         */
+        std::string retract (const uxmpp::Jid& service,
+                             const std::string& node,
+                             const std::string& id,
+                             result_cb_t cb=nullptr);
+
+        /**
+         * Subscribe our bare JID to a node.
+         * @return The id of the IQ request, or an empty string if it wasn't sent.
+         */
+        std::string subscribe (const uxmpp::Jid& service, const std::string& node, result_cb_t cb=nullptr);
+
+        /**
+         * Unsubscribe our bare JID from a node.
+         * @return The id of the IQ request, or an empty string if it wasn't sent.
+         */
+        std::string unsubscribe (const uxmpp::Jid& service, const std::string& node, result_cb_t cb=nullptr);
+
+        /**
+         * Request our subscriptions at a service. The known
+         * subscriptions at the service are replaced by the result.
+         * @return The id of the IQ request, or an empty string if it wasn't sent.
+         */
+        std::string get_subscriptions (const uxmpp::Jid& service, subscriptions_cb_t cb=nullptr);
+
+        /**
+         * Return a known subscription to a node.
+         * @param subscription Set to the subscription if found.
+         * @return false if we have no known subscription to the node.
+         */
+        bool get_subscription (const uxmpp::Jid& service,
+                               const std::string& node,
+                               PubSubSubscription& subscription);
+
+        /**
+         * Fetch the items of a node. New and changed items
+         * are also passed to the item handler.
+         * @param max_items Fetch at most this many of the most recent items, 0 for all.
+         * @return The id of the IQ request, or an empty string if it wasn't sent.
+         */
+        std::string fetch_items (const uxmpp::Jid& service,
+                                 const std::string& node,
+                                 items_cb_t cb=nullptr,
+                                 unsigned max_items=0);
+
+        /**
+         * Set a callback to be called with new and changed items.
+         */
+        void set_item_handler (item_cb_t callback);
+
+        /**
+         * Set a callback to be called when an item is retracted.
+         */
+        void set_retract_handler (retract_cb_t callback);
+
+        /**
+         * Set the max number of publish requests waiting for a response, by default 8.
+         */
+        void set_publish_window (unsigned window);
+
+        /**
+         * Set the max number of items sent in one publish request, by default 1.
+         * Only use more than one if the service is known to accept it.
+         */
+        void set_publish_batch (unsigned max_items);
+
+        /**
+         * Set the number of milliseconds to wait for the response to a request.
+         */
+        void set_timeout (unsigned timeout);
+
+        /**
+         * Return the item cache.
+         */
+        PubSubItemCache& get_cache () {
+            return cache;
+        }
+
 
     protected:
         uxmpp::Session* sess;
+
+
+    private:
+        /**
+         * A queued item.
+         */
+        struct Publish {
+            std::string service;
+            std::string node;
+            uxmpp::XmlObject item;
+            publish_cb_t cb;
+        };
+        typedef std::shared_ptr<std::vector<std::pair<std::string, publish_cb_t>>> batch_ptr; // Item IDs and callbacks
+
+        PubSubItemCache cache;
+        item_cb_t item_handler;
+        retract_cb_t retract_handler;
+        unsigned timeout;
+
+        std::mutex publish_mutex;
+        std::deque<Publish> publish_queue;
+        unsigned publish_window;
+        unsigned publish_batch;
+        unsigned in_flight;
+
+        std::mutex subscription_mutex;
+        std::unordered_map<std::string, PubSubSubscription> subscriptions; // By service and node
+
+        uxmpp::IqTracker iq_tracker; // Pending IQ requests sent by the module
+
+        void send_publish ();
+        void handle_publish_result (batch_ptr batch, uxmpp::IqStanza* iq);
+        void fail_batches (std::vector<batch_ptr>& batches, const std::string& error);
+        std::string send_request (const uxmpp::Jid& service,
+                                  uxmpp::IqType type,
+                                  uxmpp::XmlObject&& payload,
+                                  std::function<void (const std::string& error, uxmpp::XmlObject& pubsub)> cb);
+        void handle_event (const std::string& service, uxmpp::XmlObject& event);
+        void handle_item (const std::string& service, const std::string& node, uxmpp::XmlObject& item);
     };
 
 
@@ -48,10 +48,19 @@ RegisterModule::RegisterModule ()
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+RegisterModule::~RegisterModule ()
+{
+    iq_tracker.cancel_all ();
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void RegisterModule::module_registered (uxmpp::Session& session)
 {
+    lock_guard<std::mutex> lock (mutex);
     sess = &session;
     query_id = "";
     registration_id = "";
@@ -64,6 +73,8 @@ void RegisterModule::module_registered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 void RegisterModule::module_unregistered (uxmpp::Session& session)
 {
+    iq_tracker.cancel_all ();
+    lock_guard<std::mutex> lock (mutex);
     sess = nullptr;
     query_id = "";
     registration_id = "";
@@ -76,65 +87,75 @@ void RegisterModule::module_unregistered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 bool RegisterModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj)
 {
-    // We're only interested in IQ stanzas
+    // Responses to our requests are handled by Session::send_iq callbacks
     //
-    if (xml_obj.get_full_name() != xml::full_tag_iq_stanza)
-        return false;
+    return false;
+}
 
-    IqStanza& iq = reinterpret_cast<IqStanza&> (xml_obj);
 
-    // Check for info query result
-    //
-    if (!query_id.empty() && iq.get_id()==query_id) {
-        handle_info_query_result (iq);
-        return true;
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void RegisterModule::handle_result (const std::string& what, std::string& id, IqStanza* iq)
+{
+    Session* session;
+    reg_result_cb_t cb;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        id = "";
+        session = sess;
+        cb = reg_result_cb;
     }
-
-    // Check for registration result
-    //
-    if (!registration_id.empty() && iq.get_id()==registration_id) {
-        if (reg_result_cb) {
-            StanzaError error = iq.get_error ();
-            reg_result_cb (*sess, "register", error);
-        }
-        return true;
+    if (cb && session) {
+        StanzaError error (StanzaError::type_wait, StanzaError::remote_server_timeout);
+        if (iq)
+            error = iq->get_error ();
+        cb (*session, what, error);
     }
+}
 
-    // Check for un-registration result
-    //
-    if (!unregistration_id.empty() && iq.get_id()==unregistration_id) {
-        if (reg_result_cb) {
-            StanzaError error = iq.get_error ();
-            reg_result_cb (*sess, "unregister", error);
-        }
-        return true;
-    }
 
-    // Check for password change result
-    //
-    if (!pass_change_id.empty() && iq.get_id()==pass_change_id) {
-        if (reg_result_cb) {
-            StanzaError error = iq.get_error ();
-            reg_result_cb (*sess, "password", error);
+//------------------------------------------------------------------------------
+// Send a request unless one of the same kind is already sent.
+// The id is set before sending, the response may be handled
+// before send_iq returns.
+//------------------------------------------------------------------------------
+bool RegisterModule::send_request (std::string& request_id, const std::string& what,
+                                   uxmpp::XmlObject iq, uxmpp::Session::iq_callback_t cb)
+{
+    string id = Stanza::make_id ();
+    iq.set_attribute ("id", id);
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (!request_id.empty()) {
+            uxmpp_log_warning (log_module, what, " already sent");
+            return false;
         }
-        return true;
+        request_id = id;
     }
-
-    return false;
+    if (iq_tracker.send_iq(*sess, std::move(iq), cb).empty()) {
+        lock_guard<std::mutex> lock (mutex);
+        request_id = "";
+        return false;
+    }
+    return true;
 }
 
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-void RegisterModule::handle_info_query_result (IqStanza& iq)
+void RegisterModule::handle_info_query_result (IqStanza* iq)
 {
     RegistrationInfo reg_info;
 
-    reg_info.error = iq.get_error ();
-    if (iq.have_error()) {
+    if (!iq) {
+        reg_info.error = StanzaError (StanzaError::type_wait, StanzaError::remote_server_timeout);
+        uxmpp_log_info (log_module, "No response to registration info query");
+    }
+    else if (iq->have_error()) {
+        reg_info.error = iq->get_error ();
         uxmpp_log_info (log_module, "Error getting registration info: ", reg_info.error.get_condition());
     }else{
-        auto query = iq.find_node (full_tag_name_query, true);
+        auto query = iq->find_node (full_tag_name_query, true);
         for (auto& field : query.get_nodes()) {
             if (field.get_tag_name() == "instructions") {
                 reg_info.instructions = field.get_content ();
@@ -147,10 +168,17 @@ void RegisterModule::handle_info_query_result (IqStanza& iq)
             }
         }
     }
-    query_id = "";
+    Session* session;
+    reg_info_cb_t cb;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        query_id = "";
+        session = sess;
+        cb = reg_info_cb;
+    }
 
-    if (reg_info_cb)
-        reg_info_cb (*sess, reg_info);
+    if (cb && session)
+        cb (*session, reg_info);
 }
 
 
@@ -158,6 +186,7 @@ void RegisterModule::handle_info_query_result (IqStanza& iq)
 //------------------------------------------------------------------------------
 void RegisterModule::set_info_callback (reg_info_cb_t callback)
 {
+    lock_guard<std::mutex> lock (mutex);
     reg_info_cb = callback;
 }
 
@@ -166,6 +195,7 @@ void RegisterModule::set_info_callback (reg_info_cb_t callback)
 //------------------------------------------------------------------------------
 void RegisterModule::set_result_callback (reg_result_cb_t callback)
 {
+    lock_guard<std::mutex> lock (mutex);
     reg_result_cb = callback;
 }
 
@@ -179,21 +209,16 @@ bool RegisterModule::request_info (const std::string& domain)
         return false;
     }
 
-    if (!query_id.empty()) {
-        uxmpp_log_warning (log_module, "Registration info query already sent");
-        return false;
-    }
-
     string to;
     if (domain.empty())
         to = sess->get_domain().get_domain ();
     else
         to = domain;
-    query_id = Stanza::make_id ();
-    sess->send_stanza (IqStanza(IqType::get, to, "", query_id).
-                       add_node(XmlObject("query", namespace_iq_register)));
-
-    return true;
+    return send_request (query_id, "Registration info query",
+                         IqStanza(IqType::get, to, "").add_node(XmlObject("query", namespace_iq_register)),
+                         [this](Session& session, IqStanza* iq){
+                             handle_info_query_result (iq);
+                         });
 }
 
 
@@ -207,23 +232,20 @@ bool RegisterModule::register_user (std::list<std::pair<std::string, std::string
         return false;
     }
 
-    if (!registration_id.empty()) {
-        uxmpp_log_warning (log_module, "Registration request already sent");
-        return false;
-    }
-
     string to;
     if (domain.empty())
         to = sess->get_domain().get_domain ();
     else
         to = domain;
-    registration_id = Stanza::make_id ();
     XmlObject query ("query", namespace_iq_register);
     for (auto& field : fields)
         query.add_node (XmlObject(field.first).set_content(field.second));
 
-    sess->send_stanza (IqStanza(IqType::set, to, "", registration_id).add_node(std::move(query)));
-    return true;
+    return send_request (registration_id, "Registration request",
+                         IqStanza(IqType::set, to, "").add_node(std::move(query)),
+                         [this](Session& session, IqStanza* iq){
+                             handle_result ("register", registration_id, iq);
+                         });
 }
 
 
@@ -236,16 +258,13 @@ bool RegisterModule::unregister_user ()
         return false;
     }
 
-    if (!unregistration_id.empty()) {
-        uxmpp_log_warning (log_module, "Un-registration request already sent");
-        return false;
-    }
-
-    unregistration_id = Stanza::make_id ();
-    sess->send_stanza (IqStanza(IqType::set, Jid(), sess->get_jid().bare(), unregistration_id).
-                       add_node(XmlObject("query", namespace_iq_register).
-                                add_node(XmlObject("remove"))));
-    return true;
+    return send_request (unregistration_id, "Un-registration request",
+                         IqStanza(IqType::set, Jid(), sess->get_jid().bare()).
+                         add_node(XmlObject("query", namespace_iq_register).
+                                  add_node(XmlObject("remove"))),
+                         [this](Session& session, IqStanza* iq){
+                             handle_result ("unregister", unregistration_id, iq);
+                         });
 }
 
 
@@ -258,20 +277,16 @@ bool RegisterModule::set_password (const std::string& new_passphrase)
         return false;
     }
 
-    if (!pass_change_id.empty()) {
-        uxmpp_log_warning (log_module, "Un-registration request already sent");
-        return false;
-    }
-
-    pass_change_id = Stanza::make_id ();
-
     XmlObject query ("query", namespace_iq_register);
     query.add_node (XmlObject("username").set_content(sess->get_jid().get_local()));
     query.add_node (XmlObject("password").set_content(new_passphrase));
 
-    sess->send_stanza (IqStanza(IqType::set, sess->get_jid().get_domain(), "", pass_change_id).
-                       add_node(std::move(query)));
-    return true;
+    return send_request (pass_change_id, "Password change request",
+                         IqStanza(IqType::set, sess->get_jid().get_domain(), "").
+                         add_node(std::move(query)),
+                         [this](Session& session, IqStanza* iq){
+                             handle_result ("password", pass_change_id, iq);
+                         });
 }
 
 
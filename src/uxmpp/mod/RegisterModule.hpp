@@ -21,6 +21,7 @@
 
 #include <uxmpp/types.hpp>
 #include <uxmpp/XmppModule.hpp>
+#include <uxmpp/IqTracker.hpp>
 #include <uxmpp/Session.hpp>
 #include <uxmpp/StanzaError.hpp>
 #include <uxmpp/IqStanza.hpp>
@@ -29,6 +30,7 @@
 #include <functional>
 #include <string>
 #include <list>
+#include <mutex>
 
 
 namespace uxmpp { namespace mod {
@@ -62,8 +64,9 @@ namespace uxmpp { namespace mod {
 
         /**
          * Destructor.
+         * Cancels the pending IQ requests.
          */
-        virtual ~RegisterModule () = default;
+        virtual ~RegisterModule ();
 
         /**
          * Called when the module is registered to a session.
@@ -113,9 +116,13 @@ namespace uxmpp { namespace mod {
 
 
     private:
-        void handle_info_query_result (IqStanza& iq);
+        void handle_info_query_result (IqStanza* iq);
+        void handle_result (const std::string& what, std::string& id, IqStanza* iq);
+        bool send_request (std::string& request_id, const std::string& what,
+                           uxmpp::XmlObject iq, uxmpp::Session::iq_callback_t cb);
 
         uxmpp::Session* sess;
+        std::mutex mutex; // Protects the request ids and the callbacks
         std::string query_id;
 
         reg_info_cb_t reg_info_cb;
@@ -124,6 +131,8 @@ namespace uxmpp { namespace mod {
         std::string registration_id;
         std::string unregistration_id;
         std::string pass_change_id;
+
+        uxmpp::IqTracker iq_tracker; // Pending IQ requests sent by the module
     };
 
 
@@ -41,10 +41,20 @@ Roster::Roster (const std::string& version)
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static std::string bare_key (const uxmpp::Jid& jid)
+{
+    return to_string (jid.bare());
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 Roster::Roster (const Roster& roster)
-    : uxmpp::XmlObject (roster)
+    : uxmpp::XmlObject (roster),
+      index  {roster.index},
+      groups {roster.groups}
 {
 }
 
@@ -52,7 +62,9 @@ Roster::Roster (const Roster& roster)
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 Roster::Roster (Roster&& roster)
-    : uxmpp::XmlObject (roster)
+    : uxmpp::XmlObject (std::move(roster)),
+      index  {std::move(roster.index)},
+      groups {std::move(roster.groups)}
 {
 }
 
@@ -63,6 +75,8 @@ Roster& Roster::operator= (const Roster& roster)
 {
     if (this != &roster) {
         uxmpp::XmlObject::operator= (roster);
+        index  = roster.index;
+        groups = roster.groups;
     }
     return *this;
 }
@@ -74,6 +88,19 @@ Roster& Roster::operator= (const uxmpp::XmlObject& roster)
 {
     if (this != &roster) {
         uxmpp::XmlObject::operator= (roster);
+        rebuild_index ();
+    }
+    return *this;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+Roster& Roster::operator= (uxmpp::XmlObject&& roster)
+{
+    if (this != &roster) {
+        uxmpp::XmlObject::operator= (std::move(roster));
+        rebuild_index ();
     }
     return *this;
 }
@@ -83,7 +110,9 @@ Roster& Roster::operator= (const uxmpp::XmlObject& roster)
 //------------------------------------------------------------------------------
 Roster& Roster::operator= (Roster&& roster)
 {
-    uxmpp::XmlObject::operator= (roster);
+    uxmpp::XmlObject::operator= (std::move(roster));
+    index  = std::move (roster.index);
+    groups = std::move (roster.groups);
     return *this;
 }
 
@@ -96,4 +125,171 @@ std::vector<RosterItem>& Roster::get_items ()
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+const RosterEntry* Roster::find (const uxmpp::Jid& jid) const
+{
+    auto i = index.find (bare_key(jid));
+    return i==index.end() ? nullptr : &i->second.entry;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+RosterItem* Roster::find_item (const uxmpp::Jid& jid)
+{
+    auto i = index.find (bare_key(jid));
+    return i==index.end() ? nullptr : &get_items()[i->second.pos];
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string Roster::subscription_of (const uxmpp::Jid& jid) const
+{
+    auto entry = find (jid);
+    return entry ? entry->subscription : "";
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::vector<uxmpp::Jid> Roster::get_group (const std::string& group) const
+{
+    std::vector<uxmpp::Jid> jids;
+    auto i = groups.find (group);
+    if (i != groups.end()) {
+        for (auto& bare_jid : i->second)
+            jids.push_back (index.at(bare_jid).entry.jid.bare());
+    }
+    return jids;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::vector<std::string> Roster::get_group_names () const
+{
+    std::vector<std::string> names;
+    for (auto& group : groups)
+        names.push_back (group.first);
+    return names;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Roster::set_item (const RosterItem& item)
+{
+    string key = bare_key (item.get_jid());
+    auto i = index.find (key);
+    auto& items = get_items ();
+    size_t pos;
+    if (i != index.end()) {
+        pos = i->second.pos;
+        unindex_item (key);
+        items[pos] = item;
+    }else{
+        pos = items.size ();
+        add_node (item);
+    }
+    index_item (pos);
+}
+
+
+//------------------------------------------------------------------------------
+// The last item is moved to the position of the removed
+// item, so only one index entry needs to be updated.
+//------------------------------------------------------------------------------
+bool Roster::remove_item (const uxmpp::Jid& jid)
+{
+    string key = bare_key (jid);
+    auto i = index.find (key);
+    if (i == index.end())
+        return false;
+
+    auto& items = get_items ();
+    size_t pos  = i->second.pos;
+    size_t last = items.size() - 1;
+    unindex_item (key);
+    if (pos != last) {
+        items[pos] = std::move (items[last]);
+        index[bare_key(items[pos].get_jid())].pos = pos;
+    }
+    items.pop_back ();
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// A duplicate item replaces the earlier item with the same
+// bare JID, in its position, and is removed from the items.
+//------------------------------------------------------------------------------
+void Roster::rebuild_index ()
+{
+    index.clear ();
+    groups.clear ();
+    auto& items = get_items ();
+    size_t pos = 0;
+    while (pos < items.size()) {
+        if (items[pos].get_full_name() != xml::full_tag_roster_item) {
+            ++pos;
+            continue;
+        }
+        auto i = index.find (bare_key(items[pos].get_jid()));
+        if (i != index.end()) {
+            size_t earlier = i->second.pos;
+            items[earlier] = std::move (items[pos]);
+            items.erase (items.begin() + pos);
+            index_item (earlier);
+        }else{
+            index_item (pos++);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Roster::index_item (size_t pos)
+{
+    auto& item = get_items()[pos];
+    IndexEntry ie;
+    ie.pos                = pos;
+    ie.entry.jid          = item.get_jid ();
+    ie.entry.handle       = item.get_handle ();
+    ie.entry.subscription = item.get_subscription ();
+    ie.entry.ask          = item.get_ask ();
+    ie.entry.approved     = item.is_approved ();
+    ie.entry.groups       = item.get_groups ();
+    if (ie.entry.subscription.empty())
+        ie.entry.subscription = "none";
+
+    string key = bare_key (ie.entry.jid);
+    unindex_item (key); // A replaced item may have been in other groups
+    for (auto& group : ie.entry.groups)
+        groups[group].insert (key);
+    index[key] = std::move (ie);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Roster::unindex_item (const std::string& bare_jid)
+{
+    auto i = index.find (bare_jid);
+    if (i == index.end())
+        return;
+    for (auto& group : i->second.entry.groups) {
+        auto g = groups.find (group);
+        if (g == groups.end())
+            continue;
+        g->second.erase (bare_jid);
+        if (g->second.empty())
+            groups.erase (g);
+    }
+    index.erase (i);
+}
+
+
 UXMPP_END_NAMESPACE2
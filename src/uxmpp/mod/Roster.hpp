@@ -22,14 +22,36 @@
 #include <uxmpp/types.hpp>
 #include <uxmpp/XmlObject.hpp>
 #include <uxmpp/mod/RosterItem.hpp>
+#include <uxmpp/Jid.hpp>
 #include <vector>
+#include <string>
+#include <unordered_map>
+#include <set>
 
 
 namespace uxmpp { namespace mod {
 
 
     /**
-     *
+     * The parsed fields of a roster item.
+     */
+    struct RosterEntry {
+        uxmpp::Jid jid;
+        std::string handle;
+        std::string subscription; /**< "none" if the item has no 'subscription' attribute. */
+        std::string ask;
+        bool approved;
+        std::vector<std::string> groups;
+    };
+
+
+    /**
+     * A roster, the 'query' element of a roster result.
+     * The items are indexed by bare JID and by group, with the fields
+     * of each item parsed once, so lookups don't scan the roster.
+     * Modify the roster using set_item() and remove_item() to keep the
+     * index up to date. If the items are changed through get_items(),
+     * call rebuild_index() afterwards.
      */
     class Roster : public uxmpp::XmlObject {
     public:
@@ -64,6 +86,11 @@ namespace uxmpp { namespace mod {
          */
         Roster& operator= (const uxmpp::XmlObject& roster);
 
+        /**
+         * Move a roster query and build the index.
+         */
+        Roster& operator= (uxmpp::XmlObject&& roster);
+
         /**
          * Move operator.
          */
@@ -73,6 +100,91 @@ namespace uxmpp { namespace mod {
          * Return the roster items.
          */
         std::vector<RosterItem>& get_items ();
+
+        /**
+         * Return the roster version (XEP-0237), the 'ver' attribute.
+         */
+        std::string get_version () const {
+            return get_attribute ("ver");
+        }
+
+        /**
+         * Set the roster version (XEP-0237).
+         */
+        void set_version (const std::string& version) {
+            set_attribute ("ver", version);
+        }
+
+        /**
+         * Return the number of roster items.
+         */
+        size_t size () const {
+            return index.size ();
+        }
+
+        /**
+         * Find a roster item by JID. Only the bare JID is used.
+         * @return The parsed roster item, or nullptr if the JID isn't in the roster.
+         *         The pointer is valid until the roster is modified.
+         */
+        const RosterEntry* find (const uxmpp::Jid& jid) const;
+
+        /**
+         * Find a roster item by JID. Only the bare JID is used.
+         * @return The roster item, or nullptr if the JID isn't in the roster.
+         *         The pointer is valid until the roster is modified.
+         */
+        RosterItem* find_item (const uxmpp::Jid& jid);
+
+        /**
+         * Return the subscription state of a JID, like "both" or "none".
+         * Only the bare JID is used.
+         * @return The subscription state, or an empty string if the JID isn't in the roster.
+         */
+        std::string subscription_of (const uxmpp::Jid& jid) const;
+
+        /**
+         * Return the bare JIDs of the items in a group.
+         */
+        std::vector<uxmpp::Jid> get_group (const std::string& group) const;
+
+        /**
+         * Return the names of all groups in the roster.
+         */
+        std::vector<std::string> get_group_names () const;
+
+        /**
+         * Add a roster item, or replace the item with the same bare JID.
+         */
+        void set_item (const RosterItem& item);
+
+        /**
+         * Remove a roster item.
+         * The order of the remaining items may change.
+         * @return false if the JID wasn't in the roster.
+         */
+        bool remove_item (const uxmpp::Jid& jid);
+
+        /**
+         * Rebuild the index from the roster items.
+         */
+        void rebuild_index ();
+
+
+    private:
+        struct IndexEntry {
+            size_t pos; // Position in get_items()
+            RosterEntry entry;
+        };
+
+        // Bare JID to item
+        std::unordered_map<std::string, IndexEntry> index;
+
+        // Group name to the bare JIDs in the group
+        std::unordered_map<std::string, std::set<std::string>> groups;
+
+        void index_item (size_t pos);
+        void unindex_item (const std::string& bare_jid);
     };
 
 
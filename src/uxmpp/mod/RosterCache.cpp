@@ -0,0 +1,190 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/Logger.hpp>
+#include <uxmpp/mod/RosterCache.hpp>
+#include <uxmpp/XmlInputStream.hpp>
+#include <uxmpp/xml/names.hpp>
+#include <uxmpp/utils.hpp>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
+
+
+#define THIS_FILE "RosterCache"
+
+
+UXMPP_START_NAMESPACE2(uxmpp, mod)
+
+
+using namespace std;
+using namespace uxmpp;
+
+
+static const string cache_namespace {"http://ultramarin.se/uxmpp#roster-cache"};
+static const string full_tag_roster_query {xml::namespace_iq_roster + ":query"};
+
+// Don't rewrite the file for every push to a small roster
+static constexpr size_t min_pushes_before_snapshot = 64;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+RosterCache::RosterCache (const std::string& file)
+    :
+    file       {file},
+    num_pushes {0},
+    valid      {false}
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool RosterCache::load (Roster& roster)
+{
+    roster = Roster ();
+    valid  = false;
+    num_pushes = 0;
+
+    ifstream in (file);
+    if (!in) {
+        uxmpp_log_debug (THIS_FILE, "No roster cache in ", file);
+        return false;
+    }
+    ostringstream data;
+    data << in.rdbuf ();
+
+    // The first 'query' is the snapshot and the rest are pushes.
+    // An incomplete push at the end, from a crash while appending,
+    // is never emitted by the parser and is ignored.
+    //
+    Roster loaded;
+    bool have_snapshot = false;
+    bool error = false;
+    size_t pushes = 0;
+    XmlInputStream xis (XmlObject("roster-cache", cache_namespace));
+    xis.set_xml_handler ([&](XmlInputStream& stream, XmlObject& xml_obj){
+            if (xml_obj.get_full_name() != full_tag_roster_query)
+                return;
+            if (!have_snapshot) {
+                loaded = std::move (xml_obj);
+                have_snapshot = true;
+                return;
+            }
+            for (auto& node : xml_obj.get_nodes()) {
+                if (node.get_full_name() != xml::full_tag_roster_item)
+                    continue;
+                auto& item = reinterpret_cast<RosterItem&> (node);
+                if (item.get_subscription() == "remove")
+                    loaded.remove_item (item.get_jid());
+                else
+                    loaded.set_item (item);
+            }
+            loaded.set_version (xml_obj.get_attribute("ver"));
+            ++pushes;
+        });
+    xis.set_error_handler ([&](XmlInputStream& stream, int code, const std::string& msg){
+            error = true;
+        });
+    xis << data.str ();
+
+    if (error || !have_snapshot) {
+        uxmpp_log_warning (THIS_FILE, "Invalid roster cache ", file);
+        return false;
+    }
+    roster     = std::move (loaded);
+    valid      = true;
+    num_pushes = pushes;
+    uxmpp_log_debug (THIS_FILE, "Loaded ", roster.size(), " roster items, version ",
+                     roster.get_version(), ", from ", file);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool RosterCache::save (const Roster& roster)
+{
+    // Make sure the snapshot declares the roster namespace
+    //
+    XmlObject snapshot (roster);
+    snapshot.set_default_namespace_attr (xml::namespace_iq_roster);
+
+    // The snapshot is on disk before it replaces the old cache,
+    // a crash never leaves an empty or partial cache file.
+    //
+    string tmp_file = file + ".tmp";
+    string data = string("<?xml version='1.0'?><roster-cache xmlns='") + cache_namespace + "'>\n" +
+        to_string(snapshot) + "\n";
+    if (!write_file(tmp_file, O_TRUNC, data, true)) {
+        uxmpp_log_warning (THIS_FILE, "Unable to write ", tmp_file);
+        ::unlink (tmp_file.c_str());
+        valid = false;
+        return false;
+    }
+    if (rename(tmp_file.c_str(), file.c_str())) {
+        uxmpp_log_warning (THIS_FILE, "Unable to rename ", tmp_file, " to ", file);
+        ::unlink (tmp_file.c_str());
+        valid = false;
+        return false;
+    }
+    sync_dir (file);
+    valid      = true;
+    num_pushes = 0;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool RosterCache::append (const RosterItem& item, const Roster& roster)
+{
+    if (!valid || num_pushes >= std::max(min_pushes_before_snapshot, roster.size()))
+        return save (roster);
+
+    XmlObject push ("query", xml::namespace_iq_roster);
+    push.set_attribute ("ver", roster.get_version());
+    push.add_node (item);
+
+    // Count the push only when it is written to the file
+    //
+    if (!write_file(file, O_APPEND, to_string(push) + "\n", false)) {
+        uxmpp_log_warning (THIS_FILE, "Unable to write ", file);
+        valid = false;
+        return false;
+    }
+    ++num_pushes;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void RosterCache::remove ()
+{
+    ::unlink (file.c_str());
+    valid      = false;
+    num_pushes = 0;
+}
+
+
+UXMPP_END_NAMESPACE2
@@ -0,0 +1,100 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_MOD_ROSTERCACHE_HPP
+#define UXMPP_MOD_ROSTERCACHE_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/XmlObject.hpp>
+#include <uxmpp/mod/Roster.hpp>
+#include <string>
+
+
+namespace uxmpp { namespace mod {
+
+
+    /**
+     * A roster stored in a file, used with roster versioning (XEP-0237).
+     * <p/>
+     * The file is an append-only XML document. It starts with a
+     * snapshot of the roster, a roster 'query' element with the version
+     * and all items. Each roster push is then appended as a 'query'
+     * element with the new version and the pushed item, so a push costs
+     * one small write. When the pushes outnumber the roster items the
+     * file is rewritten as a new snapshot.
+     * <p/>
+     * Use one file per account.
+     */
+    class RosterCache {
+    public:
+        /**
+         * Constructor.
+         * @param file The file to store the roster in.
+         */
+        RosterCache (const std::string& file);
+
+        /**
+         * Return the name of the file.
+         */
+        const std::string& get_file () const {
+            return file;
+        }
+
+        /**
+         * Load the roster from the file, the snapshot
+         * with the pushes applied.
+         * @param roster The loaded roster.
+         * @return false if the file doesn't exist or can't be parsed,
+         *         the roster is then empty and has no version.
+         */
+        bool load (Roster& roster);
+
+        /**
+         * Replace the file with a snapshot of the roster.
+         * The snapshot is flushed to disk before it atomically replaces the file.
+         * @return false if the file can't be written.
+         */
+        bool save (const Roster& roster);
+
+        /**
+         * Append a roster push to the file.
+         * If the file has grown too large it is rewritten as a
+         * snapshot of the roster, with the push already applied.
+         * @param item The pushed item.
+         * @param roster The roster after the push.
+         * @return false if the file can't be written.
+         */
+        bool append (const RosterItem& item, const Roster& roster);
+
+        /**
+         * Remove the file.
+         */
+        void remove ();
+
+
+    private:
+        std::string file;
+        size_t num_pushes; // Pushes appended since the last snapshot
+        bool valid;        // The file has a snapshot
+    };
+
+
+}}
+
+
+#endif
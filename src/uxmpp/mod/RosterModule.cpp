@@ -25,6 +25,8 @@
 
 #define THIS_FILE "RosterModule"
 
+static const std::string XmlRosterVerFeatureFull {"urn:xmpp:features:rosterver:ver"};
+
 
 UXMPP_START_NAMESPACE2(uxmpp, mod)
 
@@ -44,6 +46,14 @@ RosterModule::RosterModule ()
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+RosterModule::~RosterModule ()
+{
+    iq_tracker.cancel_all ();
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void RosterModule::module_registered (uxmpp::Session& session)
@@ -58,6 +68,7 @@ void RosterModule::module_registered (uxmpp::Session& session)
 void RosterModule::module_unregistered (uxmpp::Session& session)
 {
     //sess->delSessionListener (*this);
+    iq_tracker.cancel_all ();
     sess = nullptr;
 }
 
@@ -76,36 +87,9 @@ bool RosterModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject
     if (xml_obj.get_full_name() == "jabber:client:iq") {
         IqStanza& iq = reinterpret_cast<IqStanza&> (xml_obj);
 
-        // Check for roster query result
-        //
-        if (iq.get_id()==roster_query_id && iq.get_type()==IqType::result) {
-            XmlObject node = iq.find_node ("jabber:iq:roster:query", true);
-            if (node) {
-                uxmpp_log_trace (THIS_FILE, "Got roster query result");
-                roster = std::move (node);
-                // Call registered roster handler
-                if (roster_handler != nullptr)
-                    roster_handler (*this, roster);
-
-                return true;
-            }
-        }
-        //
-        // Check for roster query error
-        //
-        else if (iq.get_id()==roster_query_id && iq.get_type()==IqType::error) {
-            uxmpp_log_debug (THIS_FILE, "Got roster result - roster not found");
-            roster = Roster ();
-            // Call registered roster handler
-            if (roster_handler != nullptr)
-                roster_handler (*this, roster);
-
-            return true;
-        }
-        //
         // Check for iq 'set'
         //
-        else if (iq.get_type()==IqType::set) {
+        if (iq.get_type()==IqType::set) {
             //
             // Check for roster query push
             //
@@ -133,7 +117,7 @@ bool RosterModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject
                 //
                 // We got a roster push, deal with it!
                 //
-                handle_roster_push (reinterpret_cast<RosterItem&>(item));
+                handle_roster_push (reinterpret_cast<RosterItem&>(item), query.get_attribute("ver"));
 
                 // Return an empty result stanza
                 sess->send_stanza (IqStanza(IqType::result,
@@ -151,32 +135,24 @@ bool RosterModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-void RosterModule::handle_roster_push (RosterItem& item)
+void RosterModule::handle_roster_push (RosterItem& item, const std::string& version)
 {
-    bool roster_updated = false;
-
     uxmpp_log_debug (THIS_FILE, "Got roster push: ", to_string(item, true));
 
-    //for (auto& roster_item : roster.getItems()) {
-    auto& items = roster.get_items ();
-    for (auto i=items.begin(); i!=items.end(); ++i) {
-        if (i->get_jid() == item.get_jid()) {
-            roster_updated = true;
-            // Check if the item is removed
-            if (item.get_subscription() == "remove") {
-                items.erase (i);
-                uxmpp_log_debug (THIS_FILE, "Roster item removed");
-            }else{
-                (*i) = item;
-                uxmpp_log_debug (THIS_FILE, "Roster item updated");
-            }
-            break;
-        }
-    }
-    if (!roster_updated) {
-        roster.add_node (item);
-        uxmpp_log_debug (THIS_FILE, "Roster item added");
+    // Check if the item is removed
+    //
+    if (item.get_subscription() == "remove") {
+        if (roster.remove_item(item.get_jid()))
+            uxmpp_log_debug (THIS_FILE, "Roster item removed");
+    }else{
+        bool updated = roster.find(item.get_jid()) != nullptr;
+        roster.set_item (item);
+        uxmpp_log_debug (THIS_FILE, (updated ? "Roster item updated" : "Roster item added"));
     }
+    if (!version.empty())
+        roster.set_version (version);
+    if (cache)
+        cache->append (item, roster);
 
     // Call roster push handler
     if (roster_push_handler)
@@ -193,9 +169,76 @@ void RosterModule::refresh ()
         uxmpp_log_debug (THIS_FILE, "Can't query roster, no session or session not bound");
         return;
     }
-    roster_query_id = string("rq") + sess->get_id();
-    sess->send_stanza (IqStanza(IqType::get, "", to_string(sess->get_jid()), roster_query_id).
-                       add_node(XmlObject("query", "jabber:iq:roster")));
+
+    // XEP-0237: Only send the version if the server supports it,
+    // an empty version if we have no cached roster.
+    //
+    XmlObject query ("query", "jabber:iq:roster");
+    bool versioned = false;
+    if (cache) {
+        for (auto& feature : sess->get_features()) {
+            if (feature.get_full_name() == XmlRosterVerFeatureFull) {
+                versioned = true;
+                query.set_attribute ("ver", roster.get_version());
+                break;
+            }
+        }
+    }
+    iq_tracker.send_iq (*sess,
+                        IqStanza(IqType::get, "", to_string(sess->get_jid())).add_node(query),
+                        [this, versioned](Session& session, IqStanza* iq){
+                            handle_roster_result (iq, versioned);
+                        });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool RosterModule::set_cache_file (const std::string& file)
+{
+    if (file.empty()) {
+        cache.reset ();
+        return false;
+    }
+    cache.reset (new RosterCache(file));
+    return cache->load (roster);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void RosterModule::handle_roster_result (uxmpp::IqStanza* iq, bool versioned)
+{
+    if (!iq) {
+        uxmpp_log_info (THIS_FILE, "No response to roster query");
+        return;
+    }
+
+    if (iq->get_type() == IqType::result) {
+        XmlObject node = iq->find_node ("jabber:iq:roster:query", true);
+        if (node) {
+            uxmpp_log_trace (THIS_FILE, "Got roster query result");
+            roster = std::move (node);
+            if (cache)
+                cache->save (roster);
+            // Call registered roster handler
+            if (roster_handler != nullptr)
+                roster_handler (*this, roster);
+        }
+        else if (versioned) {
+            // XEP-0237: The cached roster is up to date,
+            // any changes are sent as roster pushes.
+            uxmpp_log_debug (THIS_FILE, "Cached roster version ", roster.get_version(), " is current");
+            if (roster_handler != nullptr)
+                roster_handler (*this, roster);
+        }
+    }else{
+        uxmpp_log_debug (THIS_FILE, "Got roster result - roster not found");
+        roster = Roster ();
+        // Call registered roster handler
+        if (roster_handler != nullptr)
+            roster_handler (*this, roster);
+    }
 }
 
 
@@ -207,6 +250,30 @@ Roster& RosterModule::get_roster ()
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+const RosterEntry* RosterModule::find (const uxmpp::Jid& jid) const
+{
+    return roster.find (jid);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string RosterModule::subscription_of (const uxmpp::Jid& jid) const
+{
+    return roster.subscription_of (jid);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::vector<uxmpp::Jid> RosterModule::get_group (const std::string& group) const
+{
+    return roster.get_group (group);
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void RosterModule::update_item (const RosterItem& item)
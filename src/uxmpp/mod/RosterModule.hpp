@@ -21,10 +21,15 @@
 
 #include <string>
 #include <vector>
+#include <functional>
+#include <memory>
 #include <uxmpp/types.hpp>
 #include <uxmpp/XmppModule.hpp>
+#include <uxmpp/IqTracker.hpp>
+#include <uxmpp/IqStanza.hpp>
 #include <uxmpp/mod/Roster.hpp>
 #include <uxmpp/mod/RosterItem.hpp>
+#include <uxmpp/mod/RosterCache.hpp>
 
 
 namespace uxmpp { namespace mod {
@@ -47,8 +52,9 @@ namespace uxmpp { namespace mod {
 
         /**
          * Destructor.
+         * Cancels the pending IQ requests.
          */
-        virtual ~RosterModule () = default;
+        virtual ~RosterModule ();
 
         /**
          * Called when the module is registered to a session.
@@ -68,14 +74,45 @@ namespace uxmpp { namespace mod {
 
         /**
          * Send a roster query to the server.
+         * With a cache file and a server that supports roster versioning
+         * (XEP-0237), only the changes since the cached version are sent
+         * by the server.
          */
         void refresh ();
 
+        /**
+         * Keep the roster in a file and use roster versioning (XEP-0237).
+         * The cached roster is loaded right away, so it is available from
+         * get_roster() before the session is bound.
+         * @param file The cache file, one per account.
+         *             An empty string disables the cache.
+         * @return true if a cached roster was loaded.
+         * @see RosterCache
+         */
+        bool set_cache_file (const std::string& file);
+
         /**
          * Return the roster.
          */
         Roster& get_roster ();
 
+        /**
+         * Find a roster item by JID, see Roster::find().
+         * @return The parsed roster item, or nullptr if the JID isn't in the roster.
+         */
+        const RosterEntry* find (const uxmpp::Jid& jid) const;
+
+        /**
+         * Return the subscription state of a JID, see Roster::subscription_of().
+         * @return The subscription state, or an empty string if the JID isn't in the roster.
+         */
+        std::string subscription_of (const uxmpp::Jid& jid) const;
+
+        /**
+         * Return the bare JIDs of the roster items in a group.
+         */
+        std::vector<uxmpp::Jid> get_group (const std::string& group) const;
+
         /**
          * Update/modify a roster item.
          */
@@ -115,12 +152,21 @@ namespace uxmpp { namespace mod {
     protected:
         uxmpp::Session* sess;
         Roster roster;
-        std::string roster_query_id;
+        std::unique_ptr<RosterCache> cache;
 
         /**
          * Handle a roster push.
+         * @param item The pushed item.
+         * @param version The new roster version, if any.
          */
-        void handle_roster_push (RosterItem& item);
+        void handle_roster_push (RosterItem& item, const std::string& version="");
+
+        /**
+         * Handle the response to a roster query.
+         * @param iq The response, nullptr on timeout.
+         * @param versioned True if the query had a 'ver' attribute.
+         */
+        void handle_roster_result (uxmpp::IqStanza* iq, bool versioned=false);
 
 
     private:
@@ -138,6 +184,8 @@ namespace uxmpp { namespace mod {
          * Callback for roster push'es.
          */
         std::function<void (RosterModule&, RosterItem&)> roster_push_handler;
+
+        uxmpp::IqTracker iq_tracker; // Pending IQ requests sent by the module
     };
 
 
@@ -0,0 +1,1064 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/Logger.hpp>
+#include <uxmpp/mod/S5BModule.hpp>
+#include <uxmpp/StanzaError.hpp>
+#include <uxmpp/utils.hpp>
+#include <uxmpp/xml/names.hpp>
+#include <uxmpp/io/BsdResolver.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+UXMPP_START_NAMESPACE2(uxmpp, mod)
+
+using namespace std;
+using namespace uxmpp;
+
+static const string log_module {"S5BModule"};
+
+static const string namespace_bytestreams {"http://jabber.org/protocol/bytestreams"};
+static const string full_tag_query {namespace_bytestreams + ":query"};
+static const string full_tag_streamhost {namespace_bytestreams + ":streamhost"};
+static const string full_tag_streamhost_used {namespace_bytestreams + ":streamhost-used"};
+
+static constexpr unsigned default_connect_timeout = 5000;
+static constexpr unsigned default_request_timeout = 60000;
+
+// The most data moved by one read or write of a byte stream
+static constexpr size_t transfer_chunk_size = 1024 * 1024;
+
+// SOCKS5 protocol values (RFC 1928)
+static constexpr unsigned char socks_version     = 5;
+static constexpr unsigned char socks_no_auth     = 0;
+static constexpr unsigned char socks_cmd_connect = 1;
+static constexpr unsigned char socks_atyp_ipv4   = 1;
+static constexpr unsigned char socks_atyp_domain = 3;
+static constexpr unsigned char socks_atyp_ipv6   = 4;
+static constexpr unsigned char socks_reply_ok    = 0;
+
+
+//------------------------------------------------------------------------------
+// The SOCKS5 destination address, a domain name that
+// both the initiator and the target can calculate.
+//------------------------------------------------------------------------------
+static string get_dst_addr (const string& sid, const Jid& initiator, const Jid& target)
+{
+    return get_sha1_str (sid + to_string(initiator) + to_string(target));
+}
+
+
+//------------------------------------------------------------------------------
+// The number of bytes of a SOCKS5 reply after the first five.
+//------------------------------------------------------------------------------
+static size_t get_reply_rest (unsigned char atyp, unsigned char addr_byte)
+{
+    switch (atyp) {
+    case socks_atyp_ipv4:
+        return 4 - 1 + 2;
+    case socks_atyp_domain:
+        return addr_byte + 2;
+    case socks_atyp_ipv6:
+        return 16 - 1 + 2;
+    default:
+        return 0;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+S5BModule::Stream::Stream ()
+    : initiator {false},
+      host_index {0},
+      file {nullptr},
+      attempt {0},
+      connected {false},
+      transferring {false},
+      done {false},
+      bytes {0}
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+S5BModule::S5BModule ()
+    : XmppModule ("mod_s5b"),
+      sess {nullptr},
+      connect_timeout {default_connect_timeout},
+      request_timeout {default_request_timeout},
+      zero_copy {true},
+      listen_port {0},
+      request_handler {nullptr},
+      close_handler {nullptr}
+{
+    listen_pipe[0] = listen_pipe[1] = -1;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+S5BModule::~S5BModule ()
+{
+    iq_tracker.cancel_all ();
+    stop_listening ();
+
+    // Cancel the I/O operations that refer to the module
+    //
+    vector<stream_t> all;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        for (auto& i : streams)
+            all.push_back (i.second);
+        all.insert (all.end(), incoming.begin(), incoming.end());
+        streams.clear ();
+        incoming.clear ();
+    }
+    for (auto& stream : all) {
+        stream->timer.cancel ();
+        if (stream->socket)
+            stream->socket->close ();
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::module_registered (uxmpp::Session& session)
+{
+    sess = &session;
+    sess->add_session_listener (*this);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::module_unregistered (uxmpp::Session& session)
+{
+    iq_tracker.cancel_all ();
+    sess->del_session_listener (*this);
+    sess = nullptr;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool S5BModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj)
+{
+    // Sanity check
+    //
+    if (!sess || xml_obj.get_full_name()!=xml::full_tag_iq_stanza)
+        return false;
+
+    IqStanza& iq = reinterpret_cast<IqStanza&> (xml_obj);
+    if (iq.get_type() != IqType::set)
+        return false;
+
+    // We are not a proxy, only requests from an initiator are handled
+    //
+    auto query = iq.find_node (full_tag_query, true);
+    if (!query || !query.find_node(full_tag_streamhost, true))
+        return false;
+
+    handle_request (iq, query);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::vector<std::string> S5BModule::get_disco_features ()
+{
+    return {namespace_bytestreams};
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::on_state_change (uxmpp::Session& session,
+                                 uxmpp::SessionState new_state,
+                                 uxmpp::SessionState old_state)
+{
+    if (new_state != SessionState::closed)
+        return;
+
+    // Byte streams already sending or receiving
+    // data don't need the session any more
+    //
+    vector<stream_t> negotiating;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        for (auto& i : streams) {
+            if (!i.second->transferring)
+                negotiating.push_back (i.second);
+        }
+    }
+    for (auto& stream : negotiating)
+        end_stream (stream, StanzaError::remote_server_timeout);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool S5BModule::listen (const std::string& host, uint16_t port)
+{
+    stop_listening ();
+
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len;
+    memset (&saddr, 0, sizeof(saddr));
+    auto saddr4 = reinterpret_cast<struct sockaddr_in*> (&saddr);
+    auto saddr6 = reinterpret_cast<struct sockaddr_in6*> (&saddr);
+    if (inet_pton(AF_INET, host.c_str(), &saddr4->sin_addr) == 1) {
+        saddr4->sin_family = AF_INET;
+        saddr4->sin_port   = htons (port);
+        saddr_len = sizeof (*saddr4);
+    }
+    else if (inet_pton(AF_INET6, host.c_str(), &saddr6->sin6_addr) == 1) {
+        saddr6->sin6_family = AF_INET6;
+        saddr6->sin6_port   = htons (port);
+        saddr_len = sizeof (*saddr6);
+    }else{
+        uxmpp_log_warning (log_module, "Not an IP address: ", host);
+        return false;
+    }
+
+    int fd = socket (saddr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        uxmpp_log_warning (log_module, "Unable to create socket: ", string(strerror(errno)));
+        return false;
+    }
+    int on = 1;
+    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&saddr), saddr_len) ||
+        ::listen(fd, 16) ||
+        getsockname(fd, reinterpret_cast<struct sockaddr*>(&saddr), &saddr_len))
+    {
+        uxmpp_log_warning (log_module, "Unable to listen on ", host, ": ", string(strerror(errno)));
+        ::close (fd);
+        return false;
+    }
+    if (pipe(listen_pipe)) {
+        uxmpp_log_warning (log_module, "Unable to create pipe: ", string(strerror(errno)));
+        ::close (fd);
+        return false;
+    }
+    {
+        lock_guard<std::mutex> lock (mutex);
+        listen_host = host;
+        listen_port = ntohs (saddr.ss_family==AF_INET ? saddr4->sin_port : saddr6->sin6_port);
+    }
+    uxmpp_log_debug (log_module, "Listen for direct connections on ", host, " port ", listen_port);
+    listen_thread = std::thread ([this, fd](){
+            run_listener (fd);
+        });
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::stop_listening ()
+{
+    if (!listen_thread.joinable())
+        return;
+
+    char c = 0;
+    if (::write(listen_pipe[1], &c, 1) != 1)
+        uxmpp_log_warning (log_module, "Unable to stop the listen thread");
+    listen_thread.join ();
+    ::close (listen_pipe[0]);
+    ::close (listen_pipe[1]);
+    listen_pipe[0] = listen_pipe[1] = -1;
+
+    lock_guard<std::mutex> lock (mutex);
+    listen_host = "";
+    listen_port = 0;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::add_proxy (const uxmpp::Jid& jid, const std::string& host, uint16_t port)
+{
+    lock_guard<std::mutex> lock (mutex);
+    StreamHost proxy {jid, host, port};
+    for (auto& p : proxies) {
+        if (to_string(p.jid) == to_string(jid)) {
+            p = proxy;
+            return;
+        }
+    }
+    proxies.push_back (proxy);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::query_proxy (const uxmpp::Jid& jid, proxy_handler_t handler)
+{
+    if (!sess)
+        return;
+
+    auto id = iq_tracker.send_iq (*sess, IqStanza(IqType::get, jid, sess->get_jid()).add_node(XmlObject("query", namespace_bytestreams)),
+                                         [this, jid, handler](Session& session, IqStanza* iq){
+                                             bool found = false;
+                                             if (iq && iq->get_type()==IqType::result) {
+                                                 auto host = iq->find_node(full_tag_query, true).find_node(full_tag_streamhost, true);
+                                                 auto port = atoi (host.get_attribute("port").c_str());
+                                                 if (host && !host.get_attribute("host").empty() && port>0 && port<=65535) {
+                                                     auto proxy_jid = host.get_attribute ("jid");
+                                                     add_proxy (proxy_jid.empty() ? jid : Jid(proxy_jid),
+                                                                host.get_attribute("host"),
+                                                                static_cast<uint16_t>(port));
+                                                     found = true;
+                                                 }
+                                             }
+                                             uxmpp_log_debug (log_module, "Proxy ", to_string(jid), (found ? " added" : " not found"));
+                                             if (handler)
+                                                 handler (*this, jid, found);
+                                         });
+    if (id.empty() && handler)
+        handler (*this, jid, false);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::vector<S5BModule::StreamHost> S5BModule::get_proxies ()
+{
+    lock_guard<std::mutex> lock (mutex);
+    return proxies;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string S5BModule::send (const uxmpp::Jid& to, io::Connection& source)
+{
+    if (!sess)
+        return "";
+
+    auto stream = make_shared<Stream> ();
+    stream->sid       = make_uuid_v4 ();
+    stream->peer      = to;
+    stream->initiator = true;
+    stream->file      = &source;
+    stream->dst_addr  = get_dst_addr (stream->sid, sess->get_jid(), to);
+    stream->socket.reset (new io::SocketConnection);
+    stream->socket->set_zero_copy (zero_copy);
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (listen_port)
+            stream->hosts.push_back (StreamHost{sess->get_jid(), listen_host, listen_port});
+        stream->hosts.insert (stream->hosts.end(), proxies.begin(), proxies.end());
+        if (stream->hosts.empty()) {
+            uxmpp_log_info (log_module, "No streamhost to offer");
+            return "";
+        }
+        streams.emplace (stream->sid, stream);
+    }
+
+    XmlObject query ("query", namespace_bytestreams);
+    query.set_attribute ("sid", stream->sid);
+    query.set_attribute ("mode", "tcp");
+    for (auto& host : stream->hosts) {
+        XmlObject streamhost ("streamhost", namespace_bytestreams, false);
+        streamhost.set_attribute ("jid", to_string(host.jid));
+        streamhost.set_attribute ("host", host.host);
+        streamhost.set_attribute ("port", std::to_string(host.port));
+        query.add_node (std::move(streamhost));
+    }
+    auto id = iq_tracker.send_iq (*sess, IqStanza(IqType::set, to, sess->get_jid()).add_node(std::move(query)),
+                                         [this, stream](Session& session, IqStanza* iq){
+                                             handle_request_result (stream, iq);
+                                         },
+                                         request_timeout);
+    if (id.empty()) {
+        lock_guard<std::mutex> lock (mutex);
+        streams.erase (stream->sid);
+        return "";
+    }
+    uxmpp_log_debug (log_module, "Request byte stream ", stream->sid, " to ", to_string(to),
+                     ", ", stream->hosts.size(), " streamhosts");
+    return stream->sid;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::accept (const std::string& sid, io::Connection& sink)
+{
+    stream_t stream;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto i = streams.find (sid);
+        if (i==streams.end() || i->second->initiator || i->second->file)
+            return;
+        stream = i->second;
+        stream->file = &sink;
+    }
+    connect_host (stream);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::deny (const std::string& sid)
+{
+    stream_t stream;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto i = streams.find (sid);
+        if (i==streams.end() || i->second->initiator || i->second->file)
+            return;
+        stream = i->second;
+        stream->done = true;
+        streams.erase (i);
+    }
+    send_error (stream->peer, stream->request_id, StanzaError::type_cancel, StanzaError::not_acceptable);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::close (const std::string& sid)
+{
+    stream_t stream;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        auto i = streams.find (sid);
+        if (i == streams.end())
+            return;
+        stream = i->second;
+    }
+    if (!stream->initiator && !stream->file)
+        deny (sid);
+    else
+        end_stream (stream, "");
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::set_request_handler (request_handler_t handler)
+{
+    request_handler = handler;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::set_close_handler (close_handler_t handler)
+{
+    close_handler = handler;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::set_connect_timeout (unsigned msec)
+{
+    connect_timeout = msec;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::set_request_timeout (unsigned msec)
+{
+    request_timeout = msec;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::set_zero_copy (bool enable)
+{
+    zero_copy = enable;
+}
+
+
+//------------------------------------------------------------------------------
+// Called by the target when the initiator requests a byte stream.
+//------------------------------------------------------------------------------
+void S5BModule::handle_request (uxmpp::IqStanza& iq, uxmpp::XmlObject& query)
+{
+    if (query.get_attribute("mode") == "udp") {
+        send_error (iq.get_from(), iq.get_id(), StanzaError::type_cancel, StanzaError::feature_not_implemented);
+        return;
+    }
+
+    auto stream = make_shared<Stream> ();
+    for (auto& node : query.get_nodes()) {
+        if (node.get_full_name() != full_tag_streamhost)
+            continue;
+        auto port = atoi (node.get_attribute("port").c_str());
+        auto host = node.get_attribute ("host");
+        if (!host.empty() && port>0 && port<=65535)
+            stream->hosts.push_back (StreamHost{Jid(node.get_attribute("jid")), host, static_cast<uint16_t>(port)});
+    }
+    string sid = query.get_attribute ("sid");
+    if (sid.empty() || stream->hosts.empty()) {
+        send_error (iq.get_from(), iq.get_id(), StanzaError::type_modify, StanzaError::bad_request);
+        return;
+    }
+    stream->sid        = sid;
+    stream->peer       = iq.get_from ();
+    stream->dst_addr   = get_dst_addr (sid, stream->peer, sess->get_jid());
+    stream->request_id = iq.get_id ();
+    stream->socket.reset (new io::SocketConnection);
+    stream->socket->set_zero_copy (zero_copy);
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (request_handler && streams.find(sid)==streams.end()) {
+            streams.emplace (sid, stream);
+        }else{
+            stream = nullptr;
+        }
+    }
+    if (!stream) {
+        send_error (iq.get_from(), iq.get_id(), StanzaError::type_cancel, StanzaError::not_acceptable);
+        return;
+    }
+    uxmpp_log_debug (log_module, "Byte stream ", sid, " requested by ", to_string(stream->peer),
+                     ", ", stream->hosts.size(), " streamhosts");
+    request_handler (*this, sid, stream->peer);
+}
+
+
+//------------------------------------------------------------------------------
+// Called by the initiator with the streamhost the target connected to.
+//------------------------------------------------------------------------------
+void S5BModule::handle_request_result (stream_t stream, uxmpp::IqStanza* iq)
+{
+    if (!iq || iq->get_type()!=IqType::result) {
+        string condition = StanzaError::remote_server_timeout;
+        if (iq) {
+            auto error = iq->get_error ();
+            condition = error ? error.get_condition() : StanzaError::undefined_condition;
+        }
+        end_stream (stream, condition);
+        return;
+    }
+
+    auto used = iq->find_node(full_tag_query, true).find_node(full_tag_streamhost_used, true).get_attribute("jid");
+    bool direct = false;
+    bool found = false;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (stream->done)
+            return;
+        for (size_t i=0; i<stream->hosts.size(); ++i) {
+            if (to_string(stream->hosts[i].jid) == used) {
+                stream->host_index = i;
+                found = true;
+                break;
+            }
+        }
+        // The target is connected to us
+        direct = found && used==to_string(sess->get_jid());
+        if (direct)
+            found = stream->connected;
+    }
+    if (!found)
+        end_stream (stream, StanzaError::item_not_found);
+    else if (direct)
+        start_transfer (stream);
+    else
+        connect_host (stream);
+}
+
+
+//------------------------------------------------------------------------------
+// Connect to the current streamhost of a byte stream. The target tries
+// the streamhosts in order, the initiator connects to the proxy
+// selected by the target.
+//------------------------------------------------------------------------------
+void S5BModule::connect_host (stream_t stream)
+{
+    StreamHost host;
+    unsigned attempt;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (stream->done)
+            return;
+        attempt = ++stream->attempt;
+        stream->connected = false;
+        if (stream->host_index < stream->hosts.size())
+            host = stream->hosts[stream->host_index];
+    }
+    if (host.host.empty()) {
+        end_stream (stream, stream->initiator ? StanzaError::remote_server_not_found : StanzaError::item_not_found);
+        return;
+    }
+
+    stream->socket->close ();
+    io::BsdResolver resolver;
+    auto addr_list = resolver.lookup_host (host.host, host.port, io::AddrProto::tcp);
+    if (addr_list.empty()) {
+        uxmpp_log_info (log_module, "Unable to resolve streamhost ", host.host);
+        handle_connected (stream, attempt, EHOSTUNREACH);
+        return;
+    }
+
+    uxmpp_log_debug (log_module, "Byte stream ", stream->sid, ", connect to streamhost ",
+                     to_string(host.jid), " at ", host.host, " port ", host.port);
+    weak_ptr<Stream> weak_stream {stream};
+    stream->socket->set_connected_cb ([this, weak_stream, attempt](io::SocketConnection& conn, int errnum){
+            auto stream = weak_stream.lock ();
+            if (stream)
+                handle_connected (stream, attempt, errnum);
+        });
+    stream->timer.set (chrono::milliseconds(connect_timeout), [this, weak_stream, attempt](){
+            auto stream = weak_stream.lock ();
+            if (stream)
+                handle_connect_timeout (stream, attempt);
+        });
+    stream->socket->connect (addr_list[0]);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::handle_connected (stream_t stream, unsigned attempt, int errnum)
+{
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (stream->done || attempt!=stream->attempt)
+            return;
+        if (errnum) {
+            // Try the next streamhost, the initiator has only one
+            if (stream->initiator)
+                stream->host_index = stream->hosts.size ();
+            else
+                ++stream->host_index;
+        }
+    }
+    if (errnum) {
+        uxmpp_log_debug (log_module, "Byte stream ", stream->sid, ", unable to connect to streamhost: ",
+                         string(strerror(errnum)));
+        connect_host (stream);
+    }else{
+        socks_connect (stream, attempt);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::handle_connect_timeout (stream_t stream, unsigned attempt)
+{
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (stream->done || attempt!=stream->attempt || stream->connected)
+            return;
+    }
+    uxmpp_log_debug (log_module, "Byte stream ", stream->sid, ", streamhost connection timeout");
+    handle_connected (stream, attempt, ETIMEDOUT);
+}
+
+
+//------------------------------------------------------------------------------
+// The SOCKS5 handshake of a client, connecting to the destination
+// address of the byte stream without authentication.
+//------------------------------------------------------------------------------
+void S5BModule::socks_connect (stream_t stream, unsigned attempt)
+{
+    auto& buf = stream->buf;
+    buf[0] = socks_version;
+    buf[1] = 1;
+    buf[2] = socks_no_auth;
+    socks_io (stream, true, 0, 3, [this, attempt](stream_t stream, bool ok){
+            if (!ok) {
+                socks_connected (stream, attempt, false);
+                return;
+            }
+            socks_io (stream, false, 0, 2, [this, attempt](stream_t stream, bool ok){
+                    auto& buf = stream->buf;
+                    if (!ok || buf[0]!=socks_version || buf[1]!=socks_no_auth) {
+                        socks_connected (stream, attempt, false);
+                        return;
+                    }
+                    // Connect to the hash as a domain name, port 0
+                    auto len = stream->dst_addr.size ();
+                    buf[0] = socks_version;
+                    buf[1] = socks_cmd_connect;
+                    buf[2] = 0;
+                    buf[3] = socks_atyp_domain;
+                    buf[4] = len;
+                    memcpy (&buf[5], stream->dst_addr.data(), len);
+                    buf[5+len] = 0;
+                    buf[6+len] = 0;
+                    socks_io (stream, true, 0, len+7, [this, attempt](stream_t stream, bool ok){
+                            if (!ok) {
+                                socks_connected (stream, attempt, false);
+                                return;
+                            }
+                            socks_io (stream, false, 0, 5, [this, attempt](stream_t stream, bool ok){
+                                    auto& buf = stream->buf;
+                                    size_t rest = get_reply_rest (buf[3], buf[4]);
+                                    if (!ok || buf[0]!=socks_version || buf[1]!=socks_reply_ok || !rest) {
+                                        socks_connected (stream, attempt, false);
+                                        return;
+                                    }
+                                    socks_io (stream, false, 5, 5+rest, [this, attempt](stream_t stream, bool ok){
+                                            socks_connected (stream, attempt, ok);
+                                        });
+                                });
+                        });
+                });
+        });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::socks_connected (stream_t stream, unsigned attempt, bool ok)
+{
+    if (!ok) {
+        handle_connected (stream, attempt, ECONNREFUSED);
+        return;
+    }
+
+    StreamHost host;
+    string request_id;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (stream->done || attempt!=stream->attempt)
+            return;
+        stream->connected = true;
+        host = stream->hosts[stream->host_index];
+        request_id.swap (stream->request_id);
+    }
+    stream->timer.cancel ();
+    uxmpp_log_debug (log_module, "Byte stream ", stream->sid, " connected to streamhost ", to_string(host.jid));
+
+    if (stream->initiator) {
+        activate (stream);
+        return;
+    }
+
+    // Tell the initiator which streamhost we used
+    //
+    XmlObject query ("query", namespace_bytestreams);
+    query.set_attribute ("sid", stream->sid);
+    XmlObject used ("streamhost-used", namespace_bytestreams, false);
+    used.set_attribute ("jid", to_string(host.jid));
+    query.add_node (std::move(used));
+    if (sess)
+        sess->send_stanza (IqStanza(IqType::result, stream->peer, sess->get_jid(), request_id).add_node(query));
+    start_transfer (stream);
+}
+
+
+//------------------------------------------------------------------------------
+// Called by the initiator when connected to a proxy.
+//------------------------------------------------------------------------------
+void S5BModule::activate (stream_t stream)
+{
+    Jid proxy;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        proxy = stream->hosts[stream->host_index].jid;
+    }
+    XmlObject query ("query", namespace_bytestreams);
+    query.set_attribute ("sid", stream->sid);
+    query.add_node (XmlObject("activate", namespace_bytestreams, false).set_content(to_string(stream->peer)));
+    auto id = !sess ? "" : iq_tracker.send_iq (*sess, IqStanza(IqType::set, proxy, sess->get_jid()).add_node(query),
+                                                      [this, stream](Session& session, IqStanza* iq){
+                                                          if (iq && iq->get_type()==IqType::result) {
+                                                              start_transfer (stream);
+                                                          }else{
+                                                              string condition = StanzaError::remote_server_timeout;
+                                                              if (iq) {
+                                                                  auto error = iq->get_error ();
+                                                                  condition = error ? error.get_condition() : StanzaError::undefined_condition;
+                                                              }
+                                                              end_stream (stream, condition);
+                                                          }
+                                                      });
+    if (id.empty())
+        end_stream (stream, StanzaError::remote_server_timeout);
+}
+
+
+//------------------------------------------------------------------------------
+// Accept direct connections from targets, until stop_listening().
+//------------------------------------------------------------------------------
+void S5BModule::run_listener (int listen_fd)
+{
+    struct pollfd fds[2];
+    fds[0].fd     = listen_pipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd     = listen_fd;
+    fds[1].events = POLLIN;
+
+    while (true) {
+        fds[0].revents = fds[1].revents = 0;
+        int result = poll (fds, 2, -1);
+        if (result < 0 && errno != EINTR)
+            break;
+        if (fds[0].revents)
+            break;
+        if (!(fds[1].revents & POLLIN))
+            continue;
+
+        int fd = accept4 (listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1)
+            continue;
+        auto pending = make_shared<Stream> ();
+        pending->socket.reset (new io::SocketConnection);
+        pending->socket->attach (fd);
+        pending->socket->set_zero_copy (zero_copy);
+        {
+            lock_guard<std::mutex> lock (mutex);
+            incoming.insert (pending);
+        }
+        uxmpp_log_debug (log_module, "Direct connection from ", to_string(pending->socket->get_peer_addr()));
+
+        // Drop connections that don't complete the handshake
+        //
+        weak_ptr<Stream> weak_pending {pending};
+        pending->timer.set (chrono::milliseconds(connect_timeout), [this, weak_pending](){
+                auto pending = weak_pending.lock ();
+                if (pending)
+                    socks_accepted (pending, false);
+            });
+        socks_accept (pending);
+    }
+    ::close (listen_fd);
+}
+
+
+//------------------------------------------------------------------------------
+// The SOCKS5 handshake of a direct connection from a target.
+//------------------------------------------------------------------------------
+void S5BModule::socks_accept (stream_t pending)
+{
+    socks_io (pending, false, 0, 2, [this](stream_t pending, bool ok){
+            auto& buf = pending->buf;
+            if (!ok || buf[0]!=socks_version || buf[1]==0) {
+                socks_accepted (pending, false);
+                return;
+            }
+            socks_io (pending, false, 2, 2+buf[1], [this](stream_t pending, bool ok){
+                    auto& buf = pending->buf;
+                    auto methods_end = buf.begin() + 2 + buf[1];
+                    if (!ok || find(buf.begin()+2, methods_end, socks_no_auth) == methods_end) {
+                        socks_accepted (pending, false);
+                        return;
+                    }
+                    buf[0] = socks_version;
+                    buf[1] = socks_no_auth;
+                    socks_io (pending, true, 0, 2, [this](stream_t pending, bool ok){
+                            if (!ok) {
+                                socks_accepted (pending, false);
+                                return;
+                            }
+                            socks_io (pending, false, 0, 5, [this](stream_t pending, bool ok){
+                                    auto& buf = pending->buf;
+                                    if (!ok || buf[0]!=socks_version || buf[1]!=socks_cmd_connect ||
+                                        buf[3]!=socks_atyp_domain)
+                                    {
+                                        socks_accepted (pending, false);
+                                        return;
+                                    }
+                                    socks_io (pending, false, 5, 5+buf[4]+2, [this](stream_t pending, bool ok){
+                                            socks_accepted (pending, ok);
+                                        });
+                                });
+                        });
+                });
+        });
+}
+
+
+//------------------------------------------------------------------------------
+// Match a direct connection to a byte stream, using the destination address.
+//------------------------------------------------------------------------------
+void S5BModule::socks_accepted (stream_t pending, bool ok)
+{
+    stream_t stream;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (!incoming.erase(pending))
+            return;
+        if (ok) {
+            string dst_addr (reinterpret_cast<char*>(&pending->buf[5]), pending->buf[4]);
+            for (auto& i : streams) {
+                auto& s = i.second;
+                if (s->initiator && !s->connected && !s->done && s->dst_addr==dst_addr) {
+                    stream = s;
+                    break;
+                }
+            }
+        }
+        if (stream) {
+            // The connection is now used by the byte stream
+            stream->socket = std::move (pending->socket);
+            stream->connected = true;
+            copy (pending->buf.begin(), pending->buf.end(), stream->buf.begin());
+        }
+    }
+    pending->timer.cancel ();
+    if (!stream) {
+        uxmpp_log_debug (log_module, "Direct connection rejected");
+        if (pending->socket)
+            pending->socket->close ();
+        return;
+    }
+
+    uxmpp_log_debug (log_module, "Byte stream ", stream->sid, ", target connected directly");
+    auto& buf = stream->buf;
+    buf[0] = socks_version;
+    buf[1] = socks_reply_ok;
+    socks_io (stream, true, 0, 5+buf[4]+2, [](stream_t stream, bool ok){
+            // If this fails the target tries the next streamhost
+        });
+}
+
+
+//------------------------------------------------------------------------------
+// Read or write a SOCKS5 message in the buffer of a byte stream.
+//------------------------------------------------------------------------------
+void S5BModule::socks_io (stream_t stream, bool write, size_t pos, size_t size, socks_cb_t cb)
+{
+    auto io_cb = [this, stream, write, pos, size, cb](io::Connection& conn, void* buf, ssize_t result, int errnum){
+        // Use copies, closing the connection deletes this callback
+        auto s = stream;
+        auto next = cb;
+        if (result <= 0)
+            next (s, false);
+        else if (pos+result < size)
+            socks_io (s, write, pos+result, size, next);
+        else
+            next (s, true);
+    };
+    auto data = stream->buf.data() + pos;
+    if (write)
+        stream->socket->write (data, size-pos, io_cb);
+    else
+        stream->socket->read (data, size-pos, io_cb);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::start_transfer (stream_t stream)
+{
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (stream->done || stream->transferring)
+            return;
+        stream->transferring = true;
+    }
+    uxmpp_log_debug (log_module, "Byte stream ", stream->sid, (stream->initiator ? ", send" : ", receive"),
+                     " data", (stream->socket->is_zero_copy() ? " without copying" : ""));
+    transfer (stream);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::transfer (stream_t stream)
+{
+    auto cb = [this, stream](io::Connection& conn, void* buf, ssize_t result, int errnum){
+        handle_transfer (stream, result);
+    };
+    if (stream->initiator)
+        stream->socket->write_from_file (stream->file->get_fd(), transfer_chunk_size, -1, cb);
+    else
+        stream->socket->read_to_file (stream->file->get_fd(), transfer_chunk_size, -1, cb);
+}
+
+
+//------------------------------------------------------------------------------
+// Called from the I/O thread. The sender is done at the
+// end of the file, the receiver when the socket is closed.
+//------------------------------------------------------------------------------
+void S5BModule::handle_transfer (stream_t stream, ssize_t result)
+{
+    if (result > 0) {
+        {
+            lock_guard<std::mutex> lock (mutex);
+            if (stream->done)
+                return;
+            stream->bytes += result;
+        }
+        transfer (stream);
+    }else{
+        end_stream (stream, result==0 ? "" : StanzaError::gone);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::end_stream (stream_t stream, const std::string& error)
+{
+    string request_id;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (stream->done)
+            return;
+        stream->done = true;
+        auto i = streams.find (stream->sid);
+        if (i!=streams.end() && i->second==stream)
+            streams.erase (i);
+        request_id.swap (stream->request_id);
+    }
+    stream->timer.cancel ();
+    if (stream->socket)
+        stream->socket->close ();
+
+    // The target didn't connect to any streamhost
+    //
+    if (!request_id.empty()) {
+        send_error (stream->peer, request_id, StanzaError::type_cancel,
+                    error.empty() ? StanzaError::not_acceptable : error);
+    }
+
+    uxmpp_log_debug (log_module, "Byte stream ", stream->sid, " closed, ", stream->bytes,
+                     (stream->initiator ? " bytes sent" : " bytes received"));
+    if (close_handler)
+        close_handler (*this, stream->sid, stream->bytes, error);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void S5BModule::send_error (const uxmpp::Jid& to, const std::string& id,
+                            const std::string& type, const std::string& condition)
+{
+    if (sess) {
+        sess->send_stanza (IqStanza(IqType::error, to, sess->get_jid(), id).
+                           add_node(StanzaError(type, condition)));
+    }
+}
+
+
+UXMPP_END_NAMESPACE2
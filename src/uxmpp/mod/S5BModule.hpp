@@ -0,0 +1,320 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_MOD_S5BMODULE_HPP
+#define UXMPP_MOD_S5BMODULE_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/XmppModule.hpp>
+#include <uxmpp/IqTracker.hpp>
+#include <uxmpp/Session.hpp>
+#include <uxmpp/IqStanza.hpp>
+#include <uxmpp/Jid.hpp>
+#include <uxmpp/io/Connection.hpp>
+#include <uxmpp/io/SocketConnection.hpp>
+#include <uxmpp/io/Timer.hpp>
+
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <cstdint>
+
+
+namespace uxmpp { namespace mod {
+
+
+    /**
+     * SOCKS5 Bytestreams (XEP-0065).
+     * <p/>
+     * The byte stream is negotiated with IQ stanzas and the data is
+     * then sent over a TCP connection, either directly to the
+     * initiator or through a proxy (streamhost) relaying the data.
+     * Only the TCP mode is supported.
+     * <p/>
+     * The data of a file is moved between the file and the socket
+     * by the ConnectionManager using io::SocketConnection::write_from_file
+     * and io::SocketConnection::read_to_file, without being copied to
+     * user space if sendfile() and splice() are available.
+     * <p/>
+     * There is no end-of-data marker in a SOCKS5 bytestream, the
+     * sender closes the connection when all data is sent and the
+     * receiver reads until the connection is closed.
+     */
+    class S5BModule : public uxmpp::XmppModule, uxmpp::SessionListener {
+    public:
+
+        /**
+         * A host that the target of a byte stream may connect to.
+         */
+        struct StreamHost {
+            uxmpp::Jid jid;   /**< The JID of the initiator or the proxy. */
+            std::string host; /**< Host name or IP address. */
+            uint16_t port;    /**< Port number. */
+        };
+
+        /**
+         * Called when an entity wants to send a byte stream to us.
+         * Call accept() or deny(), from the callback or later.
+         * @param sid The ID of the byte stream.
+         * @param from The sender of the byte stream.
+         */
+        typedef std::function<void (S5BModule& module,
+                                     const std::string& sid,
+                                     const uxmpp::Jid& from)> request_handler_t;
+
+        /**
+         * Called when a byte stream is closed, sent or received.
+         * @param sid The ID of the byte stream.
+         * @param bytes The number of bytes sent or received.
+         * @param error An empty string if all data was sent, or the
+         *              connection was closed by the sender, otherwise
+         *              the stanza error condition that ended the byte stream.
+         */
+        typedef std::function<void (S5BModule& module,
+                                     const std::string& sid,
+                                     uint64_t bytes,
+                                     const std::string& error)> close_handler_t;
+
+        /**
+         * Called with the result of query_proxy().
+         * @param found True if the proxy returned its address
+         *              and was added as a streamhost.
+         */
+        typedef std::function<void (S5BModule& module,
+                                     const uxmpp::Jid& proxy,
+                                     bool found)> proxy_handler_t;
+
+        /**
+         * Default Constructor.
+         */
+        S5BModule ();
+
+        /**
+         * Destructor.
+         * Stops listening for direct connections and
+         * cancels the pending IQ requests.
+         * Byte streams must be closed before this.
+         */
+        virtual ~S5BModule ();
+
+        /**
+         * Called when the module is registered to a session.
+         */
+        virtual void module_registered (uxmpp::Session& session) override;
+
+        /**
+         * Called when the module is unregistered from a session.
+         */
+        virtual void module_unregistered (uxmpp::Session& session) override;
+
+        /**
+         * Called whan an XML object is received.
+         * @return Return true if this XML object was processed and no further work should be done.
+         */
+        virtual bool process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj) override;
+
+        /**
+         * Return the service discovery features of the module.
+         */
+        virtual std::vector<std::string> get_disco_features () override;
+
+        /**
+         * Called when the state of the session changes.
+         * Byte streams that are not yet connected are
+         * closed when the session is closed.
+         */
+        virtual void on_state_change (uxmpp::Session& session,
+                                      uxmpp::SessionState new_state,
+                                      uxmpp::SessionState old_state) override;
+
+        /**
+         * Accept direct connections from the targets of our byte streams.
+         * The address is offered as a streamhost before the proxies.
+         * @param host The IP address to listen on and offer to the targets.
+         * @param port The port to listen on, 0 for any free port.
+         * @return false if unable to listen on the address.
+         */
+        bool listen (const std::string& host, uint16_t port=0);
+
+        /**
+         * Stop accepting direct connections.
+         */
+        void stop_listening ();
+
+        /**
+         * Return the port we listen on for direct connections, 0 if not listening.
+         */
+        uint16_t get_listen_port () const {
+            return listen_port;
+        }
+
+        /**
+         * Add a proxy that is offered as a streamhost in our byte streams.
+         */
+        void add_proxy (const uxmpp::Jid& jid, const std::string& host, uint16_t port);
+
+        /**
+         * Ask a proxy for its network address and add it as a streamhost.
+         */
+        void query_proxy (const uxmpp::Jid& jid, proxy_handler_t handler=nullptr);
+
+        /**
+         * Return the proxies that are offered as streamhosts.
+         */
+        std::vector<StreamHost> get_proxies ();
+
+        /**
+         * Send all data read from a connection, usually a FileConnection,
+         * in a byte stream. The byte stream is closed at the end of the data.
+         * @param to The receiver of the byte stream.
+         * @param source The data is read from the file descriptor of this
+         *               connection, from the current position. It must not
+         *               be deleted until the byte stream is closed.
+         * @return A byte stream ID, or an empty string if the byte stream
+         *         can't be requested, for example if there is no streamhost.
+         */
+        std::string send (const uxmpp::Jid& to, io::Connection& source);
+
+        /**
+         * Accept a byte stream request.
+         * The streamhosts are tried in the order they were offered.
+         * @param sid The ID of the byte stream.
+         * @param sink The received data is written to the file descriptor of
+         *             this connection, at the current position. It must not
+         *             be deleted until the byte stream is closed.
+         */
+        void accept (const std::string& sid, io::Connection& sink);
+
+        /**
+         * Deny a byte stream request.
+         */
+        void deny (const std::string& sid);
+
+        /**
+         * Close a byte stream at once.
+         */
+        void close (const std::string& sid);
+
+        /**
+         * Set the handler called when an entity wants to send a byte stream.
+         * Without a handler all byte streams are denied.
+         */
+        void set_request_handler (request_handler_t handler);
+
+        /**
+         * Set the handler called when a byte stream is closed.
+         */
+        void set_close_handler (close_handler_t handler);
+
+        /**
+         * Set the time to wait for a connection to a streamhost, 5 seconds by default.
+         */
+        void set_connect_timeout (unsigned msec);
+
+        /**
+         * Set the time to wait for the target to accept
+         * a byte stream, 60 seconds by default.
+         */
+        void set_request_timeout (unsigned msec);
+
+        /**
+         * Use sendfile() and splice() for the data, if they are available.
+         * This is enabled by default, when disabled the data is copied
+         * through a buffer. See io::SocketConnection::set_zero_copy.
+         */
+        void set_zero_copy (bool enable);
+
+
+    private:
+
+        /**
+         * A byte stream, or an incoming direct connection
+         * that is not yet matched to a byte stream.
+         */
+        struct Stream {
+            Stream ();
+            std::string sid;
+            uxmpp::Jid peer;
+            bool initiator;
+            std::string dst_addr;          // SOCKS5 destination address
+            std::vector<StreamHost> hosts; // Offered streamhosts
+            size_t host_index;             // The streamhost being connected to
+            std::string request_id;        // Id of the request, until accepted
+            io::Connection* file;          // Source or sink
+            std::unique_ptr<io::SocketConnection> socket;
+            io::Timer timer;               // Connect timeout
+            unsigned attempt;              // Incremented for each connection attempt
+            bool connected;                // The SOCKS5 handshake is done
+            bool transferring;
+            bool done;
+            uint64_t bytes;
+            std::array<unsigned char, 262> buf; // SOCKS5 messages
+        };
+        typedef std::shared_ptr<Stream> stream_t;
+        typedef std::function<void (stream_t stream, bool ok)> socks_cb_t;
+
+        uxmpp::Session* sess;
+        std::mutex mutex;
+        std::map<std::string, stream_t> streams;
+        std::set<stream_t> incoming;
+        std::vector<StreamHost> proxies;
+        unsigned connect_timeout;
+        unsigned request_timeout;
+        bool zero_copy;
+
+        std::string listen_host;
+        uint16_t listen_port;
+        int listen_pipe[2];
+        std::thread listen_thread;
+
+        request_handler_t request_handler;
+        close_handler_t   close_handler;
+
+        uxmpp::IqTracker iq_tracker; // Pending IQ requests sent by the module
+
+        void handle_request (uxmpp::IqStanza& iq, uxmpp::XmlObject& query);
+        void handle_request_result (stream_t stream, uxmpp::IqStanza* iq);
+        void connect_host (stream_t stream);
+        void handle_connected (stream_t stream, unsigned attempt, int errnum);
+        void handle_connect_timeout (stream_t stream, unsigned attempt);
+        void socks_connect (stream_t stream, unsigned attempt);
+        void socks_connected (stream_t stream, unsigned attempt, bool ok);
+        void activate (stream_t stream);
+        void run_listener (int listen_fd);
+        void socks_accept (stream_t pending);
+        void socks_accepted (stream_t pending, bool ok);
+        void socks_io (stream_t stream, bool write, size_t pos, size_t size, socks_cb_t cb);
+        void start_transfer (stream_t stream);
+        void transfer (stream_t stream);
+        void handle_transfer (stream_t stream, ssize_t result);
+        void end_stream (stream_t stream, const std::string& error);
+        void send_error (const uxmpp::Jid& to, const std::string& id,
+                         const std::string& type, const std::string& condition);
+    };
+
+
+
+}}
+
+#endif
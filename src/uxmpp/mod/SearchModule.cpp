@@ -18,6 +18,7 @@
  */
 #include <uxmpp/mod/SearchModule.hpp>
 #include <uxmpp/Logger.hpp>
+#include <uxmpp/Stanza.hpp>
 #include <uxmpp/xml/names.hpp>
 
 
@@ -43,10 +44,19 @@ SearchModule::SearchModule ()
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+SearchModule::~SearchModule ()
+{
+    iq_tracker.cancel_all ();
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void SearchModule::module_registered (uxmpp::Session& session)
 {
+    lock_guard<std::mutex> lock (mutex);
     query_id = "";
     sess = &session;
 }
@@ -56,6 +66,8 @@ void SearchModule::module_registered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 void SearchModule::module_unregistered (uxmpp::Session& session)
 {
+    iq_tracker.cancel_all ();
+    lock_guard<std::mutex> lock (mutex);
     sess = nullptr;
     query_id = "";
 }
@@ -65,36 +77,27 @@ void SearchModule::module_unregistered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 bool SearchModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj)
 {
-    // We're only interested in IQ stanzas
+    // Responses to our requests are handled by Session::send_iq callbacks
     //
-    if (xml_obj.get_full_name() != xml::full_tag_iq_stanza)
-        return false;
-
-    IqStanza& iq = reinterpret_cast<IqStanza&> (xml_obj);
-
-    // Check for info query result
-    //
-    if (!query_id.empty() && iq.get_id()==query_id) {
-        handle_fields_query_result (iq);
-        return true;
-    }
-
     return false;
 }
 
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-void SearchModule::handle_fields_query_result (IqStanza& iq)
+void SearchModule::handle_fields_query_result (IqStanza* iq)
 {
     list<string> fields;
     string instructions {""};
 
-    if (iq.have_error()) {
-        StanzaError error = iq.get_error ();
+    if (!iq) {
+        uxmpp_log_info (log_module, "No response to search fields query");
+    }
+    else if (iq->have_error()) {
+        StanzaError error = iq->get_error ();
         uxmpp_log_info (log_module, "Error getting search fields info: ", error.get_condition());
     }else{
-        auto query = iq.find_node (full_tag_name_query, true);
+        auto query = iq->find_node (full_tag_name_query, true);
         for (auto& field : query.get_nodes()) {
             if (field.get_tag_name() == "instructions")
                 instructions = field.get_content ();
@@ -102,10 +105,17 @@ void SearchModule::handle_fields_query_result (IqStanza& iq)
                 fields.push_back (field.get_tag_name());
         }
     }
-    query_id = "";
+    Session* session;
+    fields_info_cb_t cb;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        query_id = "";
+        session = sess;
+        cb = fields_info_cb;
+    }
 
-    if (fields_info_cb)
-        fields_info_cb (*sess, instructions, fields);
+    if (cb && session)
+        cb (*session, instructions, fields);
 }
 
 
@@ -118,15 +128,30 @@ bool SearchModule::request_fields ()
         return false;
     }
 
-    if (!query_id.empty()) {
-        uxmpp_log_warning (log_module, "Search fields query already sent");
-        return false;
+    // Set the id before sending, the response
+    // may be handled before send_iq returns.
+    //
+    string id = Stanza::make_id ();
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (!query_id.empty()) {
+            uxmpp_log_warning (log_module, "Search fields query already sent");
+            return false;
+        }
+        query_id = id;
     }
 
-    query_id = Stanza::make_id ();
-    sess->send_stanza (IqStanza(IqType::get, sess->get_jid().get_domain(), sess->get_jid(), query_id).
-                       add_node(XmlObject("query", namespace_iq_search)));
-
+    id = iq_tracker.send_iq (*sess,
+                             IqStanza(IqType::get, sess->get_jid().get_domain(), sess->get_jid(), id).
+                             add_node(XmlObject("query", namespace_iq_search)),
+                             [this](Session& session, IqStanza* iq){
+                                 handle_fields_query_result (iq);
+                             });
+    if (id.empty()) {
+        lock_guard<std::mutex> lock (mutex);
+        query_id = "";
+        return false;
+    }
     return true;
 }
 
@@ -135,6 +160,7 @@ bool SearchModule::request_fields ()
 //------------------------------------------------------------------------------
 void SearchModule::set_fields_info_callback (fields_info_cb_t callback)
 {
+    lock_guard<std::mutex> lock (mutex);
     fields_info_cb = callback;
 }
 
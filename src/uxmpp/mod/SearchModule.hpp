@@ -21,6 +21,7 @@
 
 #include <uxmpp/types.hpp>
 #include <uxmpp/XmppModule.hpp>
+#include <uxmpp/IqTracker.hpp>
 #include <uxmpp/Session.hpp>
 #include <uxmpp/StanzaError.hpp>
 #include <uxmpp/IqStanza.hpp>
@@ -28,6 +29,7 @@
 #include <functional>
 #include <string>
 #include <list>
+#include <mutex>
 
 
 namespace uxmpp { namespace mod {
@@ -53,8 +55,9 @@ namespace uxmpp { namespace mod {
 
         /**
          * Destructor.
+         * Cancels the pending IQ requests.
          */
-        virtual ~SearchModule () = default;
+        virtual ~SearchModule ();
 
         /**
          * Called when the module is registered to a session.
@@ -84,11 +87,13 @@ namespace uxmpp { namespace mod {
 
 
     private:
-        void handle_fields_query_result (IqStanza& iq);
+        void handle_fields_query_result (IqStanza* iq);
 
         uxmpp::Session* sess;
+        std::mutex mutex;
         std::string query_id;
         fields_info_cb_t fields_info_cb;
+        uxmpp::IqTracker iq_tracker; // Pending IQ requests sent by the module
     };
 
 
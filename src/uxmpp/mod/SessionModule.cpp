@@ -46,6 +46,13 @@ static void send_iq_set_session (uxmpp::Session& s, string& iq_id)
     auto& features = s.get_features ();
     for (auto& node : features) {
         if (node.get_full_name() == XmlSessionTagFull) {
+            // RFC 6121 made session establishment obsolete, skip
+            // the round trip if the server says it is optional.
+            //
+            if (node.find_node(XmlSessionNs + ":optional", true)) {
+                uxmpp_log_debug (THIS_FILE, "Session establishment is optional, skipping it");
+                break;
+            }
             iq_id = Stanza::make_id ();
             s.send_stanza (IqStanza(IqType::set, s.get_stream_from_attr(), "", iq_id).
                            add_node(XmlObject("session", XmlSessionNs)));
@@ -115,7 +122,8 @@ void SessionModule::on_state_change (uxmpp::Session& session,
                                      uxmpp::SessionState new_state,
                                      uxmpp::SessionState old_state)
 {
-    if (new_state == SessionState::bound && iq_id=="")
+    // A resumed stream already has a session
+    if (new_state == SessionState::bound && iq_id=="" && !session.is_resumed())
         send_iq_set_session (session, iq_id);
 }
 
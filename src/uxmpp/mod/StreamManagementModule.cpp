@@ -0,0 +1,491 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp/Logger.hpp>
+#include <uxmpp/mod/StreamManagementModule.hpp>
+#include <uxmpp/Session.hpp>
+#include <uxmpp/xml/names.hpp>
+#include <cstdlib>
+
+
+#define THIS_FILE "StreamManagementModule"
+
+
+UXMPP_START_NAMESPACE2(uxmpp, mod)
+
+
+using namespace std;
+using namespace uxmpp;
+
+
+static const string XmlSmNs          {"urn:xmpp:sm:3"};
+static const string XmlSmTagFull     {"urn:xmpp:sm:3:sm"};
+static const string XmlEnabledTag    {"enabled"};
+static const string XmlResumedTag    {"resumed"};
+static const string XmlFailedTag     {"failed"};
+static const string XmlRequestTag    {"r"};
+static const string XmlAckTag        {"a"};
+static const string XmlBindTagFull   {"urn:ietf:params:xml:ns:xmpp-bind:bind"};
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static bool have_feature (Session& session, const string& full_name)
+{
+    for (auto& feature : session.get_features()) {
+        if (feature.get_full_name() == full_name)
+            return true;
+    }
+    return false;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static uint32_t get_h_attr (XmlObject& xml_obj)
+{
+    return static_cast<uint32_t> (strtoul(xml_obj.get_attribute("h").c_str(), nullptr, 10));
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+StreamManagementModule::StreamManagementModule ()
+    : uxmpp::XmppModule ("mod_sm"),
+      request_resume  {true},
+      ack_interval    {5},
+      ack_delay       {1000},
+      sess            {nullptr},
+      enabled         {false},
+      enable_sent     {false},
+      rx_enabled      {false},
+      resuming        {false},
+      resume_max      {0},
+      rx_count        {0},
+      rx_acked        {0},
+      tx_acked        {0},
+      ack_pending     {false},
+      request_pending {false}
+{
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void StreamManagementModule::module_registered (uxmpp::Session& session)
+{
+    sess = &session;
+    sess->add_session_listener (*this);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void StreamManagementModule::module_unregistered (uxmpp::Session& session)
+{
+    sess->del_session_listener (*this);
+    sess = nullptr;
+    clear_resume_state ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool StreamManagementModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj)
+{
+    //
+    // Try to resume the previous stream instead of binding a new resource
+    //
+    if (xml_obj.get_full_name() == xml::full_tag_features) {
+        lock_guard<mutex> lock (sm_mutex);
+        if (resume_id.empty() || resuming ||
+            session.get_state() != SessionState::negotiating ||
+            !have_feature(session, XmlSmTagFull) ||
+            !have_feature(session, XmlBindTagFull))
+        {
+            return false;
+        }
+        if (resume_max &&
+            chrono::steady_clock::now() - closed_at > chrono::seconds(resume_max))
+        {
+            uxmpp_log_debug (THIS_FILE, "Previous stream has timed out, don't resume");
+            clear_state ();
+            return false;
+        }
+        uxmpp_log_debug (THIS_FILE, "Resume stream ", resume_id, ", h: ", rx_count);
+        resuming = true;
+        session.get_xml_stream().write (XmlObject("resume", XmlSmNs).
+                                        set_attribute("previd", resume_id).
+                                        set_attribute("h", std::to_string(rx_count)));
+        return true;
+    }
+
+    //
+    // Check timer events
+    //
+    if (xml_obj.get_full_name() == xml::full_tag_uxmpp_timeout) {
+        if (xml_obj.get_attribute("id") == "sm-ack") {
+            lock_guard<mutex> lock (sm_mutex);
+            ack_pending = false;
+            if (rx_enabled && rx_count != rx_acked)
+                send_ack ();
+            return true;
+        }
+        else if (xml_obj.get_attribute("id") == "sm-request") {
+            lock_guard<mutex> lock (sm_mutex);
+            request_pending = false;
+            if (enabled && !tx_queue.empty())
+                send_request ();
+            return true;
+        }
+        return false;
+    }
+
+    if (xml_obj.get_namespace() != XmlSmNs)
+        return false;
+
+    string tag_name = xml_obj.get_tag_name ();
+    unique_lock<mutex> lock (sm_mutex);
+
+    //
+    // Handle 'r'
+    //
+    if (tag_name == XmlRequestTag) {
+        if (rx_enabled)
+            send_ack ();
+    }
+    //
+    // Handle 'a'
+    //
+    else if (tag_name == XmlAckTag) {
+        request_pending = false;
+        handle_ack (get_h_attr(xml_obj));
+    }
+    //
+    // Handle 'enabled'
+    //
+    else if (tag_name == XmlEnabledTag) {
+        if (!enable_sent)
+            return true;
+        string resume_attr = xml_obj.get_attribute ("resume");
+        enable_sent = false;
+        enabled     = true;
+        rx_enabled  = true;
+        if (resume_attr=="true" || resume_attr=="1") {
+            resume_id       = xml_obj.get_attribute ("id");
+            resume_location = xml_obj.get_attribute ("location");
+            resume_max      = static_cast<unsigned> (strtoul(xml_obj.get_attribute("max").c_str(), nullptr, 10));
+            resume_jid      = to_string (session.get_jid());
+        }
+        uxmpp_log_debug (THIS_FILE, "Stream management enabled",
+                         (resume_id.empty() ? "" : ", stream can be resumed"));
+
+        // Request an ack for the stanzas sent after <enable/>
+        //
+        if (!tx_queue.empty() && !request_pending) {
+            request_pending = true;
+            session.get_xml_stream().set_timeout ("sm-request", ack_delay);
+        }
+    }
+    //
+    // Handle 'resumed'
+    //
+    else if (tag_name == XmlResumedTag) {
+        if (!resuming)
+            return true;
+        resuming   = false;
+        enabled    = true;
+        rx_enabled = true;
+        handle_ack (get_h_attr(xml_obj));
+
+        // Send the unacknowledged stanzas in one write,
+        // or one message each if the stream is framed.
+        //
+        if (!tx_queue.empty()) {
+            XmlStream& xs = session.get_xml_stream ();
+            uxmpp_log_debug (THIS_FILE, "Stream resumed, resend ", tx_queue.size(), " stanza(s)");
+            if (xs.is_framed()) {
+                for (auto& stanza : tx_queue)
+                    xs.write_raw (stanza);
+            }else{
+                string data;
+                for (auto& stanza : tx_queue)
+                    data += stanza;
+                xs.write_raw (data);
+            }
+            send_request ();
+        }else{
+            uxmpp_log_debug (THIS_FILE, "Stream resumed");
+        }
+        string jid = resume_jid;
+        lock.unlock ();
+        session.resume (jid);
+    }
+    //
+    // Handle 'failed'
+    //
+    else if (tag_name == XmlFailedTag) {
+        bool was_resuming = resuming;
+        uxmpp_log_info (THIS_FILE, (was_resuming ? "Unable to resume stream: " : "Unable to enable stream management: "),
+                        (xml_obj.get_nodes().empty() ? "unknown" : xml_obj.get_nodes()[0].get_tag_name()));
+        if (was_resuming && !tx_queue.empty())
+            uxmpp_log_info (THIS_FILE, "Sent stanzas that may be lost: ", tx_queue.size());
+        clear_state ();
+        if (was_resuming) {
+            //
+            // Let the session bind a new resource, it does that
+            // when an XML object isn't handled by any module.
+            //
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void StreamManagementModule::on_state_change (uxmpp::Session& session,
+                                              uxmpp::SessionState new_state,
+                                              uxmpp::SessionState old_state)
+{
+    if (new_state == SessionState::bound && old_state != SessionState::bound) {
+        if (!session.is_resumed() && have_feature(session, XmlSmTagFull))
+            enable (session);
+    }
+    else if (new_state == SessionState::closed && old_state != SessionState::closed) {
+        lock_guard<mutex> lock (sm_mutex);
+        session.get_xml_stream().cancel_timeout ("sm-ack");
+        session.get_xml_stream().cancel_timeout ("sm-request");
+        enabled         = false;
+        enable_sent     = false;
+        rx_enabled      = false;
+        resuming        = false;
+        ack_pending     = false;
+        request_pending = false;
+        closed_at       = chrono::steady_clock::now ();
+
+        // A clean close or a stream error from the server ends the
+        // stream on the server side. Keep the state for resumption
+        // only if the connection was lost, or closed due to an
+        // application error like 'rx-error' or 'timeout'.
+        //
+        bool connection_lost = old_state != SessionState::closing ||
+                               !session.get_error().get_app_error().empty();
+        if (!resume_id.empty() && !connection_lost) {
+            uxmpp_log_debug (THIS_FILE, "Session closed, drop stream management state");
+            clear_state ();
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void StreamManagementModule::on_stanza_sent (uxmpp::Session& session,
+                                             const uxmpp::XmlObject& stanza,
+                                             const std::string& data)
+{
+    lock_guard<mutex> lock (sm_mutex);
+    if (!enabled && !enable_sent)
+        return;
+
+    // The server counts the stanzas sent after <enable/>,
+    // keep them but wait for <enabled/> before requesting acks.
+    //
+    tx_queue.push_back (data);
+    if (!enabled)
+        return;
+
+    // Request an ack when enough stanzas are unacknowledged,
+    // or when the timer expires.
+    //
+    size_t interval = ack_interval ? ack_interval : 1;
+    if (tx_queue.size() >= interval) {
+        if (!request_pending || tx_queue.size() % interval == 0)
+            send_request ();
+    }
+    else if (!request_pending) {
+        request_pending = true;
+        session.get_xml_stream().set_timeout ("sm-request", ack_delay);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void StreamManagementModule::on_stanza_received (uxmpp::Session& session, uxmpp::XmlObject& stanza)
+{
+    lock_guard<mutex> lock (sm_mutex);
+    if (!rx_enabled)
+        return;
+
+    ++rx_count;
+
+    // Batch acks, send one every 'ack_interval' stanza
+    // or when the timer expires.
+    //
+    if (rx_count - rx_acked >= ack_interval) {
+        send_ack ();
+    }
+    else if (!ack_pending) {
+        ack_pending = true;
+        session.get_xml_stream().set_timeout ("sm-ack", ack_delay);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool StreamManagementModule::is_enabled ()
+{
+    lock_guard<mutex> lock (sm_mutex);
+    return enabled;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool StreamManagementModule::allow_pipelined_bind (uxmpp::Session& session)
+{
+    return !can_resume ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool StreamManagementModule::can_resume ()
+{
+    lock_guard<mutex> lock (sm_mutex);
+    return !resume_id.empty();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void StreamManagementModule::clear_resume_state ()
+{
+    lock_guard<mutex> lock (sm_mutex);
+    clear_state ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string StreamManagementModule::get_resume_location ()
+{
+    lock_guard<mutex> lock (sm_mutex);
+    return resume_location;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+size_t StreamManagementModule::get_unacked_count ()
+{
+    lock_guard<mutex> lock (sm_mutex);
+    return tx_queue.size ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void StreamManagementModule::enable (uxmpp::Session& session)
+{
+    lock_guard<mutex> lock (sm_mutex);
+    clear_state ();
+
+    XmlObject enable_obj ("enable", XmlSmNs);
+    if (request_resume)
+        enable_obj.set_attribute ("resume", "true");
+
+    uxmpp_log_debug (THIS_FILE, "Enable stream management");
+    if (session.get_xml_stream().write(enable_obj))
+        enable_sent = true; // Stanzas sent from now on are counted by the server
+}
+
+
+//------------------------------------------------------------------------------
+// Note: Called with sm_mutex locked.
+//------------------------------------------------------------------------------
+void StreamManagementModule::send_ack ()
+{
+    if (!sess)
+        return;
+    if (ack_pending) {
+        ack_pending = false;
+        sess->get_xml_stream().cancel_timeout ("sm-ack");
+    }
+    rx_acked = rx_count;
+    sess->get_xml_stream().write (XmlObject(XmlAckTag, XmlSmNs).
+                                  set_attribute("h", std::to_string(rx_count)));
+}
+
+
+//------------------------------------------------------------------------------
+// Note: Called with sm_mutex locked.
+//------------------------------------------------------------------------------
+void StreamManagementModule::send_request ()
+{
+    if (!sess)
+        return;
+    sess->get_xml_stream().cancel_timeout ("sm-request");
+    request_pending = true;
+    sess->get_xml_stream().write (XmlObject(XmlRequestTag, XmlSmNs));
+}
+
+
+//------------------------------------------------------------------------------
+// Note: Called with sm_mutex locked.
+//------------------------------------------------------------------------------
+void StreamManagementModule::handle_ack (uint32_t h)
+{
+    uint32_t acked = h - tx_acked; // Sequence numbers wrap at 2^32
+    if (acked > tx_queue.size()) {
+        uxmpp_log_warning (THIS_FILE, "Server acknowledged ", acked, " stanza(s), only ",
+                           tx_queue.size(), " unacknowledged");
+        acked = tx_queue.size ();
+    }
+    tx_queue.erase (tx_queue.begin(), tx_queue.begin()+acked);
+    tx_acked = h;
+    uxmpp_log_trace (THIS_FILE, "Acknowledged: ", h, ", unacknowledged: ", tx_queue.size());
+}
+
+
+//------------------------------------------------------------------------------
+// Note: Called with sm_mutex locked.
+//------------------------------------------------------------------------------
+void StreamManagementModule::clear_state ()
+{
+    enabled         = false;
+    enable_sent     = false;
+    rx_enabled      = false;
+    resuming        = false;
+    resume_id       = "";
+    resume_location = "";
+    resume_jid      = "";
+    resume_max      = 0;
+    rx_count        = 0;
+    rx_acked        = 0;
+    tx_acked        = 0;
+    tx_queue.clear ();
+}
+
+
+UXMPP_END_NAMESPACE2
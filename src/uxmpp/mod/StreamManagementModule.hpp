@@ -0,0 +1,189 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_MOD_STREAMMANAGEMENTMODULE_HPP
+#define UXMPP_MOD_STREAMMANAGEMENTMODULE_HPP
+
+#include <uxmpp/types.hpp>
+#include <uxmpp/XmppModule.hpp>
+#include <uxmpp/XmlObject.hpp>
+#include <uxmpp/SessionListener.hpp>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+
+namespace uxmpp { namespace mod {
+
+
+    /**
+     * An XMPP stream management module (XEP-0198).
+     *
+     * When the session is bound, and the server supports it, stream
+     * management is enabled with resumption. Sent stanzas are kept,
+     * serialized, until the server has acknowledged them.
+     * Acknowledgements are batched in both directions: an <a/> is sent
+     * when 'ack_interval' stanzas have been received, or 'ack_delay'
+     * milliseconds after the first unacknowledged stanza was received.
+     * An <r/> is sent in the same way for sent stanzas.
+     *
+     * If the session is closed due to a network or timeout error, the
+     * stream state is kept. When the application runs the session again,
+     * the module sends <resume/> instead of binding a new resource, and
+     * only the stanzas not acknowledged by the server are sent again.
+     * Modules and applications can check Session::is_resumed() to avoid
+     * redoing work like fetching the roster. If the server can't resume
+     * the stream, a new resource is bound as usual.
+     *
+     * The module must be registered after the TlsModule and AuthModule.
+     */
+    class StreamManagementModule : public uxmpp::XmppModule, uxmpp::SessionListener {
+    public:
+
+        /**
+         * Default Constructor.
+         */
+        StreamManagementModule ();
+
+        /**
+         * Destructor.
+         */
+        virtual ~StreamManagementModule () = default;
+
+        /**
+         * Called when the module is registered to a session.
+         */
+        virtual void module_registered (uxmpp::Session& session) override;
+
+        /**
+         * Called when the module is unregistered from a session.
+         */
+        virtual void module_unregistered (uxmpp::Session& session) override;
+
+        /**
+         * Called whan an XML object is received.
+         * @return Return true if this XML object was processed and no further work should be done.
+         */
+        virtual bool process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj) override;
+
+        /**
+         * A previous stream is resumed instead of binding a new
+         * resource, so don't allow a pipelined bind if it can be resumed.
+         */
+        virtual bool allow_pipelined_bind (uxmpp::Session& session) override;
+
+        /**
+         * Called when the state if the session changes.
+         */
+        virtual void on_state_change (uxmpp::Session& session,
+                                      uxmpp::SessionState new_state,
+                                      uxmpp::SessionState old_state) override;
+
+        /**
+         * Called when a stanza has been sent.
+         */
+        virtual void on_stanza_sent (uxmpp::Session& session,
+                                     const uxmpp::XmlObject& stanza,
+                                     const std::string& data) override;
+
+        /**
+         * Called when a stanza is received.
+         */
+        virtual void on_stanza_received (uxmpp::Session& session, uxmpp::XmlObject& stanza) override;
+
+        /**
+         * Return true if stream management is enabled in the current stream.
+         */
+        bool is_enabled ();
+
+        /**
+         * Return true if a previous stream can be resumed.
+         */
+        bool can_resume ();
+
+        /**
+         * Forget the previous stream so the next session binds a new resource.
+         */
+        void clear_resume_state ();
+
+        /**
+         * Return the preferred address for reconnecting, as given by
+         * the server. Empty if the server didn't specify one.
+         */
+        std::string get_resume_location ();
+
+        /**
+         * Return the number of sent stanzas not yet acknowledged by the server.
+         */
+        size_t get_unacked_count ();
+
+        /**
+         * If true (default), request that the stream can be resumed.
+         */
+        bool request_resume;
+
+        /**
+         * Number of unacknowledged stanzas that triggers an <a/> or <r/>.
+         * Default 5.
+         */
+        unsigned ack_interval;
+
+        /**
+         * Maximum time in milliseconds an <a/> or <r/> is delayed. Default 1000.
+         */
+        unsigned ack_delay;
+
+
+    private:
+        uxmpp::Session* sess;
+        std::mutex sm_mutex;
+
+        bool enabled;          // Set when <enabled/> or <resumed/> is received
+        bool enable_sent;      // <enable/> sent, waiting for <enabled/> or <failed/>
+        bool rx_enabled;       // Count received stanzas, set when <enabled/> or <resumed/> is received
+        bool resuming;         // <resume/> sent, waiting for the result
+
+        std::string resume_id;       // Stream id for resumption, empty if not resumable
+        std::string resume_location; // Preferred reconnect address
+        std::string resume_jid;      // The JID bound in the stream to resume
+        unsigned    resume_max;      // Max seconds the server keeps the stream, 0 if unknown
+        std::chrono::steady_clock::time_point closed_at;
+
+        uint32_t rx_count;  // Number of received stanzas, 'h' sent to the server
+        uint32_t rx_acked;  // The last 'h' sent to the server
+        uint32_t tx_acked;  // The last 'h' received from the server
+        bool ack_pending;     // "sm-ack" timer is running
+        bool request_pending; // "sm-request" timer is running or <r/> is sent
+
+        // Sent stanzas not yet acknowledged, the first has sequence number tx_acked+1
+        std::deque<std::string> tx_queue;
+
+        void enable (uxmpp::Session& session);
+        void send_ack ();
+        void send_request ();
+        void handle_ack (uint32_t h);
+        void clear_state ();
+    };
+
+
+}}
+
+
+#endif
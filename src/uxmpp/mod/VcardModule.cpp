@@ -45,12 +45,20 @@ VcardModule::VcardModule ()
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+VcardModule::~VcardModule ()
+{
+    iq_tracker.cancel_all ();
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void VcardModule::module_registered (uxmpp::Session& session)
 {
+    lock_guard<std::mutex> lock (mutex);
     set_id = "";
-    query_ids.clear ();
     sess = &session;
 }
 
@@ -59,9 +67,10 @@ void VcardModule::module_registered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 void VcardModule::module_unregistered (uxmpp::Session& session)
 {
+    iq_tracker.cancel_all ();
+    lock_guard<std::mutex> lock (mutex);
     sess = nullptr;
     set_id = "";
-    query_ids.clear ();
 }
 
 
@@ -69,42 +78,40 @@ void VcardModule::module_unregistered (uxmpp::Session& session)
 //------------------------------------------------------------------------------
 bool VcardModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj)
 {
-    // We're only interested in IQ stanzas
+    // Responses to our requests are handled by Session::send_iq callbacks
     //
-    if (xml_obj.get_full_name() != xml::full_tag_iq_stanza)
-        return false;
+    return false;
+}
 
-    IqStanza& iq = reinterpret_cast<IqStanza&> (xml_obj);
 
-    // Check for request vcard result
-    //
-    if (query_ids.find(iq.get_id()) != query_ids.end()) {
-
-        Jid vcard_owner   = iq.have_attribute("from") ? iq.get_from().bare() : sess->get_jid().bare();
-        XmlObject vcard   = iq.find_node (full_tag_name_vcard, true);
-        StanzaError error = iq.get_error ();
-        if (iq.have_error())
-            uxmpp_log_info (log_module, "Error getting search fields info: ", error.get_condition());
-
-        query_ids.erase (iq.get_id());
-        if (vcard_cb)
-            vcard_cb (*sess, vcard_owner, vcard, error);
-        
-        return true;
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void VcardModule::handle_vcard_result (const uxmpp::Jid& jid, uxmpp::IqStanza* iq)
+{
+    Session* session;
+    vcard_cb_t cb;
+    {
+        lock_guard<std::mutex> lock (mutex);
+        session = sess;
+        cb = vcard_cb;
     }
-
-    // Check for set vcard result
-    //
-    if (!set_id.empty() && set_id == iq.get_id()) {
-        set_id = "";
-        if (iq.have_error()) {
-            StanzaError error = iq.get_error ();
-            uxmpp_log_info (log_module, "Error setting vCard: ", error.get_condition());
-        }
-        return true;
+    if (!session)
+        return;
+
+    Jid vcard_owner (jid);
+    XmlObject vcard;
+    StanzaError error (StanzaError::type_wait, StanzaError::remote_server_timeout);
+    if (iq) {
+        if (iq->have_attribute("from"))
+            vcard_owner = iq->get_from().bare ();
+        vcard = iq->find_node (full_tag_name_vcard, true);
+        error = iq->get_error ();
     }
+    if (!iq || iq->have_error())
+        uxmpp_log_info (log_module, "Error getting vCard: ", error.get_condition());
 
-    return false;
+    if (cb)
+        cb (*session, vcard_owner, vcard, error);
 }
 
 
@@ -117,11 +124,13 @@ bool VcardModule::request_vcard ()
         return false;
     }
 
-    string stanza_id = Stanza::make_id ();
-    query_ids.insert (stanza_id);
-
-    sess->send_stanza (IqStanza(IqType::get, "", to_string(sess->get_jid()), stanza_id).
-                       add_node(XmlObject("vCard", namespace_vcard)));
+    Jid jid = sess->get_jid().bare ();
+    iq_tracker.send_iq (*sess,
+                        IqStanza(IqType::get, "", to_string(sess->get_jid())).
+                        add_node(XmlObject("vCard", namespace_vcard)),
+                        [this, jid](Session& session, IqStanza* iq){
+                            handle_vcard_result (jid, iq);
+                        });
     return true;
 }
 
@@ -135,11 +144,13 @@ bool VcardModule::request_vcard (const uxmpp::Jid& jid)
         return false;
     }
 
-    string stanza_id = Stanza::make_id ();
-    query_ids.insert (stanza_id);
-
-    sess->send_stanza (IqStanza(IqType::get, jid.bare(), sess->get_jid(), stanza_id).
-                       add_node(XmlObject("vCard", namespace_vcard)));
+    Jid bare_jid = jid.bare ();
+    iq_tracker.send_iq (*sess,
+                        IqStanza(IqType::get, bare_jid, sess->get_jid()).
+                        add_node(XmlObject("vCard", namespace_vcard)),
+                        [this, bare_jid](Session& session, IqStanza* iq){
+                            handle_vcard_result (bare_jid, iq);
+                        });
     return true;
 }
 
@@ -157,13 +168,37 @@ bool VcardModule::set_vcard (const uxmpp::XmlObject& vcard)
         return false;
     }
 
-    if (!set_id.empty()) {
-        uxmpp_log_warning (log_module, "vCard already sent");
-        return false;
+    // Set the id before sending, the response
+    // may be handled before send_iq returns.
+    //
+    string id = Stanza::make_id ();
+    {
+        lock_guard<std::mutex> lock (mutex);
+        if (!set_id.empty()) {
+            uxmpp_log_warning (log_module, "vCard already sent");
+            return false;
+        }
+        set_id = id;
     }
 
-    string set_id = Stanza::make_id ();
-    sess->send_stanza (IqStanza(IqType::set, "", to_string(sess->get_jid()), set_id).add_node(vcard));
+    id = iq_tracker.send_iq (*sess,
+                             IqStanza(IqType::set, "", to_string(sess->get_jid()), id).add_node(vcard),
+                             [this](Session& session, IqStanza* iq){
+                                 {
+                                     lock_guard<std::mutex> lock (mutex);
+                                     set_id = "";
+                                 }
+                                 if (!iq)
+                                     uxmpp_log_info (log_module, "No response when setting vCard");
+                                 else if (iq->have_error())
+                                     uxmpp_log_info (log_module, "Error setting vCard: ",
+                                                     iq->get_error().get_condition());
+                             });
+    if (id.empty()) {
+        lock_guard<std::mutex> lock (mutex);
+        set_id = "";
+        return false;
+    }
     return true;
 }
 
@@ -172,6 +207,7 @@ bool VcardModule::set_vcard (const uxmpp::XmlObject& vcard)
 //------------------------------------------------------------------------------
 void VcardModule::set_vcard_callback (vcard_cb_t callback)
 {
+    lock_guard<std::mutex> lock (mutex);
     vcard_cb = callback;
 }
 
@@ -21,13 +21,15 @@
 
 #include <uxmpp/types.hpp>
 #include <uxmpp/XmppModule.hpp>
+#include <uxmpp/IqTracker.hpp>
 #include <uxmpp/Session.hpp>
 #include <uxmpp/Jid.hpp>
 #include <uxmpp/StanzaError.hpp>
+#include <uxmpp/IqStanza.hpp>
 
 #include <functional>
 #include <string>
-#include <set>
+#include <mutex>
 
 
 namespace uxmpp { namespace mod {
@@ -54,8 +56,9 @@ namespace uxmpp { namespace mod {
 
         /**
          * Destructor.
+         * Cancels the pending IQ requests.
          */
-        virtual ~VcardModule () = default;
+        virtual ~VcardModule ();
 
         /**
          * Called when the module is registered to a session.
@@ -96,9 +99,12 @@ namespace uxmpp { namespace mod {
 
     private:
         uxmpp::Session* sess;
-        std::set<std::string> query_ids;
+        std::mutex mutex;
         std::string set_id;
         vcard_cb_t vcard_cb;
+        uxmpp::IqTracker iq_tracker; // Pending IQ requests sent by the module
+
+        void handle_vcard_result (const uxmpp::Jid& jid, uxmpp::IqStanza* iq);
     };
 
 
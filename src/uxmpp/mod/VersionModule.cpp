@@ -46,6 +46,14 @@ VersionModule::VersionModule ()
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+VersionModule::~VersionModule ()
+{
+    iq_tracker.cancel_all ();
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 void VersionModule::module_registered (uxmpp::Session& session)
@@ -60,8 +68,8 @@ void VersionModule::module_registered (uxmpp::Session& session)
 void VersionModule::module_unregistered (uxmpp::Session& session)
 {
     //sess->delSessionListener (*this);
+    iq_tracker.cancel_all ();
     sess = nullptr;
-    query_ids.clear ();
 }
 
 
@@ -100,23 +108,6 @@ bool VersionModule::process_xml_object (uxmpp::Session& session, uxmpp::XmlObjec
         return false;
     }
 
-    // Handle version response
-    //
-    auto query_id = query_ids.find (iq.get_id());
-    if (query_id != query_ids.end()) {
-        Jid version_owner = query_id->second;
-        XmlObject version = iq.find_node ("jabber:iq:version:query", true);
-        StanzaError error = iq.get_error ();
-        if (iq.have_error())
-            uxmpp_log_info (log_module, "IQ error getting version info: ", error.get_condition());
-
-        query_ids.erase (iq.get_id());
-        if (version_cb)
-            version_cb (*sess, version_owner, version, error);
-
-        return true;
-    }
-
     return false;
 }
 
@@ -178,12 +169,24 @@ bool VersionModule::request_version (const uxmpp::Jid& jid)
         return false;
     }
 
-    string stanza_id = Stanza::make_id ();
-    query_ids.insert (pair<string, string>(stanza_id, to_string(jid)));
-
-    sess->send_stanza (IqStanza(IqType::get, jid, sess->get_jid(), stanza_id).
-                       add_node(XmlObject("query", "jabber:iq:version")));
-    return true;
+    Jid version_owner (jid);
+    string id = iq_tracker.send_iq (*sess,
+                                    IqStanza(IqType::get, jid, sess->get_jid()).
+                                    add_node(XmlObject("query", "jabber:iq:version")),
+                                    [this, version_owner](Session& session, IqStanza* iq){
+                                        Jid owner (version_owner);
+                                        XmlObject version;
+                                        StanzaError error (StanzaError::type_wait, StanzaError::remote_server_timeout);
+                                        if (iq) {
+                                            version = iq->find_node ("jabber:iq:version:query", true);
+                                            error = iq->get_error ();
+                                        }
+                                        if (!iq || iq->have_error())
+                                            uxmpp_log_info (log_module, "IQ error getting version info: ", error.get_condition());
+                                        if (version_cb)
+                                            version_cb (session, owner, version, error);
+                                    });
+    return !id.empty();
 }
 
 
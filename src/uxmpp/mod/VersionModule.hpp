@@ -20,9 +20,10 @@
 #define UXMPP_MOD_VERSIONMODULE_HPP
 
 #include <string>
-#include <map>
+#include <functional>
 #include <uxmpp/types.hpp>
 #include <uxmpp/XmppModule.hpp>
+#include <uxmpp/IqTracker.hpp>
 #include <uxmpp/Jid.hpp>
 #include <uxmpp/StanzaError.hpp>
 
@@ -51,8 +52,9 @@ namespace uxmpp { namespace mod {
 
         /**
          * Destructor.
+         * Cancels the pending IQ requests.
          */
-        virtual ~VersionModule () = default;
+        virtual ~VersionModule ();
 
         /**
          * Called when the module is registered to a session.
@@ -116,9 +118,8 @@ namespace uxmpp { namespace mod {
         std::string name;
         std::string version;
         std::string os;
-        //std::set<std::string> query_ids;
-        std::map<std::string, std::string> query_ids;
         version_cb_t version_cb;
+        uxmpp::IqTracker iq_tracker; // Pending IQ requests sent by the module
     };
 
 
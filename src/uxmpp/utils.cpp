@@ -26,10 +26,14 @@
 #include <random>
 
 #include <thread>
+#include <cerrno>
 #include <sys/syscall.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include <openssl/sha.h>
+#include <openssl/hmac.h>
+#include <openssl/evp.h>
 
 UXMPP_START_NAMESPACE1(uxmpp)
 
@@ -55,36 +59,45 @@ static std::array<char, 80> reverse_b64 = {
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-std::string to_base64 (const unsigned char* buf, size_t len)
+size_t to_base64 (const void* data, size_t len, char* out)
 {
-    // Sanity check
-    if (buf == nullptr)
-        return "";
-
-    string result (((len+2) / 3) * 4, '=');
-    unsigned buf_pos = 0;
-    unsigned result_pos = 0;
+    auto buf = static_cast<const unsigned char*> (data);
+    char* pos = out;
     while (len >= 3) {
-        result[result_pos++] = b64_alphabet[buf[buf_pos]>>2];
-        result[result_pos++] = b64_alphabet[(buf[buf_pos]<<4 & 0x3f) | (buf[buf_pos+1]>>4)];
-        ++buf_pos;
-        result[result_pos++] = b64_alphabet[(buf[buf_pos]<<2 & 0x3f) | (buf[buf_pos+1]>>6)];
-        ++buf_pos;
-        result[result_pos++] = b64_alphabet[buf[buf_pos++] & 0x3f];
+        *pos++ = b64_alphabet[buf[0]>>2];
+        *pos++ = b64_alphabet[(buf[0]<<4 & 0x3f) | (buf[1]>>4)];
+        *pos++ = b64_alphabet[(buf[1]<<2 & 0x3f) | (buf[2]>>6)];
+        *pos++ = b64_alphabet[buf[2] & 0x3f];
+        buf += 3;
         len -= 3;
     }
     if (len == 2) {
-        result[result_pos++] = b64_alphabet[buf[buf_pos]>>2];
-        result[result_pos++] = b64_alphabet[(buf[buf_pos]<<4 & 0x3f) | (buf[buf_pos+1]>>4)];
-        ++buf_pos;
-        result[result_pos++] = b64_alphabet[buf[buf_pos]<<2 & 0x3f];
+        *pos++ = b64_alphabet[buf[0]>>2];
+        *pos++ = b64_alphabet[(buf[0]<<4 & 0x3f) | (buf[1]>>4)];
+        *pos++ = b64_alphabet[buf[1]<<2 & 0x3f];
+        *pos++ = '=';
     }
     else if (len == 1) {
-        result[result_pos++] = b64_alphabet[buf[buf_pos]>>2];
-        result[result_pos++] = b64_alphabet[buf[buf_pos]<<4 & 0x3f];
+        *pos++ = b64_alphabet[buf[0]>>2];
+        *pos++ = b64_alphabet[buf[0]<<4 & 0x3f];
+        *pos++ = '=';
+        *pos++ = '=';
     }
+    return pos - out;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::string to_base64 (const unsigned char* buf, size_t len)
+{
+    // Sanity check
+    if (buf == nullptr)
+        return "";
 
-    return std::move (result);
+    string result (base64_size(len), '=');
+    to_base64 (buf, len, &result[0]);
+    return result;
 }
 
 
@@ -98,13 +111,15 @@ std::string to_base64 (const string& text)
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
-size_t from_base64 (const string& encoded_string, char* buf, size_t buf_len)
+size_t from_base64 (const char* encoded, size_t len, void* buf, size_t buf_len)
 {
+    auto out = static_cast<char*> (buf);
     size_t result_len = 0;
     char data = 0;
     int index = 0;
     char code;
-    for (auto c : encoded_string) {
+    for (const char* end=encoded+len; encoded<end && result_len<buf_len; ++encoded) {
+        char c = *encoded;
         code = 65;
         if (isspace(c)) {
             // Ignore whitespace
@@ -124,30 +139,37 @@ size_t from_base64 (const string& encoded_string, char* buf, size_t buf_len)
             break;
         case 1:
             data |= code >> 4;
-            buf[result_len++] = data;
+            out[result_len++] = data;
             data = (code & 0x0f) << 4;
             ++index;
             break;
         case 2:
             data |= code >> 2;
-            buf[result_len++] = data;
+            out[result_len++] = data;
             data = (code & 0x03) << 6;
             ++index;
             break;
         case 3:
             data |= code;
-            buf[result_len++] = data;
+            out[result_len++] = data;
             index = 0;
             break;
         }
     }
-    if (index != 0)
-        buf[result_len++] = data;
+    // Remaining bits in 'data' are padding, not a byte of data
 
     return result_len;
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+size_t from_base64 (const string& encoded_string, char* buf, size_t buf_len)
+{
+    return from_base64 (encoded_string.data(), encoded_string.size(), buf, buf_len);
+}
+
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 std::string from_base64 (const string& encoded_string)
@@ -300,4 +322,69 @@ std::string get_sha1_str (const std::string data)
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::array<unsigned char, 20> get_hmac_sha1 (const std::string& key, const std::string& data)
+{
+    std::array<unsigned char, 20> md;
+    unsigned int md_len = md.size ();
+    HMAC (EVP_sha1(), key.data(), key.size(),
+          reinterpret_cast<const unsigned char*>(data.data()), data.size(),
+          md.data(), &md_len);
+    return md;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+std::array<unsigned char, 20> get_pbkdf2_sha1 (const std::string& password,
+                                               const std::string& salt,
+                                               unsigned iterations)
+{
+    std::array<unsigned char, 20> key;
+    PKCS5_PBKDF2_HMAC_SHA1 (password.data(), password.size(),
+                            reinterpret_cast<const unsigned char*>(salt.data()), salt.size(),
+                            iterations, key.size(), key.data());
+    return key;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool write_file (const std::string& name, int flags, const std::string& data, bool sync)
+{
+    int fd = ::open (name.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0666);
+    if (fd < 0)
+        return false;
+    bool ok = true;
+    size_t pos = 0;
+    while (ok && pos < data.size()) {
+        auto result = ::write (fd, data.data()+pos, data.size()-pos);
+        if (result > 0)
+            pos += result;
+        else if (result<0 && errno!=EINTR)
+            ok = false;
+    }
+    if (ok && sync && ::fsync(fd))
+        ok = false;
+    if (::close(fd))
+        ok = false;
+    return ok;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void sync_dir (const std::string& file)
+{
+    auto pos = file.rfind ('/');
+    string dir = pos==string::npos ? "." : (pos==0 ? "/" : file.substr(0, pos));
+    int fd = ::open (dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync (fd);
+        ::close (fd);
+    }
+}
+
+
 UXMPP_END_NAMESPACE1
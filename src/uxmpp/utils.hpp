@@ -37,11 +37,40 @@ namespace uxmpp {
      */
     std::string to_base64 (const std::string& text);
 
+    /**
+     * Base64 encode data into a buffer, without allocating a string.
+     * @param buf The data to encode.
+     * @param len The number of bytes to encode.
+     * @param out A buffer of at least base64_size(len) characters.
+     * @return The number of characters written, base64_size(len).
+     */
+    size_t to_base64 (const void* buf, size_t len, char* out);
+
+    /**
+     * Return the size of base64 encoded data, including padding.
+     * @param len The number of bytes to encode.
+     */
+    inline size_t base64_size (size_t len) {
+        return ((len + 2) / 3) * 4;
+    }
+
     /**
      *
      */
     size_t from_base64 (const std::string& encoded_string, char* buf, size_t buf_len);
 
+    /**
+     * Decode base64 data into a buffer.
+     * Whitespace is ignored and decoding stops at the first
+     * invalid character, like padding, or when the buffer is full.
+     * @param encoded The base64 encoded data.
+     * @param len The number of characters.
+     * @param buf The buffer where to store the decoded data.
+     * @param buf_len The size of the buffer.
+     * @return The number of bytes stored in the buffer.
+     */
+    size_t from_base64 (const char* encoded, size_t len, void* buf, size_t buf_len);
+
     /**
      *
      */
@@ -93,6 +122,40 @@ namespace uxmpp {
      *
      */
     std::string get_sha1_str (const std::string data);
+
+    /**
+     * Return the HMAC-SHA-1 of some data.
+     * @param key The key, may contain binary data.
+     * @param data The data to authenticate.
+     */
+    std::array<unsigned char, 20> get_hmac_sha1 (const std::string& key, const std::string& data);
+
+    /**
+     * Derive a key from a password using PBKDF2 with HMAC-SHA-1
+     * (RFC 2898). This is the 'Hi' function of SASL SCRAM-SHA-1.
+     * @param password The password.
+     * @param salt The salt, may contain binary data.
+     * @param iterations The iteration count.
+     */
+    std::array<unsigned char, 20> get_pbkdf2_sha1 (const std::string& password,
+                                                   const std::string& salt,
+                                                   unsigned iterations);
+
+    /**
+     * Write data to a file, created if it doesn't exist.
+     * @param name The file name.
+     * @param flags Flags added to O_WRONLY|O_CREAT, e.g. O_APPEND or O_TRUNC.
+     * @param data The data to write.
+     * @param sync If true, the file is flushed to disk before returning.
+     * @return True if all data was written.
+     */
+    bool write_file (const std::string& name, int flags, const std::string& data, bool sync);
+
+    /**
+     * Flush the directory entry of a created or renamed file to disk.
+     * @param file The file name.
+     */
+    void sync_dir (const std::string& file);
 }
 
 
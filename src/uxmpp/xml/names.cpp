@@ -36,6 +36,13 @@ const std::string alias_stream     {"stream"};
 const std::string tag_stream       {"stream"};
 const std::string full_tag_stream  {"http://etherx.jabber.org/streams:stream"};
 
+//
+// WebSocket framing
+//
+const std::string namespace_framing      {"urn:ietf:params:xml:ns:xmpp-framing"};
+const std::string full_tag_framing_open  {"urn:ietf:params:xml:ns:xmpp-framing:open"};
+const std::string full_tag_framing_close {"urn:ietf:params:xml:ns:xmpp-framing:close"};
+
 //
 // features
 //
@@ -47,6 +54,12 @@ const std::string full_tag_features {"http://etherx.jabber.org/streams:features"
 //
 const std::string namespace_jabber_client {"jabber:client"};
 
+//
+// jabber:component:accept
+//
+const std::string namespace_component_accept   {"jabber:component:accept"};
+const std::string full_tag_component_handshake {"jabber:component:accept:handshake"};
+
 //
 // bind
 //
@@ -62,6 +62,23 @@ namespace uxmpp { namespace xml {
         extern const std::string full_tag_stream;
 
 
+        /**
+         * XML namespace for XMPP over WebSocket framing (RFC 7395):
+         * <code>urn:ietf:params:xml:ns:xmpp-framing</code>.
+         */
+        extern const std::string namespace_framing;
+        /**
+         * Fully qualified XML tag name for the WebSocket stream open tag:
+         * <code>urn:ietf:params:xml:ns:xmpp-framing:open</code>.
+         */
+        extern const std::string full_tag_framing_open;
+        /**
+         * Fully qualified XML tag name for the WebSocket stream close tag:
+         * <code>urn:ietf:params:xml:ns:xmpp-framing:close</code>.
+         */
+        extern const std::string full_tag_framing_close;
+
+
         /**
          * XML tag name for the features tag: <code>features</code>.
          */
@@ -79,6 +96,17 @@ namespace uxmpp { namespace xml {
         extern const std::string namespace_jabber_client;
 
 
+        /**
+         * XML jabber component namespace (XEP-0114): <code>jabber:component:accept</code>.
+         */
+        extern const std::string namespace_component_accept;
+        /**
+         * Fully qualified XML tag name for the component handshake tag:
+         * <code>jabber:component:accept:handshake</code>.
+         */
+        extern const std::string full_tag_component_handshake;
+
+
         /**
          * XML bind namespace: <code>urn:ietf:params:xml:ns:xmpp-bind</code>.
          */
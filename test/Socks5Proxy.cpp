@@ -0,0 +1,311 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "Socks5Proxy.hpp"
+#include <uxmpp/utils.hpp>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace uxmpp;
+
+static const string namespace_bytestreams {"http://jabber.org/protocol/bytestreams"};
+
+static constexpr size_t relay_chunk_size = 1024 * 1024;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static bool read_all (int fd, unsigned char* buf, size_t size)
+{
+    while (size > 0) {
+        auto result = ::read (fd, buf, size);
+        if (result <= 0)
+            return false;
+        buf  += result;
+        size -= result;
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static bool write_all (int fd, const unsigned char* buf, size_t size)
+{
+    while (size > 0) {
+        auto result = ::send (fd, buf, size, MSG_NOSIGNAL);
+        if (result <= 0)
+            return false;
+        buf  += result;
+        size -= result;
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+Socks5Proxy::Socks5Proxy ()
+    : XmppModule ("test_socks5_proxy"),
+      sess {nullptr},
+      listen_fd {-1},
+      port {0},
+      activated {0},
+      relayed {0}
+{
+    stop_pipe[0] = stop_pipe[1] = -1;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+Socks5Proxy::~Socks5Proxy ()
+{
+    stop ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool Socks5Proxy::start ()
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof (addr);
+    memset (&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    addr.sin_port        = 0;
+
+    listen_fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1)
+        return false;
+    if (bind(listen_fd, (struct sockaddr*)&addr, len) || listen(listen_fd, 16) ||
+        getsockname(listen_fd, (struct sockaddr*)&addr, &len) || pipe(stop_pipe))
+    {
+        ::close (listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    port = ntohs (addr.sin_port);
+    accept_thread = std::thread ([this](){
+            accept_connections ();
+        });
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Socks5Proxy::stop ()
+{
+    if (!accept_thread.joinable())
+        return;
+
+    char c = 0;
+    if (::write(stop_pipe[1], &c, 1) == 1)
+        accept_thread.join ();
+    else
+        accept_thread.detach ();
+
+    // Unblock the handshakes and relays
+    //
+    {
+        lock_guard<std::mutex> lock (mutex);
+        for (auto fd : all_fds)
+            shutdown (fd, SHUT_RDWR);
+    }
+    while (true) {
+        std::thread t;
+        {
+            lock_guard<std::mutex> lock (mutex);
+            if (threads.empty())
+                break;
+            t = std::move (threads.front());
+            threads.pop_front ();
+        }
+        t.join ();
+    }
+    for (auto fd : all_fds)
+        ::close (fd);
+    all_fds.clear ();
+    connections.clear ();
+    ::close (listen_fd);
+    ::close (stop_pipe[0]);
+    ::close (stop_pipe[1]);
+    listen_fd = stop_pipe[0] = stop_pipe[1] = -1;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Socks5Proxy::module_registered (uxmpp::Session& session)
+{
+    sess = &session;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Socks5Proxy::module_unregistered (uxmpp::Session& session)
+{
+    sess = nullptr;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+bool Socks5Proxy::process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj)
+{
+    if (!sess || xml_obj.get_full_name()!=xml::full_tag_iq_stanza)
+        return false;
+    IqStanza& iq = reinterpret_cast<IqStanza&> (xml_obj);
+    auto query = iq.find_node (namespace_bytestreams + ":query", true);
+    if (!query)
+        return false;
+
+    IqStanza response (IqType::result, iq.get_from(), sess->get_jid(), iq.get_id());
+    if (iq.get_type() == IqType::get) {
+        // Our network address
+        XmlObject streamhost ("streamhost", namespace_bytestreams, false);
+        streamhost.set_attribute ("jid", to_string(sess->get_jid()));
+        streamhost.set_attribute ("host", "127.0.0.1");
+        streamhost.set_attribute ("port", std::to_string(port));
+        response.add_node (XmlObject("query", namespace_bytestreams).add_node(streamhost));
+    }
+    else if (iq.get_type() == IqType::set) {
+        // Activate, relay the data between the two connections
+        // with the destination address of the byte stream
+        auto target = query.find_node(namespace_bytestreams + ":activate", true).get_content ();
+        auto dst_addr = get_sha1_str (query.get_attribute("sid") + to_string(iq.get_from()) + target);
+        lock_guard<std::mutex> lock (mutex);
+        auto i = connections.find (dst_addr);
+        if (i==connections.end() || i->second.size()!=2) {
+            response.set_type (IqType::error);
+            response.add_node (StanzaError(StanzaError::type_cancel, StanzaError::item_not_found));
+        }else{
+            int fd1 = i->second[0];
+            int fd2 = i->second[1];
+            connections.erase (i);
+            threads.emplace_back ([this, fd1, fd2](){ relay(fd1, fd2); });
+            threads.emplace_back ([this, fd1, fd2](){ relay(fd2, fd1); });
+            ++activated;
+        }
+    }else{
+        return false;
+    }
+    sess->send_stanza (response);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+void Socks5Proxy::accept_connections ()
+{
+    struct pollfd fds[2];
+    fds[0].fd     = stop_pipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd     = listen_fd;
+    fds[1].events = POLLIN;
+
+    while (true) {
+        fds[0].revents = fds[1].revents = 0;
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+            break;
+        if (fds[0].revents)
+            break;
+        if (!(fds[1].revents & POLLIN))
+            continue;
+        int fd = accept4 (listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1)
+            continue;
+        lock_guard<std::mutex> lock (mutex);
+        all_fds.push_back (fd);
+        threads.emplace_back ([this, fd](){ handshake(fd); });
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// The SOCKS5 handshake, without authentication. The connection
+// is kept until the byte stream is activated.
+//------------------------------------------------------------------------------
+void Socks5Proxy::handshake (int fd)
+{
+    unsigned char buf[262];
+    if (!read_all(fd, buf, 2) || buf[0]!=5 || !read_all(fd, buf+2, buf[1]))
+        return;
+    unsigned char method[2] = {5, 0};
+    if (!write_all(fd, method, 2))
+        return;
+    if (!read_all(fd, buf, 5) || buf[0]!=5 || buf[1]!=1 || buf[3]!=3 || !read_all(fd, buf+5, buf[4]+2))
+        return;
+
+    // Reply with the requested address
+    buf[1] = 0;
+    if (!write_all(fd, buf, 5+buf[4]+2))
+        return;
+
+    lock_guard<std::mutex> lock (mutex);
+    connections[string(reinterpret_cast<char*>(buf+5), buf[4])].push_back (fd);
+}
+
+
+//------------------------------------------------------------------------------
+// Relay data in one direction until the end of the data.
+//------------------------------------------------------------------------------
+void Socks5Proxy::relay (int from_fd, int to_fd)
+{
+#ifdef UXMPP_HAVE_SPLICE
+    int p[2];
+    if (pipe2(p, O_CLOEXEC))
+        return;
+    fcntl (p[1], F_SETPIPE_SZ, relay_chunk_size);
+    while (true) {
+        auto result = splice (from_fd, nullptr, p[1], nullptr, relay_chunk_size, SPLICE_F_MOVE);
+        if (result <= 0)
+            break;
+        while (result > 0) {
+            auto moved = splice (p[0], nullptr, to_fd, nullptr, result, SPLICE_F_MOVE);
+            if (moved <= 0)
+                break;
+            result  -= moved;
+            relayed += moved;
+        }
+        if (result > 0)
+            break;
+    }
+    ::close (p[0]);
+    ::close (p[1]);
+#else
+    std::vector<unsigned char> buf (relay_chunk_size);
+    while (true) {
+        auto result = ::read (from_fd, buf.data(), buf.size());
+        if (result<=0 || !write_all(to_fd, buf.data(), result))
+            break;
+        relayed += result;
+    }
+#endif
+    shutdown (to_fd, SHUT_WR);
+}
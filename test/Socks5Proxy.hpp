@@ -0,0 +1,124 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_TEST_SOCKS5PROXY_HPP
+#define UXMPP_TEST_SOCKS5PROXY_HPP
+
+#include <uxmpp.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+
+/**
+ * A SOCKS5 bytestream proxy (XEP-0065) for tests and benchmarks.
+ * It is a module registered to the session of the proxy JID, that
+ * answers address queries and activation requests. Connections to
+ * the proxy are handled by blocking threads, and an activated byte
+ * stream is relayed with splice(). It is not meant to be secure or
+ * complete, and it only listens on the loopback interface.
+ */
+class Socks5Proxy : public uxmpp::XmppModule {
+public:
+
+    /**
+     * Constructor.
+     */
+    Socks5Proxy ();
+
+    /**
+     * Destructor. Stops the proxy.
+     */
+    ~Socks5Proxy ();
+
+    /**
+     * Start listening on a free port.
+     * @return false on error.
+     */
+    bool start ();
+
+    /**
+     * Stop the proxy and close all connections.
+     */
+    void stop ();
+
+    /**
+     * Return the port the proxy listens on.
+     */
+    uint16_t get_port () const {
+        return port;
+    }
+
+    /**
+     * Return the number of activated byte streams.
+     */
+    unsigned num_activated () const {
+        return activated;
+    }
+
+    /**
+     * Return the number of bytes relayed.
+     */
+    uint64_t bytes_relayed () const {
+        return relayed;
+    }
+
+    /**
+     * Called when the module is registered to a session.
+     */
+    virtual void module_registered (uxmpp::Session& session) override;
+
+    /**
+     * Called when the module is unregistered from a session.
+     */
+    virtual void module_unregistered (uxmpp::Session& session) override;
+
+    /**
+     * Answer bytestream queries and activation requests.
+     */
+    virtual bool process_xml_object (uxmpp::Session& session, uxmpp::XmlObject& xml_obj) override;
+
+
+private:
+    uxmpp::Session* sess;
+    int listen_fd;
+    int stop_pipe[2];
+    uint16_t port;
+    std::atomic<unsigned> activated;
+    std::atomic<uint64_t> relayed;
+
+    std::mutex mutex;
+    std::thread accept_thread;
+    std::list<std::thread> threads;
+    // Connections that completed the SOCKS5 handshake, by destination address
+    std::map<std::string, std::vector<int>> connections;
+    // All accepted connections, closed by stop()
+    std::vector<int> all_fds;
+
+    void accept_connections ();
+    void handshake (int fd);
+    void relay (int from_fd, int to_fd);
+};
+
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestCheck.hpp"
+#include <iostream>
+
+using namespace std;
+
+static bool result = true;
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+bool check (bool ok, const std::string& what)
+{
+    if (!ok) {
+        cout << "FAIL: " << what << endl;
+        result = false;
+    }
+    return ok;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int test_result ()
+{
+    cout << (result ? "OK" : "FAILED") << endl;
+    return result ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_TEST_TESTCHECK_HPP
+#define UXMPP_TEST_TESTCHECK_HPP
+
+#include <string>
+
+
+/**
+ * Print a failure message unless a condition is true.
+ * The test fails if any check fails, see test_result().
+ * @param ok The condition.
+ * @param what What failed.
+ * @return The condition.
+ */
+bool check (bool ok, const std::string& what);
+
+/**
+ * Print OK or FAILED, the result of all checks.
+ * @return The exit code of the test.
+ */
+int test_result ();
+
+
+#endif
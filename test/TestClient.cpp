@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestClient.hpp"
+#include <iostream>
+
+using namespace std;
+using namespace uxmpp;
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+TestClient::TestClient (uint16_t port, const std::string& user, const std::string& resource)
+{
+    auth.auth_user = user;
+    auth.auth_pass = "secret";
+    sess.register_module (auth);
+    sess.add_session_listener (*this);
+    cfg.domain      = "localhost";
+    cfg.server      = "127.0.0.1";
+    cfg.port        = port;
+    cfg.disable_srv = true;
+    cfg.resource    = resource;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+TestClient::~TestClient ()
+{
+    stop ();
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+void TestClient::start ()
+{
+    if (thread.joinable())
+        thread.join (); // The previous run has ended
+    thread = std::thread ([this](){
+            sess.run (cfg);
+        });
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+void TestClient::stop ()
+{
+    sess.stop ();
+    if (thread.joinable())
+        thread.join ();
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+void TestClient::on_state_change (Session& session, SessionState new_state, SessionState old_state)
+{
+    if (new_state == SessionState::bound)
+        bound.post ();
+    else if (new_state == SessionState::closed)
+        session_closed.post ();
+}
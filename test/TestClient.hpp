@@ -0,0 +1,86 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_TEST_TESTCLIENT_HPP
+#define UXMPP_TEST_TESTCLIENT_HPP
+
+#include "TestCheck.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <string>
+#include <thread>
+#include <cstdint>
+
+
+/**
+ * A client session to a TestServer on the loopback interface, in
+ * domain 'localhost' and with password 'secret'. The session runs in a
+ * thread of its own.
+ * <p/>
+ * A test derives from this class, registers its modules in its
+ * constructor and then calls start(). The destructor of the derived
+ * class must call stop(), the session must not outlive the modules.
+ */
+class TestClient : public uxmpp::SessionListener {
+public:
+    /**
+     * Constructor. The authentication module is registered.
+     * @param port The port of the server.
+     * @param user The user to log in as.
+     * @param resource The resource to bind.
+     */
+    TestClient (uint16_t port, const std::string& user="alice", const std::string& resource="test");
+
+    /**
+     * Destructor. Stops the session.
+     */
+    virtual ~TestClient ();
+
+    /**
+     * Start the session thread. To run the session again, wait
+     * until it is closed before calling start() again.
+     */
+    void start ();
+
+    /**
+     * Stop the session and wait for the session thread to end.
+     */
+    void stop ();
+
+    /**
+     * Posts the 'bound' semaphore when the session is bound,
+     * and the 'session_closed' semaphore when it is closed.
+     * A derived class overriding this method must call it.
+     */
+    virtual void on_state_change (uxmpp::Session& session,
+                                  uxmpp::SessionState new_state,
+                                  uxmpp::SessionState old_state) override;
+
+    uxmpp::Session sess;
+    uxmpp::SessionConfig cfg;
+    uxmpp::mod::AuthModule auth;
+    uxmpp::Semaphore bound;
+    uxmpp::Semaphore session_closed;
+
+
+private:
+    std::thread thread;
+};
+
+
+#endif
@@ -0,0 +1,405 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_TEST_TESTSERVER_HPP
+#define UXMPP_TEST_TESTSERVER_HPP
+
+#include <uxmpp.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+
+
+/**
+ * A small XMPP server for tests and benchmarks, built on XmlStream.
+ * It listens on the loopback interface and supports STARTTLS with a
+ * built-in test certificate, SASL PLAIN and SCRAM-SHA-1, zlib stream
+ * compression, resource binding, stream management, rosters, and routing of messages,
+ * presence and IQs between local accounts. Routed stanzas can be
+ * delayed or dropped to simulate network latency. It is not meant to
+ * be secure or complete.
+ */
+class TestServer {
+public:
+
+    /**
+     * Called for each stanza routed from one local session to another.
+     * The stanza may be modified.
+     * @param from The full JID of the sender.
+     * @param to The 'to' attribute of the stanza.
+     * @param stanza The stanza.
+     * @return The number of milliseconds to delay the stanza, or a
+     *         negative value to drop it.
+     */
+    typedef std::function<int (const std::string& from,
+                               const std::string& to,
+                               uxmpp::XmlObject& stanza)> route_hook_t;
+
+    /**
+     * Constructor.
+     * @param domain The domain served.
+     */
+    TestServer (const std::string& domain="localhost");
+
+    /**
+     * Destructor. Stops the server.
+     */
+    ~TestServer ();
+
+    /**
+     * Add an account.
+     * @param user The local part of the account JID.
+     * @param password The password.
+     */
+    void add_account (const std::string& user, const std::string& password);
+
+    /**
+     * Add an item to the roster of an account.
+     * @param user The local part of the account JID.
+     * @param jid The bare JID of the contact.
+     * @param name The name of the contact.
+     * @param subscription The subscription state.
+     */
+    void add_roster_item (const std::string& user,
+                          const std::string& jid,
+                          const std::string& name="",
+                          const std::string& subscription="both");
+
+    /**
+     * Add the presence of a contact without a session on this server,
+     * like a contact on another server. It is sent to the user when
+     * a session announces its initial presence, in the order added.
+     * @param user The user receiving the presence.
+     * @param presence A presence stanza with a 'from' attribute.
+     */
+    void add_contact_presence (const std::string& user, const uxmpp::XmlObject& presence);
+
+    /**
+     * Add the service discovery info of an entity hosted by the
+     * server, like the server itself or a component. Disco requests
+     * to the entity are routed, with the latency and the route hook,
+     * and answered by the server.
+     * @param jid The JID of the entity.
+     * @param category The identity category.
+     * @param type The identity type.
+     * @param features The features.
+     * @param node The node, if any.
+     */
+    void add_disco_info (const std::string& jid,
+                         const std::string& category,
+                         const std::string& type,
+                         const std::vector<std::string>& features,
+                         const std::string& node="");
+
+    /**
+     * Add a service discovery item to an entity hosted by the server.
+     * @param jid The JID of the entity listing the item.
+     * @param item_jid The 'jid' attribute of the item.
+     * @param item_node The 'node' attribute of the item, if any.
+     * @param node The node of the entity listing the item, if any.
+     */
+    void add_disco_item (const std::string& jid,
+                         const std::string& item_jid,
+                         const std::string& item_node="",
+                         const std::string& node="");
+
+    /**
+     * Add a multi-user chat room (XEP-0045) hosted by the server.
+     * Sessions join, change nickname and leave with presence to
+     * room/nick, and send groupchat messages to the room. The room has
+     * synthetic occupants without sessions, nicknamed occupant<n> with
+     * the real JID occupant<n>@domain/muc, and a discussion history of
+     * messages from them, one minute apart. Real JIDs are revealed to
+     * everyone. Room stanzas are routed with the latency and the route hook.
+     * @param room The bare JID of the room, in the served domain.
+     * @param num_occupants The number of synthetic occupants.
+     * @param num_history The number of messages in the history.
+     */
+    void add_room (const std::string& room, size_t num_occupants, size_t num_history=0);
+
+    /**
+     * Change the presence of a synthetic occupant of a room and send it
+     * to the sessions in the room. An unknown nickname joins the room.
+     * @param room The bare JID of the room.
+     * @param nick The nickname of the occupant.
+     * @param show The 'show' value, or "unavailable" to leave the room.
+     */
+    void room_presence (const std::string& room, const std::string& nick, const std::string& show="");
+
+    /**
+     * Add a publish-subscribe service (XEP-0060) hosted by the server.
+     * Nodes are created when an item is first published to them and
+     * keep the most recent items. Subscriptions are by bare JID, all
+     * sessions of a subscriber get the event notifications, with the
+     * payload. A new subscriber gets the last published item.
+     * @param jid The JID of the service.
+     * @param max_items_per_publish The max number of items in a publish
+     *                              request, more are rejected with bad-request.
+     */
+    void add_pubsub_service (const std::string& jid, unsigned max_items_per_publish=1);
+
+    /**
+     * Offer STARTTLS, optionally required before authentication.
+     * Enabled by default.
+     */
+    void set_tls (bool enable, bool required=false);
+
+    /**
+     * Offer zlib stream compression (XEP-0138) after authentication.
+     * Enabled by default.
+     */
+    void set_compression (bool enable);
+
+    /**
+     * Offer stream management (XEP-0198) with resumption. Enabled by
+     * default. Only the stanzas received from clients are counted,
+     * stanzas sent to a lost connection are not sent again when the
+     * stream is resumed.
+     * @param enable Offer stream management.
+     * @param fail Answer <enable/> with <failed/>.
+     */
+    void set_stream_management (bool enable, bool fail=false);
+
+    /**
+     * Discard the stanzas received from clients, as if they were lost
+     * on the network. They are not counted by stream management.
+     * @param enable Discard stanzas.
+     */
+    void set_lose_stanzas (bool enable);
+
+    /**
+     * Close all client connections without ending the streams, like
+     * a lost network connection. Streams with stream management can
+     * be resumed.
+     */
+    void drop_connections ();
+
+    /**
+     * Delay all routed stanzas, unless a route hook is set.
+     * @param msec Milliseconds.
+     */
+    void set_latency (unsigned msec);
+
+    /**
+     * Set a hook that decides the delay of each routed stanza.
+     * Set it before start(), or while no stanzas are routed.
+     */
+    void set_route_hook (route_hook_t hook);
+
+    /**
+     * Start listening on the loopback interface.
+     * @param port The port number, 0 to use any free port.
+     * @return false if the server can't be started.
+     */
+    bool start (uint16_t port=0);
+
+    /**
+     * Close all client connections and stop the server.
+     */
+    void stop ();
+
+    /**
+     * Return the port number the server listens on.
+     */
+    uint16_t get_port () const {
+        return port;
+    }
+
+    /**
+     * Return the domain served.
+     */
+    const std::string& get_domain () const {
+        return domain;
+    }
+
+    /**
+     * Return the number of bound sessions.
+     */
+    size_t num_sessions ();
+
+    /**
+     * Return the number of streams restarted with compression enabled.
+     */
+    uint64_t num_compressed_streams () const {
+        return compressed_streams;
+    }
+
+    /**
+     * Return the number of stanzas routed between sessions.
+     */
+    uint64_t num_routed () const {
+        return routed;
+    }
+
+    /**
+     * Return the number of roster results with the full roster.
+     * With roster versioning (XEP-0237) a client with a current
+     * cached roster gets an empty result instead.
+     */
+    uint64_t num_full_rosters () const {
+        return full_rosters;
+    }
+
+    /**
+     * Return the number of disco requests answered.
+     */
+    uint64_t num_disco_requests () const {
+        return disco_requests;
+    }
+
+    /**
+     * Return the largest number of disco requests
+     * waiting for a response at the same time.
+     */
+    unsigned max_disco_in_flight () const {
+        return disco_max_in_flight;
+    }
+
+    /**
+     * Return the number of publish requests handled by pubsub services.
+     */
+    uint64_t num_publish_requests () const {
+        return publish_requests;
+    }
+
+
+private:
+    struct Client;
+    typedef std::shared_ptr<Client> client_ptr;
+
+    struct Account {
+        std::string password;
+        std::string salt;
+        std::string stored_key;
+        std::string server_key;
+        std::map<std::string, uxmpp::XmlObject> roster;
+        std::vector<uxmpp::XmlObject> roster_log; // The item changed in each roster version
+        std::vector<uxmpp::XmlObject> contact_presence;
+    };
+
+    struct DiscoEntity {
+        uxmpp::XmlObject info;               // Empty if only items are added
+        std::vector<uxmpp::XmlObject> items;
+    };
+
+    struct Room {
+        std::map<std::string, uxmpp::XmlObject> occupants; // Presence by nickname
+        std::map<std::string, std::string> joined;         // Nickname by the full JID of a session
+        std::vector<std::pair<std::string, uxmpp::XmlObject>> history; // Messages and their time stamps
+        uxmpp::XmlObject subject;
+    };
+
+    struct PubSubNode {
+        std::list<uxmpp::XmlObject> items;              // The most recently published last
+        std::map<std::string, std::string> subscribers; // Subscription ID by bare JID
+    };
+
+    struct PubSubService {
+        unsigned max_items_per_publish;
+        std::map<std::string, PubSubNode> nodes;
+    };
+
+    struct SmStream {
+        std::string user;
+        std::string jid;
+        uint32_t handled; // Number of stanzas received from the client
+    };
+
+    struct Delayed {
+        std::string from;
+        std::string to;
+        uxmpp::XmlObject stanza;
+    };
+
+    typedef std::chrono::steady_clock clock;
+
+    std::string domain;
+    uint16_t port;
+    int listen_fd;
+    bool tls;
+    bool tls_required;
+    bool compression;
+    bool sm;
+    bool sm_fail;
+    std::atomic<bool> lose_stanzas;
+    unsigned latency;
+    route_hook_t route_hook;
+    std::atomic<uint64_t> routed;
+    std::atomic<uint64_t> compressed_streams;
+    std::atomic<uint64_t> full_rosters;
+    std::atomic<unsigned> next_id;
+    std::atomic<uint64_t> disco_requests;
+    std::atomic<unsigned> disco_in_flight;
+    std::atomic<unsigned> disco_max_in_flight;
+    std::atomic<uint64_t> publish_requests;
+
+    std::mutex mutex;
+    std::map<std::string, Account> accounts;
+    std::map<std::string, client_ptr> sessions;       // Bound sessions by full JID
+    std::list<client_ptr> clients;                    // All connections
+    std::map<std::string, DiscoEntity> disco;         // Disco entities by JID and node
+    std::map<std::string, Room> rooms;                // Multi-user chat rooms by bare JID
+    std::map<std::string, PubSubService> pubsub;      // Pubsub services by JID
+    std::map<std::string, SmStream> sm_streams;       // Resumable streams of lost connections by ID
+    std::thread accept_thread;
+
+    std::mutex delay_mutex;
+    std::condition_variable delay_cond;
+    std::multimap<clock::time_point, Delayed> delayed;
+    std::thread delay_thread;
+    bool running;
+
+    void accept_connections ();
+    void deliver_delayed ();
+    void reap_clients (bool all);
+    void on_rx (client_ptr client, uxmpp::XmlObject& xml_obj);
+    void open_stream (Client& client);
+    void handle_starttls (Client& client);
+    void handle_auth (Client& client, uxmpp::XmlObject& xml_obj);
+    void handle_compress (Client& client, uxmpp::XmlObject& xml_obj);
+    void handle_bind (client_ptr client, uxmpp::XmlObject& iq);
+    void handle_sm (client_ptr client, uxmpp::XmlObject& xml_obj);
+    void handle_server_iq (Client& client, uxmpp::XmlObject& iq);
+    void handle_roster (Client& client, uxmpp::XmlObject& iq);
+    void handle_presence (Client& client, uxmpp::XmlObject& presence);
+    bool is_disco_request (uxmpp::XmlObject& iq);
+    bool handle_disco (const std::string& from, const std::string& to, uxmpp::XmlObject& iq);
+    bool handle_room (const std::string& from, const std::string& to, uxmpp::XmlObject& stanza);
+    bool handle_pubsub (const std::string& from, const std::string& to, uxmpp::XmlObject& iq);
+    void notify (const std::string& service, PubSubNode& pubsub_node, const uxmpp::XmlObject& items,
+                 std::list<std::pair<client_ptr, uxmpp::XmlObject>>& out);
+    void broadcast (Room& room, const uxmpp::XmlObject& stanza, const std::string& except,
+                    std::list<std::pair<client_ptr, uxmpp::XmlObject>>& out);
+    void route (Client& client, uxmpp::XmlObject& stanza);
+    void deliver (const std::string& from, const std::string& to, uxmpp::XmlObject& stanza);
+    void send_error (const std::string& from, const std::string& to,
+                     uxmpp::XmlObject& stanza, const std::string& condition);
+    std::list<client_ptr> get_resources (const std::string& bare_jid);
+};
+
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UXMPP_TEST_BENCH_HPP
+#define UXMPP_TEST_BENCH_HPP
+
+/*
+ * A minimal micro-benchmark runner, included once by each bench_* program.
+ *
+ * Each benchmark prints one line with four tab separated fields:
+ * <pre>
+ * name   iterations   ns/op   allocs/op
+ * </pre>
+ * The format doesn't change, so results can be compared with a
+ * simple script. The time is the best of three runs of the calibrated
+ * number of iterations. Set UXMPP_BENCH_MSEC to change the time of
+ * each run, 200 ms by default. Benchmark names given on the command
+ * line select the benchmarks to run, by substring.
+ */
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+
+static std::atomic<uint64_t> bench_num_allocs {0};
+
+void* operator new (size_t size)
+{
+    bench_num_allocs.fetch_add (1, std::memory_order_relaxed);
+    void* p = malloc (size ? size : 1);
+    if (!p)
+        throw std::bad_alloc ();
+    return p;
+}
+
+void operator delete (void* p) noexcept
+{
+    free (p);
+}
+
+
+/**
+ * Keep the compiler from optimizing away a computed value.
+ */
+template<typename T>
+inline void bench_keep (const T& value)
+{
+    asm volatile ("" : : "g"(&value) : "memory");
+}
+
+
+/**
+ * Run benchmarks and print the results.
+ */
+class Bench {
+public:
+    Bench (int argc, char* argv[]) {
+        for (int i=1; i<argc; ++i)
+            filters.push_back (argv[i]);
+        const char* msec = getenv ("UXMPP_BENCH_MSEC");
+        run_time = std::chrono::milliseconds (msec ? atoi(msec) : 200);
+    }
+
+    /**
+     * Run a benchmark.
+     * @param name The name of the benchmark.
+     * @param fn Called with the number of iterations to run.
+     */
+    template<typename F>
+    void run (const std::string& name, F fn) {
+        if (!selected(name))
+            return;
+
+        // Find the number of iterations that takes about run_time
+        //
+        uint64_t n = 1;
+        while (true) {
+            auto t = time (fn, n);
+            if (t >= run_time || n >= (1ull << 40))
+                break;
+            if (t < run_time / 100)
+                n *= 10;
+            else
+                n = n * run_time.count() / (t.count() ? t.count() : 1) + 1;
+        }
+
+        std::chrono::nanoseconds best {std::chrono::nanoseconds::max()};
+        uint64_t allocs = 0;
+        for (int i=0; i<3; ++i) {
+            uint64_t a = bench_num_allocs;
+            auto t = time (fn, n);
+            if (t < best) {
+                best = t;
+                allocs = bench_num_allocs - a;
+            }
+        }
+        printf ("%s\t%llu\t%.1f\t%.2f\n", name.c_str(), static_cast<unsigned long long>(n),
+                static_cast<double>(best.count()) / n, static_cast<double>(allocs) / n);
+        fflush (stdout);
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    std::vector<std::string> filters;
+    std::chrono::nanoseconds run_time;
+
+    bool selected (const std::string& name) const {
+        if (filters.empty())
+            return true;
+        for (auto& f : filters) {
+            if (name.find(f) != std::string::npos)
+                return true;
+        }
+        return false;
+    }
+
+    template<typename F>
+    static std::chrono::nanoseconds time (F& fn, uint64_t n) {
+        auto start = clock::now ();
+        fn (n);
+        return std::chrono::duration_cast<std::chrono::nanoseconds> (clock::now() - start);
+    }
+};
+
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "bench.hpp"
+#include <uxmpp.hpp>
+#include <iostream>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+using namespace std;
+using namespace uxmpp;
+
+
+//------------------------------------------------------------------------------
+// Send a message over a socket pair and wait for the echo, both
+// ends served by the ConnectionManager.
+//------------------------------------------------------------------------------
+static void bench_round_trip (Bench& bench, const string& name, size_t size)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+        cerr << "Unable to create a socket pair" << endl;
+        return;
+    }
+    for (auto fd : sv)
+        fcntl (fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    io::Connection client;
+    io::Connection echo;
+    client.set_fd (sv[0]);
+    echo.set_fd (sv[1]);
+
+    vector<char> msg (size, 'x');
+    vector<char> client_buf (size);
+    vector<char> echo_buf (size);
+    size_t received = 0;
+    Semaphore done;
+
+    echo.set_rx_cb ([&echo_buf](io::Connection& conn, void* buf, ssize_t result, int errnum){
+            if (result <= 0)
+                return;
+            conn.write (buf, result);
+            conn.read (echo_buf.data(), echo_buf.size());
+        });
+    client.set_rx_cb ([&](io::Connection& conn, void* buf, ssize_t result, int errnum){
+            if (result <= 0)
+                return;
+            received += result;
+            if (received < msg.size())
+                conn.read (client_buf.data(), client_buf.size());
+            else
+                done.post ();
+        });
+    echo.read (echo_buf.data(), echo_buf.size());
+
+    bench.run (name, [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                received = 0;
+                client.read (client_buf.data(), client_buf.size());
+                client.write (msg.data(), msg.size());
+                done.wait ();
+            }
+        });
+
+    client.cancel ();
+    echo.cancel ();
+    client.close ();
+    echo.close ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (LogLevel::silent);
+    Bench bench (argc, argv);
+
+    bench_round_trip (bench, "cm_round_trip_64", 64);
+    bench_round_trip (bench, "cm_round_trip_4k", 4096);
+
+    io::Timer timer;
+    bench.run ("timer_set_cancel", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                timer.set (chrono::seconds(60), [](){});
+                timer.cancel ();
+            }
+        });
+
+    Semaphore fired;
+    bench.run ("timer_set_expire", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                timer.set (chrono::microseconds(0), [&fired](){
+                        fired.post ();
+                    });
+                fired.wait ();
+            }
+        });
+
+    return 0;
+}
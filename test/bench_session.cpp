@@ -0,0 +1,100 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "bench.hpp"
+#include <uxmpp.hpp>
+#include <string>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+
+/**
+ * A session that lets us pass XML objects directly
+ * to the listeners, IQ correlator and modules.
+ */
+class BenchSession : public Session {
+public:
+    void dispatch (XmlObject& xml_obj) {
+        on_rx_xml_obj (xs, xml_obj);
+    }
+};
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static void bench_dispatch (Bench& bench, BenchSession& sess, const string& name, const XmlObject& stanza)
+{
+    // Each iteration dispatches a copy, the stanza may be modified by the modules
+    bench.run (name, [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                XmlObject xml_obj (stanza);
+                sess.dispatch (xml_obj);
+            }
+        });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (LogLevel::silent);
+    Bench bench (argc, argv);
+
+    // The modules of a typical client, in the same order as in the uxmpp client
+    //
+    BenchSession sess;
+    SessionModule     mod_session;
+    RosterModule      mod_roster;
+    PresenceModule    mod_pr;
+    MessageModule     mod_msg;
+    PingModule        mod_ping;
+    PrivateDataModule mod_priv_data;
+    DiscoModule       mod_disco;
+    VcardModule       mod_vcard;
+    VersionModule     mod_version;
+    sess.register_module (mod_session);
+    sess.register_module (mod_roster);
+    sess.register_module (mod_pr);
+    sess.register_module (mod_msg);
+    sess.register_module (mod_ping);
+    sess.register_module (mod_priv_data);
+    sess.register_module (mod_disco);
+    sess.register_module (mod_vcard);
+    sess.register_module (mod_version);
+
+    MessageStanza msg ("bob@example.com/desktop", "alice@example.com/phone",
+                       "Are you coming to the meeting this afternoon?", MessageType::chat);
+    bench_dispatch (bench, sess, "session_dispatch_message", msg);
+
+    PresenceStanza presence ("bob@example.com/desktop", "alice@example.com/phone");
+    presence.set_status ("In a meeting");
+    bench_dispatch (bench, sess, "session_dispatch_presence", presence);
+
+    IqStanza ping (IqType::get, "bob@example.com/desktop", "example.com", "p1");
+    ping.add_node (XmlObject("ping", "urn:xmpp:ping"));
+    bench_dispatch (bench, sess, "session_dispatch_iq_ping", ping);
+
+    IqStanza unknown (IqType::get, "bob@example.com/desktop", "alice@example.com/phone", "u1");
+    unknown.add_node (XmlObject("query", "urn:uxmpp:unknown"));
+    bench_dispatch (bench, sess, "session_dispatch_iq_unhandled", unknown);
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "bench.hpp"
+#include <uxmpp.hpp>
+#include <string>
+
+using namespace std;
+using namespace uxmpp;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (LogLevel::silent);
+    Bench bench (argc, argv);
+
+    const string full_jid {"alice@example.com/phone-4711"};
+    bench.run ("jid_parse_full", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                Jid jid (full_jid);
+                bench_keep (jid);
+            }
+        });
+    const string bare_jid {"alice@example.com"};
+    bench.run ("jid_parse_bare", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                Jid jid (bare_jid);
+                bench_keep (jid);
+            }
+        });
+    Jid jid (full_jid);
+    bench.run ("jid_to_string", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                auto s = to_string (jid);
+                bench_keep (s);
+            }
+        });
+
+    string data;
+    for (int i=0; i<1024; ++i)
+        data.push_back (static_cast<char>(i * 7));
+    string encoded = to_base64 (data);
+    bench.run ("base64_encode_1k", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                auto s = to_base64 (data);
+                bench_keep (s);
+            }
+        });
+    bench.run ("base64_decode_1k", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                auto s = from_base64 (encoded);
+                bench_keep (s);
+            }
+        });
+
+    bench.run ("make_uuid_v4", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                auto s = make_uuid_v4 ();
+                bench_keep (s);
+            }
+        });
+
+    return 0;
+}
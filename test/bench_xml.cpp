@@ -0,0 +1,149 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "bench.hpp"
+#include <uxmpp.hpp>
+#include <string>
+
+using namespace std;
+using namespace uxmpp;
+
+
+static const string stream_start {
+    "<?xml version='1.0'?><stream:stream xmlns='jabber:client' "
+    "xmlns:stream='http://etherx.jabber.org/streams' id='s1' from='localhost' version='1.0'>"};
+
+static const string message {
+    "<message from='alice@example.com/phone' to='bob@example.com/desktop' type='chat' id='m1'>"
+    "<body>Are you coming to the meeting this afternoon?</body>"
+    "<thread>e0ffe42b28561960c6b12b944a092794b9683a38</thread>"
+    "<active xmlns='http://jabber.org/protocol/chatstates'/>"
+    "<request xmlns='urn:xmpp:receipts'/></message>"};
+
+static const string presence {
+    "<presence from='alice@example.com/phone' to='bob@example.com/desktop'>"
+    "<show>away</show><status>In a meeting</status><priority>5</priority>"
+    "<c xmlns='http://jabber.org/protocol/caps' hash='sha-1' node='http://uxmpp.org'"
+    " ver='QgayPKawpkPSDYmwT/WM94uAlu0='/></presence>"};
+
+
+//------------------------------------------------------------------------------
+// A roster result with 50 items.
+//------------------------------------------------------------------------------
+static string make_roster ()
+{
+    string roster = "<iq type='result' id='r1' to='bob@example.com/desktop'>"
+        "<query xmlns='jabber:iq:roster' ver='ver42'>";
+    for (int i=0; i<50; ++i) {
+        roster += "<item jid='contact" + std::to_string(i) + "@example.com' name='Contact "
+            + std::to_string(i) + "' subscription='both'><group>Friends</group></item>";
+    }
+    return roster + "</query></iq>";
+}
+
+
+//------------------------------------------------------------------------------
+// Parse a stanza into an XmlObject.
+//------------------------------------------------------------------------------
+static XmlObject parse (const string& stanza)
+{
+    XmlObject result;
+    XmlInputStream xis (XmlObject(xml::tag_stream, xml::namespace_stream, false, false));
+    xis.set_xml_handler ([&result](XmlInputStream& stream, XmlObject& xml_obj){
+            result = xml_obj;
+        });
+    xis << stream_start << stanza;
+    return result;
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static void bench_parse (Bench& bench, const string& name, const string& stanza)
+{
+    bench.run (name, [&stanza](uint64_t n){
+            uint64_t count = 0;
+            XmlInputStream xis (XmlObject(xml::tag_stream, xml::namespace_stream, false, false));
+            xis.set_xml_handler ([&count](XmlInputStream& stream, XmlObject& xml_obj){
+                    ++count;
+                });
+            xis << stream_start;
+            for (uint64_t i=0; i<n; ++i)
+                xis << stanza;
+            bench_keep (count);
+        });
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (LogLevel::silent);
+    Bench bench (argc, argv);
+
+    string roster = make_roster ();
+    XmlObject msg_obj = parse (message);
+    XmlObject pres_obj = parse (presence);
+    XmlObject roster_obj = parse (roster);
+
+    bench_parse (bench, "xml_parse_message", message);
+    bench_parse (bench, "xml_parse_presence", presence);
+    bench_parse (bench, "xml_parse_roster50", roster);
+
+    bench.run ("xml_to_string_message", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                auto s = to_string (msg_obj);
+                bench_keep (s);
+            }
+        });
+    bench.run ("xml_to_string_roster50", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                auto s = to_string (roster_obj);
+                bench_keep (s);
+            }
+        });
+
+    bench.run ("xml_copy_message", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                XmlObject copy (msg_obj);
+                bench_keep (copy);
+            }
+        });
+    bench.run ("xml_copy_roster50", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                XmlObject copy (roster_obj);
+                bench_keep (copy);
+            }
+        });
+
+    bench.run ("xml_find_node_body", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                auto node = msg_obj.find_node ("body");
+                bench_keep (node);
+            }
+        });
+    bench.run ("xml_find_node_caps", [&](uint64_t n){
+            for (uint64_t i=0; i<n; ++i) {
+                auto node = pres_obj.find_node ("http://jabber.org/protocol/caps:c", true);
+                bench_keep (node);
+            }
+        });
+
+    return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include "TestClient.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <iostream>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_Caps"
+
+static constexpr int num_resources = 20;
+static const string disco_info_ns {"http://jabber.org/protocol/disco#info"};
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static XmlObject feature (const string& var)
+{
+    return XmlObject("feature", disco_info_ns, false).set_attribute ("var", var);
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static XmlObject field (const string& var, vector<string> values, const string& type="")
+{
+    XmlObject f ("field", "jabber:x:data", false);
+    f.set_attribute ("var", var);
+    if (!type.empty())
+        f.set_attribute ("type", type);
+    for (auto& value : values)
+        f.add_node (XmlObject("value", "jabber:x:data", false).set_content(value));
+    return f;
+}
+
+
+//-----------------------------------------------------------------------
+// The examples in XEP-0115, section 5.2 and 5.3.
+//-----------------------------------------------------------------------
+static void test_make_ver ()
+{
+    XmlObject simple ("query", disco_info_ns);
+    simple.add_node (DiscoIdentity("client", "pc", "Exodus 0.9.1"));
+    simple.add_node (feature("http://jabber.org/protocol/disco#info"));
+    simple.add_node (feature("http://jabber.org/protocol/disco#items"));
+    simple.add_node (feature("http://jabber.org/protocol/muc"));
+    simple.add_node (feature("http://jabber.org/protocol/caps"));
+    check (CapsCache::make_ver(simple) == "QgayPKawpkPSDYmwT/WM94uAlu0=", "wrong simple ver");
+
+    XmlObject complex ("query", disco_info_ns);
+    DiscoIdentity en ("client", "pc", "Psi 0.11");
+    en.set_attribute ("xml:lang", "en");
+    DiscoIdentity el ("client", "pc", "\xce\xa8 0.11");
+    el.set_attribute ("xml:lang", "el");
+    complex.add_node (en);
+    complex.add_node (el);
+    complex.add_node (feature("http://jabber.org/protocol/disco#items"));
+    complex.add_node (feature("http://jabber.org/protocol/caps"));
+    complex.add_node (feature("http://jabber.org/protocol/disco#info"));
+    complex.add_node (feature("http://jabber.org/protocol/muc"));
+    XmlObject form ("x", "jabber:x:data");
+    form.set_attribute ("type", "result");
+    form.add_node (field("FORM_TYPE", {"urn:xmpp:dataforms:softwareinfo"}, "hidden"));
+    form.add_node (field("ip_version", {"ipv6", "ipv4"}));
+    form.add_node (field("os", {"Mac"}));
+    form.add_node (field("os_version", {"10.5.1"}));
+    form.add_node (field("software", {"Psi"}));
+    form.add_node (field("software_version", {"0.11"}));
+    complex.add_node (form);
+    check (CapsCache::make_ver(complex) == "q07IKJEyjvHSyhy//CH0CxmKi8w=", "wrong complex ver");
+
+    simple.add_node (feature("http://jabber.org/protocol/muc"));
+    check (CapsCache::make_ver(simple).empty(), "duplicate feature accepted");
+    CapsCache cache;
+    check (!cache.add("QgayPKawpkPSDYmwT/WM94uAlu0=", simple) && cache.size()==0, "invalid info cached");
+    check (cache.add("q07IKJEyjvHSyhy//CH0CxmKi8w=", complex) && cache.size()==1, "valid info not cached");
+}
+
+
+/**
+ * A client session announcing its presence with entity capabilities.
+ */
+class Client : public TestClient {
+public:
+    Client (uint16_t port, const string& user, const string& resource, CapsCache* cache, bool ping)
+        : TestClient (port, user, resource), num_caps {0}
+    {
+        if (cache)
+            mod_disco.set_caps_cache (*cache);
+        mod_disco.set_caps_handler ([this](DiscoModule& dm, const Jid& jid, const XmlObject& info){
+                if (jid.get_local() == "bob")
+                    ++num_caps;
+            });
+        sess.register_module (mod_disco);
+        sess.register_module (mod_presence);
+        if (ping)
+            sess.register_module (mod_ping);
+        start ();
+    }
+    ~Client () {
+        stop ();
+    }
+    bool wait_for_caps (int count) {
+        for (int i=0; i<500 && num_caps<count; ++i)
+            this_thread::sleep_for (chrono::milliseconds(10));
+        return num_caps == count;
+    }
+
+    DiscoModule mod_disco;
+    PresenceModule mod_presence;
+    PingModule mod_ping;
+    std::atomic<int> num_caps;
+};
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+    string file = "/tmp/test_Caps." + std::to_string(getpid()) + ".xml";
+
+    test_make_ver ();
+
+    // Count the disco#info queries sent to bob
+    //
+    std::atomic<int> bob_queries {0};
+    TestServer server;
+    server.add_account ("alice", "secret");
+    server.add_account ("bob", "secret");
+    server.add_roster_item ("alice", "bob@localhost");
+    server.add_roster_item ("bob", "alice@localhost");
+    server.set_tls (false);
+    server.set_route_hook ([&bob_queries](const string& from, const string& to, XmlObject& stanza){
+            if (stanza.get_tag_name()=="iq" && stanza.get_attribute("type")=="get" &&
+                to.compare(0, 4, "bob@")==0 &&
+                stanza.find_node(disco_info_ns + ":query", true))
+            {
+                ++bob_queries;
+            }
+            return 0;
+        });
+    if (!server.start()) {
+        cout << "FAIL: unable to start the server" << endl;
+        return 1;
+    }
+
+    // All bob's resources run the same client version
+    //
+    {
+        CapsCache cache;
+        cache.set_file (file);
+        Client alice (server.get_port(), "alice", "desktop", &cache, false);
+        check (alice.bound.wait(chrono::seconds(10)), "alice not bound");
+        alice.mod_presence.announce ();
+
+        vector<unique_ptr<Client>> bob;
+        for (int i=0; i<num_resources; ++i) {
+            bob.emplace_back (new Client(server.get_port(), "bob", "res" + std::to_string(i), nullptr, true));
+            check (bob.back()->bound.wait(chrono::seconds(10)), "bob not bound");
+            bob.back()->mod_presence.announce ();
+        }
+        check (alice.wait_for_caps(num_resources), "missing capabilities");
+        check (bob_queries == 1, string("queried ") + std::to_string(bob_queries) + " times");
+        check (alice.mod_disco.has_feature(Jid("bob@localhost/res3"), "urn:xmpp:ping"), "feature not found");
+        check (!alice.mod_disco.has_feature(Jid("bob@localhost/res3"), "urn:xmpp:receipts"), "wrong feature");
+        check (cache.size() == 2, "wrong cache size"); // alice and bob
+
+        // Restart alice with the cache file
+        //
+        alice.sess.stop ();
+        bob_queries = 0;
+        CapsCache restarted;
+        check (restarted.set_file(file) && restarted.size()==2, "cache not loaded");
+        auto start = chrono::steady_clock::now ();
+        Client alice2 (server.get_port(), "alice", "desktop", &restarted, false);
+        check (alice2.bound.wait(chrono::seconds(10)), "alice not bound again");
+        alice2.mod_presence.announce ();
+        check (alice2.wait_for_caps(num_resources), "missing capabilities after restart");
+        auto usec = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start).count ();
+        check (bob_queries == 0, "queried after restart");
+        check (alice2.mod_disco.get_caps_info(Jid("bob@localhost/res0")) != nullptr, "no info after restart");
+
+        cout << num_resources << " resources with the same capabilities, disco queries: 1, "
+             << "after restart: 0 (" << usec << " us to all capabilities)" << endl;
+    }
+    server.stop ();
+    ::unlink (file.c_str());
+
+    return test_result ();
+}
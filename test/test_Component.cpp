@@ -0,0 +1,326 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestCheck.hpp"
+#include <uxmpp.hpp>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace uxmpp;
+
+#define THIS_FILE "test_Component"
+
+static constexpr int num_messages = 20000;
+
+static const string component_domain {"component.localhost"};
+static const string secret {"s3cr3t"};
+
+
+//-----------------------------------------------------------------------
+// Return the value of an attribute in an XML start tag.
+//-----------------------------------------------------------------------
+static string get_attr (const string& tag, const string& name)
+{
+    auto pos = tag.find (string(" ") + name + "='");
+    if (pos == string::npos)
+        return "";
+    pos += name.size() + 3;
+    return tag.substr (pos, tag.find('\'', pos) - pos);
+}
+
+
+//-----------------------------------------------------------------------
+// Read from the socket until 'what' is in the buffer.
+//-----------------------------------------------------------------------
+static bool read_until (int fd, string& rx, const string& what)
+{
+    char buf[4096];
+    while (rx.find(what) == string::npos) {
+        ssize_t r = ::read (fd, buf, sizeof(buf));
+        if (r <= 0)
+            return false;
+        rx.append (buf, r);
+    }
+    return true;
+}
+
+
+//-----------------------------------------------------------------------
+// Write a string to the socket.
+//-----------------------------------------------------------------------
+static void write_all (int fd, const string& tx)
+{
+    size_t pos = 0;
+    while (pos < tx.size()) {
+        ssize_t r = ::write (fd, tx.data()+pos, tx.size()-pos);
+        if (r <= 0)
+            return;
+        pos += r;
+    }
+}
+
+
+//-----------------------------------------------------------------------
+// A minimal stand-in for the component side of an XMPP server.
+// It verifies the handshake, echoes IQ requests and counts messages.
+// When all messages from the component are received it answers
+// with a 'done' message followed by the same number of messages
+// to the component.
+//-----------------------------------------------------------------------
+static void serve_component (int fd)
+{
+    string rx;
+    if (!read_until(fd, rx, "<stream:stream") || !read_until(fd, rx, ">"))
+        return;
+    string header = rx.substr (rx.find("<stream:stream"));
+    header = header.substr (0, header.find('>'));
+    rx.erase (0, rx.find('>', rx.find("<stream:stream")) + 1);
+    if (get_attr(header, "xmlns") != "jabber:component:accept" || get_attr(header, "to") != component_domain) {
+        cout << "FAIL: unexpected stream header: " << header << endl;
+        return;
+    }
+    write_all (fd, "<?xml version='1.0'?><stream:stream xmlns='jabber:component:accept' "
+               "xmlns:stream='http://etherx.jabber.org/streams' id='s1' from='" + component_domain + "'>");
+
+    // Handshake
+    //
+    if (!read_until(fd, rx, "</handshake>"))
+        return;
+    auto start = rx.find ('>', rx.find("<handshake")) + 1;
+    string digest = rx.substr (start, rx.find("</handshake>") - start);
+    rx.erase (0, rx.find("</handshake>") + 12);
+    if (digest != get_sha1_str(string("s1") + secret)) {
+        write_all (fd, "<stream:error><not-authorized xmlns='urn:ietf:params:xml:ns:xmpp-streams'/>"
+                   "</stream:error></stream:stream>");
+        read_until (fd, rx, "</stream:stream>");
+        return;
+    }
+    write_all (fd, "<handshake/>");
+
+    // Stanzas
+    //
+    int count = 0;
+    char buf[16384];
+    while (true) {
+        string tx;
+        size_t pos = 0;
+        while (true) {
+            auto msg_end = rx.find ("</message>", pos);
+            auto iq_end  = rx.find ("</iq>", pos);
+            if (msg_end == string::npos && iq_end == string::npos)
+                break;
+            if (msg_end < iq_end) {
+                pos = msg_end + 10;
+                if (++count == num_messages) {
+                    tx += "<message from='bench@localhost/a' to='" + component_domain + "'><body>done</body></message>";
+                    for (int i=0; i<num_messages; ++i) {
+                        tx += "<message from='bench@localhost/a' to='user" + std::to_string(i) + "@" +
+                            component_domain + "'><body>Message " + std::to_string(i) + "</body></message>";
+                    }
+                }
+            }else{
+                string iq = rx.substr (pos, iq_end - pos);
+                pos = iq_end + 5;
+                iq.erase (0, iq.find("<iq"));
+                string tag = iq.substr (0, iq.find('>'));
+                tx += "<iq type='result' id='" + get_attr(tag, "id") + "' from='" + get_attr(tag, "to") +
+                    "' to='" + get_attr(tag, "from") + "'>" + iq.substr(tag.size()+1) + "</iq>";
+            }
+        }
+        rx.erase (0, pos);
+        if (rx.find("</stream:stream>") != string::npos)
+            tx += "</stream:stream>";
+        if (!tx.empty())
+            write_all (fd, tx);
+        if (rx.find("</stream:stream>") != string::npos)
+            break;
+
+        ssize_t r = ::read (fd, buf, sizeof(buf));
+        if (r <= 0)
+            break;
+        rx.append (buf, r);
+    }
+}
+
+
+/**
+ * Send and receive messages in an application thread when the session is bound.
+ */
+class Component : public SessionListener {
+public:
+    Component () : result{false}, num_rx{0}, bad_ns{0} {}
+    ~Component () {
+        if (thread.joinable())
+            thread.join ();
+    }
+    virtual void on_state_change (Session& session, SessionState new_state, SessionState old_state) {
+        if (new_state == SessionState::bound) {
+            thread = std::thread ([this, &session](){
+                    result = run (session);
+                    session.stop ();
+                });
+        }
+    }
+    virtual void on_stanza_received (Session& session, XmlObject& xml_obj) {
+        if (xml_obj.get_full_name() != xml::full_tag_message_stanza) {
+            if (xml_obj.get_tag_name() == "message")
+                ++bad_ns;
+            return;
+        }
+        MessageStanza& msg = reinterpret_cast<MessageStanza&> (xml_obj);
+        if (msg.get_body() == "done") {
+            done.post ();
+        }else if (++num_rx == num_messages) {
+            all_received.post ();
+        }
+    }
+    bool run (Session& session);
+
+    bool result;
+    std::atomic<int> num_rx;
+    std::atomic<int> bad_ns;
+    Semaphore done;
+    Semaphore all_received;
+    std::thread thread;
+};
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+bool Component::run (Session& session)
+{
+    bool ok = true;
+
+    ok = check (to_string(session.get_jid()) == component_domain, "wrong session jid") && ok;
+
+    // An IQ request through the component connection
+    //
+    auto result = session.iq (IqType::get, Jid("peer@localhost/a"), XmlObject("query", "urn:uxmpp:test"), 5000).get ();
+    ok = check (result.is_ok(), "no IQ result") && ok;
+    ok = check (result.get_payload().get_full_name() == "urn:uxmpp:test:query", "wrong IQ payload") && ok;
+
+    // Messages from the component to the server
+    //
+    auto start = chrono::steady_clock::now ();
+    for (int i=0; i<num_messages; ++i) {
+        session.send_stanza (MessageStanza("bench@localhost/a",
+                                           "user" + std::to_string(i) + "@" + component_domain,
+                                           "Message " + std::to_string(i)));
+    }
+    ok = check (done.wait(chrono::seconds(30)), "messages not received by the server") && ok;
+    auto tx_time = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start);
+
+    // Messages from the server to the component
+    //
+    start = chrono::steady_clock::now ();
+    ok = check (all_received.wait(chrono::seconds(30)), "messages not received by the component") && ok;
+    auto rx_time = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start);
+    ok = check (bad_ns == 0, "message in the wrong namespace") && ok;
+
+    cout << num_messages << " messages, component to server: "
+         << (tx_time.count() ? num_messages * 1000000LL / tx_time.count() : 0) << " msgs/s, "
+         << "server to component: "
+         << (rx_time.count() ? num_messages * 1000000LL / rx_time.count() : 0) << " msgs/s" << endl;
+
+    return ok;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+
+    int listen_fd = socket (AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset (&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    socklen_t len = sizeof (addr);
+    if (bind(listen_fd, (struct sockaddr*)&addr, len) || listen(listen_fd, 1) ||
+        getsockname(listen_fd, (struct sockaddr*)&addr, &len))
+    {
+        cout << "FAIL: Unable to start the server" << endl;
+        return 1;
+    }
+    std::thread server ([listen_fd](){
+            for (int i=0; i<2; ++i) {
+                int fd = accept (listen_fd, nullptr, nullptr);
+                if (fd == -1)
+                    return;
+                serve_component (fd);
+                ::close (fd);
+            }
+        });
+
+    SessionConfig cfg;
+    cfg.domain = component_domain;
+    cfg.server = "127.0.0.1";
+    cfg.port   = ntohs (addr.sin_port);
+
+    bool ok = true;
+
+    // A component with the wrong secret
+    //
+    {
+        ComponentSession sess;
+        io::Timer timeout;
+        timeout.set (chrono::seconds(10), [&sess](){
+                sess.stop (true);
+            });
+        sess.run (cfg, "wrong");
+        timeout.cancel ();
+        ok = check (sess.get_error().get_error_name() == "not-authorized",
+                    "wrong secret not rejected") && ok;
+    }
+
+    // Throughput
+    //
+    {
+        ComponentSession sess;
+        Component component;
+        sess.add_session_listener (component);
+        io::Timer timeout;
+        timeout.set (chrono::seconds(60), [&sess](){
+                sess.stop (true);
+            });
+        sess.run (cfg, secret);
+        timeout.cancel ();
+        if (component.thread.joinable())
+            component.thread.join ();
+        ok = check (component.result, "component session failed") && ok;
+    }
+
+    server.join ();
+    ::close (listen_fd);
+
+    if (!ok)
+        return 1;
+    cout << "OK" << endl;
+    return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ *  Copyright (C) 2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp.hpp>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <cstring>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::io;
+
+#define THIS_FILE "test_Compression"
+
+
+//-----------------------------------------------------------------------
+// Read a recorded XMPP stream and split it into stanzas.
+//-----------------------------------------------------------------------
+static vector<string> read_stream (const string& filename)
+{
+    vector<string> stanzas;
+    ifstream in (filename);
+    if (!in)
+        return stanzas;
+    stringstream ss;
+    ss << in.rdbuf ();
+
+    XmlInputStream xis (XmlObject(xml::tag_stream, xml::namespace_stream, false, false));
+    xis.set_xml_handler ([&stanzas](XmlInputStream& stream, XmlObject& xml_obj){
+            if (xml_obj.get_full_name() != xml::full_tag_stream)
+                stanzas.push_back (to_string(xml_obj));
+        });
+    xis << ss.str ();
+    return stanzas;
+}
+
+
+//-----------------------------------------------------------------------
+// Make up a stream typical for a client login: a large roster,
+// a presence flood and some vCards and messages.
+//-----------------------------------------------------------------------
+static vector<string> make_stream ()
+{
+    vector<string> stanzas;
+    const char* groups[] = {"Friends", "Work", "Family", "Ops"};
+    const char* shows[]  = {"away", "chat", "dnd", "xa"};
+    const int num_contacts = 300;
+
+    IqStanza roster (IqType::result, "alice@example.com/home", "", "roster_1");
+    XmlObject query ("query", xml::namespace_iq_roster);
+    for (int i=0; i<num_contacts; ++i) {
+        string jid = string("contact") + std::to_string(i) + "@example.org";
+        query.add_node (XmlObject("item", xml::namespace_iq_roster, false).
+                        set_attribute("jid", jid).
+                        set_attribute("name", string("Contact ") + std::to_string(i)).
+                        set_attribute("subscription", "both").
+                        add_node(XmlObject("group", xml::namespace_iq_roster, false).set_content(groups[i%4])));
+    }
+    roster.add_node (query);
+    stanzas.push_back (to_string(roster));
+
+    for (int i=0; i<num_contacts; ++i) {
+        PresenceStanza pr (string("contact") + std::to_string(i) + "@example.org/mobile-" + std::to_string(i*7919%10000),
+                           "alice@example.com/home");
+        pr.add_node (XmlObject("show", xml::namespace_jabber_client, false).set_content(shows[i%4]));
+        pr.add_node (XmlObject("priority", xml::namespace_jabber_client, false).set_content("5"));
+        pr.add_node (XmlObject("c", "http://jabber.org/protocol/caps").
+                     set_attribute("hash", "sha-1").
+                     set_attribute("node", "http://example.org/client").
+                     set_attribute("ver", "QgayPKawpkPSDYmwT/WM94uAlu0="));
+        stanzas.push_back (to_string(pr));
+    }
+
+    for (int i=0; i<20; ++i) {
+        IqStanza vcard (IqType::result, "alice@example.com/home",
+                        string("contact") + std::to_string(i) + "@example.org", string("vc_") + std::to_string(i));
+        vcard.add_node (XmlObject("vCard", "vcard-temp").
+                        add_node(XmlObject("FN", "vcard-temp", false).set_content(string("Contact ") + std::to_string(i))).
+                        add_node(XmlObject("NICKNAME", "vcard-temp", false).set_content(string("c") + std::to_string(i))).
+                        add_node(XmlObject("EMAIL", "vcard-temp", false).
+                                 add_node(XmlObject("INTERNET", "vcard-temp", false)).
+                                 add_node(XmlObject("USERID", "vcard-temp", false).
+                                          set_content(string("contact") + std::to_string(i) + "@example.org"))).
+                        add_node(XmlObject("ORG", "vcard-temp", false).
+                                 add_node(XmlObject("ORGNAME", "vcard-temp", false).set_content("Example Inc."))));
+        stanzas.push_back (to_string(vcard));
+    }
+
+    for (int i=0; i<50; ++i) {
+        MessageStanza msg (string("contact") + std::to_string(i%10) + "@example.org/mobile",
+                           "alice@example.com/home",
+                           string("Message number ") + std::to_string(i) + ", see you at the meeting.",
+                           MessageType::chat, ChatState::active, string("msg_") + std::to_string(i));
+        stanzas.push_back (to_string(msg));
+    }
+
+    return stanzas;
+}
+
+
+//-----------------------------------------------------------------------
+// Compress and decompress all stanzas, one sync flush per stanza.
+// If 'persistent' is false the dictionary is dropped after each stanza.
+//-----------------------------------------------------------------------
+static bool run (const vector<string>& stanzas, int level, bool persistent, const string& label)
+{
+    size_t data_bytes = 0;
+    size_t wire_bytes = 0;
+    chrono::duration<double, micro> tx_time (0);
+    chrono::duration<double, micro> rx_time (0);
+
+    unique_ptr<ZlibCompressor> tx (new ZlibCompressor(level));
+    unique_ptr<ZlibCompressor> rx (new ZlibCompressor(level));
+    vector<char> buf (UXMPP_ZLIB_RX_BUF_SIZE);
+
+    for (auto& stanza : stanzas) {
+        if (!persistent) {
+            tx.reset (new ZlibCompressor(level));
+            rx.reset (new ZlibCompressor(level));
+        }
+        string wire;
+        auto start = chrono::steady_clock::now ();
+        tx->compress (stanza.data(), stanza.size(), wire);
+        auto end = chrono::steady_clock::now ();
+        tx_time += end - start;
+
+        // Decompress in chunks of the RX buffer size
+        //
+        string data;
+        start = chrono::steady_clock::now ();
+        for (size_t pos=0; pos<wire.size(); ) {
+            size_t len = min (wire.size()-pos, rx->get_rx_buf_size());
+            memcpy (rx->get_rx_buf(), wire.data()+pos, len);
+            rx->set_rx_size (len);
+            pos += len;
+            while (rx->have_rx_data()) {
+                ssize_t result = rx->decompress (buf.data(), buf.size());
+                if (result <= 0)
+                    break;
+                data.append (buf.data(), result);
+            }
+        }
+        end = chrono::steady_clock::now ();
+        rx_time += end - start;
+
+        if (data != stanza) {
+            cerr << label << ": decompressed data differs from the original" << endl;
+            return false;
+        }
+        data_bytes += stanza.size ();
+        wire_bytes += wire.size ();
+    }
+
+    cout << left << setw(16) << label << right
+         << setw(10) << data_bytes
+         << setw(10) << wire_bytes
+         << setw(9) << fixed << setprecision(1) << (100.0 * wire_bytes / data_bytes) << "%"
+         << setw(12) << setprecision(0) << tx_time.count()
+         << setw(12) << rx_time.count()
+         << setw(12) << setprecision(1) << (data_bytes / tx_time.count()) // bytes/us == MB/s
+         << endl;
+    return true;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (LogLevel::silent);
+
+    vector<string> stanzas;
+    if (argc > 1) {
+        stanzas = read_stream (argv[1]);
+        if (stanzas.empty()) {
+            cerr << "Usage: test_Compression [recorded_stream.xml]" << endl;
+            cerr << "No stanzas found in " << argv[1] << endl;
+            return 1;
+        }
+        cout << "Stream: " << argv[1] << ", " << stanzas.size() << " stanzas" << endl;
+    }else{
+        stanzas = make_stream ();
+        cout << "Stream: generated login (roster, presence, vCards, messages), "
+             << stanzas.size() << " stanzas" << endl;
+    }
+
+    cout << left << setw(16) << "Mode" << right
+         << setw(10) << "Bytes" << setw(10) << "Wire" << setw(10) << "Ratio"
+         << setw(12) << "Deflate us" << setw(12) << "Inflate us" << setw(12) << "MB/s" << endl;
+
+    bool ok = true;
+    for (int level : {1, 3, 6, 9}) {
+        ok = ok && run (stanzas, level, true, string("level ") + std::to_string(level));
+    }
+    ok = ok && run (stanzas, 6, false, "level 6, reset");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include "TestClient.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <iostream>
+#include <string>
+#include <memory>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_DiscoCrawl"
+
+static constexpr int num_services = 100;
+static constexpr int num_rooms    = 5;    // Rooms of each conference service
+static constexpr int latency      = 5;    // Milliseconds
+static const string muc_ns {"http://jabber.org/protocol/muc"};
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static string service (int n)
+{
+    return string("svc") + std::to_string(n) + ".localhost";
+}
+
+
+/**
+ * A client session with a disco module.
+ */
+class Client : public TestClient {
+public:
+    Client (uint16_t port) : TestClient (port) {
+        sess.register_module (mod_disco);
+        start ();
+    }
+    ~Client () {
+        stop ();
+    }
+
+    // Crawl and wait for the result
+    shared_ptr<const DiscoTree> crawl (const string& root, const DiscoCrawlConfig& crawl_cfg, bool refresh) {
+        shared_ptr<const DiscoTree> tree;
+        Semaphore done;
+        bool started = mod_disco.crawl (Jid(root), [&](DiscoModule& module, shared_ptr<const DiscoTree> t){
+                tree = t;
+                done.post ();
+            }, crawl_cfg, refresh);
+        if (!started || !done.wait(chrono::seconds(20)))
+            return nullptr;
+        return tree;
+    }
+
+    DiscoModule mod_disco;
+};
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static long crawl_msec (Client& client, const DiscoCrawlConfig& cfg, shared_ptr<const DiscoTree>& tree)
+{
+    auto start = chrono::steady_clock::now ();
+    tree = client.crawl ("localhost", cfg, true);
+    return chrono::duration_cast<chrono::milliseconds> (chrono::steady_clock::now() - start).count ();
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+
+    // The server lists its services, every tenth service is
+    // a conference service with rooms. One service is listed
+    // twice and the server lists itself.
+    //
+    TestServer server;
+    server.add_account ("alice", "secret");
+    server.add_disco_info ("localhost", "server", "im", {"urn:xmpp:ping"});
+    for (int i=0; i<num_services; ++i) {
+        server.add_disco_item ("localhost", service(i));
+        if (i%10 == 0) {
+            server.add_disco_info (service(i), "conference", "text", {muc_ns});
+            for (int j=0; j<num_rooms; ++j) {
+                string room = string("room") + std::to_string(j) + "@" + service(i);
+                server.add_disco_item (service(i), room);
+                server.add_disco_info (room, "conference", "text", {muc_ns, "muc_public"});
+            }
+        }else{
+            server.add_disco_info (service(i), "pubsub", "service", {"http://jabber.org/protocol/pubsub"});
+        }
+    }
+    server.add_disco_item ("localhost", service(1));
+    server.add_disco_item ("localhost", "localhost");
+
+    // A service with an item that doesn't answer, and
+    // an item on a server that doesn't exist.
+    //
+    server.add_disco_info ("broken.localhost", "component", "generic", {});
+    server.add_disco_item ("broken.localhost", "dead.localhost");
+    server.add_disco_item ("broken.localhost", "remote.example.com");
+    server.add_disco_info ("dead.localhost", "store", "file", {});
+
+    server.set_route_hook ([](const string& from, const string& to, XmlObject& stanza){
+            return to=="dead.localhost" ? -1 : latency;
+        });
+    server.set_tls (false);
+    if (!server.start()) {
+        cout << "FAIL: unable to start the server" << endl;
+        return 1;
+    }
+
+    Client client (server.get_port());
+    check (client.bound.wait(chrono::seconds(10)), "not bound");
+
+    // Sequential crawl, and with a window
+    //
+    DiscoCrawlConfig cfg;
+    cfg.window = 1;
+    shared_ptr<const DiscoTree> tree;
+    auto requests = server.num_disco_requests ();
+    auto sequential_msec = crawl_msec (client, cfg, tree);
+    check (tree && tree->size()==num_services+1, "wrong sequential tree size");
+    check (server.num_disco_requests()-requests == num_services+2, "entities queried more than once");
+    check (server.max_disco_in_flight() == 1, "window exceeded");
+
+    cfg.window = 16;
+    requests = server.num_disco_requests ();
+    auto window_msec = crawl_msec (client, cfg, tree);
+    check (tree && tree->size()==num_services+1, "wrong tree size");
+    check (server.num_disco_requests()-requests == num_services+2, "entities queried more than once");
+    check (server.max_disco_in_flight() <= cfg.window, "window exceeded");
+
+    if (tree) {
+        auto& root = tree->get_root ();
+        check (root.has_info && root.has_items && root.has_identity("server", "im") &&
+               root.has_feature("urn:xmpp:ping"), "wrong root info");
+        check (root.children.size() == num_services, "wrong number of root items");
+        auto muc = tree->find_by_feature (muc_ns);
+        check (muc.size() == num_services/10, "wrong number of MUC services");
+        auto entity = tree->find (Jid(service(3)));
+        check (entity && entity->has_info && entity->has_identity("pubsub") && entity->depth==1 &&
+               entity->parent==0 && !entity->has_items, "wrong service entity");
+    }
+    check (client.mod_disco.get_server_items().size() == num_services, "server items not set");
+
+    // The result is cached
+    //
+    requests = server.num_disco_requests ();
+    auto cached = client.crawl ("localhost", cfg, false);
+    check (cached==tree && server.num_disco_requests()==requests, "result not cached");
+
+    // Rooms, two crawls at the same time
+    //
+    cfg.max_depth = 2;
+    requests = server.num_disco_requests ();
+    Semaphore done;
+    shared_ptr<const DiscoTree> trees[2];
+    for (auto& t : trees) {
+        client.mod_disco.crawl (Jid("localhost"), [&](DiscoModule& module, shared_ptr<const DiscoTree> result){
+                t = result;
+                done.post ();
+            }, cfg, true);
+    }
+    check (done.wait(chrono::seconds(20)) && done.wait(chrono::seconds(20)), "deep crawl not done");
+    check (trees[0] && trees[0]==trees[1], "crawls not merged");
+    if (trees[0]) {
+        check (trees[0]->size() == 1 + num_services + num_services/10*num_rooms, "wrong deep tree size");
+        check (trees[0]->find_by_identity("conference", "text").size() == num_services/10*(num_rooms+1),
+               "wrong number of conference entities");
+        auto room = trees[0]->find (Jid("room2@" + service(20)));
+        check (room && room->depth==2 && room->has_feature("muc_public") &&
+               to_string(trees[0]->get_entities()[room->parent].jid)==service(20), "wrong room entity");
+    }
+    check (server.num_disco_requests()-requests == 2 + 2*num_services + num_services/10*num_rooms,
+           "wrong number of deep crawl requests");
+
+    // Errors and timeouts, not cached
+    //
+    cfg.timeout = 300;
+    auto broken = client.crawl ("broken.localhost", cfg, false);
+    check (broken && broken->size()==3, "wrong broken tree size");
+    if (broken) {
+        auto dead = broken->find (Jid("dead.localhost"));
+        auto remote = broken->find (Jid("remote.example.com"));
+        check (dead && !dead->has_info && dead->error==StanzaError::remote_server_timeout, "no timeout");
+        check (remote && !remote->has_info && remote->error==StanzaError::remote_server_not_found,
+               "no error");
+    }
+    check (client.mod_disco.get_crawl_result(Jid("broken.localhost")) == nullptr, "timed out crawl cached");
+    check (client.mod_disco.get_crawl_result(Jid("localhost")) == trees[0], "wrong cached result");
+
+    server.stop ();
+
+    cout << num_services << " services, " << latency << " ms latency: sequential crawl "
+         << sequential_msec << " ms, window " << cfg.window << " " << window_msec << " ms" << endl;
+
+    return test_result ();
+}
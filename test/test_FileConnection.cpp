@@ -74,6 +74,7 @@ int main (int argc, char* argv[])
         });
 
     //uxmpp_log_info (THIS_FILE, "Start read");
+    in_file.register_buffer (rx_buf.data(), rx_buf.size());
     in_file.read_offset (rx_buf.data(), rx_buf.size(), 6);
 
     while (!rx_done || !tx_done)
@@ -0,0 +1,268 @@
+/*
+ *  Copyright (C) 2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp.hpp>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <atomic>
+#include <sys/socket.h>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::io;
+
+#define THIS_FILE "test_FileLatency"
+
+static constexpr int num_pings = 500;
+
+
+//-----------------------------------------------------------------------
+// Measure the round-trip time of one byte over a socket pair,
+// the socket pair is handled by the ConnectionManager.
+//-----------------------------------------------------------------------
+static vector<double> measure_rtt (Connection& a, Connection& b)
+{
+    vector<double> rtt;
+    Semaphore sem;
+    char ping = 'p';
+    char a_buf;
+    char b_buf;
+
+    b.set_rx_cb ([&](Connection& c, void* buf, ssize_t r, int e){
+            if (r > 0) {
+                c.write (&ping, 1);
+                c.read (&b_buf, 1);
+            }
+        });
+    a.set_rx_cb ([&](Connection& c, void* buf, ssize_t r, int e){
+            if (r > 0)
+                sem.post ();
+        });
+
+    b.read (&b_buf, 1);
+    for (int i=0; i<num_pings; ++i) {
+        auto start = chrono::steady_clock::now ();
+        a.read (&a_buf, 1);
+        a.write (&ping, 1);
+        if (!sem.wait(chrono::seconds(5))) {
+            cerr << "Ping timeout" << endl;
+            break;
+        }
+        auto end = chrono::steady_clock::now ();
+        rtt.push_back (chrono::duration<double, micro>(end-start).count());
+        this_thread::sleep_for (chrono::microseconds(500));
+    }
+    a.cancel ();
+    b.cancel ();
+    sort (rtt.begin(), rtt.end());
+    return rtt;
+}
+
+
+//-----------------------------------------------------------------------
+// Count the socket round trips that complete while no file read
+// completes. The socket pair is handled by the ConnectionManager, so
+// if the file is read on the ConnectionManager thread, no round trip
+// can complete while a read is in progress.
+//-----------------------------------------------------------------------
+static int count_concurrent_pings (Connection& a, Connection& b, atomic<unsigned>& reads)
+{
+    int concurrent = 0;
+    Semaphore sem;
+    char ping = 'p';
+    char a_buf;
+    char b_buf;
+
+    b.set_rx_cb ([&](Connection& c, void* buf, ssize_t r, int e){
+            if (r > 0) {
+                c.write (&ping, 1);
+                c.read (&b_buf, 1);
+            }
+        });
+    a.set_rx_cb ([&](Connection& c, void* buf, ssize_t r, int e){
+            if (r > 0)
+                sem.post ();
+        });
+
+    b.read (&b_buf, 1);
+    for (int i=0; i<num_pings; ++i) {
+        unsigned reads_before = reads;
+        a.read (&a_buf, 1);
+        a.write (&ping, 1);
+        if (!sem.wait(chrono::seconds(5))) {
+            cerr << "Ping timeout" << endl;
+            break;
+        }
+        if (reads == reads_before)
+            ++concurrent;
+    }
+    a.cancel ();
+    b.cancel ();
+    return concurrent;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static double percentile (const vector<double>& v, double p)
+{
+    if (v.empty())
+        return 0;
+    return v[min(v.size()-1, (size_t)(p * v.size()))];
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static void print_rtt (const string& label, const vector<double>& rtt)
+{
+    cout << label
+         << "p50: " << percentile(rtt, 0.5) << " us, "
+         << "p99: " << percentile(rtt, 0.99) << " us, "
+         << "max: " << (rtt.empty() ? 0 : rtt.back()) << " us" << endl;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (LogLevel::silent);
+    if (argc < 2) {
+        cerr << "Usage: test_FileLatency <large_file> [poll|io_uring|thread_pool] [chunk_size]" << endl;
+        return 1;
+    }
+
+    // The socket pair
+    //
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0, sv)) {
+        cerr << "socketpair: " << strerror(errno) << endl;
+        return 1;
+    }
+    Connection a;
+    Connection b;
+    a.set_fd (sv[0]);
+    b.set_fd (sv[1]);
+
+    // The file to read while measuring
+    //
+    FileConnection file (argv[1], O_RDONLY);
+    if (file.get_fd() == -1) {
+        cerr << "Unable to open " << argv[1] << endl;
+        return 1;
+    }
+    string backend = argc>2 ? argv[2] : "";
+    if (backend == "poll")
+        file.set_io_backend (IoBackend::poll);
+    else if (backend == "io_uring")
+        file.set_io_backend (IoBackend::io_uring);
+    else if (backend == "thread_pool")
+        file.set_io_backend (IoBackend::thread_pool);
+    switch (file.get_io_backend()) {
+    case IoBackend::poll:
+        cout << "File backend: poll" << endl;
+        break;
+    case IoBackend::io_uring:
+        cout << "File backend: io_uring" << endl;
+        break;
+    case IoBackend::thread_pool:
+        cout << "File backend: thread_pool" << endl;
+        break;
+    }
+
+    // Idle round-trip time
+    //
+    auto idle_rtt = measure_rtt (a, b);
+    print_rtt ("Idle:         ", idle_rtt);
+
+    // Round-trip time while reading the file over and over
+    //
+    size_t chunk_size = argc>3 ? stoul(argv[3]) : 1024*1024;
+    vector<char> file_buf (chunk_size);
+    atomic<bool> reading {true};
+    Semaphore read_done;
+    off_t offset = 0;
+    unsigned long long total = 0;
+    file.set_rx_cb ([&](Connection& c, void* buf, ssize_t r, int e){
+            if (!reading) {
+                read_done.post ();
+                return;
+            }
+            if (r > 0) {
+                total  += r;
+                offset += r;
+            }else{
+                offset = 0; // Start over
+            }
+            c.read_offset (file_buf.data(), file_buf.size(), offset);
+        });
+    file.read_offset (file_buf.data(), file_buf.size(), offset);
+
+    auto load_rtt = measure_rtt (a, b);
+    reading = false;
+    read_done.wait (chrono::seconds(5));
+    print_rtt ("Reading file: ", load_rtt);
+    cout << "Read " << total/(1024*1024) << " MB from file" << endl;
+
+    // Read large chunks, so each read takes long enough for several
+    // socket round trips, even when the file is in the page cache.
+    //
+    size_t big_chunk_size = max (chunk_size, (size_t)64*1024*1024);
+    vector<char> big_buf (big_chunk_size);
+    atomic<unsigned> reads {0};
+    reading = true;
+    offset = 0;
+    file.set_rx_cb ([&](Connection& c, void* buf, ssize_t r, int e){
+            ++reads;
+            if (!reading) {
+                read_done.post ();
+                return;
+            }
+            offset = r>0 ? offset+r : 0;
+            c.read_offset (big_buf.data(), big_buf.size(), offset);
+        });
+    file.read_offset (big_buf.data(), big_buf.size(), offset);
+    auto concurrent = count_concurrent_pings (a, b, reads);
+    reading = false;
+    read_done.wait (chrono::seconds(5));
+    cout << "Round trips completed during a file read: "
+         << concurrent << " of " << num_pings << " (" << reads << " reads)" << endl;
+
+    // The socket latency should stay flat. Allow for some scheduling
+    // jitter since the file reader competes for the same CPU cores.
+    //
+    double limit = max (10 * percentile(idle_rtt, 0.99), 10000.0);
+    if (percentile(load_rtt, 0.99) > limit) {
+        cout << "FAIL: p99 latency while reading the file exceeds " << limit << " us" << endl;
+        return 1;
+    }
+
+    // Sockets must be served while the file is read
+    //
+    if (concurrent < num_pings/10) {
+        cout << "FAIL: file reads block the connection manager" << endl;
+        return 1;
+    }
+    cout << "OK" << endl;
+
+    return 0;
+}
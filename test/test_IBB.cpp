@@ -0,0 +1,255 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include "TestClient.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <unistd.h>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_IBB"
+
+static constexpr size_t file_size = 2 * 1024 * 1024;
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static string read_file (const string& file)
+{
+    ifstream in (file);
+    ostringstream data;
+    data << in.rdbuf ();
+    return data.str ();
+}
+
+
+/**
+ * A client session with an IBB module.
+ */
+class Client : public TestClient {
+public:
+    Client (uint16_t port, const string& user) : TestClient (port, user) {
+        mod_ibb.set_close_handler ([this](IBBModule& module, const string& sid, uint64_t bytes,
+                                          const string& error){
+                lock_guard<std::mutex> lock (mutex);
+                closed_bytes = bytes;
+                closed_error = error;
+                closed.post ();
+            });
+        sess.register_module (mod_ibb);
+        start ();
+    }
+    ~Client () {
+        stop ();
+    }
+
+    // Wait for a stream to be closed and return the error
+    string wait_closed (uint64_t* bytes=nullptr) {
+        if (!closed.wait(chrono::seconds(30)))
+            return "no close";
+        lock_guard<std::mutex> lock (mutex);
+        if (bytes)
+            *bytes = closed_bytes;
+        return closed_error;
+    }
+
+    IBBModule mod_ibb;
+    Semaphore closed;
+    std::mutex mutex;
+    uint64_t closed_bytes;
+    string closed_error;
+};
+
+
+//-----------------------------------------------------------------------
+// Send a file from alice to bob, return the throughput in MB/s.
+//-----------------------------------------------------------------------
+static double send_file (Client& alice, Client& bob, const string& in_file, const string& out_file,
+                         size_t block_size, unsigned window)
+{
+    io::FileConnection source (in_file, O_RDONLY);
+    io::FileConnection sink (out_file, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    bob.mod_ibb.set_open_handler ([&sink](IBBModule& module, const string& sid, const Jid& from, size_t bs){
+            module.accept (sid, sink);
+        });
+
+    auto start = chrono::steady_clock::now ();
+    auto sid = alice.mod_ibb.open (bob.sess.get_jid(), source, block_size, window);
+    check (!sid.empty(), "stream not opened");
+    uint64_t bytes = 0;
+    check (bob.wait_closed(&bytes)=="" && bytes==file_size, "file not received");
+    auto usec = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start).count ();
+    check (alice.wait_closed(&bytes)=="" && bytes==file_size, "file not sent");
+    check (read_file(in_file) == read_file(out_file), "received file differs");
+
+    return static_cast<double>(file_size) / (usec ? usec : 1);
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+
+    // Streaming base64
+    //
+    {
+        string data ("\x00\xff\x10 streaming base64", 20);
+        for (size_t len=0; len<=data.size(); ++len) {
+            char encoded[32];
+            size_t n = to_base64 (data.data(), len, encoded);
+            check (n==base64_size(len) && string(encoded, n)==to_base64(data.substr(0, len)),
+                   "wrong base64 encoding");
+            char decoded[32];
+            check (from_base64(encoded, n, decoded, sizeof(decoded)) == len &&
+                   string(decoded, len) == data.substr(0, len), "wrong base64 decoding");
+            if (len > 1)
+                check (from_base64(encoded, n, decoded, len-1) == len-1, "buffer overflow");
+        }
+    }
+
+    TestServer server;
+    server.add_account ("alice", "secret");
+    server.add_account ("bob", "secret");
+    server.set_tls (false);
+    if (!server.start()) {
+        cout << "FAIL: unable to start the server" << endl;
+        return 1;
+    }
+
+    Client alice (server.get_port(), "alice");
+    Client bob (server.get_port(), "bob");
+    check (alice.bound.wait(chrono::seconds(10)) && bob.bound.wait(chrono::seconds(10)), "not bound");
+
+    // Data from memory, sent in small blocks
+    //
+    string received;
+    bob.mod_ibb.set_data_handler ([&received](IBBModule& module, const string& sid, const void* data, size_t size){
+            received.append (static_cast<const char*>(data), size);
+        });
+    bob.mod_ibb.set_open_handler ([](IBBModule& module, const string& sid, const Jid& from, size_t block_size){
+            module.accept (sid);
+        });
+    string text;
+    for (int i=0; i<1000; ++i)
+        text += "Line " + std::to_string(i) + " <&>\n";
+    auto sid = alice.mod_ibb.open (bob.sess.get_jid(), 1000, 4);
+    for (size_t pos=0; pos<text.size(); pos+=777)
+        alice.mod_ibb.send (sid, text.data()+pos, std::min(size_t(777), text.size()-pos));
+    alice.mod_ibb.close (sid);
+    uint64_t bytes = 0;
+    check (bob.wait_closed(&bytes)=="" && bytes==text.size() && received==text, "data not received");
+    check (alice.wait_closed(&bytes)=="" && bytes==text.size(), "data not sent");
+
+    // The sequence number wraps around after 65535
+    //
+    received.clear ();
+    string many (70000 * 2, 'x');
+    sid = alice.mod_ibb.open (bob.sess.get_jid(), 2, 64);
+    alice.mod_ibb.send (sid, many.data(), many.size());
+    alice.mod_ibb.close (sid);
+    check (bob.wait_closed(&bytes)=="" && received==many, "data not received after seq wrap");
+    check (alice.wait_closed()=="", "data not sent after seq wrap");
+
+    // Denied, and too large blocks
+    //
+    bob.mod_ibb.set_open_handler ([](IBBModule& module, const string& sid, const Jid& from, size_t block_size){
+            module.deny (sid);
+        });
+    alice.mod_ibb.open (bob.sess.get_jid(), 4096);
+    check (alice.wait_closed() == StanzaError::not_acceptable, "stream not denied");
+    bob.mod_ibb.set_max_block_size (1024);
+    alice.mod_ibb.open (bob.sess.get_jid(), 4096);
+    check (alice.wait_closed() == StanzaError::resource_constraint, "too large block size accepted");
+    bob.mod_ibb.set_max_block_size (65535);
+
+    // Data out of order
+    //
+    bob.mod_ibb.set_open_handler ([](IBBModule& module, const string& sid, const Jid& from, size_t block_size){
+            module.accept (sid);
+        });
+    Semaphore opened;
+    XmlObject open ("open", "http://jabber.org/protocol/ibb");
+    open.set_attribute ("sid", "out-of-order");
+    open.set_attribute ("block-size", "4096");
+    alice.sess.send_iq (IqStanza(IqType::set, bob.sess.get_jid(), alice.sess.get_jid()).add_node(open),
+                        [&opened](Session& session, IqStanza* iq){
+                            if (iq && iq->get_type()==IqType::result)
+                                opened.post ();
+                        });
+    check (opened.wait(chrono::seconds(10)), "stream not accepted");
+    XmlObject data ("data", "http://jabber.org/protocol/ibb");
+    data.set_attribute ("sid", "out-of-order");
+    data.set_attribute ("seq", "1");
+    data.set_content (to_base64("data"));
+    string condition;
+    alice.sess.send_iq (IqStanza(IqType::set, bob.sess.get_jid(), alice.sess.get_jid()).add_node(data),
+                        [&opened, &condition](Session& session, IqStanza* iq){
+                            if (iq)
+                                condition = iq->get_error().get_condition ();
+                            opened.post ();
+                        });
+    check (opened.wait(chrono::seconds(10)) && condition==StanzaError::unexpected_request,
+           "data out of order accepted");
+    check (bob.wait_closed() == StanzaError::unexpected_request, "stream not closed");
+
+    // Throughput of files over the loopback interface
+    //
+    string in_file  = "/tmp/test_IBB." + std::to_string(getpid()) + ".in";
+    string out_file = "/tmp/test_IBB." + std::to_string(getpid()) + ".out";
+    {
+        std::mt19937 rng (4711);
+        string content (file_size, '\0');
+        for (auto& c : content)
+            c = static_cast<char> (rng());
+        ofstream (in_file) << content;
+    }
+    // Without latency the throughput is limited by the CPU, with
+    // latency by the number of blocks waiting for a response.
+    //
+    cout << "latency\tblock size\twindow\tMB/s" << endl;
+    for (unsigned latency : {0, 2}) {
+        server.set_latency (latency);
+        for (size_t block_size : {4096, 16384, 65535}) {
+            for (unsigned window : {1, 4, 16}) {
+                auto mb_per_sec = send_file (alice, bob, in_file, out_file, block_size, window);
+                cout << latency << " ms\t" << block_size << "\t\t" << window << "\t"
+                     << fixed << setprecision(1) << mb_per_sec << endl;
+            }
+        }
+    }
+    ::unlink (in_file.c_str());
+    ::unlink (out_file.c_str());
+
+    server.stop ();
+
+    return test_result ();
+}
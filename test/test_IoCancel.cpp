@@ -0,0 +1,165 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestCheck.hpp"
+#include <uxmpp.hpp>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <atomic>
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::io;
+
+#define THIS_FILE "test_IoCancel"
+
+static constexpr size_t file_size = 64 * 1024 * 1024;
+
+//-----------------------------------------------------------------------
+// Write a file and drop it from the page cache,
+// so reading it takes a while.
+//-----------------------------------------------------------------------
+static bool make_file (const string& name)
+{
+    int fd = ::open (name.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    if (fd < 0)
+        return false;
+    vector<char> data (1024*1024, 'x');
+    for (size_t n=0; n<file_size; n+=data.size()) {
+        if (::write(fd, data.data(), data.size()) != (ssize_t) data.size()) {
+            ::close (fd);
+            return false;
+        }
+    }
+    fdatasync (fd);
+    posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close (fd);
+    return true;
+}
+
+
+//-----------------------------------------------------------------------
+// Start reading the whole file, stop the read with 'stop' and check
+// that the buffer isn't written to after 'stop' returns.
+//-----------------------------------------------------------------------
+template<typename F>
+static void check_stop (const string& file, IoBackend backend, const string& what, F stop)
+{
+    int fd = ::open (file.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close (fd);
+    }
+
+    auto conn = new FileConnection (file, O_RDONLY);
+    if (!conn->set_io_backend(backend)) {
+        delete conn;
+        return;
+    }
+    vector<char> buf (file_size, 0);
+    atomic<bool> called {false};
+    conn->read_offset (buf.data(), buf.size(), 0, [&called](Connection& c, void* b, ssize_t r, int e){
+            called = true;
+        });
+    this_thread::sleep_for (chrono::microseconds(200));
+    bool completed = called;
+    stop (conn);
+
+    vector<char> after_stop (buf);
+    this_thread::sleep_for (chrono::milliseconds(500));
+    check (buf==after_stop, what + ": buffer written after the read was stopped");
+    check (completed || !called, what + ": callback called after the read was stopped");
+    if (conn)
+        delete conn;
+}
+
+
+//-----------------------------------------------------------------------
+// Stop the I/O with 'stop' while a read callback is running and check
+// that 'stop' doesn't return before the callback does.
+//-----------------------------------------------------------------------
+template<typename F>
+static void check_stop_callback (const string& file, IoBackend backend, const string& what, F stop)
+{
+    auto conn = new FileConnection (file, O_RDONLY);
+    if (!conn->set_io_backend(backend)) {
+        delete conn;
+        return;
+    }
+    vector<char> buf (4096, 0);
+    atomic<bool> started {false};
+    atomic<bool> returned {false};
+    conn->read_offset (buf.data(), buf.size(), 0, [&started, &returned](Connection& c, void* b, ssize_t r, int e){
+            started = true;
+            this_thread::sleep_for (chrono::milliseconds(200));
+            returned = true;
+        });
+    for (int i=0; i<1000 && !started; ++i)
+        this_thread::sleep_for (chrono::milliseconds(1));
+    if (check(started, what + ": read not completed")) {
+        stop (conn);
+        check (returned, what + ": returned while the callback was running");
+    }
+    if (conn)
+        delete conn;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+
+    string file = "/tmp/test_IoCancel." + std::to_string(getpid());
+    if (!make_file(file)) {
+        cout << "FAIL: unable to create " << file << endl;
+        return 1;
+    }
+
+    for (auto backend : {IoBackend::io_uring, IoBackend::thread_pool}) {
+        string name = backend==IoBackend::io_uring ? "io_uring" : "thread_pool";
+        check_stop (file, backend, name + " cancel", [](FileConnection*& conn){
+                conn->cancel ();
+            });
+        check_stop (file, backend, name + " close", [](FileConnection*& conn){
+                conn->close ();
+            });
+        check_stop (file, backend, name + " delete", [](FileConnection*& conn){
+                delete conn;
+                conn = nullptr;
+            });
+        check_stop (file, backend, name + " change backend", [](FileConnection*& conn){
+                conn->set_io_backend (IoBackend::poll);
+            });
+        check_stop_callback (file, backend, name + " cancel during callback", [](FileConnection*& conn){
+                conn->cancel ();
+            });
+        check_stop_callback (file, backend, name + " delete during callback", [](FileConnection*& conn){
+                delete conn;
+                conn = nullptr;
+            });
+    }
+    ::unlink (file.c_str());
+
+    return test_result ();
+}
@@ -0,0 +1,108 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestCheck.hpp"
+#include <uxmpp.hpp>
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+using namespace uxmpp;
+
+#define THIS_FILE "test_IqCorrelator"
+
+static constexpr int num_requests = 10000;
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+
+    Jid own_jid ("user@example.com/res");
+    IqCorrelator correlator;
+    atomic<int> responses {0};
+    atomic<int> timeouts {0};
+    auto cb = [&](IqStanza* iq){
+        if (iq)
+            ++responses;
+        else
+            ++timeouts;
+    };
+
+    // Matching of id and 'from'
+    //
+    correlator.add ("a", Jid("peer@example.com/x"), cb, 10000);
+    correlator.add ("b", Jid(""), cb, 10000);
+    correlator.add ("c", Jid("example.com"), cb, 10000);
+    check (!correlator.add("a", Jid(""), cb, 10000), "duplicate id accepted");
+
+    IqStanza response (IqType::result, "user@example.com/res", "evil@example.com/x", "a");
+    check (!correlator.dispatch(response, own_jid), "response from the wrong entity accepted");
+    response = IqStanza (IqType::get, "user@example.com/res", "peer@example.com/x", "a");
+    check (!correlator.dispatch(response, own_jid), "request accepted as a response");
+    response = IqStanza (IqType::result, "user@example.com/res", "peer@example.com/x", "a");
+    check (correlator.dispatch(response, own_jid), "response not accepted");
+    check (!correlator.dispatch(response, own_jid), "response accepted twice");
+
+    response = IqStanza (IqType::error, "user@example.com/res", "user@example.com", "b");
+    check (correlator.dispatch(response, own_jid), "response from own bare jid not accepted");
+    response = IqStanza (IqType::result, "user@example.com/res", "", "c");
+    check (correlator.dispatch(response, own_jid), "response from the server without 'from' not accepted");
+    check (responses==3 && correlator.size()==0, "wrong number of responses");
+
+    // Deadlines
+    //
+    responses = 0;
+    auto start = chrono::steady_clock::now ();
+    for (int i=0; i<num_requests; ++i)
+        correlator.add (to_string(i), Jid(""), cb, 100 + (i % 5) * 50);
+    check (correlator.size() == num_requests, "requests not added");
+
+    // Answer every other request
+    //
+    for (int i=0; i<num_requests; i+=2) {
+        response = IqStanza (IqType::result, "", "", to_string(i));
+        correlator.dispatch (response, own_jid);
+    }
+    auto dispatch_time = chrono::steady_clock::now() - start;
+    cout << "Added and answered " << num_requests/2 << " of " << num_requests << " requests in "
+         << chrono::duration_cast<chrono::milliseconds>(dispatch_time).count() << " ms" << endl;
+
+    while (timeouts < num_requests/2 && chrono::steady_clock::now()-start < chrono::seconds(5))
+        this_thread::sleep_for (chrono::milliseconds(10));
+    auto elapsed = chrono::duration_cast<chrono::milliseconds> (chrono::steady_clock::now()-start);
+    cout << "Got " << timeouts << " timeouts after " << elapsed.count() << " ms" << endl;
+    check (responses == num_requests/2, "wrong number of responses");
+    check (timeouts == num_requests/2, "wrong number of timeouts");
+    check (elapsed >= chrono::milliseconds(300), "timeouts too early");
+    check (correlator.size() == 0, "requests left after the deadline");
+
+    // Cancel and abort
+    //
+    timeouts = 0;
+    correlator.add ("x", Jid(""), cb, 10000);
+    correlator.add ("y", Jid(""), cb, 10000);
+    check (correlator.cancel("x"), "cancel failed");
+    correlator.abort_all ();
+    check (timeouts == 1 && correlator.size() == 0, "abort failed");
+
+    return test_result ();
+}
@@ -0,0 +1,274 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestCheck.hpp"
+#include <uxmpp.hpp>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace uxmpp;
+
+#define THIS_FILE "test_IqFuture"
+
+static constexpr int num_queries = 500;
+
+static const string test_ns {"urn:uxmpp:test"};
+
+
+//-----------------------------------------------------------------------
+// Return the value of an attribute in an XML start tag.
+//-----------------------------------------------------------------------
+static string get_attr (const string& tag, const string& name)
+{
+    auto pos = tag.find (string(" ") + name + "='");
+    if (pos == string::npos)
+        return "";
+    pos += name.size() + 3;
+    return tag.substr (pos, tag.find('\'', pos) - pos);
+}
+
+
+//-----------------------------------------------------------------------
+// A minimal stand-in for an XMPP server. It binds a resource and
+// answers IQ requests:
+// * to 'noreply@...' - no response
+// * to 'error@...'   - item-not-found
+// * otherwise        - a result with the payload of the request
+//-----------------------------------------------------------------------
+static void run_server (int listen_fd)
+{
+    int fd = accept (listen_fd, nullptr, nullptr);
+    if (fd == -1)
+        return;
+
+    string rx;
+    char buf[4096];
+    bool stream_open = false;
+    while (true) {
+        ssize_t r = ::read (fd, buf, sizeof(buf));
+        if (r <= 0)
+            break;
+        rx.append (buf, r);
+
+        if (!stream_open) {
+            if (rx.find("<stream:stream") == string::npos || rx.find('>', rx.find("<stream:stream")) == string::npos)
+                continue;
+            stream_open = true;
+            rx.erase (0, rx.find('>', rx.find("<stream:stream")) + 1);
+            string header = "<?xml version='1.0'?><stream:stream xmlns='jabber:client' "
+                "xmlns:stream='http://etherx.jabber.org/streams' id='s1' from='localhost' version='1.0'>"
+                "<stream:features><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/></stream:features>";
+            ::write (fd, header.data(), header.size());
+        }
+
+        string tx;
+        size_t end;
+        while ((end = rx.find("</iq>")) != string::npos) {
+            string iq = rx.substr (0, end);
+            rx.erase (0, end + 5);
+            auto start = iq.find ("<iq");
+            if (start == string::npos)
+                continue;
+            iq.erase (0, start);
+            string tag  = iq.substr (0, iq.find('>'));
+            string id   = get_attr (tag, "id");
+            string to   = get_attr (tag, "to");
+            string body = iq.substr (tag.size() + 1);
+
+            if (iq.find("xmpp-bind") != string::npos) {
+                tx += "<iq type='result' id='" + id + "'><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'>"
+                    "<jid>user@localhost/test</jid></bind></iq>";
+            }
+            else if (to.find("noreply@") == 0) {
+                continue;
+            }
+            else if (to.find("error@") == 0) {
+                tx += "<iq type='error' id='" + id + "' from='" + to + "'>"
+                    "<error type='cancel'><item-not-found xmlns='urn:ietf:params:xml:ns:xmpp-stanzas'/></error></iq>";
+            }else{
+                tx += "<iq type='result' id='" + id + "' from='" + to + "'>" + body + "</iq>";
+            }
+        }
+        if (rx.find("</stream:stream>") != string::npos)
+            tx += "</stream:stream>";
+        if (!tx.empty())
+            ::write (fd, tx.data(), tx.size());
+        if (rx.find("</stream:stream>") != string::npos)
+            break;
+    }
+    ::close (fd);
+}
+
+
+/**
+ * Run the requests in an application thread when the session is bound.
+ */
+class Client : public SessionListener {
+public:
+    Client () : result{false} {}
+    ~Client () {
+        if (thread.joinable())
+            thread.join ();
+    }
+    virtual void on_state_change (Session& session, SessionState new_state, SessionState old_state) {
+        if (new_state == SessionState::bound) {
+            thread = std::thread ([this, &session](){
+                    result = run (session);
+                    session.stop ();
+                });
+        }
+    }
+    bool run (Session& session);
+    bool result;
+    std::thread thread;
+};
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+bool Client::run (Session& session)
+{
+    bool ok = true;
+
+    // Sequential requests
+    //
+    auto info = session.iq (IqType::get, Jid("peer@localhost/a"), XmlObject("query", test_ns)).get ();
+    ok = check (info.is_ok(), "no result") && ok;
+    ok = check (info.get_payload().get_full_name() == test_ns + ":query", "wrong payload") && ok;
+
+    auto error = session.iq (IqType::get, Jid("error@localhost/a"), XmlObject("query", test_ns)).get ();
+    ok = check (error.have_response() && !error.is_ok(), "no error response") && ok;
+    ok = check (error.get_error().get_condition() == StanzaError::item_not_found, "wrong error condition") && ok;
+
+    auto start = chrono::steady_clock::now ();
+    auto none = session.iq (IqType::get, Jid("noreply@localhost/a"), XmlObject("query", test_ns), 200).get ();
+    auto elapsed = chrono::steady_clock::now() - start;
+    ok = check (!none.have_response(), "response from 'noreply'") && ok;
+    ok = check (none.get_error().get_condition() == StanzaError::remote_server_timeout, "no timeout error") && ok;
+    ok = check (elapsed >= chrono::milliseconds(200), "timeout too early") && ok;
+
+    // The same number of requests, one at a time and all at once
+    //
+    start = chrono::steady_clock::now ();
+    for (int i=0; i<num_queries; ++i) {
+        Jid to ("peer" + std::to_string(i) + "@localhost/a");
+        if (!session.iq(IqType::get, to, XmlObject("query", test_ns)).get().is_ok()) {
+            ok = check (false, "sequential request failed");
+            break;
+        }
+    }
+    auto sequential = chrono::duration_cast<chrono::milliseconds> (chrono::steady_clock::now() - start);
+
+    vector<XmlObject> requests;
+    for (int i=0; i<num_queries; ++i) {
+        Jid to ("peer" + std::to_string(i) + "@localhost/a");
+        requests.push_back (IqStanza(IqType::get, to, session.get_jid()).add_node(XmlObject("query", test_ns)));
+    }
+    Semaphore all_done;
+    vector<IqResult> results;
+    start = chrono::steady_clock::now ();
+    session.iq_all (requests, [&](Session& s, vector<IqResult>& r){
+            results = r;
+            all_done.post ();
+        });
+    ok = check (all_done.wait(chrono::seconds(10)), "iq_all not done") && ok;
+    auto fan_out = chrono::duration_cast<chrono::milliseconds> (chrono::steady_clock::now() - start);
+
+    int num_ok = 0;
+    for (auto& r : results) {
+        if (r.is_ok())
+            ++num_ok;
+    }
+    ok = check (results.size() == requests.size(), "wrong number of results") && ok;
+    ok = check (num_ok == num_queries, "wrong number of successful results") && ok;
+
+    cout << num_queries << " requests, sequential: " << sequential.count() << " ms, "
+         << "iq_all: " << fan_out.count() << " ms" << endl;
+
+    // A request without a response in iq_all
+    //
+    requests.resize (1);
+    requests.push_back (IqStanza(IqType::get, Jid("noreply@localhost/a"), session.get_jid()).
+                        add_node(XmlObject("query", test_ns)));
+    session.iq_all (requests, [&](Session& s, vector<IqResult>& r){
+            results = r;
+            all_done.post ();
+        }, 200);
+    ok = check (all_done.wait(chrono::seconds(10)), "iq_all not done") && ok;
+    ok = check (results.size()==2 && results[0].is_ok() && !results[1].have_response(),
+                "wrong results from iq_all with a timeout") && ok;
+
+    return ok;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+
+    int listen_fd = socket (AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset (&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    socklen_t len = sizeof (addr);
+    if (bind(listen_fd, (struct sockaddr*)&addr, len) || listen(listen_fd, 1) ||
+        getsockname(listen_fd, (struct sockaddr*)&addr, &len))
+    {
+        cout << "FAIL: Unable to start the server" << endl;
+        return 1;
+    }
+    std::thread server ([listen_fd](){
+            run_server (listen_fd);
+        });
+
+    Session sess;
+    Client client;
+    sess.add_session_listener (client);
+    SessionConfig cfg;
+    cfg.domain      = "localhost";
+    cfg.server      = "127.0.0.1";
+    cfg.port        = ntohs (addr.sin_port);
+    cfg.disable_srv = true;
+
+    io::Timer timeout;
+    timeout.set (chrono::seconds(30), [&sess](){
+            sess.stop (true);
+        });
+    sess.run (cfg);
+    timeout.cancel ();
+    if (client.thread.joinable())
+        client.thread.join ();
+    server.join ();
+    ::close (listen_fd);
+
+    if (!check(client.result, "requests failed"))
+        return 1;
+    cout << "OK" << endl;
+    return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include "TestClient.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_MUC"
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static long usec_since (chrono::steady_clock::time_point start)
+{
+    return chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start).count ();
+}
+
+
+/**
+ * Records the events of the rooms.
+ */
+class Listener : public MucListener {
+public:
+    Listener () : history {0}, messages {0}, occupants_joined {0}, occupants_changed {0},
+        occupants_left {0}, last_message {nullptr}
+    {
+    }
+    virtual void on_room_joined (MultiUserChatModule& module, MucRoom& room) override {
+        joined.post ();
+    }
+    virtual void on_room_left (MultiUserChatModule& module, MucRoom& room, const string& error) override {
+        {
+            lock_guard<std::mutex> lock (mutex);
+            left_error = error;
+        }
+        left.post ();
+    }
+    virtual void on_occupant_joined (MultiUserChatModule& module, MucRoom& room,
+                                     const MucOccupant& occupant) override {
+        {
+            lock_guard<std::mutex> lock (mutex);
+            last_nick = occupant.nick;
+        }
+        ++occupants_joined;
+        event.post ();
+    }
+    virtual void on_occupant_changed (MultiUserChatModule& module, MucRoom& room,
+                                      const MucOccupant& occupant) override {
+        ++occupants_changed;
+        changed.post ();
+    }
+    virtual void on_occupant_left (MultiUserChatModule& module, MucRoom& room,
+                                   const MucOccupant& occupant) override {
+        {
+            lock_guard<std::mutex> lock (mutex);
+            last_nick = occupant.nick;
+        }
+        ++occupants_left;
+        event.post ();
+    }
+    virtual void on_nick_changed (MultiUserChatModule& module, MucRoom& room,
+                                  const MucOccupant& occupant, const string& old_nick) override {
+        {
+            lock_guard<std::mutex> lock (mutex);
+            last_nick = old_nick + " -> " + occupant.nick;
+        }
+        event.post ();
+    }
+    virtual void on_message (MultiUserChatModule& module, MucRoom& room,
+                             MessageStanza& msg, bool is_history) override {
+        lock_guard<std::mutex> lock (mutex);
+        if (is_history) {
+            ++history;
+            stamps.push_back (msg.find_node("urn:xmpp:delay:delay", true).get_attribute("stamp"));
+        }else{
+            ++messages;
+            last_message = &msg;
+            last_body = msg.get_body ();
+            message.post ();
+        }
+    }
+    virtual void on_subject (MultiUserChatModule& module, MucRoom& room, const string& nick) override {
+        subject.post ();
+    }
+
+    string get_last_nick () {
+        lock_guard<std::mutex> lock (mutex);
+        return last_nick;
+    }
+
+    std::mutex mutex;
+    Semaphore joined;
+    Semaphore left;
+    Semaphore event;
+    Semaphore changed;
+    Semaphore message;
+    Semaphore subject;
+    string left_error;
+    string last_nick;
+    string last_body;
+    vector<string> stamps;
+    unsigned history;
+    unsigned messages;
+    std::atomic<unsigned> occupants_joined;
+    std::atomic<unsigned> occupants_changed;
+    std::atomic<unsigned> occupants_left;
+    const void* last_message;
+};
+
+
+/**
+ * A client session with a multi-user chat module,
+ * registered before the presence and message modules.
+ */
+class Client : public TestClient {
+public:
+    Client (uint16_t port, const string& user) : TestClient (port, user) {
+        mod_muc.add_listener (listener);
+        sess.register_module (mod_muc);
+        sess.register_module (mod_presence);
+        sess.register_module (mod_msg);
+        start ();
+    }
+    ~Client () {
+        stop ();
+    }
+
+    MultiUserChatModule mod_muc;
+    PresenceModule mod_presence;
+    MessageModule mod_msg;
+    Listener listener;
+};
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+    const auto timeout = chrono::seconds (10);
+
+    TestServer server;
+    server.add_account ("alice", "secret");
+    server.add_account ("bob", "secret");
+    server.add_room ("big@localhost", 10000, 50);
+    server.add_room ("small@localhost", 10, 20);
+    for (size_t n : {1000, 10000, 20000})
+        server.add_room ("bench" + std::to_string(n) + "@localhost", n);
+    server.set_tls (false);
+    if (!server.start()) {
+        cout << "FAIL: unable to start the server" << endl;
+        return 1;
+    }
+
+    Client alice (server.get_port(), "alice");
+    Client bob (server.get_port(), "bob");
+    check (alice.bound.wait(timeout) && bob.bound.wait(timeout), "not bound");
+    Jid big ("big@localhost");
+    Jid small ("small@localhost");
+
+    // Join a large room, the occupants are delivered in one batch
+    //
+    Listener second;
+    alice.mod_muc.add_listener (second);
+    auto room = alice.mod_muc.join (big, "alice", MucHistory(5));
+    check (room && !alice.mod_muc.join(big, "alice"), "not joining, or joining twice");
+    check (alice.listener.joined.wait(timeout) && alice.listener.subject.wait(timeout), "not joined");
+    check (room->get_state()==MucRoomState::joined && room->size()==10001 &&
+           alice.listener.occupants_joined==0, "occupants not batched");
+    check (alice.listener.history==5 && room->get_subject()=="Room big@localhost", "wrong history or subject");
+    auto occupant = room->find ("occupant42");
+    check (occupant && occupant->jid=="occupant42@localhost/muc" && occupant->role==MucRole::participant,
+           "occupant not found");
+    occupant = room->find_by_jid ("occupant4242@localhost/muc");
+    check (occupant && occupant->nick=="occupant4242", "occupant not found by JID");
+    check (room->get_self() && room->get_self()->jid==to_string(alice.sess.get_jid()), "self not found");
+
+    // Incremental updates
+    //
+    auto bob_room = bob.mod_muc.join (big, "bob", MucHistory(0));
+    check (bob_room && bob.listener.joined.wait(timeout) && bob.listener.subject.wait(timeout) &&
+           bob.listener.history==0, "bob not joined");
+    check (alice.listener.event.wait(timeout) && alice.listener.get_last_nick()=="bob" &&
+           room->find_by_jid(to_string(bob.sess.get_jid())), "bob not seen joining");
+
+    bob.mod_muc.change_nick (big, "robert");
+    check (alice.listener.event.wait(timeout) && alice.listener.get_last_nick()=="bob -> robert",
+           "nickname change not seen");
+    check (!room->find("bob") && room->find_by_jid(to_string(bob.sess.get_jid()))->nick=="robert",
+           "nickname not changed");
+    check (bob.listener.event.wait(timeout) && bob_room->get_nick()=="robert", "own nickname not changed");
+
+    server.room_presence ("big@localhost", "occupant7", "away");
+    server.room_presence ("big@localhost", "occupant7", "away"); // No change
+    server.room_presence ("big@localhost", "occupant8", "dnd");
+    check (alice.listener.changed.wait(timeout) && alice.listener.changed.wait(timeout) &&
+           alice.listener.occupants_changed==2, "wrong number of changes");
+    check (room->find("occupant7")->show==PresenceShow::away, "presence not updated");
+    server.room_presence ("big@localhost", "occupant9", "unavailable");
+    check (alice.listener.event.wait(timeout) && alice.listener.occupants_left==1 &&
+           room->size()==10001 && !room->find("occupant9"), "occupant not removed");
+
+    // All listeners get the same message
+    //
+    check (!bob.mod_muc.send_message(big, "Hello").empty(), "message not sent");
+    check (alice.listener.message.wait(timeout) && second.message.wait(timeout) &&
+           bob.listener.message.wait(timeout), "message not received");
+    check (alice.listener.last_body=="Hello" && alice.listener.last_message==second.last_message,
+           "message copied per listener");
+    alice.mod_muc.del_listener (second);
+
+    bob.mod_muc.leave (big);
+    check (bob.listener.left.wait(timeout) && bob.listener.left_error.empty() &&
+           !bob.mod_muc.get_room(big), "bob didn't leave");
+    check (alice.listener.event.wait(timeout) && alice.listener.get_last_nick()=="robert" &&
+           room->size()==10000, "bob not seen leaving");
+
+    // Nickname in use
+    //
+    check (bob.mod_muc.join(small, "occupant3") && bob.listener.left.wait(timeout) &&
+           bob.listener.left_error==StanzaError::conflict && !bob.mod_muc.get_room(small), "no conflict");
+
+    // History since a time
+    //
+    bob.mod_muc.join (small, "bob", MucHistory(3));
+    check (bob.listener.subject.wait(timeout) && bob.listener.history==3, "wrong history");
+    bob.mod_muc.leave (small);
+    check (bob.listener.left.wait(timeout), "bob didn't leave");
+    auto since = bob.listener.stamps[1];
+    bob.listener.history = 0;
+    bob.mod_muc.join (small, "bob", MucHistory(-1, -1, since));
+    check (bob.listener.subject.wait(timeout) && bob.listener.history==2, "wrong history since " + since);
+
+    // Join time, and presence updates
+    //
+    cout << "occupants\tjoin ms\tpresence updates/s" << endl;
+    for (size_t n : {1000, 10000, 20000}) {
+        string room_jid = "bench" + std::to_string(n) + "@localhost";
+        auto start = chrono::steady_clock::now ();
+        auto bench = alice.mod_muc.join (Jid(room_jid), "alice", MucHistory(0));
+        check (bench && alice.listener.joined.wait(chrono::seconds(60)), "not joined");
+        auto join_usec = usec_since (start);
+        check (bench->size()==n+1, "wrong number of occupants");
+
+        start = chrono::steady_clock::now ();
+        unsigned changed = alice.listener.occupants_changed;
+        for (size_t i=0; i<n; ++i)
+            server.room_presence (room_jid, "occupant" + std::to_string(i), "away");
+        for (size_t i=0; i<n; ++i)
+            alice.listener.changed.wait (chrono::seconds(10));
+        auto update_usec = usec_since (start);
+        check (alice.listener.occupants_changed==changed+n, "updates lost");
+
+        cout << n << "\t\t" << join_usec/1000 << "\t" << n*1000000/(update_usec ? update_usec : 1) << endl;
+        alice.mod_muc.leave (Jid(room_jid));
+        check (alice.listener.left.wait(timeout), "not left");
+    }
+
+    // The rooms are left when the session closes
+    //
+    alice.sess.stop ();
+    check (alice.listener.left.wait(timeout) && alice.listener.left_error==StanzaError::remote_server_timeout,
+           "room not left when the session closed");
+
+    server.stop ();
+    return test_result ();
+}
@@ -0,0 +1,206 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestCheck.hpp"
+#include <uxmpp.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+using namespace uxmpp;
+
+#define THIS_FILE "test_Metrics"
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static bool contains (const string& text, const string& what)
+{
+    return text.find(what) != string::npos;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static const MetricSample* find_sample (const vector<MetricSample>& samples,
+                                        const string& name,
+                                        const string& labels)
+{
+    for (auto& sample : samples) {
+        if (sample.name==name && sample.labels==labels)
+            return &sample;
+    }
+    return nullptr;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static string read_socket (const string& path)
+{
+    struct sockaddr_un addr;
+    memset (&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, path.c_str());
+    int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))) {
+        close (fd);
+        return "";
+    }
+    string text;
+    char buf[1024];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        text.append (buf, n);
+    close (fd);
+    return text;
+}
+
+
+/**
+ * A session that lets us pass XML objects directly to the modules.
+ */
+class TestSession : public Session {
+public:
+    void dispatch (XmlObject xml_obj) {
+        on_rx_xml_obj (xs, xml_obj);
+    }
+};
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+    auto& metrics = Metrics::get_instance ();
+
+    // The registry
+    //
+    auto counter = metrics.add (MetricType::counter, "test_events_total", "Test events.", "kind=\"a\"");
+    auto gauge   = metrics.add (MetricType::gauge, "test_depth", "Test depth.");
+    auto summary = metrics.add (MetricType::summary, "test_seconds", "Test time.", "", 1e-3);
+    check (metrics.add(MetricType::counter, "test_events_total", "", "kind=\"a\"") == counter,
+           "same name and labels gave a new metric");
+    check (metrics.add(MetricType::counter, "test_events_total", "", "kind=\"b\"") != counter,
+           "other labels gave the same metric");
+    counter->inc ();
+    counter->inc (4);
+    gauge->set (10);
+    gauge->dec (3);
+    summary->observe (250);
+    summary->observe (750);
+
+    auto samples = metrics.snapshot ();
+    auto sample = find_sample (samples, "test_events_total", "kind=\"a\"");
+    check (sample && sample->value==5, "counter value");
+    sample = find_sample (samples, "test_depth", "");
+    check (sample && sample->value==7, "gauge value");
+    sample = find_sample (samples, "test_seconds", "");
+    check (sample && sample->value==1.0 && sample->count==2, "scaled summary value");
+
+    // Prometheus text format
+    //
+    auto text = metrics.to_prometheus ();
+    check (contains(text, "# HELP test_events_total Test events.\n"), "HELP line");
+    check (contains(text, "# TYPE test_events_total counter\n"), "TYPE line");
+    check (contains(text, "test_events_total{kind=\"a\"} 5\n"), "counter line");
+    check (contains(text, "test_events_total{kind=\"b\"} 0\n"), "second counter line");
+    check (contains(text, "test_depth 7\n"), "gauge line");
+    check (contains(text, "test_seconds_sum 1\n"), "summary sum line");
+    check (contains(text, "test_seconds_count 2\n"), "summary count line");
+
+    metrics.remove (gauge);
+    check (!contains(metrics.to_prometheus(), "test_depth"), "removed metric still exported");
+
+    // XML stream metrics come and go with the stream
+    //
+    {
+        XmlStream xs (XmlObject("stream", "http://etherx.jabber.org/streams"));
+        check (contains(metrics.to_prometheus(), "uxmpp_xmlstream_rx_bytes_total{stream="),
+               "no XML stream metrics");
+    }
+    check (!contains(metrics.to_prometheus(), "uxmpp_xmlstream_rx_bytes_total{stream="),
+           "XML stream metrics left after the stream is gone");
+
+    // Session and module metrics
+    //
+    {
+        TestSession sess;
+        mod::PingModule mod_ping;
+        sess.register_module (mod_ping);
+        IqStanza ping (IqType::get, "bob@example.com/desktop", "example.com", "p1");
+        ping.add_node (XmlObject("ping", "urn:xmpp:ping"));
+        sess.dispatch (ping);
+        sess.dispatch (ping);
+        samples = metrics.snapshot ();
+        sample = find_sample (samples, "uxmpp_session_module_seconds", "module=\"mod_ping\"");
+        check (sample && sample->count==2, "module metric not updated");
+        sample = find_sample (samples, "uxmpp_session_module_seconds", "module=\"core\"");
+        check (sample && sample->count==2, "core module metric not updated");
+    }
+
+    // Timer metrics
+    //
+    {
+        io::Timer timer;
+        Semaphore fired;
+        timer.set (chrono::milliseconds(1), [&fired](){fired.post();});
+        fired.wait ();
+        samples = metrics.snapshot ();
+        sample = find_sample (samples, "uxmpp_timer_expiry_lag_seconds", "");
+        check (sample && sample->count>=1, "timer lag not updated");
+        sample = find_sample (samples, "uxmpp_timer_armed", "");
+        check (sample && sample->value==0, "armed timers");
+    }
+
+    // Export to a file
+    //
+    string file = "/tmp/test_Metrics." + std::to_string(getpid()) + ".prom";
+    check (metrics.write_file(file), "write_file failed");
+    ifstream in (file);
+    stringstream ss;
+    ss << in.rdbuf ();
+    check (contains(ss.str(), "test_events_total{kind=\"a\"} 5\n"), "bad file content");
+    unlink (file.c_str());
+
+    check (metrics.export_to_file(file, 10), "export_to_file failed");
+    this_thread::sleep_for (chrono::milliseconds(100));
+    metrics.stop_export ();
+    check (access(file.c_str(), F_OK) == 0, "file not exported");
+    unlink (file.c_str());
+
+    // Export to a socket
+    //
+    string path = "/tmp/test_Metrics." + std::to_string(getpid()) + ".sock";
+    check (metrics.export_to_socket(path), "export_to_socket failed");
+    counter->inc ();
+    check (contains(read_socket(path), "test_events_total{kind=\"a\"} 6\n"), "bad socket content");
+    check (contains(read_socket(path), "test_events_total{kind=\"a\"} 6\n"), "second client");
+    metrics.stop_export ();
+    check (access(path.c_str(), F_OK) != 0, "socket not removed");
+
+    return test_result ();
+}
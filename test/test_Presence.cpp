@@ -0,0 +1,135 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestCheck.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <iostream>
+#include <string>
+#include <chrono>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_Presence"
+
+static constexpr int num_contacts = 5000;
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static PresenceStanza presence (const string& from, const string& show="", int priority=0,
+                                const string& status="")
+{
+    PresenceStanza pr ("", from);
+    if (!show.empty())
+        pr.set_show (show);
+    if (priority)
+        pr.set_priority (priority);
+    if (!status.empty())
+        pr.add_node (XmlObject("status", xml::namespace_jabber_client, false).set_content(status));
+    return pr;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+
+    PresenceTable table;
+    int changes = 0;
+    string changed_resource;
+    bool went_offline = false;
+    table.set_change_handler ([&](PresenceTable& t, const Jid& jid, const ResourcePresence* best){
+            ++changes;
+            went_offline = best == nullptr;
+            changed_resource = best ? best->resource : "";
+        });
+
+    // Aggregate the resources of a contact
+    //
+    auto pr = presence ("bob@example.com/phone", "away", 1, "On the road");
+    check (table.update(pr) && changes==1 && changed_resource=="phone", "first resource not added");
+    pr = presence ("bob@example.com/laptop", "chat", 5);
+    check (table.update(pr) && changes==2 && changed_resource=="laptop", "better resource not best");
+    pr = presence ("bob@example.com/tablet", "", 5);
+    check (table.update(pr) && changes==2, "notified for a worse resource");
+    check (table.update(pr) == false && changes==2, "notified for a duplicate presence");
+
+    auto best = table.get_best (Jid("bob@example.com"));
+    check (best && best->resource=="laptop" && best->show==PresenceShow::chat && best->priority==5,
+           "wrong best resource");
+    auto phone = table.get_resource (Jid("bob@example.com/phone"));
+    check (phone && phone->status=="On the road" && phone->show==PresenceShow::away, "wrong resource");
+    check (table.find(Jid("bob@example.com"))->resources.size() == 3, "wrong number of resources");
+
+    // The best resource gets worse, and leaves
+    //
+    pr = presence ("bob@example.com/laptop", "xa", 5);
+    check (table.update(pr) && changes==3 && changed_resource=="tablet", "best not recalculated");
+    pr = presence ("bob@example.com/tablet");
+    pr.set_attribute ("type", "unavailable");
+    check (table.update(pr) && changes==4 && changed_resource=="laptop", "best not replaced");
+    pr = presence ("bob@example.com/phone");
+    pr.set_attribute ("type", "unavailable");
+    check (table.update(pr) && changes==4, "notified when a worse resource left");
+    check (table.get_best(Jid("bob@example.com"))->resource == "laptop", "wrong best after remove");
+    pr = presence ("bob@example.com/laptop");
+    pr.set_attribute ("type", "unavailable");
+    check (table.update(pr) && changes==5 && went_offline, "contact not unavailable");
+    check (!table.is_available(Jid("bob@example.com")) && table.size()==0, "contact still in table");
+
+    // Subscription requests don't change the table
+    //
+    pr = presence ("carol@example.com");
+    pr.set_subscribe_op (SubscribeOp::subscribe);
+    check (!table.update(pr) && table.size()==0, "subscription request in table");
+
+    // A login presence flood
+    //
+    changes = 0;
+    vector<PresenceStanza> flood;
+    for (int i=0; i<num_contacts; ++i) {
+        string contact = string("contact") + std::to_string(i) + "@example.com";
+        flood.push_back (presence(contact + "/desktop", "", 0, "Working"));
+        flood.push_back (presence(contact + "/phone", (i%2) ? "away" : "", 1));
+    }
+    auto start = chrono::steady_clock::now ();
+    for (auto& stanza : flood)
+        table.update (stanza);
+    auto usec = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start).count ();
+    check (table.size()==num_contacts && changes==2*num_contacts, "wrong table after flood");
+    best = table.get_best (Jid("contact7@example.com/desktop"));
+    check (best && best->resource=="phone" && best->show==PresenceShow::away, "wrong best after flood");
+
+    start = chrono::steady_clock::now ();
+    int available = 0;
+    for (int i=0; i<num_contacts; ++i) {
+        if (table.is_available(Jid(string("contact") + std::to_string(i) + "@example.com")))
+            ++available;
+    }
+    auto lookup_usec = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start).count ();
+    check (available == num_contacts, "contacts not available");
+
+    cout << 2*num_contacts << " presence updates: " << usec << " us, "
+         << num_contacts << " lookups: " << lookup_usec << " us" << endl;
+
+    return test_result ();
+}
@@ -0,0 +1,236 @@
+/*
+ *  Copyright (C) 2013,2014 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include "TestClient.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <thread>
+#include <chrono>
+#include <ctime>
+#include <cstdlib>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_PresenceBatch"
+
+static constexpr int num_contacts = 2000;
+static const string last_jid {"last@example.com/end"};
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static string contact (int n)
+{
+    return string("contact") + std::to_string(n) + "@example.com";
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static long cpu_usec ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec*1000000L + ts.tv_nsec/1000L;
+}
+
+
+/**
+ * A client that "renders" its contact list, a pass over the presence
+ * table, each time it is told about presence updates.
+ */
+class Client : public TestClient {
+public:
+    Client (uint16_t port, bool batched)
+        : TestClient (port, "alice", batched ? "batched" : "plain"), renders{0}, updates{0}
+    {
+        if (batched) {
+            mod_presence.set_batch_handler ([this](PresenceModule& pm, vector<PresenceStanza>& batch){
+                    bool done = false;
+                    for (auto& pr : batch) {
+                        auto from = pr.get_attribute ("from");
+                        if (Jid(from).bare() == sess.get_jid().bare())
+                            continue; // Our own presence
+                        last_show[from] = pr.get_show ();
+                        ++updates;
+                        done = done || from==last_jid;
+                    }
+                    render (done);
+                });
+        }else{
+            mod_presence.set_presence_handler ([this](PresenceModule& pm, PresenceStanza& pr){
+                    auto from = pr.get_attribute ("from");
+                    if (Jid(from).bare() == sess.get_jid().bare())
+                        return; // Our own presence
+                    last_show[from] = pr.get_show ();
+                    ++updates;
+                    render (from == last_jid);
+                });
+        }
+        sess.register_module (mod_presence);
+        start ();
+    }
+    ~Client () {
+        stop ();
+    }
+    void render (bool done) {
+        ++renders;
+        size_t away = 0;
+        for (auto& entry : mod_presence.get_table().get_contacts())
+            away += entry.second.get_best().show == PresenceShow::away;
+        num_away = away;
+        if (done) {
+            settled_time = chrono::steady_clock::now ();
+            settled_cpu  = cpu_usec ();
+            settled.post ();
+        }
+    }
+
+    PresenceModule mod_presence;
+    unsigned renders;
+    unsigned updates;
+    size_t num_away;
+    unordered_map<string, string> last_show;
+    chrono::steady_clock::time_point settled_time;
+    long settled_cpu;
+    Semaphore settled;
+};
+
+
+//-----------------------------------------------------------------------
+// Log in and announce our presence. Return the time until the
+// client has rendered the final presence of all contacts.
+//-----------------------------------------------------------------------
+static void login (uint16_t port, bool batched, long& usec, long& cpu)
+{
+    Client client (port, batched);
+    const char* mode = batched ? "batched" : "per stanza";
+    check (client.bound.wait(chrono::seconds(10)), string("not bound, ") + mode);
+
+    auto start = chrono::steady_clock::now ();
+    auto start_cpu = cpu_usec ();
+    client.mod_presence.announce ();
+    check (client.settled.wait(chrono::seconds(60)), string("presence not settled, ") + mode);
+    usec = chrono::duration_cast<chrono::microseconds> (client.settled_time - start).count ();
+    cpu  = client.settled_cpu - start_cpu;
+
+    // The last presence from each resource wins.
+    // The table also has our own presence.
+    check (client.mod_presence.get_table().size() == num_contacts+2, string("wrong table size, ") + mode);
+    check (client.num_away == num_contacts/2, string("wrong rendered state, ") + mode);
+    check (client.last_show.size() == 2*num_contacts+1, string("missing resources, ") + mode);
+    check (client.last_show[contact(1) + "/phone"] == "away" &&
+           client.last_show[contact(2) + "/phone"] == "", string("wrong last presence, ") + mode);
+    if (batched) {
+        check (client.updates < 4*num_contacts, "batch not deduplicated");
+        check (client.renders < 10, "too many batches");
+    }else{
+        check (client.updates == 4*num_contacts+1, "wrong number of presence stanzas");
+    }
+    cout << mode << ": " << client.updates << " updates in " << client.renders << " callbacks" << endl;
+}
+
+
+//-----------------------------------------------------------------------
+// A batch handler may flush the batch and change the batch handler.
+// Return false if the handler deadlocks.
+//-----------------------------------------------------------------------
+static bool reentrant_handler ()
+{
+    Session session;
+    PresenceModule mod_presence;
+    session.register_module (mod_presence);
+    size_t delivered = 0;
+    mod_presence.set_batch_handler ([&delivered](PresenceModule& pm, vector<PresenceStanza>& batch){
+            delivered += batch.size ();
+            pm.flush_batch ();
+            pm.set_batch_handler (nullptr);
+        });
+    PresenceStanza pr ("", contact(0) + "/desktop");
+    mod_presence.process_xml_object (session, pr);
+
+    Semaphore done;
+    std::thread t ([&mod_presence, &done](){
+            mod_presence.flush_batch ();
+            done.post ();
+        });
+    if (!check(done.wait(chrono::seconds(5)), "batch handler deadlocked")) {
+        t.detach ();
+        return false;
+    }
+    t.join ();
+    check (delivered == 1, "wrong batch size");
+    session.unregister_module (mod_presence);
+    return true;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+
+    if (!reentrant_handler())
+        exit (test_result()); // Don't wait for the deadlocked thread
+
+    // Each contact has two resources, and the phone changes its presence
+    // once during the burst. Odd contacts end up away.
+    //
+    TestServer server;
+    server.add_account ("alice", "secret");
+    for (int i=0; i<num_contacts; ++i) {
+        PresenceStanza desktop ("", contact(i) + "/desktop");
+        server.add_contact_presence ("alice", desktop);
+        PresenceStanza phone ("", contact(i) + "/phone");
+        phone.set_priority (1);
+        server.add_contact_presence ("alice", PresenceStanza(phone).set_show(i%2 ? "" : "away"));
+    }
+    for (int i=0; i<num_contacts; ++i) {
+        PresenceStanza phone ("", contact(i) + "/phone");
+        phone.set_priority (1);
+        server.add_contact_presence ("alice", PresenceStanza(phone).set_show(i%2 ? "away" : ""));
+    }
+    for (int i=0; i<num_contacts; ++i) {
+        PresenceStanza desktop ("", contact(i) + "/desktop");
+        server.add_contact_presence ("alice", desktop.set_status("Working"));
+    }
+    server.add_contact_presence ("alice", PresenceStanza("", last_jid));
+    server.set_tls (false);
+    if (!server.start()) {
+        cout << "FAIL: unable to start the server" << endl;
+        return 1;
+    }
+
+    long plain_usec, plain_cpu;
+    long batched_usec, batched_cpu;
+    login (server.get_port(), false, plain_usec, plain_cpu);
+    login (server.get_port(), true, batched_usec, batched_cpu);
+    server.stop ();
+
+    cout << 4*num_contacts+1 << " presence stanzas, announce to settled: per stanza " << plain_usec
+         << " us (cpu " << plain_cpu << " us), batched " << batched_usec
+         << " us (cpu " << batched_cpu << " us)" << endl;
+
+    return test_result ();
+}
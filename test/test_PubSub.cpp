@@ -0,0 +1,331 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include "TestClient.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_PubSub"
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static long usec_since (chrono::steady_clock::time_point start)
+{
+    return chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start).count ();
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static XmlObject entry (const string& text)
+{
+    return XmlObject("entry", "urn:uxmpp:test").set_content (text);
+}
+
+
+/**
+ * A client session with a pubsub module that records
+ * the items and the results of its requests.
+ */
+class Client : public TestClient {
+public:
+    Client (uint16_t port, const string& user) : TestClient (port, user), num_items {0}, num_published {0} {
+        mod_pubsub.set_item_handler ([this](PubSubModule& module, const Jid& service,
+                                            const string& node, const XmlObject& item){
+                {
+                    lock_guard<std::mutex> lock (mutex);
+                    last_item = node + "/" + item.get_attribute("id");
+                }
+                ++num_items;
+                item_received.post ();
+            });
+        mod_pubsub.set_retract_handler ([this](PubSubModule& module, const Jid& service,
+                                               const string& node, const string& id){
+                {
+                    lock_guard<std::mutex> lock (mutex);
+                    last_retracted = node + "/" + id;
+                }
+                retracted.post ();
+            });
+        sess.register_module (mod_pubsub);
+        start ();
+    }
+    ~Client () {
+        stop ();
+    }
+
+    PubSubModule::publish_cb_t on_published () {
+        return [this](PubSubModule& module, const string& id, const string& error){
+            {
+                lock_guard<std::mutex> lock (mutex);
+                published.push_back (id);
+                publish_errors.push_back (error);
+            }
+            ++num_published;
+            publish_done.post ();
+        };
+    }
+    PubSubModule::result_cb_t on_result () {
+        return [this](PubSubModule& module, const string& error){
+            {
+                lock_guard<std::mutex> lock (mutex);
+                last_error = error;
+            }
+            done.post ();
+        };
+    }
+    string get_last_item () {
+        lock_guard<std::mutex> lock (mutex);
+        return last_item;
+    }
+    void clear_published () {
+        lock_guard<std::mutex> lock (mutex);
+        published.clear ();
+        publish_errors.clear ();
+        num_published = 0;
+    }
+
+    PubSubModule mod_pubsub;
+    Semaphore item_received;
+    Semaphore retracted;
+    Semaphore publish_done;
+    Semaphore done;
+    std::mutex mutex;
+    string last_item;
+    string last_retracted;
+    string last_error;
+    vector<string> published;
+    vector<string> publish_errors;
+    std::atomic<unsigned> num_items;
+    std::atomic<unsigned> num_published;
+};
+
+
+//-----------------------------------------------------------------------
+// Publish items to a node and return the number of items per second.
+//-----------------------------------------------------------------------
+static long publish_rate (Client& client, const Jid& service, const string& node,
+                          unsigned num, unsigned window, unsigned batch)
+{
+    client.clear_published ();
+    client.mod_pubsub.set_publish_window (window);
+    client.mod_pubsub.set_publish_batch (batch);
+
+    auto start = chrono::steady_clock::now ();
+    for (unsigned i=0; i<num; ++i)
+        client.mod_pubsub.publish (service, node, entry("Reading " + std::to_string(i)), "", client.on_published());
+    for (unsigned i=0; i<num; ++i) {
+        if (!client.publish_done.wait(chrono::seconds(30)))
+            break;
+    }
+    auto usec = usec_since (start);
+    check (client.num_published==num, "benchmark items not published");
+    return usec ? (long) (num * 1000000.0 / usec) : 0;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+    const auto timeout = chrono::seconds (10);
+
+    TestServer server;
+    server.add_account ("alice", "secret");
+    server.add_account ("bob", "secret");
+    server.add_pubsub_service ("pubsub.localhost");
+    server.add_pubsub_service ("batch.localhost", 32);
+    server.set_tls (false);
+    if (!server.start()) {
+        cout << "FAIL: unable to start the server" << endl;
+        return 1;
+    }
+
+    Client alice (server.get_port(), "alice");
+    Client bob (server.get_port(), "bob");
+    check (alice.bound.wait(timeout) && bob.bound.wait(timeout), "not bound");
+    Jid pubsub ("pubsub.localhost");
+
+    // Subscribe and receive an event
+    //
+    bob.mod_pubsub.subscribe (pubsub, "news", bob.on_result());
+    check (bob.done.wait(timeout) && bob.last_error.empty(), "not subscribed");
+    PubSubSubscription subscription;
+    check (bob.mod_pubsub.get_subscription(pubsub, "news", subscription) &&
+           subscription.state=="subscribed" && !subscription.subid.empty() &&
+           subscription.jid==bob.sess.get_jid().bare(), "wrong subscription");
+
+    alice.mod_pubsub.publish (pubsub, "news", entry("one"), "1", alice.on_published());
+    check (alice.publish_done.wait(timeout) && alice.published.back()=="1" &&
+           alice.publish_errors.back().empty(), "item not published");
+    check (bob.item_received.wait(timeout) && bob.get_last_item()=="news/1", "no event");
+
+    // An item already received as an event is not passed again when fetched
+    //
+    vector<XmlObject> fetched;
+    bob.mod_pubsub.fetch_items (pubsub, "news", [&](PubSubModule& module, const string& error,
+                                                    const vector<XmlObject>& items){
+            fetched = items;
+            bob.done.post ();
+        });
+    check (bob.done.wait(timeout) && fetched.size()==1 && fetched[0].get_attribute("id")=="1",
+           "wrong fetch result");
+    check (bob.num_items == 1, "duplicate item from fetch");
+
+    // A changed item with the same ID is passed, an unchanged one isn't
+    //
+    alice.mod_pubsub.publish (pubsub, "news", entry("one again"), "1");
+    check (bob.item_received.wait(timeout) && bob.num_items==2, "changed item not passed");
+    alice.mod_pubsub.publish (pubsub, "news", entry("one again"), "1");
+    alice.mod_pubsub.publish (pubsub, "news", entry("two"), "2");
+    check (bob.item_received.wait(timeout) && bob.get_last_item()=="news/2" && bob.num_items==3,
+           "unchanged item passed");
+    XmlObject cached;
+    check (bob.mod_pubsub.get_cache().find("pubsub.localhost", "news", "1", cached) &&
+           cached.find_node("urn:uxmpp:test:entry", true).get_content()=="one again", "cache not updated");
+
+    // Fetch before subscribing, the last item sent on subscribe isn't passed again
+    //
+    alice.mod_pubsub.publish (pubsub, "weather", entry("sunny"), "w1", alice.on_published());
+    check (alice.publish_done.wait(timeout), "item not published");
+    bob.mod_pubsub.fetch_items (pubsub, "weather", nullptr, 1);
+    check (bob.item_received.wait(timeout) && bob.get_last_item()=="weather/w1", "fetched item not passed");
+    bob.mod_pubsub.subscribe (pubsub, "weather", bob.on_result());
+    check (bob.done.wait(timeout) && bob.last_error.empty(), "not subscribed");
+    alice.mod_pubsub.publish (pubsub, "weather", entry("rain"), "w2");
+    check (bob.item_received.wait(timeout) && bob.get_last_item()=="weather/w2" && bob.num_items==5,
+           "last item passed twice");
+
+    // Retract
+    //
+    alice.mod_pubsub.retract (pubsub, "news", "2", alice.on_result());
+    check (alice.done.wait(timeout) && alice.last_error.empty(), "not retracted");
+    check (bob.retracted.wait(timeout) && bob.last_retracted=="news/2" &&
+           bob.mod_pubsub.get_cache().size("pubsub.localhost", "news")==1, "retract not handled");
+    alice.mod_pubsub.retract (pubsub, "news", "2", alice.on_result());
+    check (alice.done.wait(timeout) && alice.last_error==StanzaError::item_not_found, "retracted twice");
+
+    // Subscription management
+    //
+    vector<PubSubSubscription> subscriptions;
+    bob.mod_pubsub.get_subscriptions (pubsub, [&](PubSubModule& module, const string& error,
+                                                  const vector<PubSubSubscription>& result){
+            subscriptions = result;
+            bob.done.post ();
+        });
+    check (bob.done.wait(timeout) && subscriptions.size()==2, "wrong subscriptions");
+    bob.mod_pubsub.unsubscribe (pubsub, "news", bob.on_result());
+    check (bob.done.wait(timeout) && bob.last_error.empty() &&
+           !bob.mod_pubsub.get_subscription(pubsub, "news", subscription), "not unsubscribed");
+    bob.mod_pubsub.unsubscribe (pubsub, "news", bob.on_result());
+    check (bob.done.wait(timeout) && !bob.last_error.empty(), "unsubscribed twice");
+    alice.mod_pubsub.publish (pubsub, "news", entry("three"), "3");
+    alice.mod_pubsub.publish (pubsub, "weather", entry("snow"), "w3");
+    check (bob.item_received.wait(timeout) && bob.get_last_item()=="weather/w3",
+           "event from an unsubscribed node");
+
+    // The cache keeps the most recent items of each node
+    //
+    bob.mod_pubsub.get_cache().set_max_items (10);
+    bob.mod_pubsub.subscribe (pubsub, "bulk", bob.on_result());
+    check (bob.done.wait(timeout), "not subscribed");
+    for (int i=0; i<20; ++i)
+        alice.mod_pubsub.publish (pubsub, "bulk", entry("bulk"), "b" + std::to_string(i), alice.on_published());
+    bool all = true;
+    for (int i=0; i<20; ++i)
+        all = all && bob.item_received.wait(timeout) && alice.publish_done.wait(timeout);
+    auto bulk = bob.mod_pubsub.get_cache().get_items ("pubsub.localhost", "bulk");
+    check (all && bulk.size()==10 && bulk.front().get_attribute("id")=="b10" &&
+           bulk.back().get_attribute("id")=="b19", "cache not bounded");
+
+    // Items queued while the window is full share publish requests.
+    // Each request is delayed so all items are queued before the first result.
+    //
+    server.set_latency (250);
+    alice.clear_published ();
+    alice.mod_pubsub.set_publish_window (4);
+    alice.mod_pubsub.set_publish_batch (10);
+    auto requests = server.num_publish_requests ();
+    vector<string> ids;
+    for (int i=0; i<100; ++i)
+        ids.push_back (alice.mod_pubsub.publish(Jid("batch.localhost"), "batch", entry("x"), "", alice.on_published()));
+    for (int i=0; i<100; ++i)
+        alice.publish_done.wait (timeout);
+    check (alice.published==ids && alice.publish_errors==vector<string>(100),
+           "batch not published in order");
+    check (server.num_publish_requests()-requests == 4+10, "items not batched");
+
+    // A service accepting one item per request rejects the batch
+    //
+    alice.clear_published ();
+    alice.mod_pubsub.set_publish_window (1);
+    for (int i=0; i<3; ++i)
+        alice.mod_pubsub.publish (pubsub, "x", entry("x"), "", alice.on_published());
+    for (int i=0; i<3; ++i)
+        alice.publish_done.wait (timeout);
+    check (alice.publish_errors==vector<string>({"", StanzaError::bad_request, StanzaError::bad_request}),
+           "batch not rejected");
+    server.set_latency (0);
+
+    // Publish throughput over one session
+    //
+    Jid bench ("batch.localhost");
+    const vector<pair<unsigned, unsigned>> configs {{1, 1}, {8, 1}, {32, 1}, {32, 16}};
+    for (auto latency : {0, 1}) {
+        unsigned num = latency ? 2000 : 20000;
+        server.set_latency (latency);
+        cout << num << " items, latency " << latency << " ms:";
+        for (auto& config : configs) {
+            auto rate = publish_rate (alice, bench, "bench", num, config.first, config.second);
+            cout << " window " << config.first << "/batch " << config.second << " " << rate << " items/s,";
+        }
+        cout << endl;
+    }
+
+    // Queued items fail when the session is closed
+    //
+    server.set_latency (500);
+    alice.clear_published ();
+    alice.mod_pubsub.set_publish_window (1);
+    alice.mod_pubsub.set_publish_batch (1);
+    for (int i=0; i<3; ++i)
+        alice.mod_pubsub.publish (pubsub, "late", entry("x"), "", alice.on_published());
+    alice.sess.stop ();
+    for (int i=0; i<3; ++i)
+        alice.publish_done.wait (timeout);
+    check (alice.publish_errors==vector<string>(3, StanzaError::remote_server_timeout),
+           "queued items not failed");
+    check (alice.mod_pubsub.publish(pubsub, "late", entry("x")).empty(), "published without a session");
+
+    server.stop ();
+
+    return test_result ();
+}
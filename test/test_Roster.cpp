@@ -0,0 +1,160 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestCheck.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <iostream>
+#include <string>
+#include <chrono>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_Roster"
+
+static constexpr int num_items = 5000;
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static string contact (int n)
+{
+    return string("contact") + std::to_string(n) + "@example.com";
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+
+    // A roster result like the one from the server
+    //
+    XmlObject query ("query", xml::namespace_iq_roster, true, true);
+    for (int i=0; i<num_items; ++i) {
+        RosterItem item (Jid(contact(i)), string("Contact ") + std::to_string(i),
+                         vector<string>{(i%2) ? "odd" : "even"});
+        item.set_attribute ("subscription", (i%3) ? "both" : "to");
+        query.add_node (item);
+    }
+    Roster roster;
+    roster = query;
+
+    check (roster.size() == num_items, "wrong roster size");
+    auto entry = roster.find (Jid(contact(44) + "/phone"));
+    check (entry && entry->handle=="Contact 44" && entry->subscription=="both" &&
+           entry->groups.size()==1 && entry->groups[0]=="even", "wrong roster entry");
+    check (roster.subscription_of(Jid(contact(3))) == "to", "wrong subscription");
+    check (roster.subscription_of(Jid("stranger@example.com")).empty(), "stranger found");
+    check (roster.get_group("odd").size() == num_items/2, "wrong group size");
+    check (roster.get_group_names().size() == 2, "wrong number of groups");
+
+    // Update an item and move it to another group
+    //
+    RosterItem updated (Jid(contact(44)), "Forty-four", vector<string>{"friends"});
+    roster.set_item (updated);
+    entry = roster.find (Jid(contact(44)));
+    check (roster.size()==num_items && entry && entry->handle=="Forty-four" &&
+           entry->subscription=="none", "item not updated");
+    check (roster.get_group("friends").size()==1 &&
+           roster.get_group("even").size()==num_items/2-1, "groups not updated");
+    auto item = roster.find_item (Jid(contact(44)));
+    check (item && item->get_handle()=="Forty-four", "wrong XML item");
+
+    // Add and remove items
+    //
+    roster.set_item (RosterItem(Jid("new@example.com")));
+    check (roster.size()==num_items+1 && roster.subscription_of(Jid("new@example.com"))=="none",
+           "item not added");
+    check (roster.remove_item(Jid(contact(0))), "item not removed");
+    check (!roster.remove_item(Jid(contact(0))), "item removed twice");
+    check (!roster.find(Jid(contact(0))) && roster.size()==num_items, "wrong roster after remove");
+    check (roster.get_items().size() == roster.size(), "items and index differ");
+
+    // The index must match the XML items
+    //
+    bool consistent = true;
+    for (auto& i : roster.get_items()) {
+        auto found = roster.find_item (i.get_jid());
+        if (found != &i)
+            consistent = false;
+    }
+    check (consistent, "index doesn't match the items");
+    Roster copy (roster);
+    check (copy.find_item(Jid(contact(44))) == &copy.get_items()[roster.find_item(Jid(contact(44))) -
+                                                                &roster.get_items()[0]],
+           "copy has a bad index");
+
+    // Moving a roster, or a roster query into a roster, doesn't copy the items
+    //
+    const void* first = &copy.get_items()[0];
+    Roster moved (std::move(copy));
+    check (&moved.get_items()[0]==first && moved.find_item(moved.get_items()[0].get_jid())==first,
+           "items copied by the move constructor");
+    Roster assigned;
+    assigned = std::move (moved);
+    check (&assigned.get_items()[0]==first && assigned.size()==roster.size(), "items copied by move assignment");
+    XmlObject result (query);
+    first = &result.get_nodes()[0];
+    assigned = std::move (result);
+    check (&assigned.get_items()[0]==first && assigned.size()==num_items && assigned.find(Jid(contact(44))),
+           "roster query copied by move assignment");
+
+    // Setting an item that exists, given with a resource, replaces it in place
+    //
+    auto pos = roster.find_item (Jid(contact(7))) - &roster.get_items()[0];
+    roster.set_item (RosterItem(Jid(contact(7) + "/phone"), "Seven"));
+    item = roster.find_item (Jid(contact(7)));
+    check (roster.size()==num_items && roster.get_items().size()==num_items &&
+           item==&roster.get_items()[pos] && item->get_handle()=="Seven", "item not replaced in place");
+
+    // A duplicate item in a roster result replaces the earlier item
+    //
+    XmlObject dup_query ("query", xml::namespace_iq_roster, true, true);
+    dup_query.add_node (RosterItem(Jid(contact(1)), "One", vector<string>{"old"}));
+    dup_query.add_node (RosterItem(Jid(contact(2)), "Two"));
+    dup_query.add_node (RosterItem(Jid(contact(1)), "Uno", vector<string>{"new"}));
+    dup_query.add_node (RosterItem(Jid(contact(3)), "Three"));
+    Roster dup;
+    dup = dup_query;
+    auto& dup_items = dup.get_items ();
+    check (dup.size()==3 && dup_items.size()==3, "duplicate item kept");
+    check (dup_items.size()==3 &&
+           dup_items[0].get_handle()=="Uno" && dup_items[1].get_handle()=="Two" &&
+           dup_items[2].get_handle()=="Three" && dup.find_item(Jid(contact(3)))==&dup_items[2],
+           "duplicate item not replaced in place");
+    check (dup.get_group("old").empty() && dup.get_group("new").size()==1, "groups of the duplicate item");
+
+    // Lookup time
+    //
+    auto start = chrono::steady_clock::now ();
+    int authorized = 0;
+    for (int i=0; i<num_items; ++i) {
+        auto s = roster.subscription_of (Jid(contact(i) + "/res"));
+        if (s=="from" || s=="both")
+            ++authorized;
+    }
+    auto usec = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start).count ();
+    check (authorized > 0, "no authorized contacts");
+    cout << num_items << " subscription lookups in a roster of " << roster.size()
+         << " items: " << usec << " us" << endl;
+
+    return test_result ();
+}
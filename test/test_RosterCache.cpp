@@ -0,0 +1,188 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include "TestClient.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_RosterCache"
+
+static constexpr int num_items = 5000;
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static string contact (int n)
+{
+    return string("contact") + std::to_string(n) + "@localhost";
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static long usec_since (chrono::steady_clock::time_point start)
+{
+    return chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start).count ();
+}
+
+
+/**
+ * A client session with a roster module using a cache file.
+ */
+class Client : public TestClient {
+public:
+    Client (uint16_t port, const string& cache_file) : TestClient (port) {
+        auto load_start = chrono::steady_clock::now ();
+        loaded = mod_roster.set_cache_file (cache_file);
+        load_usec = usec_since (load_start);
+        mod_roster.set_roster_handler ([this](RosterModule& rm, Roster& roster){
+                roster_ready.post ();
+            });
+        mod_roster.set_roster_push_handler ([this](RosterModule& rm, RosterItem& item){
+                pushed.post ();
+            });
+        sess.register_module (mod_roster);
+        start ();
+    }
+    ~Client () {
+        stop ();
+    }
+    virtual void on_state_change (Session& session, SessionState new_state, SessionState old_state) {
+        if (new_state == SessionState::bound) {
+            refresh_start = chrono::steady_clock::now ();
+            mod_roster.refresh ();
+        }
+        TestClient::on_state_change (session, new_state, old_state);
+    }
+
+    RosterModule mod_roster;
+    bool loaded;
+    long load_usec;
+    chrono::steady_clock::time_point refresh_start;
+    Semaphore roster_ready;
+    Semaphore pushed;
+};
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+    string file = "/tmp/test_RosterCache." + std::to_string(getpid()) + ".xml";
+
+    // Save, append and load
+    //
+    {
+        Roster roster ("7");
+        for (int i=0; i<100; ++i)
+            roster.set_item (RosterItem(Jid(contact(i)), "Name & <" + std::to_string(i) + ">",
+                                        vector<string>{"group"}));
+        RosterCache cache (file);
+        check (cache.save(roster), "unable to save");
+
+        RosterItem removed (Jid(contact(5)));
+        removed.set_attribute ("subscription", "remove");
+        roster.remove_item (removed.get_jid());
+        roster.set_version ("8");
+        check (cache.append(removed, roster), "unable to append");
+        RosterItem added (Jid("new@localhost"), "New");
+        roster.set_item (added);
+        roster.set_version ("9");
+        check (cache.append(added, roster), "unable to append");
+
+        // An incomplete push at the end is ignored
+        ofstream (file, ios::app) << "<query xmlns='jabber:iq:roster' ver='10'><item jid='x@y'";
+
+        Roster loaded;
+        RosterCache cache2 (file);
+        check (cache2.load(loaded), "unable to load");
+        check (loaded.get_version()=="9" && loaded.size()==100, "wrong version or size");
+        check (loaded.find(Jid("new@localhost")) && !loaded.find(Jid(contact(5))), "pushes not applied");
+        auto entry = loaded.find (Jid(contact(7)));
+        check (entry && entry->handle=="Name & <7>" && entry->groups.size()==1, "wrong item");
+
+        cache2.remove ();
+        check (!cache2.load(loaded) && loaded.size()==0 && loaded.get_version().empty(),
+               "loaded a removed cache");
+    }
+
+    // Log in twice with roster versioning
+    //
+    TestServer server;
+    server.add_account ("alice", "secret");
+    for (int i=0; i<num_items; ++i)
+        server.add_roster_item ("alice", contact(i), "Contact " + std::to_string(i));
+    server.set_tls (false);
+    if (!server.start()) {
+        cout << "FAIL: unable to start the server" << endl;
+        return 1;
+    }
+
+    long full_usec = 0;
+    {
+        Client client (server.get_port(), file);
+        check (!client.loaded, "loaded a cache that doesn't exist");
+        check (client.bound.wait(chrono::seconds(10)), "not bound");
+        check (client.roster_ready.wait(chrono::seconds(10)), "no roster");
+        full_usec = usec_since (client.refresh_start);
+        check (client.mod_roster.get_roster().size() == num_items, "wrong roster size");
+        check (server.num_full_rosters() == 1, "no full roster");
+    }
+
+    server.add_roster_item ("alice", "late@localhost", "Late");
+
+    long cached_usec = 0;
+    long load_usec = 0;
+    {
+        Client client (server.get_port(), file);
+        load_usec = client.load_usec;
+        check (client.loaded && client.mod_roster.get_roster().size()==num_items,
+               "cached roster not loaded");
+        check (client.bound.wait(chrono::seconds(10)), "not bound");
+        check (client.roster_ready.wait(chrono::seconds(10)), "no roster result");
+        check (client.pushed.wait(chrono::seconds(10)), "no roster push");
+        cached_usec = usec_since (client.refresh_start);
+        check (client.mod_roster.get_roster().size() == num_items+1, "push not applied");
+        check (client.mod_roster.find(Jid("late@localhost")) != nullptr, "pushed item not found");
+        check (server.num_full_rosters() == 1, "full roster sent again");
+    }
+
+    {
+        Roster roster;
+        RosterCache cache (file);
+        check (cache.load(roster) && roster.size()==num_items+1, "push not cached");
+        cache.remove ();
+    }
+    server.stop ();
+
+    cout << num_items << " roster items, refresh to roster ready: full " << full_usec
+         << " us, versioned " << cached_usec << " us, cache load " << load_usec << " us" << endl;
+
+    return test_result ();
+}
@@ -0,0 +1,253 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include "TestClient.hpp"
+#include "Socks5Proxy.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_S5B"
+
+static constexpr size_t file_size = 32 * 1024 * 1024;
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static string read_file (const string& file)
+{
+    ifstream in (file);
+    ostringstream data;
+    data << in.rdbuf ();
+    return data.str ();
+}
+
+
+//-----------------------------------------------------------------------
+// Return a port on the loopback interface that nobody listens on.
+//-----------------------------------------------------------------------
+static uint16_t get_closed_port ()
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof (addr);
+    memset (&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    int fd = socket (AF_INET, SOCK_STREAM, 0);
+    bind (fd, (struct sockaddr*)&addr, len);
+    getsockname (fd, (struct sockaddr*)&addr, &len);
+    ::close (fd);
+    return ntohs (addr.sin_port);
+}
+
+
+/**
+ * A client session with a SOCKS5 bytestream module, and an
+ * IBB module to compare with.
+ */
+class Client : public TestClient {
+public:
+    Client (uint16_t port, const string& user, XmppModule* module=nullptr) : TestClient (port, user) {
+        mod_s5b.set_close_handler ([this](S5BModule& module, const string& sid, uint64_t bytes,
+                                          const string& error){
+                on_closed (bytes, error);
+            });
+        mod_ibb.set_close_handler ([this](IBBModule& module, const string& sid, uint64_t bytes,
+                                          const string& error){
+                on_closed (bytes, error);
+            });
+        sess.register_module (mod_s5b);
+        sess.register_module (mod_ibb);
+        if (module)
+            sess.register_module (*module);
+        start ();
+    }
+    ~Client () {
+        stop ();
+    }
+    void on_closed (uint64_t bytes, const string& error) {
+        lock_guard<std::mutex> lock (mutex);
+        closed_bytes = bytes;
+        closed_error = error;
+        closed.post ();
+    }
+
+    // Wait for a stream to be closed and return the error
+    string wait_closed (uint64_t* bytes=nullptr) {
+        if (!closed.wait(chrono::seconds(30)))
+            return "no close";
+        lock_guard<std::mutex> lock (mutex);
+        if (bytes)
+            *bytes = closed_bytes;
+        return closed_error;
+    }
+
+    S5BModule mod_s5b;
+    IBBModule mod_ibb;
+    Semaphore closed;
+    std::mutex mutex;
+    uint64_t closed_bytes;
+    string closed_error;
+};
+
+
+//-----------------------------------------------------------------------
+// Send a file from alice to bob, return the throughput in MB/s.
+//-----------------------------------------------------------------------
+static double send_file (Client& alice, Client& bob, const string& in_file, const string& out_file,
+                         bool ibb=false)
+{
+    io::FileConnection source (in_file, O_RDONLY);
+    io::FileConnection sink (out_file, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    bob.mod_s5b.set_request_handler ([&sink](S5BModule& module, const string& sid, const Jid& from){
+            module.accept (sid, sink);
+        });
+    bob.mod_ibb.set_open_handler ([&sink](IBBModule& module, const string& sid, const Jid& from, size_t bs){
+            module.accept (sid, sink);
+        });
+
+    auto start = chrono::steady_clock::now ();
+    auto sid = ibb ?
+        alice.mod_ibb.open (bob.sess.get_jid(), source, 65535, 16) :
+        alice.mod_s5b.send (bob.sess.get_jid(), source);
+    check (!sid.empty(), "byte stream not requested");
+    uint64_t bytes = 0;
+    auto error = bob.wait_closed (&bytes);
+    check (error=="" && bytes==file_size, "file not received: " + error);
+    auto usec = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start).count ();
+    error = alice.wait_closed (&bytes);
+    check (error=="" && bytes==file_size, "file not sent: " + error);
+    check (read_file(in_file) == read_file(out_file), "received file differs");
+
+    return static_cast<double>(file_size) / (usec ? usec : 1);
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+    signal (SIGPIPE, SIG_IGN);
+
+    string in_file  = "/tmp/test_S5B.in." + std::to_string(getpid());
+    string out_file = "/tmp/test_S5B.out." + std::to_string(getpid());
+    {
+        mt19937 gen (47);
+        string data (file_size, 0);
+        for (auto& c : data)
+            c = static_cast<char> (gen());
+        ofstream (in_file) << data;
+    }
+
+    TestServer server;
+    server.add_account ("alice", "secret");
+    server.add_account ("bob", "secret");
+    server.add_account ("proxy", "secret");
+    server.set_tls (false);
+    Socks5Proxy proxy;
+    if (!server.start() || !proxy.start()) {
+        cout << "FAIL: unable to start the server" << endl;
+        return 1;
+    }
+
+    Client alice (server.get_port(), "alice");
+    Client bob (server.get_port(), "bob");
+    Client proxy_client (server.get_port(), "proxy", &proxy);
+    check (alice.bound.wait(chrono::seconds(10)) && bob.bound.wait(chrono::seconds(10)) &&
+           proxy_client.bound.wait(chrono::seconds(10)), "not bound");
+
+    // Nothing to offer without a listener or a proxy
+    //
+    {
+        io::FileConnection source (in_file, O_RDONLY);
+        check (alice.mod_s5b.send(bob.sess.get_jid(), source).empty(), "requested without streamhosts");
+    }
+
+    // Direct connection
+    //
+    check (alice.mod_s5b.listen("127.0.0.1") && alice.mod_s5b.get_listen_port(), "unable to listen");
+    send_file (alice, bob, in_file, out_file);
+
+    // Denied
+    //
+    {
+        io::FileConnection source (in_file, O_RDONLY);
+        bob.mod_s5b.set_request_handler ([](S5BModule& module, const string& sid, const Jid& from){
+                module.deny (sid);
+            });
+        check (!alice.mod_s5b.send(bob.sess.get_jid(), source).empty(), "not requested");
+        check (alice.wait_closed() == StanzaError::not_acceptable, "not denied");
+    }
+
+    // Through a proxy, after failing to connect to a dead one
+    //
+    alice.mod_s5b.stop_listening ();
+    alice.mod_s5b.add_proxy (Jid("dead.localhost"), "127.0.0.1", get_closed_port());
+    Semaphore found;
+    alice.mod_s5b.query_proxy (proxy_client.sess.get_jid(), [&found](S5BModule& module, const Jid& jid, bool ok){
+            if (ok)
+                found.post ();
+        });
+    check (found.wait(chrono::seconds(10)) && alice.mod_s5b.get_proxies().size()==2, "proxy not found");
+    send_file (alice, bob, in_file, out_file);
+    check (proxy.num_activated()==1 && proxy.bytes_relayed()==file_size, "not sent through the proxy");
+
+    // Throughput, file to file
+    //
+    cout << "streamhost\tcopy\tMB/s" << endl;
+    for (bool direct : {true, false}) {
+        if (direct)
+            alice.mod_s5b.listen ("127.0.0.1");
+        else
+            alice.mod_s5b.stop_listening ();
+        for (bool zero_copy : {true, false}) {
+            alice.mod_s5b.set_zero_copy (zero_copy);
+            bob.mod_s5b.set_zero_copy (zero_copy);
+            auto mb_per_sec = send_file (alice, bob, in_file, out_file);
+            cout << (direct ? "direct" : "proxy") << "\t\t" << (zero_copy ? "kernel" : "buffer") << "\t"
+                 << fixed << setprecision(1) << mb_per_sec << endl;
+        }
+    }
+    auto mb_per_sec = send_file (alice, bob, in_file, out_file, true);
+    cout << "IBB, 65535 byte blocks, window 16\t" << fixed << setprecision(1) << mb_per_sec << endl;
+
+    proxy.stop ();
+    server.stop ();
+    ::unlink (in_file.c_str());
+    ::unlink (out_file.c_str());
+
+    return test_result ();
+}
@@ -0,0 +1,161 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include "TestClient.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <functional>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_StreamCompression"
+
+
+//-----------------------------------------------------------------------
+// Wait for a condition to be true, at most 10 seconds.
+//-----------------------------------------------------------------------
+static bool wait_for (std::function<bool ()> condition)
+{
+    for (int i=0; i<1000 && !condition(); ++i)
+        this_thread::sleep_for (chrono::milliseconds(10));
+    return condition ();
+}
+
+
+/**
+ * A client session that records the bodies of received messages,
+ * optionally with stream compression and TLS.
+ */
+class Client : public TestClient {
+public:
+    Client (uint16_t port, const string& user, bool compress, bool tls=false) : TestClient (port, user) {
+        if (tls) {
+            mod_tls.tls_cfg.verify_server = false;
+            sess.register_module (mod_tls);
+        }
+        if (compress)
+            sess.register_module (mod_compression);
+        start ();
+    }
+    ~Client () {
+        stop ();
+    }
+    void send (const string& to, const string& body) {
+        sess.send_stanza (MessageStanza(to, "", body));
+    }
+    virtual void on_stanza_received (Session& session, XmlObject& xml_obj) {
+        if (xml_obj.get_full_name() != xml::full_tag_message_stanza)
+            return;
+        MessageStanza& msg = reinterpret_cast<MessageStanza&> (xml_obj);
+        lock_guard<std::mutex> lock (mutex);
+        bodies.push_back (msg.get_body());
+    }
+    vector<string> get_bodies () {
+        lock_guard<std::mutex> lock (mutex);
+        return bodies;
+    }
+
+    TlsModule mod_tls;
+    CompressionModule mod_compression;
+    std::mutex mutex;
+    vector<string> bodies;
+};
+
+
+//-----------------------------------------------------------------------
+// Negotiate compression, restart the stream and exchange messages
+// with a session without compression.
+//-----------------------------------------------------------------------
+static void run (TestServer& server, bool tls, const string& label)
+{
+    auto compressed_before = server.num_compressed_streams ();
+    Client alice (server.get_port(), "alice", true, tls);
+    Client bob (server.get_port(), "bob", false, tls);
+    if (!check(alice.bound.wait(chrono::seconds(10)), label + "alice not bound") ||
+        !check(bob.bound.wait(chrono::seconds(10)), label + "bob not bound"))
+    {
+        return;
+    }
+    check (alice.sess.get_socket().is_compression_enabled(), label + "compression not enabled");
+    check (!bob.sess.get_socket().is_compression_enabled(), label + "compression enabled without the module");
+    check (server.num_compressed_streams() == compressed_before + 1, label + "server stream not compressed");
+
+    // Small messages, and one larger than the zlib RX buffer
+    //
+    vector<string> expected;
+    for (int i=0; i<20; ++i)
+        expected.push_back ("Message number " + std::to_string(i) + ", see you at the meeting.");
+    expected.push_back (string(4*UXMPP_ZLIB_RX_BUF_SIZE, 'x'));
+    for (auto& body : expected) {
+        alice.send ("bob@localhost/test", body);
+        bob.send ("alice@localhost/test", body);
+    }
+    check (wait_for([&](){ return bob.get_bodies().size() >= expected.size(); }), label + "messages from alice not delivered");
+    check (wait_for([&](){ return alice.get_bodies().size() >= expected.size(); }), label + "messages to alice not delivered");
+    check (bob.get_bodies() == expected, label + "wrong messages from alice");
+    check (alice.get_bodies() == expected, label + "wrong messages to alice");
+
+    // The data is compressed in both directions
+    //
+    auto stats = alice.sess.get_socket().get_compression_stats ();
+    check (stats.tx_data > 4*UXMPP_ZLIB_RX_BUF_SIZE && stats.tx_wire < stats.tx_data, label + "sent data not compressed");
+    check (stats.rx_data > 4*UXMPP_ZLIB_RX_BUF_SIZE && stats.rx_wire < stats.rx_data, label + "received data not compressed");
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+
+    TestServer server;
+    server.add_account ("alice", "secret");
+    server.add_account ("bob", "secret");
+    if (!server.start()) {
+        cout << "FAIL: unable to start the server" << endl;
+        return 1;
+    }
+
+    server.set_tls (false);
+    run (server, false, "");
+    server.set_tls (true, true);
+    run (server, true, "TLS: ");
+
+    // Compression isn't offered
+    //
+    server.set_tls (false);
+    server.set_compression (false);
+    {
+        Client alice (server.get_port(), "alice", true);
+        check (alice.bound.wait(chrono::seconds(10)), "alice not bound without compression");
+        check (!alice.sess.get_socket().is_compression_enabled(), "compression enabled when not offered");
+    }
+
+    server.stop ();
+    return test_result ();
+}
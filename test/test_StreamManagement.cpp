@@ -0,0 +1,183 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include "TestClient.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <functional>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_StreamManagement"
+
+
+//-----------------------------------------------------------------------
+// Wait for a condition to be true, at most 10 seconds.
+//-----------------------------------------------------------------------
+static bool wait_for (std::function<bool ()> condition)
+{
+    for (int i=0; i<1000 && !condition(); ++i)
+        this_thread::sleep_for (chrono::milliseconds(10));
+    return condition ();
+}
+
+
+/**
+ * A client session with stream management.
+ */
+class Client : public TestClient {
+public:
+    Client (uint16_t port) : TestClient (port) {
+        sess.register_module (mod_sm);
+        start ();
+    }
+    ~Client () {
+        stop ();
+    }
+    void send (const string& body) {
+        sess.send_stanza (MessageStanza("bob@localhost/test", "", body));
+    }
+
+    StreamManagementModule mod_sm;
+};
+
+
+/**
+ * A client session that records the bodies of received messages.
+ */
+class Receiver : public TestClient {
+public:
+    Receiver (uint16_t port) : TestClient (port, "bob") {
+        start ();
+    }
+    ~Receiver () {
+        stop ();
+    }
+    virtual void on_stanza_received (Session& session, XmlObject& xml_obj) {
+        if (xml_obj.get_full_name() != xml::full_tag_message_stanza)
+            return;
+        MessageStanza& msg = reinterpret_cast<MessageStanza&> (xml_obj);
+        lock_guard<std::mutex> lock (mutex);
+        bodies.push_back (msg.get_body());
+    }
+    vector<string> get_bodies () {
+        lock_guard<std::mutex> lock (mutex);
+        return bodies;
+    }
+
+    std::mutex mutex;
+    vector<string> bodies;
+};
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+
+    TestServer server;
+    server.add_account ("alice", "secret");
+    server.add_account ("bob", "secret");
+    server.set_tls (false);
+    if (!server.start()) {
+        cout << "FAIL: unable to start the server" << endl;
+        return 1;
+    }
+
+    // The server fails to enable stream management,
+    // sent stanzas must not be counted or kept.
+    //
+    server.set_stream_management (true, true);
+    {
+        Client alice (server.get_port());
+        check (alice.bound.wait(chrono::seconds(10)), "session not bound");
+        this_thread::sleep_for (chrono::milliseconds(200));
+        alice.send ("not counted");
+        this_thread::sleep_for (chrono::milliseconds(200));
+        check (!alice.mod_sm.is_enabled(), "enabled after <failed/>");
+        check (alice.mod_sm.get_unacked_count() == 0, "stanzas kept after <failed/>");
+        check (!alice.mod_sm.can_resume(), "resumable after <failed/>");
+    }
+    server.set_stream_management (true);
+
+    // Resume a stream where the server has lost the last sent stanzas
+    //
+    {
+        Receiver bob (server.get_port());
+        Client alice (server.get_port());
+        check (bob.bound.wait(chrono::seconds(10)), "bob not bound");
+        check (alice.bound.wait(chrono::seconds(10)), "alice not bound");
+        check (wait_for([&alice](){ return alice.mod_sm.is_enabled(); }), "stream management not enabled");
+
+        // Acknowledged stanzas
+        //
+        for (int i=1; i<=3; ++i)
+            alice.send ("m" + std::to_string(i));
+        check (wait_for([&alice](){ return alice.mod_sm.get_unacked_count() == 0; }), "stanzas not acknowledged");
+        check (wait_for([&bob](){ return bob.get_bodies().size() == 3; }), "stanzas not delivered");
+
+        // Stanzas lost on the network
+        //
+        server.set_lose_stanzas (true);
+        for (int i=4; i<=7; ++i)
+            alice.send ("m" + std::to_string(i));
+        this_thread::sleep_for (chrono::milliseconds(1500)); // Let the <r/> timer expire
+        check (alice.mod_sm.get_unacked_count() == 4, "lost stanzas acknowledged");
+
+        // Lose the connection and resume the stream
+        //
+        server.drop_connections ();
+        check (alice.session_closed.wait(chrono::seconds(10)), "alice not disconnected");
+        check (bob.session_closed.wait(chrono::seconds(10)), "bob not disconnected");
+        check (alice.mod_sm.can_resume(), "stream can't be resumed");
+        server.set_lose_stanzas (false);
+
+        bob.start ();
+        check (bob.bound.wait(chrono::seconds(10)), "bob not bound again");
+        alice.start ();
+        check (alice.bound.wait(chrono::seconds(10)), "alice not resumed");
+        check (alice.sess.is_resumed(), "session not resumed");
+
+        // Exactly the unacknowledged stanzas are sent again
+        //
+        check (wait_for([&alice](){ return alice.mod_sm.get_unacked_count() == 0; }), "resent stanzas not acknowledged");
+        this_thread::sleep_for (chrono::milliseconds(200));
+        vector<string> expected {"m1", "m2", "m3", "m4", "m5", "m6", "m7"};
+        auto bodies = bob.get_bodies ();
+        check (bodies == expected, "resent " + std::to_string(bodies.size()-3) + " stanzas, expected 4");
+
+        // The stream is counted from where it was
+        //
+        alice.send ("m8");
+        check (wait_for([&bob](){ return bob.get_bodies().size() == 8; }), "stanza not delivered after resume");
+        check (wait_for([&alice](){ return alice.mod_sm.get_unacked_count() == 0; }), "stanza not acknowledged after resume");
+    }
+
+    server.stop ();
+    return test_result ();
+}
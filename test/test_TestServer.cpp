@@ -0,0 +1,192 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include "TestCheck.hpp"
+#include <uxmpp.hpp>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_TestServer"
+
+
+/**
+ * A client session running in its own thread.
+ */
+class Client : public SessionListener {
+public:
+    Client (const string& user, const string& password, const string& mechanism, uint16_t port,
+            bool pipeline_bind=false) {
+        auth.auth_user = user;
+        auth.auth_pass = password;
+        auth.mechanism = mechanism;
+        sess.register_module (tls);
+        sess.register_module (auth);
+        sess.add_session_listener (*this);
+        cfg.domain      = "localhost";
+        cfg.server      = "127.0.0.1";
+        cfg.port        = port;
+        cfg.disable_srv = true;
+        cfg.resource    = pipeline_bind ? "fast" : "test";
+        cfg.pipeline_bind = pipeline_bind;
+        start = chrono::steady_clock::now ();
+        thread = std::thread ([this](){
+                sess.run (cfg);
+                bound.post ();
+            });
+    }
+    ~Client () {
+        sess.stop ();
+        thread.join ();
+    }
+    virtual void on_state_change (Session& session, SessionState new_state, SessionState old_state) {
+        if (new_state == SessionState::bound) {
+            login_time = chrono::duration_cast<chrono::milliseconds> (chrono::steady_clock::now() - start);
+            bound.post ();
+        }
+    }
+    virtual void on_stanza_received (Session& session, XmlObject& xml_obj) {
+        if (xml_obj.get_full_name() != xml::full_tag_message_stanza)
+            return;
+        lock_guard<std::mutex> lock (mutex);
+        last_body = reinterpret_cast<MessageStanza&>(xml_obj).get_body ();
+        received.post ();
+    }
+    bool wait_bound () {
+        return bound.wait(chrono::seconds(10)) && sess.get_state()==SessionState::bound;
+    }
+    string get_last_body () {
+        lock_guard<std::mutex> lock (mutex);
+        return last_body;
+    }
+
+    Session sess;
+    SessionConfig cfg;
+    TlsModule tls;
+    AuthModule auth;
+    Semaphore bound;
+    Semaphore received;
+    std::mutex mutex;
+    string last_body;
+    chrono::steady_clock::time_point start;
+    chrono::milliseconds login_time;
+    std::thread thread;
+};
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+    bool ok = true;
+
+    TestServer server;
+    server.add_account ("alice", "secret-a");
+    server.add_account ("bob", "secret-b");
+    server.add_roster_item ("alice", "bob@localhost", "Bob");
+    server.add_roster_item ("bob", "alice@localhost", "Alice");
+    server.set_tls (true, true);
+    if (!check(server.start(), "unable to start the server"))
+        return 1;
+
+    // Login with STARTTLS and SASL PLAIN and SCRAM-SHA-1
+    //
+    Client alice ("alice", "secret-a", "PLAIN", server.get_port());
+    Client bob ("bob", "secret-b", "", server.get_port());
+    ok = check (alice.wait_bound(), "alice not bound") && ok;
+    ok = check (bob.wait_bound(), "bob not bound") && ok;
+    if (!ok)
+        return 1;
+    ok = check (alice.sess.get_socket().is_tls_enabled(), "no TLS") && ok;
+    ok = check (to_string(bob.sess.get_jid()) == "bob@localhost/test", "wrong jid") && ok;
+    cout << "Login time, PLAIN: " << alice.login_time.count() << " ms, "
+         << "SCRAM-SHA-1: " << bob.login_time.count() << " ms" << endl;
+
+    // Login with bind pipelined with the stream restart
+    //
+    {
+        Client fast ("alice", "secret-a", "PLAIN", server.get_port(), true);
+        ok = check (fast.wait_bound(), "not bound with a pipelined bind") && ok;
+        ok = check (to_string(fast.sess.get_jid()) == "alice@localhost/fast", "wrong jid, pipelined bind") && ok;
+        ok = check (fast.sess.get_login_round_trips() + 1 == alice.sess.get_login_round_trips(),
+                    "pipelined bind didn't save a round trip") && ok;
+        ok = check (fast.sess.get_login_time().count() > 0, "no login time") && ok;
+        cout << "Login round trips, PLAIN: " << alice.sess.get_login_round_trips() << ", "
+             << "SCRAM-SHA-1: " << bob.sess.get_login_round_trips() << ", "
+             << "PLAIN with pipelined bind: " << fast.sess.get_login_round_trips() << endl;
+    }
+
+    {
+        Client mallory ("bob", "wrong", "", server.get_port());
+        ok = check (!mallory.wait_bound(), "login with the wrong password") && ok;
+        ok = check (mallory.sess.get_error().get_app_error() == "authentication-failure",
+                    "no authentication failure") && ok;
+    }
+
+    // Roster
+    //
+    auto roster = bob.sess.iq (IqType::get, Jid(""), XmlObject("query", xml::namespace_iq_roster), 5000).get ();
+    ok = check (roster.is_ok() && roster.get_payload().get_nodes().size()==1 &&
+                roster.get_payload().get_nodes()[0].get_attribute("jid") == "alice@localhost",
+                "wrong roster") && ok;
+    XmlObject query ("query", xml::namespace_iq_roster);
+    query.add_node (XmlObject("item", xml::namespace_iq_roster, false).set_attribute("jid", "carol@localhost"));
+    ok = check (bob.sess.iq(IqType::set, Jid(""), query, 5000).get().is_ok(), "roster set failed") && ok;
+
+    // Message routing, with and without latency
+    //
+    auto start = chrono::steady_clock::now ();
+    alice.sess.send_stanza (MessageStanza("bob@localhost", "", "hello"));
+    ok = check (bob.received.wait(chrono::seconds(5)) && bob.get_last_body()=="hello", "message not routed") && ok;
+    auto direct = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start);
+
+    server.set_latency (50);
+    start = chrono::steady_clock::now ();
+    bob.sess.send_stanza (MessageStanza("alice@localhost/test", "", "delayed"));
+    ok = check (alice.received.wait(chrono::seconds(5)) && alice.get_last_body()=="delayed",
+                "delayed message not routed") && ok;
+    auto delayed = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start);
+    ok = check (delayed >= chrono::milliseconds(50), "message not delayed") && ok;
+    cout << "Message latency: " << direct.count() << " us, with 50 ms injected: " << delayed.count() << " us" << endl;
+
+    server.set_route_hook ([](const string& from, const string& to, XmlObject& stanza){
+            return stanza.find_node("body") ? -1 : 0;
+        });
+    alice.sess.send_stanza (MessageStanza("bob@localhost", "", "dropped"));
+    ok = check (!bob.received.wait(chrono::milliseconds(200)), "message not dropped") && ok;
+
+    auto error = alice.sess.iq (IqType::get, Jid("nobody@localhost/x"), XmlObject("query", "urn:uxmpp:test"), 5000).get ();
+    ok = check (error.get_error().get_condition() == StanzaError::service_unavailable, "no error for unknown jid") && ok;
+
+    alice.sess.stop ();
+    bob.sess.stop ();
+    server.stop ();
+
+    if (!ok)
+        return 1;
+    cout << "OK" << endl;
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include "TestClient.hpp"
+#include <uxmpp.hpp>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+#define THIS_FILE "test_Tracer"
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static bool contains (const string& text, const string& what)
+{
+    return text.find(what) != string::npos;
+}
+
+
+/**
+ * A client session that counts received messages.
+ */
+class Client : public TestClient {
+public:
+    Client (uint16_t port) : TestClient (port) {
+        sess.register_module (mod_msg);
+        start ();
+    }
+    ~Client () {
+        stop ();
+    }
+    virtual void on_stanza_received (Session& session, XmlObject& xml_obj) {
+        if (xml_obj.get_full_name() == xml::full_tag_message_stanza)
+            received.post ();
+    }
+
+    MessageModule mod_msg;
+    Semaphore received;
+};
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+    auto& tracer = Tracer::get_instance ();
+
+    // Sampling
+    //
+    check (!tracer.is_enabled() && tracer.sample()==0, "tracing enabled by default");
+    tracer.set_sample_interval (4);
+    unsigned sampled = 0;
+    for (int i=0; i<100; ++i) {
+        if (tracer.sample())
+            ++sampled;
+    }
+    check (sampled == 25, "sampled " + std::to_string(sampled) + " of 100, expected 25");
+
+    // The ring buffer keeps the newest events
+    //
+    tracer.set_buffer_size (4);
+    for (int i=0; i<10; ++i)
+        tracer.span ("test", i*1000, i*1000+500, i+1);
+    check (tracer.size() == 4, "ring buffer size");
+    auto json = tracer.to_json ();
+    check (!contains(json, "\"trace_id\":6,") && contains(json, "\"trace_id\":7,"), "oldest events not dropped");
+    check (contains(json, "\"ts\":9.000,\"dur\":0.500"), "bad timestamps");
+    tracer.set_buffer_size (65536);
+
+    // Trace a session, every stanza is sampled
+    //
+    TestServer server;
+    server.add_account ("alice", "secret");
+    server.set_tls (false);
+    if (!server.start()) {
+        cout << "FAIL: unable to start the server" << endl;
+        return 1;
+    }
+    tracer.set_sample_interval (1);
+    {
+        Client alice (server.get_port());
+        check (alice.bound.wait(chrono::seconds(10)), "session not bound");
+        alice.sess.send_stanza (MessageStanza("alice@localhost/test", "", "hello"));
+        check (alice.received.wait(chrono::seconds(10)), "message not received");
+    }
+    tracer.set_sample_interval (0);
+
+    json = tracer.to_json ();
+    for (auto name : {"rx", "parse", "queue", "dispatch", "tx", "serialize", "send"})
+        check (contains(json, string("\"cat\":\"stanza\",\"name\":\"") + name + "\""), string("no '") + name + "' span");
+    check (contains(json, "\"name\":\"module\""), "no module span");
+    check (contains(json, "\"detail\":\"mod_message\""), "no span for the message module");
+    check (contains(json, "\"detail\":\"message\""), "no span for the message stanza");
+    if (argc > 1)
+        tracer.write_file ("test_Tracer.json");
+
+    // Nothing is traced when disabled
+    //
+    tracer.clear ();
+    {
+        Client alice (server.get_port());
+        check (alice.bound.wait(chrono::seconds(10)), "session not bound");
+    }
+    check (tracer.size() == 0, "events traced when disabled");
+
+    server.stop ();
+    return test_result ();
+}
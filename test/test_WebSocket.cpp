@@ -0,0 +1,447 @@
+/*
+ *  Copyright (C) 2014-2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp.hpp>
+#include <uxmpp/utils.hpp>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::io;
+
+#define THIS_FILE "test_WebSocket"
+
+static constexpr int num_messages = 50;
+
+static const string framing_ns {"urn:ietf:params:xml:ns:xmpp-framing"};
+
+
+/**
+ * A minimal stand-in for an XMPP over WebSocket server.
+ * It serves one client with blocking socket I/O in its own thread.
+ */
+class WebSocketServer {
+public:
+    WebSocketServer (bool deflate) : deflate{deflate}, listen_fd{-1}, fd{-1}, port{0}, ok{false}, pongs{0} {}
+    ~WebSocketServer () {
+        if (thread.joinable())
+            thread.join ();
+        if (listen_fd != -1)
+            ::close (listen_fd);
+    }
+
+    bool start ();
+    void run ();
+
+    bool deflate;            // Accept permessage-deflate if offered
+    bool deflate_used {false};
+    int listen_fd;
+    int fd;
+    uint16_t port;
+    bool ok;                 // The whole session went as expected
+    int pongs;
+    int echoes {0};
+    string error;
+    std::thread thread;
+    unique_ptr<ZlibCompressor> zc;
+
+private:
+    bool read_bytes (void* buf, size_t size);
+    bool write_bytes (const string& data);
+    bool handshake ();
+    bool read_message (string& msg);
+    bool send_frame (uint8_t opcode, const string& payload, bool fin=true);
+    bool send_message (const string& msg);
+    bool fail (const string& what) {
+        error = what;
+        return false;
+    }
+};
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+bool WebSocketServer::start ()
+{
+    listen_fd = socket (AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset (&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof (addr);
+    if (bind(listen_fd, (struct sockaddr*)&addr, len) || listen(listen_fd, 1) ||
+        getsockname(listen_fd, (struct sockaddr*)&addr, &len))
+    {
+        return false;
+    }
+    port = ntohs (addr.sin_port);
+    thread = std::thread ([this](){
+            run ();
+            if (fd != -1)
+                ::close (fd);
+        });
+    return true;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+bool WebSocketServer::read_bytes (void* buf, size_t size)
+{
+    char* p = static_cast<char*> (buf);
+    while (size) {
+        ssize_t r = ::read (fd, p, size);
+        if (r <= 0)
+            return false;
+        p += r;
+        size -= r;
+    }
+    return true;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+bool WebSocketServer::write_bytes (const string& data)
+{
+    return ::write(fd, data.data(), data.size()) == (ssize_t)data.size();
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+bool WebSocketServer::handshake ()
+{
+    string request;
+    char ch;
+    while (request.find("\r\n\r\n") == string::npos) {
+        if (!read_bytes(&ch, 1))
+            return fail ("connection closed during handshake");
+        request.push_back (ch);
+    }
+    auto pos = request.find ("Sec-WebSocket-Key: ");
+    if (pos == string::npos)
+        return fail ("no Sec-WebSocket-Key");
+    string key = request.substr (pos+19, request.find("\r\n", pos)-pos-19);
+    if (request.find("Sec-WebSocket-Protocol: xmpp\r\n") == string::npos)
+        return fail ("protocol 'xmpp' not requested");
+
+    auto digest = get_sha1 (key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+    string response = "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Protocol: xmpp\r\n";
+    response += "Sec-WebSocket-Accept: " + to_base64(digest.data(), digest.size()) + "\r\n";
+    if (deflate && request.find("permessage-deflate") != string::npos) {
+        deflate_used = true;
+        zc.reset (new ZlibCompressor(Z_DEFAULT_COMPRESSION, -15));
+        response += "Sec-WebSocket-Extensions: permessage-deflate\r\n";
+    }
+    response += "\r\n";
+    return write_bytes (response);
+}
+
+
+//-----------------------------------------------------------------------
+// Read a complete data message, answering control frames.
+//-----------------------------------------------------------------------
+bool WebSocketServer::read_message (string& msg)
+{
+    string payload;
+    bool compressed = false;
+    msg.clear ();
+    while (true) {
+        uint8_t hdr[2];
+        if (!read_bytes(hdr, 2))
+            return fail ("connection closed");
+        uint8_t opcode = hdr[0] & 0x0f;
+        uint64_t len = hdr[1] & 0x7f;
+        if (!(hdr[1] & 0x80))
+            return fail ("unmasked frame from client");
+        if (len == 126) {
+            uint8_t ext[2];
+            read_bytes (ext, 2);
+            len = (ext[0] << 8) | ext[1];
+        }else if (len == 127) {
+            uint8_t ext[8];
+            read_bytes (ext, 8);
+            len = 0;
+            for (int i=0; i<8; ++i)
+                len = (len << 8) | ext[i];
+        }
+        uint8_t mask[4];
+        read_bytes (mask, 4);
+        string data (len, '\0');
+        if (len && !read_bytes(&data[0], len))
+            return fail ("connection closed");
+        for (size_t i=0; i<len; ++i)
+            data[i] ^= mask[i & 3];
+
+        if (opcode == 0xa) {
+            if (data == "hi")
+                ++pongs;
+            continue;
+        }
+        if (opcode == 0x8) {
+            msg = "close frame";
+            return true;
+        }
+        if (opcode == 0x1)
+            compressed = hdr[0] & 0x40;
+        payload += data;
+        if (hdr[0] & 0x80)
+            break;
+    }
+    if (compressed) {
+        if (!zc)
+            return fail ("compressed frame without permessage-deflate");
+        payload.append ("\x00\x00\xff\xff", 4);
+        if (!zc->decompress(payload.data(), payload.size(), msg))
+            return fail ("inflate error");
+    }else{
+        msg = payload;
+    }
+    return true;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+bool WebSocketServer::send_frame (uint8_t opcode, const string& payload, bool fin)
+{
+    string frame;
+    frame.push_back ((fin ? 0x80 : 0) | opcode);
+    if (payload.size() < 126) {
+        frame.push_back (payload.size());
+    }else if (payload.size() < 65536) {
+        frame.push_back (126);
+        frame.push_back (payload.size() >> 8);
+        frame.push_back (payload.size() & 0xff);
+    }else{
+        frame.push_back (127);
+        for (int shift=56; shift>=0; shift-=8)
+            frame.push_back (((uint64_t)payload.size() >> shift) & 0xff);
+    }
+    return write_bytes (frame + payload);
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+bool WebSocketServer::send_message (const string& msg)
+{
+    if (!zc)
+        return send_frame (0x1, msg);
+    string payload;
+    zc->compress (msg.data(), msg.size(), payload);
+    payload.resize (payload.size() - 4);
+    string frame;
+    frame.push_back (0x80 | 0x40 | 0x1);
+    if (payload.size() < 126) {
+        frame.push_back (payload.size());
+    }else{
+        frame.push_back (126);
+        frame.push_back (payload.size() >> 8);
+        frame.push_back (payload.size() & 0xff);
+    }
+    return write_bytes (frame + payload);
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+void WebSocketServer::run ()
+{
+    fd = accept (listen_fd, nullptr, nullptr);
+    if (fd == -1 || !handshake())
+        return;
+
+    // Stream open
+    //
+    string msg;
+    if (!read_message(msg) || msg.find("<open") != 0 || msg.find(framing_ns) == string::npos) {
+        fail (string("expected <open/>, got: ") + msg);
+        return;
+    }
+    send_message ("<open xmlns='" + framing_ns + "' id='ws-1' from='localhost' version='1.0' xml:lang='en'/>");
+    send_message ("<stream:features xmlns:stream='http://etherx.jabber.org/streams'>"
+                  "<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/></stream:features>");
+
+    // Resource binding
+    //
+    if (!read_message(msg) || msg.find("<iq") != 0 || msg.find("xmlns='jabber:client'") == string::npos) {
+        fail (string("expected bind request, got: ") + msg);
+        return;
+    }
+    send_message ("<iq xmlns='jabber:client' type='result' id='b#1'>"
+                  "<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'><jid>user@localhost/ws</jid></bind></iq>");
+
+    // A ping, some messages, a large one and a fragmented one
+    //
+    send_frame (0x9, "hi");
+    for (int i=0; i<num_messages; ++i) {
+        send_message ("<message xmlns='jabber:client' from='peer@localhost/x' to='user@localhost/ws'>"
+                      "<body>message " + std::to_string(i) + "</body></message>");
+    }
+    send_message ("<message xmlns='jabber:client' from='peer@localhost/x'><body>" +
+                  string(10000, 'x') + "</body></message>");
+    if (!zc) {
+        send_frame (0x1, "<message xmlns='jabber:client' from='peer@localhost/x'><body>frag", false);
+        send_frame (0x0, "mented</body></message>");
+    }else{
+        send_message ("<message xmlns='jabber:client' from='peer@localhost/x'><body>fragmented</body></message>");
+    }
+
+    // The client echoes all messages, each one in a message of its own
+    //
+    int expected = num_messages + 2;
+    while (echoes < expected) {
+        if (!read_message(msg))
+            return;
+        if (msg.find("<message") != 0 || msg.find("xmlns='jabber:client'") == string::npos ||
+            msg.find("</message>") != msg.size()-10)
+        {
+            fail (string("unexpected message: ") + msg.substr(0, 100));
+            return;
+        }
+        ++echoes;
+    }
+
+    // Close the stream. The session stops the XML stream right after
+    // queueing its closing tag, so the socket may close before it is sent.
+    //
+    send_message ("<close xmlns='" + framing_ns + "'/>");
+    if (read_message(msg)) {
+        if (msg.find("<close") != 0 && msg != "close frame") {
+            fail (string("expected <close/>, got: ") + msg);
+            return;
+        }
+        send_frame (0x8, "\x03\xe8");
+    }
+    error.clear ();
+    ok = true;
+}
+
+
+/**
+ * Echo received messages.
+ */
+class Echo : public SessionListener {
+public:
+    Echo () : count{0}, bound{false}, large{false}, fragmented{false} {}
+    virtual void on_state_change (Session& session, SessionState new_state, SessionState old_state) {
+        if (new_state == SessionState::bound)
+            bound = true;
+    }
+    virtual void on_stanza_received (Session& session, XmlObject& stanza) {
+        if (stanza.get_tag_name() != "message")
+            return;
+        MessageStanza& msg = reinterpret_cast<MessageStanza&> (stanza);
+        string body = msg.get_body ();
+        if (body.size() == 10000)
+            large = true;
+        if (body == "fragmented")
+            fragmented = true;
+        ++count;
+        session.send_stanza (MessageStanza(msg.get_from(), session.get_jid(), body));
+    }
+    atomic<int> count;
+    bool bound;
+    bool large;
+    bool fragmented;
+};
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+static bool run_test (bool server_deflate, bool client_deflate)
+{
+    cout << "Server deflate: " << (server_deflate?"yes":"no")
+         << ", client deflate: " << (client_deflate?"yes":"no") << endl;
+
+    WebSocketServer server (server_deflate);
+    if (!server.start()) {
+        cout << "FAIL: Unable to start the server" << endl;
+        return false;
+    }
+
+    Session sess;
+    Echo echo;
+    sess.add_session_listener (echo);
+    SessionConfig cfg;
+    cfg.domain = "localhost";
+    cfg.websocket_url = string("ws://127.0.0.1:") + std::to_string(server.port) + "/xmpp-websocket";
+    cfg.websocket_deflate = client_deflate;
+
+    // Stop the session if the server doesn't close it
+    //
+    Timer timeout;
+    timeout.set (chrono::seconds(10), [&sess](){
+            sess.stop (true);
+        });
+    sess.run (cfg);
+    timeout.cancel ();
+    if (server.thread.joinable())
+        server.thread.join ();
+
+    bool result = true;
+    auto check = [&result](bool ok, const string& what){
+        if (!ok) {
+            cout << "FAIL: " << what << endl;
+            result = false;
+        }
+    };
+    check (server.error.empty(), string("server error: ") + server.error);
+    check (echo.bound, "session not bound");
+    check (echo.count == num_messages+2, string("received ") + std::to_string(echo.count) + " messages");
+    check (echo.large, "large message not received");
+    check (echo.fragmented, "fragmented message not received");
+    check (server.echoes == num_messages+2, string("server received ") + std::to_string(server.echoes) + " messages");
+    check (server.pongs == 1, "no pong received");
+    check (server.deflate_used == (server_deflate && client_deflate), "permessage-deflate not negotiated as expected");
+    check (server.ok, "stream not closed");
+    check (sess.get_error().get_app_error().empty(),
+           string("session error: ") + sess.get_error().get_app_error());
+    if (result)
+        cout << "OK" << endl;
+    return result;
+}
+
+
+//-----------------------------------------------------------------------
+//-----------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uxmpp_set_log_level (argc>1 ? LogLevel::trace : LogLevel::silent);
+
+    bool result = true;
+    result = run_test (false, true)  && result;
+    result = run_test (true,  true)  && result;
+    result = run_test (true,  false) && result;
+
+    return result ? 0 : 1;
+}
@@ -95,6 +95,7 @@ public:
     TlsModule         mod_tls;       // RFC-6120
     AuthModule        mod_auth;      // RFC-6120
     SessionModule     mod_session;   // RFC-6120
+    StreamManagementModule mod_sm;   // XEP-0198
     KeepAliveModule   mod_alive;     //
     RosterModule      mod_roster;    // RFC-6120
     PresenceModule    mod_pr;        // RFC-6121, XEP-0256
@@ -186,6 +187,11 @@ void AppLogic::on_state_change (Session& session, SessionState new_state, Sessio
         session.unregister_module (mod_tls);
         session.unregister_module (mod_auth);
 
+        // A resumed stream already has the roster and our presence
+        //
+        if (session.is_resumed())
+            return;
+
         // Send initial stanzas
         //
         mod_roster.refresh ();
@@ -254,6 +260,7 @@ void AppLogic::run ()
 {
     sess.register_module (mod_tls);
     sess.register_module (mod_auth);
+    sess.register_module (mod_sm);
     sess.register_module (mod_session);
     sess.register_module (mod_roster);
     sess.register_module (mod_pr);
@@ -0,0 +1,680 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include <uxmpp.hpp>
+#include <uxmpp/mod/TlsModule.hpp>
+#include <uxmpp/mod/AuthModule.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <cstdio>
+#include <csignal>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+using load_clock = chrono::steady_clock;
+
+
+/**
+ * Prefix of the message body and presence status of the stanzas we send.
+ * It is followed by the send time, so the receiver can tell the latency.
+ */
+static const string marker {"uxmpp-load "};
+
+
+/**
+ * A histogram of values in microseconds, lock free so that
+ * any session thread can record a value.
+ * Each power of two is split in 32 buckets, so a percentile
+ * is reported within about 3% of the actual value.
+ */
+class Histogram {
+public:
+    Histogram () : count{0}, sum{0}, max{0} {
+        for (auto& b : buckets)
+            b = 0;
+    }
+
+    void record (uint64_t usec) {
+        ++buckets[index(usec)];
+        ++count;
+        sum += usec;
+        auto m = max.load ();
+        while (usec > m && !max.compare_exchange_weak(m, usec))
+            ;
+    }
+
+    uint64_t get_count () const {
+        return count;
+    }
+
+    uint64_t percentile (double q) const {
+        uint64_t total = count;
+        if (total == 0)
+            return 0;
+        uint64_t rank = static_cast<uint64_t> (q * total);
+        if (rank >= total)
+            rank = total - 1;
+        uint64_t seen = 0;
+        for (unsigned i=0; i<num_buckets; ++i) {
+            seen += buckets[i];
+            if (seen > rank)
+                return std::min (value(i), max.load());
+        }
+        return max;
+    }
+
+    string to_json () const {
+        ostringstream os;
+        os << "{\"count\": " << count
+           << ", \"mean\": " << (count ? sum/count : 0)
+           << ", \"p50\": "  << percentile (0.5)
+           << ", \"p99\": "  << percentile (0.99)
+           << ", \"p999\": " << percentile (0.999)
+           << ", \"max\": "  << max
+           << "}";
+        return os.str ();
+    }
+
+private:
+    static constexpr unsigned sub_bits    = 5;
+    static constexpr unsigned num_buckets = (64 - sub_bits + 1) << sub_bits;
+
+    static unsigned index (uint64_t v) {
+        if (v < (1u << sub_bits))
+            return v;
+        unsigned e = 63 - __builtin_clzll (v);
+        return ((e - sub_bits + 1) << sub_bits) | ((v >> (e - sub_bits)) & ((1u << sub_bits) - 1));
+    }
+
+    // The middle of a bucket
+    static uint64_t value (unsigned i) {
+        if (i < (1u << sub_bits))
+            return i;
+        unsigned e = (i >> sub_bits) + sub_bits - 1;
+        uint64_t low = static_cast<uint64_t>((1u << sub_bits) | (i & ((1u << sub_bits) - 1))) << (e - sub_bits);
+        return low + ((1ull << (e - sub_bits)) >> 1);
+    }
+
+    std::atomic<uint64_t> buckets[num_buckets];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+
+/**
+ * Counters and send-to-receive latency of one kind of traffic.
+ */
+struct TrafficStats {
+    TrafficStats () : sent{0}, received{0}, errors{0} {}
+    std::atomic<uint64_t> sent;
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> errors;
+    Histogram latency;
+};
+
+
+/**
+ * Command line options.
+ */
+struct LoadConfig {
+    LoadConfig ()
+        : server {"127.0.0.1"}, port {5222}, domain {"localhost"},
+          user_prefix {"user"}, password {"password"},
+          sessions {10}, first {1}, ramp_rate {50}, duration {10},
+          msg_rate {100}, presence_rate {10}, iq_rate {10},
+          tls {true}, pipeline_bind {false}, local {false}, log_level {LogLevel::silent}
+        {}
+    string server;
+    uint16_t port;
+    string domain;
+    string user_prefix;
+    string password;
+    unsigned sessions;
+    unsigned first;
+    double ramp_rate;
+    double duration;
+    double msg_rate;
+    double presence_rate;
+    double iq_rate;
+    bool tls;
+    bool pipeline_bind;
+    bool local;
+    string output;
+    LogLevel log_level;
+};
+
+
+static TrafficStats msg_stats;
+static TrafficStats presence_stats;
+static TrafficStats iq_stats;
+static Histogram setup_time;
+static Histogram setup_round_trips;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static uint64_t now_nsec ()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(load_clock::now().time_since_epoch()).count ();
+}
+
+
+//------------------------------------------------------------------------------
+// Record the latency of a received stanza if it was sent by us.
+//------------------------------------------------------------------------------
+static void record_marker (const string& text, TrafficStats& stats)
+{
+    if (text.compare(0, marker.size(), marker) != 0)
+        return;
+    uint64_t sent = strtoull (text.c_str()+marker.size(), nullptr, 10);
+    uint64_t now  = now_nsec ();
+    ++stats.received;
+    stats.latency.record (now>sent ? (now-sent)/1000 : 0);
+}
+
+
+/**
+ * One XMPP client session, running in its own thread.
+ */
+class LoadSession : public SessionListener {
+public:
+    LoadSession (const LoadConfig& lcfg, unsigned n) : bound{false}, done{false} {
+        user = lcfg.user_prefix + std::to_string (n);
+        auth.auth_user = user;
+        auth.auth_pass = lcfg.password;
+        tls.tls_cfg.verify_server = false;
+        if (lcfg.tls)
+            sess.register_module (tls);
+        sess.register_module (auth);
+        sess.add_session_listener (*this);
+        cfg.domain      = lcfg.domain;
+        cfg.server      = lcfg.server;
+        cfg.port        = lcfg.port;
+        cfg.disable_srv = !lcfg.server.empty ();
+        cfg.resource    = "load";
+        cfg.pipeline_bind = lcfg.pipeline_bind;
+    }
+    ~LoadSession () {
+        stop ();
+    }
+    void start () {
+        start_time = load_clock::now ();
+        thread = std::thread ([this](){
+                sess.run (cfg);
+                done = true;
+            });
+    }
+    void stop () {
+        sess.stop (true);
+        if (thread.joinable())
+            thread.join ();
+    }
+    virtual void on_state_change (Session& session, SessionState new_state, SessionState old_state) {
+        if (new_state == SessionState::bound) {
+            setup_time.record (chrono::duration_cast<chrono::microseconds>(load_clock::now()-start_time).count());
+            setup_round_trips.record (session.get_login_round_trips());
+            session.send_stanza (PresenceStanza());
+            bound = true;
+        }
+        else if (new_state == SessionState::closed) {
+            bound = false;
+        }
+    }
+    virtual void on_stanza_received (Session& session, XmlObject& xml_obj) {
+        auto name = xml_obj.get_full_name ();
+        if (name == xml::full_tag_message_stanza) {
+            auto& msg = reinterpret_cast<MessageStanza&> (xml_obj);
+            if (msg.get_message_type() == MessageType::error)
+                ++msg_stats.errors;
+            else
+                record_marker (msg.get_body(), msg_stats);
+        }
+        else if (name == xml::full_tag_presence_stanza) {
+            record_marker (reinterpret_cast<PresenceStanza&>(xml_obj).get_status(), presence_stats);
+        }
+    }
+
+    void send_message (const string& to) {
+        MessageStanza msg (to, "", marker + std::to_string(now_nsec()), MessageType::chat);
+        ++msg_stats.sent;
+        sess.send_stanza (msg);
+    }
+    void send_presence () {
+        PresenceStanza presence;
+        presence.set_status (marker + std::to_string(now_nsec()));
+        ++presence_stats.sent;
+        sess.send_stanza (presence);
+    }
+    void send_ping () {
+        IqStanza iq (IqType::get, cfg.domain);
+        iq.add_node (XmlObject("ping", "urn:xmpp:ping"));
+        auto sent = load_clock::now ();
+        ++iq_stats.sent;
+        sess.send_iq (iq, [sent](Session& s, IqStanza* response){
+                if (response && response->get_type()==IqType::result) {
+                    ++iq_stats.received;
+                    iq_stats.latency.record (
+                        chrono::duration_cast<chrono::microseconds>(load_clock::now()-sent).count());
+                }else{
+                    ++iq_stats.errors;
+                }
+            }, 10000);
+    }
+
+    string user;
+    Session sess;
+    SessionConfig cfg;
+    TlsModule tls;
+    AuthModule auth;
+    std::atomic<bool> bound;
+    std::atomic<bool> done;
+    load_clock::time_point start_time;
+    std::thread thread;
+};
+
+
+//------------------------------------------------------------------------------
+// CPU time used by the process, in milliseconds.
+//------------------------------------------------------------------------------
+static double get_cpu_msec ()
+{
+    struct rusage ru;
+    getrusage (RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0 +
+        (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+}
+
+
+//------------------------------------------------------------------------------
+// Resident set size of the process, in kB.
+//------------------------------------------------------------------------------
+static uint64_t get_rss_kb ()
+{
+    unsigned long size = 0, resident = 0;
+    FILE* f = fopen ("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+            resident = 0;
+        fclose (f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static string traffic_json (const TrafficStats& stats, double rate, double duration)
+{
+    ostringstream os;
+    os << "{\"target_rate\": " << rate
+       << ", \"sent\": "     << stats.sent
+       << ", \"received\": " << stats.received
+       << ", \"errors\": "   << stats.errors
+       << ", \"rate\": "     << (duration>0 ? stats.sent/duration : 0)
+       << ", \"latency_us\": " << stats.latency.to_json ()
+       << "}";
+    return os.str ();
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static void print_cmdline_help ()
+{
+    cout << "uxmpp_load [OPTION]\n"
+        "Log in a number of XMPP sessions and send messages, presence and IQ\n"
+        "requests between them at a target rate. The accounts used are\n"
+        "<prefix><first>..<prefix><first+sessions-1>, all with the same password.\n"
+        "The result is printed as JSON.\n"
+        "  -s, --server <host>          Server host or IP address. Default is 127.0.0.1.\n"
+        "  -o, --port <port>            Server port number. Default is 5222.\n"
+        "  -d, --domain <domain>        XMPP domain. Default is localhost.\n"
+        "  -u, --user-prefix <prefix>   Account name prefix. Default is 'user'.\n"
+        "  -f, --first <number>         Number of the first account. Default is 1.\n"
+        "  -p, --password <passphrase>  Password of all accounts. Default is 'password'.\n"
+        "  -n, --sessions <number>      Number of sessions. Default is 10.\n"
+        "  -r, --ramp <rate>            Sessions started per second. Default is 50.\n"
+        "  -t, --duration <seconds>     Duration of the traffic. Default is 10.\n"
+        "  -m, --msg-rate <rate>        Messages per second. Default is 100.\n"
+        "  -e, --presence-rate <rate>   Presence updates per second. Default is 10.\n"
+        "  -i, --iq-rate <rate>         IQ pings to the server per second. Default is 10.\n"
+        "  -j, --output <file>          Write the JSON result to a file instead of stdout.\n"
+        "  -l, --log-level <level>      Log level (0-5). Default is 0.\n"
+        "      --local                  Run against a stand-in server in this process.\n"
+        "      --no-tls                 Don't use STARTTLS.\n"
+        "      --pipeline-bind          Send bind together with the stream restart after login.\n"
+        "      --help                   Print this help text.\n\n";
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static bool parse_args (int argc, char* argv[], LoadConfig& lcfg)
+{
+    static struct option long_options[] {
+        { "server",        required_argument, NULL, 's' },
+        { "port",          required_argument, NULL, 'o' },
+        { "domain",        required_argument, NULL, 'd' },
+        { "user-prefix",   required_argument, NULL, 'u' },
+        { "first",         required_argument, NULL, 'f' },
+        { "password",      required_argument, NULL, 'p' },
+        { "sessions",      required_argument, NULL, 'n' },
+        { "ramp",          required_argument, NULL, 'r' },
+        { "duration",      required_argument, NULL, 't' },
+        { "msg-rate",      required_argument, NULL, 'm' },
+        { "presence-rate", required_argument, NULL, 'e' },
+        { "iq-rate",       required_argument, NULL, 'i' },
+        { "output",        required_argument, NULL, 'j' },
+        { "log-level",     required_argument, NULL, 'l' },
+        { "local",         no_argument,       NULL,  0  },
+        { "no-tls",        no_argument,       NULL,  0  },
+        { "pipeline-bind", no_argument,       NULL,  0  },
+        { "help",          no_argument,       NULL,  0  },
+        { NULL,            0,                 NULL,  0  },
+    };
+    while (true) {
+        int option_index {0};
+        int c = getopt_long (argc, argv, "s:o:d:u:f:p:n:r:t:m:e:i:j:l:", long_options, &option_index);
+        if (c == -1)
+            break;
+        switch (c) {
+        case 0:
+            if (string("local") == long_options[option_index].name) {
+                lcfg.local = true;
+            }else if (string("no-tls") == long_options[option_index].name) {
+                lcfg.tls = false;
+            }else if (string("pipeline-bind") == long_options[option_index].name) {
+                lcfg.pipeline_bind = true;
+            }else{
+                print_cmdline_help ();
+                exit (0);
+            }
+            break;
+        case 's':
+            lcfg.server = optarg;
+            break;
+        case 'o':
+            lcfg.port = atoi (optarg);
+            break;
+        case 'd':
+            lcfg.domain = optarg;
+            break;
+        case 'u':
+            lcfg.user_prefix = optarg;
+            break;
+        case 'f':
+            lcfg.first = atoi (optarg);
+            break;
+        case 'p':
+            lcfg.password = optarg;
+            break;
+        case 'n':
+            lcfg.sessions = atoi (optarg);
+            break;
+        case 'r':
+            lcfg.ramp_rate = atof (optarg);
+            break;
+        case 't':
+            lcfg.duration = atof (optarg);
+            break;
+        case 'm':
+            lcfg.msg_rate = atof (optarg);
+            break;
+        case 'e':
+            lcfg.presence_rate = atof (optarg);
+            break;
+        case 'i':
+            lcfg.iq_rate = atof (optarg);
+            break;
+        case 'j':
+            lcfg.output = optarg;
+            break;
+        case 'l':
+            lcfg.log_level = static_cast<LogLevel> (atoi(optarg));
+            break;
+        default:
+            print_cmdline_help ();
+            return false;
+        }
+    }
+    if (lcfg.sessions < 1 || lcfg.ramp_rate <= 0) {
+        cerr << "At least one session and a positive ramp rate is required" << endl;
+        return false;
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Send stanzas from randomly chosen sessions at the target rates.
+//------------------------------------------------------------------------------
+static void drive_traffic (const LoadConfig& lcfg, vector<LoadSession*>& active)
+{
+    struct Schedule {
+        double rate;
+        uint64_t n;
+    };
+    Schedule msg {lcfg.msg_rate, 0};
+    Schedule presence {lcfg.presence_rate, 0};
+    Schedule iq {lcfg.iq_rate, 0};
+
+    std::mt19937 rnd (4711);
+    std::uniform_int_distribution<size_t> pick (0, active.size()-1);
+
+    auto start = load_clock::now ();
+    auto end   = start + chrono::duration_cast<load_clock::duration> (chrono::duration<double>(lcfg.duration));
+
+    auto due = [start](Schedule& s) {
+        return start + chrono::duration_cast<load_clock::duration> (chrono::duration<double>(s.n / s.rate));
+    };
+
+    while (true) {
+        auto now = load_clock::now ();
+        if (now >= end)
+            break;
+        auto next = end;
+        for (auto s : {&msg, &presence, &iq}) {
+            if (s->rate <= 0)
+                continue;
+            while (due(*s) <= now) {
+                auto& sender = *active[pick(rnd)];
+                if (s == &msg) {
+                    auto receiver = active[pick(rnd)];
+                    if (active.size() > 1) {
+                        while (receiver == &sender)
+                            receiver = active[pick(rnd)];
+                    }
+                    sender.send_message (receiver->user + "@" + lcfg.domain);
+                }
+                else if (s == &presence) {
+                    sender.send_presence ();
+                }else{
+                    sender.send_ping ();
+                }
+                ++s->n;
+            }
+            next = std::min (next, due(*s));
+        }
+        std::this_thread::sleep_until (next);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    LoadConfig lcfg;
+    if (!parse_args(argc, argv, lcfg))
+        return 1;
+    uxmpp_set_log_level (lcfg.log_level);
+
+    // Closed connections are reported as I/O errors
+    signal (SIGPIPE, SIG_IGN);
+
+    // A stand-in server with the accounts used,
+    // each with the previous and next user in the roster.
+    //
+    std::unique_ptr<TestServer> local_server;
+    if (lcfg.local) {
+        local_server.reset (new TestServer(lcfg.domain));
+        unsigned last = lcfg.first + lcfg.sessions - 1;
+        for (unsigned i=lcfg.first; i<=last; ++i) {
+            string user = lcfg.user_prefix + std::to_string (i);
+            local_server->add_account (user, lcfg.password);
+            if (i > lcfg.first)
+                local_server->add_roster_item (user, lcfg.user_prefix + std::to_string(i-1) + "@" + lcfg.domain);
+            if (i < last)
+                local_server->add_roster_item (user, lcfg.user_prefix + std::to_string(i+1) + "@" + lcfg.domain);
+        }
+        local_server->set_tls (lcfg.tls);
+        if (!local_server->start()) {
+            cerr << "Unable to start the local server" << endl;
+            return 1;
+        }
+        lcfg.server = "127.0.0.1";
+        lcfg.port   = local_server->get_port ();
+    }
+
+    auto rss_start = get_rss_kb ();
+    auto cpu_start = get_cpu_msec ();
+
+    // Ramp up the sessions
+    //
+    cerr << "Starting " << lcfg.sessions << " sessions" << endl;
+    vector<std::unique_ptr<LoadSession>> sessions;
+    auto ramp_start = load_clock::now ();
+    for (unsigned i=0; i<lcfg.sessions; ++i) {
+        std::this_thread::sleep_until (ramp_start + chrono::duration_cast<load_clock::duration>(
+                                           chrono::duration<double>(i / lcfg.ramp_rate)));
+        sessions.emplace_back (new LoadSession(lcfg, lcfg.first + i));
+        sessions.back()->start ();
+    }
+
+    // Wait until all sessions are bound or have failed
+    //
+    auto ramp_deadline = load_clock::now () + chrono::seconds (30);
+    vector<LoadSession*> active;
+    while (true) {
+        active.clear ();
+        unsigned num_done = 0;
+        for (auto& s : sessions) {
+            if (s->bound)
+                active.push_back (s.get());
+            else if (s->done)
+                ++num_done;
+        }
+        if (active.size()+num_done == sessions.size() || load_clock::now() >= ramp_deadline)
+            break;
+        std::this_thread::sleep_for (chrono::milliseconds(10));
+    }
+    double ramp_sec = chrono::duration<double> (load_clock::now() - ramp_start).count ();
+    auto rss_ramp = get_rss_kb ();
+    auto cpu_ramp = get_cpu_msec ();
+
+    // Drive the traffic, then give the last stanzas some time to arrive
+    //
+    double traffic_sec = 0;
+    if (!active.empty()) {
+        cerr << active.size() << " sessions bound, sending traffic for " << lcfg.duration << " seconds" << endl;
+        auto traffic_start = load_clock::now ();
+        drive_traffic (lcfg, active);
+        traffic_sec = chrono::duration<double> (load_clock::now() - traffic_start).count ();
+
+        auto drain_deadline = load_clock::now () + chrono::seconds (2);
+        while (load_clock::now() < drain_deadline &&
+               (msg_stats.received+msg_stats.errors < msg_stats.sent ||
+                iq_stats.received+iq_stats.errors < iq_stats.sent))
+        {
+            std::this_thread::sleep_for (chrono::milliseconds(10));
+        }
+    }
+    auto rss_end = get_rss_kb ();
+    auto cpu_end = get_cpu_msec ();
+
+    unsigned num_bound = active.size ();
+    sessions.clear ();
+    if (local_server)
+        local_server->stop ();
+
+    // Report
+    //
+    ostringstream os;
+    os << fixed << setprecision (3);
+    os << "{\n"
+       << "  \"config\": {\"server\": \"" << (lcfg.local ? string("local") : lcfg.server) << "\""
+       << ", \"port\": " << lcfg.port
+       << ", \"domain\": \"" << lcfg.domain << "\""
+       << ", \"tls\": " << (lcfg.tls ? "true" : "false")
+       << ", \"pipeline_bind\": " << (lcfg.pipeline_bind ? "true" : "false")
+       << ", \"sessions\": " << lcfg.sessions
+       << ", \"ramp_rate\": " << lcfg.ramp_rate
+       << ", \"duration\": " << lcfg.duration << "},\n"
+       << "  \"sessions\": {\"requested\": " << lcfg.sessions
+       << ", \"bound\": " << num_bound
+       << ", \"failed\": " << (lcfg.sessions - num_bound)
+       << ", \"ramp_sec\": " << ramp_sec
+       << ", \"setup_us\": " << setup_time.to_json ()
+       << ", \"setup_round_trips\": " << setup_round_trips.to_json () << "},\n"
+       << "  \"traffic_sec\": " << traffic_sec << ",\n"
+       << "  \"message\": "  << traffic_json (msg_stats, lcfg.msg_rate, traffic_sec) << ",\n"
+       << "  \"presence\": " << traffic_json (presence_stats, lcfg.presence_rate, traffic_sec) << ",\n"
+       << "  \"iq\": "       << traffic_json (iq_stats, lcfg.iq_rate, traffic_sec) << ",\n"
+       << "  \"resources\": {\"includes_local_server\": " << (lcfg.local ? "true" : "false")
+       << ", \"cpu_ms_ramp\": " << (cpu_ramp - cpu_start)
+       << ", \"cpu_ms_traffic\": " << (cpu_end - cpu_ramp)
+       << ", \"cpu_ms_per_session_login\": " << (num_bound ? (cpu_ramp - cpu_start) / num_bound : 0)
+       << ", \"cpu_ms_per_session_sec\": "
+       << (num_bound && traffic_sec>0 ? (cpu_end - cpu_ramp) / num_bound / traffic_sec : 0)
+       << ", \"rss_kb_start\": " << rss_start
+       << ", \"rss_kb_ramp\": " << rss_ramp
+       << ", \"rss_kb_end\": " << rss_end
+       << ", \"rss_kb_per_session\": "
+       << (num_bound ? (static_cast<double>(rss_ramp) - rss_start) / num_bound : 0) << "}\n"
+       << "}\n";
+
+    if (lcfg.output.empty()) {
+        cout << os.str ();
+    }else{
+        ofstream out (lcfg.output);
+        out << os.str ();
+        if (!out) {
+            cerr << "Unable to write " << lcfg.output << endl;
+            return 1;
+        }
+    }
+    return num_bound ? 0 : 1;
+}
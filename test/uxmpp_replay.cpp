@@ -0,0 +1,353 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <uxmpp.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <cstdlib>
+#include <getopt.h>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace uxmpp;
+using namespace uxmpp::mod;
+
+using replay_clock = chrono::steady_clock;
+
+
+//------------------------------------------------------------------------------
+// Count all heap allocations in the process.
+//------------------------------------------------------------------------------
+static std::atomic<uint64_t> num_allocs {0};
+static std::atomic<uint64_t> num_alloc_bytes {0};
+
+static void* count_alloc (size_t size) noexcept
+{
+    ++num_allocs;
+    num_alloc_bytes += size;
+    return malloc (size ? size : 1);
+}
+
+// Kept out of line, so the compiler doesn't see free() called
+// on a pointer returned by operator new.
+//
+__attribute__((noinline)) static void count_free (void* p) noexcept
+{
+    free (p);
+}
+
+void* operator new (size_t size)
+{
+    void* p = count_alloc (size);
+    if (!p)
+        throw std::bad_alloc ();
+    return p;
+}
+
+void* operator new[] (size_t size)
+{
+    void* p = count_alloc (size);
+    if (!p)
+        throw std::bad_alloc ();
+    return p;
+}
+
+void* operator new (size_t size, const std::nothrow_t&) noexcept
+{
+    return count_alloc (size);
+}
+
+void* operator new[] (size_t size, const std::nothrow_t&) noexcept
+{
+    return count_alloc (size);
+}
+
+void operator delete (void* p) noexcept
+{
+    count_free (p);
+}
+
+void operator delete[] (void* p) noexcept
+{
+    count_free (p);
+}
+
+void operator delete (void* p, const std::nothrow_t&) noexcept
+{
+    count_free (p);
+}
+
+void operator delete[] (void* p, const std::nothrow_t&) noexcept
+{
+    count_free (p);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete (void* p, size_t) noexcept
+{
+    count_free (p);
+}
+
+void operator delete[] (void* p, size_t) noexcept
+{
+    count_free (p);
+}
+#endif
+
+
+/**
+ * Measure the time an XMPP module spends on received XML objects.
+ */
+class TimedModule : public XmppModule {
+public:
+    TimedModule (XmppModule& m)
+        : XmppModule (m.get_name()), module (m), calls {0}, handled {0}, nsec {0}
+        {}
+    virtual bool process_xml_object (Session& session, XmlObject& xml_obj) override {
+        auto start = replay_clock::now ();
+        bool result = module.process_xml_object (session, xml_obj);
+        nsec += chrono::duration_cast<chrono::nanoseconds>(replay_clock::now()-start).count ();
+        ++calls;
+        if (result)
+            ++handled;
+        return result;
+    }
+    virtual std::vector<std::string> get_disco_features () override {
+        return module.get_disco_features ();
+    }
+
+    XmppModule& module;
+    uint64_t calls;
+    uint64_t handled;
+    uint64_t nsec;
+};
+
+
+/**
+ * A session that reads the XML stream from a file instead of a socket.
+ * Everything above the connection is the same as in a live session:
+ * the XML parser, the XML stream and its RX thread, the listeners, the
+ * IQ correlator and the registered modules. Whatever the modules send
+ * is serialized and written to /dev/null.
+ */
+class ReplaySession : public Session {
+public:
+    ReplaySession () : num_objects {0}, num_stanzas {0}, dispatch_nsec {0} {}
+
+    /**
+     * Replay the XML stream in a file.
+     * @return false if the file can't be opened.
+     */
+    bool replay (const string& file) {
+        io::FileConnection rx_file (file, O_RDONLY);
+        io::FileConnection tx_file ("/dev/null", O_WRONLY);
+        if (rx_file.get_fd()==-1 || tx_file.get_fd()==-1)
+            return false;
+
+        // Wrap the registered modules, including the session core
+        //
+        auto& modules = get_modules ();
+        if (timed.empty()) {
+            for (auto module : modules)
+                timed.emplace_back (new TimedModule(*module));
+        }
+        auto original = module_entries;
+        auto entries = make_shared<vector<ModuleEntry>> (*original);
+        auto t = timed.begin ();
+        for (auto& entry : *entries)
+            entry.module = (t++)->get ();
+        module_entries = entries;
+
+        cfg.domain      = "localhost";
+        cfg.disable_srv = true;
+        change_state (SessionState::connecting);
+        init_stream_xml_obj ();
+        xs.set_rx_cb ([this](XmlStream& stream, XmlObject& xml_obj){
+                on_rx_xml_obj (stream, xml_obj);
+            });
+        xs.run (rx_file, tx_file, stream_xml_obj);
+        xs.set_rx_cb (nullptr);
+        change_state (SessionState::closed);
+        iq_correlator.abort_all ();
+
+        module_entries = original;
+        return true;
+    }
+
+    uint64_t num_objects;
+    uint64_t num_stanzas;
+    uint64_t dispatch_nsec;
+    vector<std::unique_ptr<TimedModule>> timed;
+
+protected:
+    virtual void on_rx_xml_obj (XmlStream& stream, XmlObject& xml_obj) override {
+        auto start = replay_clock::now ();
+        auto full_name = xml_obj.get_full_name ();
+        if (full_name == xml::full_tag_iq_stanza ||
+            full_name == xml::full_tag_message_stanza ||
+            full_name == xml::full_tag_presence_stanza)
+        {
+            ++num_stanzas;
+        }
+        ++num_objects;
+        Session::on_rx_xml_obj (stream, xml_obj);
+        dispatch_nsec += chrono::duration_cast<chrono::nanoseconds>(replay_clock::now()-start).count ();
+    }
+};
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static void print_cmdline_help ()
+{
+    cout << "uxmpp_replay [OPTION] <file>\n"
+        "Replay an XML stream, as received from an XMPP server, through the XML\n"
+        "parser, the XML stream and the module dispatch of a client session,\n"
+        "without any sockets. The file starts with the 'stream' start tag the\n"
+        "server sent after the last stream restart. Throughput, allocations and\n"
+        "the time spent in each module are reported.\n"
+        "  -n, --passes <number>        Number of times to replay the file. Default is 1.\n"
+        "  -l, --log-level <level>      Log level (0-5). Default is 0.\n"
+        "      --help                   Print this help text.\n\n";
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    unsigned passes = 1;
+    LogLevel log_level = LogLevel::silent;
+
+    static struct option long_options[] {
+        { "passes",    required_argument, NULL, 'n' },
+        { "log-level", required_argument, NULL, 'l' },
+        { "help",      no_argument,       NULL,  0  },
+        { NULL,        0,                 NULL,  0  },
+    };
+    while (true) {
+        int option_index {0};
+        int c = getopt_long (argc, argv, "n:l:", long_options, &option_index);
+        if (c == -1)
+            break;
+        switch (c) {
+        case 0:
+            print_cmdline_help ();
+            return 0;
+        case 'n':
+            passes = atoi (optarg);
+            break;
+        case 'l':
+            log_level = static_cast<LogLevel> (atoi(optarg));
+            break;
+        default:
+            print_cmdline_help ();
+            return 1;
+        }
+    }
+    if (optind >= argc || passes < 1) {
+        print_cmdline_help ();
+        return 1;
+    }
+    string file = argv[optind];
+    uxmpp_set_log_level (log_level);
+
+    struct stat st;
+    if (stat(file.c_str(), &st)) {
+        cerr << "Unable to open " << file << endl;
+        return 1;
+    }
+
+    // The modules of a typical client, in the same order as in the uxmpp client
+    //
+    ReplaySession sess;
+    SessionModule     mod_session;
+    RosterModule      mod_roster;
+    PresenceModule    mod_pr;
+    MessageModule     mod_msg;
+    PingModule        mod_ping;
+    PrivateDataModule mod_priv_data;
+    DiscoModule       mod_disco;
+    VcardModule       mod_vcard;
+    VersionModule     mod_version;
+    sess.register_module (mod_session);
+    sess.register_module (mod_roster);
+    sess.register_module (mod_pr);
+    sess.register_module (mod_msg);
+    sess.register_module (mod_ping);
+    sess.register_module (mod_priv_data);
+    sess.register_module (mod_disco);
+    sess.register_module (mod_vcard);
+    sess.register_module (mod_version);
+
+    uint64_t allocs = num_allocs;
+    uint64_t alloc_bytes = num_alloc_bytes;
+    auto start = replay_clock::now ();
+    for (unsigned i=0; i<passes; ++i) {
+        if (!sess.replay(file)) {
+            cerr << "Unable to open " << file << endl;
+            return 1;
+        }
+    }
+    double sec = chrono::duration<double> (replay_clock::now() - start).count ();
+    allocs = num_allocs - allocs;
+    alloc_bytes = num_alloc_bytes - alloc_bytes;
+
+    uint64_t bytes = static_cast<uint64_t> (st.st_size) * passes;
+    uint64_t stanzas = sess.num_stanzas;
+    uint64_t per = stanzas ? stanzas : 1;
+
+    cout << fixed << setprecision (1);
+    cout << "file:                " << file << "\n"
+         << "passes:              " << passes << "\n"
+         << "bytes:               " << bytes << "\n"
+         << "xml objects:         " << sess.num_objects << "\n"
+         << "stanzas:             " << stanzas << "\n"
+         << "time (ms):           " << sec*1000 << "\n"
+         << "stanzas/s:           " << stanzas/sec << "\n"
+         << "bytes/s:             " << bytes/sec << "\n"
+         << "allocs/stanza:       " << static_cast<double>(allocs)/per << "\n"
+         << "alloc bytes/stanza:  " << static_cast<double>(alloc_bytes)/per << "\n"
+         << "dispatch ns/stanza:  " << static_cast<double>(sess.dispatch_nsec)/per << "\n"
+         << "\n";
+
+    cout << left << setw(20) << "module" << right
+         << setw(12) << "calls" << setw(12) << "handled"
+         << setw(12) << "total ms" << setw(12) << "ns/call" << "\n";
+    uint64_t module_nsec = 0;
+    for (auto& t : sess.timed) {
+        module_nsec += t->nsec;
+        cout << left << setw(20) << t->get_name() << right
+             << setw(12) << t->calls << setw(12) << t->handled
+             << setw(12) << t->nsec/1e6
+             << setw(12) << (t->calls ? static_cast<double>(t->nsec)/t->calls : 0) << "\n";
+    }
+    uint64_t other = sess.dispatch_nsec>module_nsec ? sess.dispatch_nsec-module_nsec : 0;
+    cout << left << setw(20) << "(session)" << right
+         << setw(12) << sess.num_objects << setw(12) << ""
+         << setw(12) << other/1e6
+         << setw(12) << (sess.num_objects ? static_cast<double>(other)/sess.num_objects : 0) << "\n";
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ *  Copyright (C) 2015 Ultramarin Design AB <dan@ultramarin.se>
+ *
+ *  This file is part of uxmpp.
+ *
+ *  uxmpp is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TestServer.hpp"
+#include <uxmpp.hpp>
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <csignal>
+#include <getopt.h>
+
+using namespace std;
+using namespace uxmpp;
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+static void print_cmdline_help ()
+{
+    cout << "uxmpp_server [OPTION]\n"
+        "A local XMPP server for tests and benchmarks. It serves accounts user1..userN,\n"
+        "all with the same password. The roster of each user contains the previous\n"
+        "and the next user.\n"
+        "  -o, --port <port>            Port number to listen on. Default is 5222.\n"
+        "  -d, --domain <domain>        Domain served. Default is localhost.\n"
+        "  -n, --accounts <number>      Number of accounts. Default is 100.\n"
+        "  -p, --password <passphrase>  Password of all accounts. Default is 'password'.\n"
+        "  -t, --latency <msec>         Delay routed stanzas. Default is 0.\n"
+        "  -l, --log-level <level>      Log level (0-5). Default is 2.\n"
+        "      --no-tls                 Don't offer STARTTLS.\n"
+        "      --require-tls            Require STARTTLS before authentication.\n"
+        "      --help                   Print this help text.\n\n";
+}
+
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+int main (int argc, char* argv[])
+{
+    uint16_t port = 5222;
+    string domain = "localhost";
+    string password = "password";
+    int accounts = 100;
+    unsigned latency = 0;
+    bool tls = true;
+    bool require_tls = false;
+    LogLevel log_level = LogLevel::warning;
+
+    static struct option long_options[] {
+        { "port",        required_argument, NULL, 'o' },
+        { "domain",      required_argument, NULL, 'd' },
+        { "accounts",    required_argument, NULL, 'n' },
+        { "password",    required_argument, NULL, 'p' },
+        { "latency",     required_argument, NULL, 't' },
+        { "log-level",   required_argument, NULL, 'l' },
+        { "no-tls",      no_argument,       NULL,  0  },
+        { "require-tls", no_argument,       NULL,  0  },
+        { "help",        no_argument,       NULL,  0  },
+        { NULL,          0,                 NULL,  0  },
+    };
+    while (true) {
+        int option_index {0};
+        int c = getopt_long (argc, argv, "o:d:n:p:t:l:", long_options, &option_index);
+        if (c == -1)
+            break;
+        switch (c) {
+        case 0:
+            if (string("no-tls") == long_options[option_index].name) {
+                tls = false;
+            }else if (string("require-tls") == long_options[option_index].name) {
+                require_tls = true;
+            }else{
+                print_cmdline_help ();
+                return 0;
+            }
+            break;
+        case 'o':
+            port = atoi (optarg);
+            break;
+        case 'd':
+            domain = optarg;
+            break;
+        case 'n':
+            accounts = atoi (optarg);
+            break;
+        case 'p':
+            password = optarg;
+            break;
+        case 't':
+            latency = atoi (optarg);
+            break;
+        case 'l':
+            log_level = static_cast<LogLevel> (atoi(optarg));
+            break;
+        default:
+            print_cmdline_help ();
+            return 1;
+        }
+    }
+    uxmpp_set_log_level (log_level);
+
+    TestServer server (domain);
+    for (int i=1; i<=accounts; ++i) {
+        string user = "user" + std::to_string (i);
+        server.add_account (user, password);
+        if (i > 1)
+            server.add_roster_item (user, "user" + std::to_string(i-1) + "@" + domain);
+        if (i < accounts)
+            server.add_roster_item (user, "user" + std::to_string(i+1) + "@" + domain);
+    }
+    server.set_tls (tls, require_tls);
+    server.set_latency (latency);
+
+    // Block the signals we wait for
+    //
+    sigset_t sigs;
+    sigemptyset (&sigs);
+    sigaddset (&sigs, SIGINT);
+    sigaddset (&sigs, SIGTERM);
+    pthread_sigmask (SIG_BLOCK, &sigs, nullptr);
+
+    // Closed connections are reported as I/O errors
+    signal (SIGPIPE, SIG_IGN);
+
+    if (!server.start(port)) {
+        cerr << "Unable to listen on port " << port << endl;
+        return 1;
+    }
+    cout << "Serving " << accounts << " accounts for " << domain << " on 127.0.0.1:" << server.get_port() << endl;
+
+    int sig;
+    sigwait (&sigs, &sig);
+
+    cout << "Routed " << server.num_routed() << " stanzas" << endl;
+    server.stop ();
+    return 0;
+}